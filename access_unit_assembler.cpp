@@ -0,0 +1,73 @@
+#include "config.h"
+
+#include "access_unit_assembler.h"
+
+access_unit_assembler::access_unit_assembler()
+{
+access_units = 0;
+nals = 0;
+have_slice = false;
+}
+
+//for producers that don't describe their packets
+void access_unit_assembler::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+parser.parse( data, bytes, info );
+write( data, bytes, info );
+}
+
+void access_unit_assembler::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( info.access_unit_start )
+	{
+	flush();
+	}
+
+//an end marker with nothing before it carries nothing to decode
+if( buffer.empty() && info.access_unit_end && !info.vcl() )
+	{
+	return;
+	}
+
+if( buffer.empty() )
+	{
+	au_info = info;
+	au_info.access_unit_start = true;
+	have_slice = false;
+	}
+if( info.vcl() && !have_slice )
+	{
+	au_info.nal_unit_type = info.nal_unit_type;
+	au_info.nal_ref_idc = info.nal_ref_idc;
+	au_info.first_mb_in_slice = info.first_mb_in_slice;
+	au_info.frame_num = info.frame_num;
+	have_slice = true;
+	}
+au_info.parameter_set |= info.parameter_set;
+au_info.sei |= info.sei;
+au_info.recovery_point |= info.recovery_point;
+
+buffer.insert( buffer.end(), data, data + bytes );
+nals++;
+
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void access_unit_assembler::flush()
+{
+if( buffer.empty() )
+	{
+	return;
+	}
+
+size_t bytes = buffer.size();
+buffer.resize( bytes + PACKET_PADDING_SIZE, 0 );
+au_info.access_unit_end = true;
+server.broadcast( &buffer[0], bytes, au_info );
+buffer.clear();
+access_units++;
+}
@@ -0,0 +1,38 @@
+#ifndef ACCESS_UNIT_ASSEMBLER_H
+#define ACCESS_UNIT_ASSEMBLER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "packet_server.h"
+
+//Collects NALs into whole access units and broadcasts each one as a single
+//packet, followed by PACKET_PADDING_SIZE zero bytes, so a decoder gets one
+//call per frame. An access unit goes out as soon as its end is known, from
+//an end marker NAL or the descriptor's access_unit_end, and otherwise when
+//the next one starts. Its descriptor is that of its first slice, with the
+//parameter_set, sei and recovery_point flags set if any of its NALs had
+//them, and the timestamp of its first NAL.
+class access_unit_assembler: public data_source
+	{
+	public:
+	access_unit_assembler();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	void flush();
+	packet_server server;
+
+	uint64_t access_units;
+	uint64_t nals;
+
+	private:
+	std::vector<uint8_t> buffer;
+	nal_info au_info;
+	bool have_slice;
+	nal_parser parser;
+	};
+
+#endif
@@ -0,0 +1,283 @@
+#include <time.h>
+
+#include "async_sink.h"
+
+static uint64_t now_ns()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000000ULL + temp.tv_nsec;
+}
+
+const char * overflow_policy_name( overflow_policy policy )
+{
+switch( policy )
+	{
+	case OVERFLOW_BLOCK:
+		return "block";
+	case OVERFLOW_DROP_OLDEST:
+		return "drop oldest";
+	case OVERFLOW_DROP_TO_RECOVERY:
+		return "drop to recovery point";
+	}
+return "unknown";
+}
+
+async_sink::async_sink( data_source * target, size_t depth, overflow_policy policy ) : target( target ), ring( depth ), on_overflow( policy )
+{
+peak.store( 0 );
+skipping = false;
+written.store( 0 );
+dropped.store( 0 );
+dropped_bytes.store( 0 );
+blocked.store( 0 );
+latency_ns.store( 0 );
+peak_latency_ns.store( 0 );
+sleeping.store( false );
+waiting.store( false );
+stopping.store( false );
+worker = std::thread( &async_sink::run, this );
+}
+
+async_sink::~async_sink()
+{
+	{
+	std::lock_guard<std::mutex> guard( lock );
+	stopping.store( true );
+	}
+wake.notify_one();
+worker.join();
+}
+
+void async_sink::write( const uint8_t * data, size_t bytes )
+{
+enqueue( packet_pool::shared().copy( data, bytes ), NULL );
+}
+
+void async_sink::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+enqueue( packet_pool::shared().copy( data, bytes ), &info );
+}
+
+void async_sink::write( const packet_ref & packet )
+{
+enqueue( packet, NULL );
+}
+
+void async_sink::write( const packet_ref & packet, const nal_info & info )
+{
+enqueue( packet, &info );
+}
+
+void async_sink::enqueue( const packet_ref & packet, const nal_info * info )
+{
+bool resume = false;
+if( info )
+	{
+	resume = recovery.resumes( *info );
+	}
+
+if( skipping )
+	{
+	if( !resume )
+		{
+		dropped++;
+		dropped_bytes += packet.size();
+		return;
+		}
+	skipping = false;
+	}
+
+async_packet * p = make_room( info );
+if( p == NULL )
+	{
+	if( !resume )
+		{
+		dropped++;
+		dropped_bytes += packet.size();
+		skipping = true;
+		return;
+		}
+	//the packet that overflowed is itself a way back in
+	drop_all();
+	while( ( p = ring.reserve() ) == NULL )
+		{
+		std::this_thread::yield();
+		}
+	}
+
+p->packet = packet;
+p->described = info != NULL;
+if( info )
+	{
+	p->info = *info;
+	}
+p->enqueued_ns = now_ns();
+ring.publish();
+
+size_t d = ring.size();
+if( d > peak.load( std::memory_order_relaxed ) )
+	{
+	peak.store( d, std::memory_order_relaxed );
+	}
+
+//publish() is sequentially consistent, so either the worker sees the packet
+//before it sleeps or we see it asleep here
+if( sleeping.load() )
+	{
+	std::lock_guard<std::mutex> guard( lock );
+	wake.notify_one();
+	}
+}
+
+//returns a free slot, or NULL when dropping to a recovery point has
+//emptied the queue and the packet should go too
+async_packet * async_sink::make_room( const nal_info * info )
+{
+async_packet * p = ring.reserve();
+if( p )
+	{
+	return p;
+	}
+
+if( on_overflow == OVERFLOW_BLOCK )
+	{
+	blocked++;
+	std::unique_lock<std::mutex> guard( lock );
+	waiting.store( true );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	while( ( p = ring.reserve() ) == NULL )
+		{
+		room.wait( guard );
+		}
+	waiting.store( false );
+	return p;
+	}
+
+if( on_overflow == OVERFLOW_DROP_TO_RECOVERY && info )
+	{
+	drop_all();
+	return NULL;
+	}
+
+//the slot we need may be the one the worker is swapping out right now,
+//which takes no time at all
+drop_oldest();
+while( ( p = ring.reserve() ) == NULL )
+	{
+	std::this_thread::yield();
+	}
+return p;
+}
+
+void async_sink::drop_oldest()
+{
+size_t ticket;
+async_packet * p = ring.claim( &ticket );
+if( p )
+	{
+	dropped++;
+	dropped_bytes += p->packet.size();
+	p->packet.reset();
+	ring.release( ticket );
+	}
+}
+
+void async_sink::drop_all()
+{
+size_t first;
+size_t n = ring.claim_all( &first );
+for( size_t i = first; i < first + n; ++i )
+	{
+	dropped++;
+	dropped_bytes += ring.at( i ).packet.size();
+	ring.at( i ).packet.reset();
+	ring.release( i );
+	}
+}
+
+void async_sink::run()
+{
+while( true )
+	{
+	size_t ticket;
+	async_packet * p = ring.claim( &ticket );
+	if( p == NULL )
+		{
+		if( stopping.load() )
+			{
+			return;
+			}
+		std::unique_lock<std::mutex> guard( lock );
+		sleeping.store( true );
+		std::atomic_thread_fence( std::memory_order_seq_cst );
+		while( ring.empty() && !stopping.load() )
+			{
+			wake.wait( guard );
+			}
+		sleeping.store( false );
+		continue;
+		}
+
+	//take the packet out of the ring, so the slot is free straight away
+	current.packet = std::move( p->packet );
+	current.described = p->described;
+	current.info = p->info;
+	current.enqueued_ns = p->enqueued_ns;
+	ring.release( ticket );
+	if( waiting.load() )
+		{
+		std::lock_guard<std::mutex> guard( lock );
+		room.notify_one();
+		}
+
+	uint64_t l = now_ns() - current.enqueued_ns;
+	latency_ns += l;
+	if( l > peak_latency_ns.load( std::memory_order_relaxed ) )
+		{
+		peak_latency_ns.store( l, std::memory_order_relaxed );
+		}
+
+	if( current.described )
+		{
+		target->write( current.packet, current.info );
+		}
+	else
+		{
+		target->write( current.packet );
+		}
+	current.packet.reset();
+	written++;
+	}
+}
+
+size_t async_sink::depth() const
+{
+return ring.size();
+}
+
+size_t async_sink::max_depth() const
+{
+return peak.load();
+}
+
+size_t async_sink::capacity() const
+{
+return ring.capacity();
+}
+
+overflow_policy async_sink::policy() const
+{
+return on_overflow;
+}
+
+double async_sink::average_latency_us() const
+{
+uint64_t n = written.load();
+return n ? latency_ns.load() / 1e3 / n : 0.0;
+}
+
+double async_sink::max_latency_us() const
+{
+return peak_latency_ns.load() / 1e3;
+}
@@ -0,0 +1,107 @@
+#ifndef ASYNC_SINK_H
+#define ASYNC_SINK_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "spsc_ring.h"
+
+//what an async sink does with a packet that finds its queue full
+enum overflow_policy
+	{
+	OVERFLOW_BLOCK,             //wait for room, holding up the producer
+	OVERFLOW_DROP_OLDEST,       //throw away the oldest queued packet
+	OVERFLOW_DROP_TO_RECOVERY   //throw away everything until the next recovery point
+	};
+
+const char * overflow_policy_name( overflow_policy policy );
+
+//one queued packet
+struct async_packet
+	{
+	packet_ref packet;
+	nal_info info;
+	bool described;
+	uint64_t enqueued_ns;
+	};
+
+//Runs another data_source's writes on a thread of its own. Packets from a
+//packet_server arrive as pooled buffers and are queued by reference; plain
+//writes are first copied into one from the shared pool. Either way the
+//bounded single producer ring only holds references, and write() returns
+//without waiting on the target. The worker moves each packet out of the
+//ring before writing it, so the ring is never held while the target works,
+//and only sleeps once the ring is empty. Packets still queued when the sink
+//is destroyed are written first.
+//
+//A full ring is handled by the overflow policy. Dropping to a recovery
+//point empties the queue, since what is in it is already late, then passes
+//nothing until a packet starts an access unit with an IDR, a recovery point
+//SEI or parameter sets, so the target picks up close to live with a stream
+//it can decode. It needs described packets; undescribed ones fall back to
+//dropping the oldest.
+class async_sink: public data_source
+	{
+	public:
+	async_sink( data_source * target, size_t depth, overflow_policy policy );
+	~async_sink();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	bool wants_packets() const { return true; }
+	void write( const packet_ref & packet );
+	void write( const packet_ref & packet, const nal_info & info );
+
+	//packets queued right now, and the most there have been
+	size_t depth() const;
+	size_t max_depth() const;
+	size_t capacity() const;
+	overflow_policy policy() const;
+
+	//enqueue to write latency, in microseconds
+	double average_latency_us() const;
+	double max_latency_us() const;
+
+	std::atomic<uint64_t> written;
+	std::atomic<uint64_t> dropped;
+	std::atomic<uint64_t> dropped_bytes;
+	std::atomic<uint64_t> blocked;      //writes that had to wait for room
+
+	private:
+	void enqueue( const packet_ref & packet, const nal_info * info );
+	async_packet * make_room( const nal_info * info );
+	void drop_oldest();
+	void drop_all();
+	void run();
+
+	data_source * target;
+	spsc_ring<async_packet> ring;
+	overflow_policy on_overflow;
+	std::atomic<size_t> peak;
+
+	//drop to recovery state, producer side only
+	bool skipping;
+	recovery_tracker recovery;
+
+	//the packet the worker is writing, moved out of its slot
+	async_packet current;
+
+	std::atomic<uint64_t> latency_ns;
+	std::atomic<uint64_t> peak_latency_ns;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::condition_variable room;
+	std::atomic<bool> sleeping;
+	std::atomic<bool> waiting;
+	std::atomic<bool> stopping;
+	std::thread worker;
+	};
+
+#endif
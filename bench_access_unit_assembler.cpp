@@ -0,0 +1,189 @@
+#define __STDC_CONSTANT_MACROS
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+}
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <cstdlib>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "access_unit_assembler.h"
+#include "data_source.h"
+#include "x264_destreamer.h"
+
+using namespace std;
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//keeps every NAL, padded for the decoder, and its descriptor so both runs
+//replay the same input
+class data_source_collector: public data_source
+	{
+	public:
+	void write( const uint8_t * data, size_t bytes ){}
+	void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		nals.push_back( vector<uint8_t>( data, data + bytes ) );
+		nals.back().resize( bytes + PACKET_PADDING_SIZE, 0 );
+		sizes.push_back( bytes );
+		infos.push_back( info );
+		}
+	vector< vector<uint8_t> > nals;
+	vector< size_t > sizes;
+	vector< nal_info > infos;
+	};
+
+//decodes whatever it is given, timing each call and each frame's latency
+class data_source_timed_decoder: public data_source
+	{
+	public:
+	data_source_timed_decoder()
+		{
+		avcodec_register_all();
+		AVCodec * codec = avcodec_find_decoder( AV_CODEC_ID_H264 );
+		ctx = avcodec_alloc_context3( codec );
+		ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+		ctx->width = WIDTH;
+		ctx->height = HEIGHT;
+		if( avcodec_open2( ctx, codec, NULL ) < 0 )
+			{
+			printf( "couldn't open codec\n" );
+			exit( 1 );
+			}
+		frame = av_frame_alloc();
+		calls = 0;
+		frames = 0;
+		decode_time = 0;
+		latency = 0;
+		max_latency = 0;
+		}
+
+	~data_source_timed_decoder()
+		{
+		av_frame_free( &frame );
+		avcodec_close( ctx );
+		av_free( ctx );
+		}
+
+	void write( const uint8_t * data, size_t bytes )
+		{
+		AVPacket avpkt;
+		av_init_packet( &avpkt );
+		avpkt.data = (uint8_t*)data;
+		avpkt.size = bytes;
+		int got_frame = 0;
+
+		double start = now();
+		avcodec_decode_video2( ctx, frame, &got_frame, &avpkt );
+		double end = now();
+		decode_time += end - start;
+		calls++;
+
+		if( got_frame && !arrivals.empty() )
+			{
+			double l = end - arrivals.front();
+			arrivals.pop_front();
+			latency += l;
+			max_latency = l > max_latency ? l : max_latency;
+			frames++;
+			}
+		}
+
+	deque< double > arrivals;
+	uint64_t calls;
+	uint64_t frames;
+	double decode_time;
+	double latency;
+	double max_latency;
+
+	private:
+	AVCodecContext * ctx;
+	AVFrame * frame;
+	};
+
+//feeds the NALs one frame per interval, noting when each frame's last NAL went in
+static void replay( const data_source_collector & stream, data_source & sink, data_source_timed_decoder & decoder, double interval, size_t max_frames )
+{
+size_t frame = 0;
+double next = now();
+for( size_t i = 0; i < stream.nals.size() && frame < max_frames; ++i )
+	{
+	if( stream.infos[i].access_unit_start && i > 0 )
+		{
+		frame++;
+		next += interval;
+		double wait = next - now();
+		if( wait > 0 )
+			{
+			usleep( wait * 1e6 );
+			}
+		}
+	if( i + 1 == stream.nals.size() || stream.infos[i+1].access_unit_start )
+		{
+		decoder.arrivals.push_back( now() );
+		}
+	sink.write( &stream.nals[i][0], stream.sizes[i], stream.infos[i] );
+	}
+}
+
+static void report( const char * name, const data_source_timed_decoder & decoder )
+{
+printf( "%-14s %6.2f decode calls/frame, %7.1f us decoding/frame, latency after last NAL %6.2f ms avg %6.2f ms max\n",
+	name,
+	decoder.frames ? (double)decoder.calls / decoder.frames : 0.0,
+	decoder.frames ? decoder.decode_time * 1e6 / decoder.frames : 0.0,
+	decoder.frames ? decoder.latency * 1e3 / decoder.frames : 0.0,
+	decoder.max_latency * 1e3 );
+}
+
+int main( int num_args, const char * const args[] )
+{
+if( num_args < 2 )
+	{
+	cout<<"usage:"<<args[0]<<" input_file [fps] [frames]"<<endl;
+	exit(4);
+	}
+double fps = num_args >= 3 ? atof( args[2] ) : 30.0;
+size_t max_frames = num_args >= 4 ? atoi( args[3] ) : 300;
+
+//split the recording once, up front
+x264_destreamer ds;
+data_source_collector stream;
+ds.server.register_callback( &stream );
+FILE * f = fopen( args[1], "rb" );
+if( f == NULL )
+	{
+	cout<<"Couldn't open "<<args[1]<<endl;
+	exit(4);
+	}
+static uint8_t block[65536];
+size_t n;
+while( ( n = fread( block, 1, sizeof( block ), f ) ) > 0 )
+	{
+	ds.write( block, n );
+	}
+fclose( f );
+
+data_source_timed_decoder per_nal;
+replay( stream, per_nal, per_nal, 1.0 / fps, max_frames );
+report( "per NAL", per_nal );
+
+data_source_timed_decoder per_au;
+access_unit_assembler au;
+au.server.register_callback( &per_au );
+replay( stream, au, per_au, 1.0 / fps, max_frames );
+au.flush();
+report( "per access unit", per_au );
+}
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "data_source.h"
+#include "packet_server.h"
+
+using namespace std;
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//only counts, standing in for a network sender
+class data_source_counter: public data_source
+	{
+	public:
+	data_source_counter(){ packets = 0; bytes_seen = 0; }
+	void write( const uint8_t * data, size_t bytes ){ packets++; bytes_seen += bytes; }
+	size_t packets;
+	size_t bytes_seen;
+	};
+
+//takes as long as a decode and display might
+class data_source_slow: public data_source
+	{
+	public:
+	data_source_slow( int us ) : us( us ){}
+	void write( const uint8_t * data, size_t bytes ){ usleep( us ); }
+	int us;
+	};
+
+//slow, and checks that after every gap the stream picks up somewhere a
+//decoder could, at a recovery point
+class data_source_checker: public data_source
+	{
+	public:
+	data_source_checker( int us ) : us( us ){ last = -1; packets = 0; gaps = 0; bad_gaps = 0; }
+	void write( const uint8_t * data, size_t bytes ){}
+	void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		int frame;
+		memcpy( &frame, data, sizeof( frame ) );
+		if( last != -1 && frame != last + 1 )
+			{
+			gaps++;
+			if( !info.recovery_point )
+				{
+				bad_gaps++;
+				}
+			}
+		last = frame;
+		packets++;
+		usleep( us );
+		}
+	int us;
+	int last;
+	size_t packets;
+	size_t gaps;
+	size_t bad_gaps;
+	};
+
+//broadcasts slice sized packets at a frame rate, one access unit each with
+//a recovery point every 30, returning the worst single broadcast in
+//microseconds and the average in *average
+static double run( packet_server & server, size_t packets, double interval, double * average )
+{
+vector<uint8_t> packet( 1200, 0x55 );
+nal_info info;
+info.nal_unit_type = NAL_SLICE;
+info.access_unit_start = true;
+double total = 0;
+double worst = 0;
+double next = now();
+for( size_t i = 0; i < packets; ++i )
+	{
+	int frame = i;
+	memcpy( &packet[0], &frame, sizeof( frame ) );
+	info.recovery_point = i % 30 == 0;
+
+	double start = now();
+	server.broadcast( &packet[0], packet.size(), info );
+	double t = now() - start;
+	total += t;
+	worst = t > worst ? t : worst;
+
+	next += interval;
+	double wait = next - now();
+	if( wait > 0 )
+		{
+		usleep( wait * 1e6 );
+		}
+	}
+*average = total * 1e6 / packets;
+return worst * 1e6;
+}
+
+int main( int num_args, const char * const args[] )
+{
+int slow_us = num_args >= 2 ? atoi( args[1] ) : 5000;
+size_t packets = num_args >= 3 ? atoi( args[2] ) : 500;
+cout<<"usage:"<<args[0]<<" [slow sink us] [packets]"<<endl;
+
+//one packet per ms, so the slow sink can't keep up inline
+double interval = 0.001;
+double average;
+double worst;
+int failures = 0;
+
+	{
+	data_source_slow slow( slow_us );
+	data_source_counter counter;
+	packet_server server;
+	server.register_callback( &slow );
+	server.register_callback( &counter );
+	worst = run( server, packets, interval, &average );
+	printf( "inline: broadcast %8.1f us avg %8.1f us max, counter got %i\n", average, worst, (int)counter.packets );
+	}
+
+static const overflow_policy policies[] = { OVERFLOW_DROP_OLDEST, OVERFLOW_DROP_TO_RECOVERY, OVERFLOW_BLOCK };
+for( size_t i = 0; i < sizeof( policies ) / sizeof( policies[0] ); ++i )
+	{
+	data_source_checker checker( slow_us );
+	data_source_counter counter;
+		{
+		packet_server server;
+		server.register_async_callback( &checker, 64, policies[i] );
+		server.register_async_callback( &counter );
+		worst = run( server, packets, interval, &average );
+		printf( "async, %s: broadcast %8.1f us avg %8.1f us max\n", overflow_policy_name( policies[i] ), average, worst );
+		server.report();
+		}
+	printf( "  slow sink got %i packets, %i gaps, %i not at a recovery point\n", (int)checker.packets, (int)checker.gaps, (int)checker.bad_gaps );
+	if( ( policies[i] == OVERFLOW_DROP_TO_RECOVERY && checker.bad_gaps ) ||
+	    ( policies[i] == OVERFLOW_BLOCK && checker.packets != packets ) ||
+	    counter.packets != packets )
+		{
+		printf( "  FAILED\n" );
+		failures++;
+		}
+	}
+
+return failures ? 1 : 0;
+}
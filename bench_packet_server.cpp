@@ -0,0 +1,151 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <time.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "packet_server.h"
+#include "static_packet_server.h"
+
+using namespace std;
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//about the least work a sink can do
+class data_source_counter: public data_source
+	{
+	public:
+	data_source_counter(){ packets = 0; bytes_seen = 0; }
+	void write( const uint8_t * data, size_t bytes ){ packets++; bytes_seen += bytes; }
+	uint64_t packets;
+	uint64_t bytes_seen;
+	};
+
+//packet_server as it is today, but with the pointers in one array, to
+//tell the cost of the virtual calls from that of walking the list
+class vector_packet_server
+	{
+	public:
+	void register_callback( data_source * target ){ targets.push_back( target ); }
+	void broadcast( const uint8_t * data, size_t bytes )
+		{
+		for( size_t i = 0; i < targets.size(); ++i )
+			{
+			targets[i]->write( data, bytes );
+			}
+		}
+	private:
+	vector<data_source*> targets;
+	};
+
+//pushes everything the broadcast touches out of the caches, as decoding a
+//frame between packets would
+static void evict()
+{
+static vector<uint8_t> junk( 16 * 1024 * 1024 );
+for( size_t i = 0; i < junk.size(); i += 64 )
+	{
+	junk[i]++;
+	}
+}
+
+static const size_t hot_packets = 1000000;
+static const size_t cold_packets = 200;
+
+//ns per broadcast in a tight loop, and with the caches cold before each one
+template< typename Server >
+static void measure( Server & server, double * hot, double * cold )
+{
+static uint8_t packet[1200 + PACKET_PADDING_SIZE];
+double start = now();
+for( size_t i = 0; i < hot_packets; ++i )
+	{
+	server.broadcast( packet, 1200 );
+	//each broadcast has to happen, not be folded into one by the compiler
+	__asm__ __volatile__( "" : : "r"( packet ) : "memory" );
+	}
+*hot = ( now() - start ) * 1e9 / hot_packets;
+
+double total = 0;
+for( size_t i = 0; i < cold_packets; ++i )
+	{
+	evict();
+	double t = now();
+	server.broadcast( packet, 1200 );
+	total += now() - t;
+	}
+*cold = total * 1e9 / cold_packets;
+}
+
+//0..N-1 as a parameter pack, to give the static server N sinks
+template< size_t... I > struct indices {};
+template< size_t N, size_t... I > struct build_indices : build_indices< N - 1, N - 1, I... > {};
+template< size_t... I > struct build_indices< 0, I... > { typedef indices< I... > type; };
+
+template< size_t I > struct counter_type { typedef data_source_counter type; };
+
+//the same counters through each server. The list's nodes are allocated
+//with other blocks between them, the way a long running program's heap
+//ends up, so each is somewhere else
+template< size_t... I >
+static void run( indices< I... >, data_source_counter * counters )
+{
+size_t n = sizeof...( I );
+double list_hot, list_cold, vector_hot, vector_cold, static_hot, static_cold;
+
+	{
+	packet_server server;
+	vector< vector<uint8_t>* > spacers;
+	for( size_t i = 0; i < n; ++i )
+		{
+		server.register_callback( &counters[i] );
+		spacers.push_back( new vector<uint8_t>( 4096 + rand() % 65536 ) );
+		}
+	measure( server, &list_hot, &list_cold );
+	for( size_t i = 0; i < spacers.size(); ++i )
+		{
+		delete spacers[i];
+		}
+	}
+
+	{
+	vector_packet_server server;
+	for( size_t i = 0; i < n; ++i )
+		{
+		server.register_callback( &counters[i] );
+		}
+	measure( server, &vector_hot, &vector_cold );
+	}
+
+	{
+	static_packet_server< typename counter_type<I>::type... > server( counters[I]... );
+	measure( server, &static_hot, &static_cold );
+	}
+
+printf( "%2i sinks: list %6.1f ns hot %7.1f ns cold, vector %6.1f ns hot %7.1f ns cold, static %6.1f ns hot %7.1f ns cold\n",
+	(int)n, list_hot, list_cold, vector_hot, vector_cold, static_hot, static_cold );
+}
+
+int main( int num_args, const char * const args[] )
+{
+data_source_counter counters[16];
+
+run( build_indices<1>::type(), counters );
+run( build_indices<4>::type(), counters );
+run( build_indices<16>::type(), counters );
+
+uint64_t total = 0;
+for( int i = 0; i < 16; ++i )
+	{
+	total += counters[i].packets;
+	}
+printf( "%llu packets counted\n", (unsigned long long)total );
+return 0;
+}
@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "data_source.h"
+#include "data_source_shm.h"
+#include "shm_reader.h"
+#include "writev_all.h"
+#include "x264_destreamer.h"
+
+using namespace std;
+
+#define BENCH_RING "/bench_shm"
+
+static uint64_t now_ns()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000000 + temp.tv_nsec;
+}
+
+//CPU seconds this process has used, user and system
+static double cpu()
+{
+rusage usage;
+getrusage( RUSAGE_SELF, &usage );
+return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+//the filler NAL that ends each frame carries the time it was sent, in hex
+//so it can't look like a start code
+#define STAMP_OFFSET 5
+#define STAMP_DIGITS 16
+
+//times each frame from being sent to its last NAL arriving
+class latency_sink: public data_source
+	{
+	public:
+	void write( const uint8_t * data, size_t bytes )
+		{
+		if( bytes < STAMP_OFFSET + STAMP_DIGITS || ( data[4] & 0x1F ) != NAL_FILLER )
+			{
+			return;
+			}
+		char stamp[STAMP_DIGITS + 1];
+		memcpy( stamp, data + STAMP_OFFSET, STAMP_DIGITS );
+		stamp[STAMP_DIGITS] = 0;
+		latencies.push_back( ( now_ns() - strtoull( stamp, NULL, 16 ) ) / 1e3 );
+		}
+	void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		write( data, bytes );
+		}
+	vector<double> latencies;
+	};
+
+//a frame of slices, as x264 would cut it, then the filler
+static void make_frame( vector< vector<uint8_t> > & nals, size_t slices, size_t max_slice )
+{
+nals.clear();
+for( size_t i = 0; i < slices; ++i )
+	{
+	size_t n = max_slice / 2 + rand() % ( max_slice / 2 );
+	vector<uint8_t> nal( n );
+	nal[0] = nal[1] = nal[2] = 0;
+	nal[3] = 1;
+	nal[4] = 0x65;
+	for( size_t j = 5; j < n; ++j )
+		{
+		nal[j] = 0x10 + rand() % 0xE0;
+		}
+	nals.push_back( nal );
+	}
+vector<uint8_t> filler( STAMP_OFFSET + STAMP_DIGITS + 1, 0xFF );
+filler[0] = filler[1] = filler[2] = 0;
+filler[3] = 1;
+filler[4] = NAL_FILLER;
+filler.back() = 0x80;
+nals.push_back( filler );
+}
+
+static void stamp( vector<uint8_t> & filler )
+{
+char text[STAMP_DIGITS + 1];
+snprintf( text, sizeof( text ), "%016llx", (unsigned long long)now_ns() );
+memcpy( &filler[STAMP_OFFSET], text, STAMP_DIGITS );
+}
+
+enum transport { PIPE, SHM };
+static const char * transport_names[] = { "pipe", "shm ring" };
+
+//the viewer's side, in a process of its own: reads until the encoder's
+//side goes, then prints what the frames took
+static void view( transport t, int fd, size_t frames )
+{
+latency_sink sink;
+double start = cpu();
+if( t == PIPE )
+	{
+	//as viewer_stdin reads
+	x264_destreamer ds;
+	ds.server.register_callback( &sink );
+	static uint8_t data[65536];
+	ssize_t bytes;
+	while( ( bytes = read( fd, data, sizeof( data ) ) ) > 0 )
+		{
+		ds.write( data, bytes );
+		}
+	}
+else
+	{
+	shm_reader reader;
+	reader.server.register_callback( &sink );
+	if( !reader.open( BENCH_RING, 1000 ) )
+		{
+		printf( "couldn't open %s\n", BENCH_RING );
+		return;
+		}
+	while( reader.read() )
+		{
+		}
+	}
+double used = cpu() - start;
+
+vector<double> & l = sink.latencies;
+if( l.empty() )
+	{
+	printf( "%-9s nothing arrived\n", transport_names[t] );
+	return;
+	}
+sort( l.begin(), l.end() );
+printf( "%-9s %5i/%i frames, latency median %6.1f us, 99%% %6.1f us, max %7.1f us, viewer %5.1f us CPU/frame\n",
+	transport_names[t], (int)l.size(), (int)frames, l[l.size() / 2], l[l.size() * 99 / 100], l.back(), used * 1e6 / frames );
+}
+
+static void run( transport t, const vector< vector<uint8_t> > & frame, size_t frames, int interval_us )
+{
+vector< vector<uint8_t> > nals( frame );
+int fds[2] = { -1, -1 };
+data_source_shm * shm = NULL;
+if( t == PIPE )
+	{
+	if( pipe( fds ) < 0 )
+		{
+		printf( "couldn't make a pipe\n" );
+		return;
+		}
+	}
+else
+	{
+	shm = new data_source_shm( BENCH_RING );
+	}
+
+fflush( stdout );
+pid_t viewer = fork();
+if( viewer == 0 )
+	{
+	if( t == PIPE )
+		{
+		close( fds[1] );
+		}
+	view( t, fds[0], frames );
+	fflush( stdout );
+	_exit( 0 );
+	}
+if( t == PIPE )
+	{
+	close( fds[0] );
+	}
+
+//let the viewer get going
+usleep( 200000 );
+
+//each frame as the encoders send it: over the pipe straight from the
+//encoder's buffers with the next start code, so the destreamer can pass
+//on the filler without waiting, and into the ring as one access unit
+vector<struct iovec> iov;
+vector<nal_info> infos( nals.size() );
+infos[0].access_unit_start = true;
+infos[0].recovery_point = true;
+infos[0].nal_unit_type = NAL_SLICE_IDR;
+infos.back().nal_unit_type = NAL_FILLER;
+infos.back().access_unit_end = true;
+static const uint8_t next_header[4] = { 0, 0, 0, 1 };
+if( t == PIPE )
+	{
+	struct iovec first = make_iovec( next_header, 4 );
+	writev_all( fds[1], &first, 1 );
+	}
+
+double start = cpu();
+uint64_t next = now_ns();
+for( size_t f = 0; f < frames; ++f )
+	{
+	stamp( nals.back() );
+	iov.clear();
+	for( size_t i = 0; i < nals.size(); ++i )
+		{
+		int skip = t == PIPE && i == 0 ? 4 : 0;
+		iov.push_back( make_iovec( &nals[i][skip], nals[i].size() - skip ) );
+		}
+	if( t == PIPE )
+		{
+		iov.push_back( make_iovec( next_header, 4 ) );
+		writev_all( fds[1], &iov[0], iov.size() );
+		}
+	else
+		{
+		shm->write_batch( &iov[0], iov.size(), &infos[0] );
+		}
+
+	next += interval_us * 1000ULL;
+	uint64_t now = now_ns();
+	if( next > now )
+		{
+		usleep( ( next - now ) / 1000 );
+		}
+	}
+double used = cpu() - start;
+
+if( t == PIPE )
+	{
+	close( fds[1] );
+	}
+else
+	{
+	shm->report();
+	delete shm;
+	}
+waitpid( viewer, NULL, 0 );
+printf( "%-9s encoder %5.1f us CPU/frame\n", transport_names[t], used * 1e6 / frames );
+}
+
+int main( int num_args, const char * const args[] )
+{
+size_t frames = num_args >= 2 ? atoi( args[1] ) : 2000;
+int interval_us = num_args >= 3 ? atoi( args[2] ) : 1000;
+size_t slices = num_args >= 4 ? atoi( args[3] ) : 12;
+cout<<"usage:"<<args[0]<<" [frames] [us between frames] [slices per frame]"<<endl;
+
+srand( 1 );
+vector< vector<uint8_t> > frame;
+make_frame( frame, slices, 1200 );
+size_t bytes = 0;
+for( size_t i = 0; i < frame.size(); ++i )
+	{
+	bytes += frame[i].size();
+	}
+printf( "%i frames of %i bytes, one every %i us, encoder to viewer on this host\n", (int)frames, (int)bytes, interval_us );
+
+run( PIPE, frame, frames, interval_us );
+run( SHM, frame, frames, interval_us );
+return 0;
+}
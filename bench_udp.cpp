@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "data_source_ts.h"
+#include "data_source_udp.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define BENCH_PORT 12399
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//CPU seconds this thread has used, user and system
+static double cpu()
+{
+rusage usage;
+getrusage( RUSAGE_THREAD, &usage );
+return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+//viewers, on ports from here up, and the group they join multicast
+#define BENCH_VIEWERS_PORT 12400
+#define BENCH_GROUP "239.255.12.34"
+
+//counts what arrives on loopback, or for a multicast group on loopback
+class receiver: public udp_receiver
+	{
+	public:
+	receiver( int port = BENCH_PORT, const char * group = NULL ) : udp_receiver( port, group )
+		{
+		datagrams.store( 0 );
+		bytes.store( 0 );
+		start();
+		}
+	~receiver()
+		{
+		stop();
+		}
+	atomic<uint64_t> datagrams;
+	atomic<uint64_t> bytes;
+
+	protected:
+	void arrived( const uint8_t * data, size_t bytes, const struct sockaddr_in & from, uint64_t arrival_us )
+		{
+		datagrams++;
+		this->bytes += bytes;
+		}
+	};
+
+//a frame of slices no bigger than slice-max-size, as x264 would cut it
+static void make_frame( vector<uint8_t> & frame, vector<struct iovec> & nals, size_t slices, size_t max_slice )
+{
+frame.clear();
+vector<size_t> sizes;
+for( size_t i = 0; i < slices; ++i )
+	{
+	size_t n = max_slice / 2 + rand() % ( max_slice / 2 );
+	frame.push_back( 0 );
+	frame.push_back( 0 );
+	frame.push_back( 0 );
+	frame.push_back( 1 );
+	for( size_t j = 4; j < n; ++j )
+		{
+		frame.push_back( 0x10 + rand() % 0xE0 );
+		}
+	sizes.push_back( n );
+	}
+nals.clear();
+size_t offset = 0;
+for( size_t i = 0; i < sizes.size(); ++i )
+	{
+	struct iovec v;
+	v.iov_base = &frame[offset];
+	v.iov_len = sizes[i];
+	nals.push_back( v );
+	offset += sizes[i];
+	}
+}
+
+enum path { SENDTO_PER_NAL, SENDTO_PER_FRAME, SENDMMSG_PER_NAL, SENDMMSG_SEGMENTS, GSO_SEGMENTS };
+static const char * path_names[] = { "sendto per NAL", "sendto per frame", "sendmmsg per NAL", "sendmmsg segments", "UDP_SEGMENT" };
+
+static void run( path p, const vector<uint8_t> & frame, const vector<struct iovec> & nals, size_t segment_size, double seconds )
+{
+receiver rx;
+data_source_udp udp( "127.0.0.1", BENCH_PORT, p == SENDMMSG_SEGMENTS || p == GSO_SEGMENTS ? segment_size : 0 );
+if( p == SENDMMSG_SEGMENTS )
+	{
+	udp.disable_gso();
+	}
+if( p == GSO_SEGMENTS && !udp.gso() )
+	{
+	printf( "%-18s not supported here\n", path_names[p] );
+	return;
+	}
+
+size_t frames = 0;
+double start = now();
+double cpu_start = cpu();
+while( now() - start < seconds )
+	{
+	switch( p )
+		{
+		case SENDTO_PER_NAL:
+			for( size_t i = 0; i < nals.size(); ++i )
+				{
+				udp.write( (const uint8_t *)nals[i].iov_base, nals[i].iov_len );
+				}
+			break;
+		case SENDTO_PER_FRAME:
+			udp.write( &frame[0], frame.size() );
+			break;
+		default:
+			udp.write_batch( &nals[0], nals.size() );
+			break;
+		}
+	frames++;
+	}
+double elapsed = now() - start;
+double cpu_used = cpu() - cpu_start;
+usleep( 200000 );
+
+size_t expected = p == SENDTO_PER_FRAME ? frames :
+	p == SENDTO_PER_NAL || p == SENDMMSG_PER_NAL ? frames * nals.size() :
+	frames * ( ( frame.size() + segment_size - 1 ) / segment_size );
+printf( "%-18s %8.0f frames/s %9.0f datagrams/s sent, %5.1f%% received, %6.2f us CPU/frame\n",
+	path_names[p], frames / elapsed, expected / elapsed,
+	100.0 * rx.datagrams.load() / expected, cpu_used * 1e6 / frames );
+}
+
+enum fan_out { SENDER_PER_VIEWER, DESTINATIONS, MULTICAST };
+static const char * fan_out_names[] = { "a sender each", "destinations", "multicast" };
+
+//a datagram per NAL to each of so many viewers, the way RTP is sent
+static void run_viewers( fan_out f, size_t viewers, const vector<struct iovec> & nals, double seconds )
+{
+vector<receiver *> rx;
+vector<data_source_udp *> senders;
+for( size_t i = 0; i < viewers; ++i )
+	{
+	rx.push_back( f == MULTICAST ? new receiver( BENCH_VIEWERS_PORT, BENCH_GROUP ) : new receiver( BENCH_VIEWERS_PORT + i ) );
+	if( f == SENDER_PER_VIEWER || i == 0 )
+		{
+		senders.push_back( new data_source_udp( f == MULTICAST ? BENCH_GROUP : "127.0.0.1", BENCH_VIEWERS_PORT + i ) );
+		}
+	else if( f == DESTINATIONS )
+		{
+		senders[0]->add_destination( "127.0.0.1", BENCH_VIEWERS_PORT + i );
+		}
+	}
+if( f == MULTICAST && ( !rx[0]->joined || !senders[0]->multicast( 0, "127.0.0.1", true ) ) )
+	{
+	printf( "%-14s not supported here\n", fan_out_names[f] );
+	viewers = 0;
+	}
+
+size_t frames = 0;
+double start = now();
+double cpu_start = cpu();
+while( viewers && now() - start < seconds )
+	{
+	for( size_t i = 0; i < senders.size(); ++i )
+		{
+		senders[i]->write_batch( &nals[0], nals.size() );
+		}
+	frames++;
+	}
+double elapsed = now() - start;
+double cpu_used = cpu() - cpu_start;
+usleep( 200000 );
+
+uint64_t received = 0;
+for( size_t i = 0; i < rx.size(); ++i )
+	{
+	received += rx[i]->datagrams.load();
+	delete rx[i];
+	}
+for( size_t i = 0; i < senders.size(); ++i )
+	{
+	delete senders[i];
+	}
+if( viewers == 0 )
+	{
+	return;
+	}
+size_t expected = frames * nals.size() * viewers;
+printf( "%-14s %2i viewers %8.0f frames/s, %5.1f%% received, %7.2f us CPU/frame, %6.2f us per viewer\n",
+	fan_out_names[f], (int)viewers, frames / elapsed, 100.0 * received / expected,
+	cpu_used * 1e6 / frames, cpu_used * 1e6 / frames / viewers );
+}
+
+#define BENCH_LATENCY_PORT 12398
+
+enum format { ANNEX_B, TS_PER_ACCESS_UNIT, TS_PER_SLICE };
+static const char * format_names[] = { "Annex B", "MPEG-TS", "MPEG-TS per slice" };
+
+//from handing a frame over to its last datagram arriving over loopback, a
+//frame at a time, raw the way encoder_udp sends it or muxed for gst_recv.sh
+static void run_latency( format f, const vector<uint8_t> & frame, const vector<struct iovec> & nals, double seconds )
+{
+int sd = socket( AF_INET, SOCK_DGRAM, 0 );
+int size = 16 * 1024 * 1024;
+setsockopt( sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ) );
+struct timeval timeout = { 0, 100000 };
+setsockopt( sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+struct sockaddr_in addr;
+memset( &addr, 0, sizeof( addr ) );
+addr.sin_family = AF_INET;
+addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+addr.sin_port = htons( BENCH_LATENCY_PORT );
+if( bind( sd, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 )
+	{
+	printf( "couldn't bind port %i\n", BENCH_LATENCY_PORT );
+	exit( 1 );
+	}
+
+//Annex B is cut into datagrams as big as TS puts in one, and TS, full
+//datagrams but for the last, goes through the same UDP_SEGMENT send
+size_t segment_size = TS_PACKETS_PER_DATAGRAM * TS_PACKET_SIZE;
+data_source_udp udp( "127.0.0.1", BENCH_LATENCY_PORT, segment_size );
+data_source_ts ts( f == TS_PER_SLICE );
+ts.server.register_callback( &udp );
+
+//the frame's slices described, as the bytes in them aren't real ones
+vector<nal_info> infos( nals.size() );
+for( size_t i = 0; i < infos.size(); ++i )
+	{
+	infos[i].nal_unit_type = NAL_SLICE;
+	infos[i].access_unit_start = i == 0;
+	infos[i].access_unit_end = i + 1 == infos.size();
+	}
+
+vector<double> latencies;
+vector<uint8_t> buffer( 65536 );
+uint64_t bytes = 0;
+size_t frames = 0;
+size_t lost = 0;
+double start = now();
+double cpu_start = cpu();
+while( now() - start < seconds )
+	{
+	uint64_t sent = ts.datagrams;
+	double begin = now();
+	if( f == ANNEX_B )
+		{
+		udp.write_batch( &nals[0], nals.size() );
+		}
+	else
+		{
+		ts.write_batch( &nals[0], nals.size(), &infos[0] );
+		}
+	size_t expected = f == ANNEX_B ? ( frame.size() + segment_size - 1 ) / segment_size : ts.datagrams - sent;
+	size_t received = 0;
+	while( received < expected )
+		{
+		ssize_t n = recv( sd, &buffer[0], buffer.size(), 0 );
+		if( n < 0 )
+			{
+			break;
+			}
+		bytes += n;
+		received++;
+		}
+	if( received < expected )
+		{
+		lost++;
+		continue;
+		}
+	latencies.push_back( ( now() - begin ) * 1e6 );
+	frames++;
+	}
+double cpu_used = cpu() - cpu_start;
+close( sd );
+
+sort( latencies.begin(), latencies.end() );
+if( latencies.empty() )
+	{
+	printf( "%-18s nothing arrived\n", format_names[f] );
+	return;
+	}
+printf( "%-18s %7.1f us median, %7.1f us 99th percentile, %5.1f%% more bytes, %6.2f us CPU/frame, %i lost\n",
+	format_names[f], latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100],
+	100.0 * ( (double)bytes / frames / frame.size() - 1 ), cpu_used * 1e6 / frames, (int)lost );
+}
+
+int main( int num_args, const char * const args[] )
+{
+size_t slices = num_args >= 2 ? atoi( args[1] ) : 12;
+size_t segment_size = num_args >= 3 ? atoi( args[2] ) : 1200;
+double seconds = num_args >= 4 ? atof( args[3] ) : 1.0;
+cout<<"usage:"<<args[0]<<" [slices per frame] [slice-max-size] [seconds]"<<endl;
+
+vector<uint8_t> frame;
+vector<struct iovec> nals;
+srand( 1 );
+make_frame( frame, nals, slices, segment_size );
+printf( "%i slices, %i bytes per frame, over loopback\n", (int)slices, (int)frame.size() );
+
+for( int p = SENDTO_PER_NAL; p <= GSO_SEGMENTS; ++p )
+	{
+	run( (path)p, frame, nals, segment_size, seconds );
+	}
+
+//what each viewer costs the sender, sent the same stream once or by itself
+printf( "\nthe same frames to several viewers over loopback\n" );
+for( size_t viewers = 1; viewers <= 32; viewers *= 2 )
+	{
+	for( int f = SENDER_PER_VIEWER; f <= MULTICAST; ++f )
+		{
+		run_viewers( (fan_out)f, viewers, nals, seconds );
+		}
+	}
+
+//what muxing into MPEG-TS for GStreamer adds to sending the frame raw
+printf( "\nframe to last datagram over loopback\n" );
+for( int f = ANNEX_B; f <= TS_PER_SLICE; ++f )
+	{
+	run_latency( (format)f, frame, nals, seconds );
+	}
+return 0;
+}
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "nal_file_reader.h"
+#include "packet_server.h"
+#include "x264_destreamer.h"
+
+using namespace std;
+
+//the byte at a time state machine x264_destreamer used to be, kept as the reference
+class reference_destreamer
+	{
+	public:
+	reference_destreamer(){ previous_state = 0xFFFFFFFF; sync = false; }
+	void write( const uint8_t * data, size_t bytes )
+		{
+		while( bytes-- )
+			{
+			input( *data++ );
+			}
+		}
+	packet_server server;
+
+	private:
+	void input( uint8_t byte )
+		{
+		previous_state = ( ( previous_state & 0x00FFFFFF ) << 8 ) | byte;
+		if( previous_state == 0x00000001 )
+			{
+			if( sync && buffer.size() > 4 )
+				{
+				buffer.insert( buffer.end(), 8, 0 );
+				server.broadcast( &buffer[0], buffer.size()-8 );
+				buffer.clear();
+				}
+			sync = true;
+			}
+		if( sync )
+			{
+			buffer.push_back( ( previous_state & 0xFF000000 ) >> 24 );
+			}
+		}
+	std::vector<uint8_t>buffer;
+	uint32_t previous_state;
+	bool sync;
+	};
+
+//keeps a copy of every NAL, and checks what follows it: zero padding when
+//it was copied, or the next start code when it points into the input
+class data_source_collector: public data_source
+	{
+	public:
+	data_source_collector(){ bad_padding = 0; }
+	void write( const uint8_t * data, size_t bytes )
+		{
+		static const uint8_t zeros[X264_DESTREAMER_PADDING] = { 0 };
+		static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+		nals.push_back( vector<uint8_t>( data, data + bytes ) );
+		if( memcmp( &data[bytes], zeros, sizeof( zeros ) ) != 0 &&
+		    memcmp( &data[bytes], start_code, sizeof( start_code ) ) != 0 )
+			{
+			bad_padding++;
+			}
+		}
+	vector< vector<uint8_t> > nals;
+	size_t bad_padding;
+	};
+
+//only counts, so the benchmark measures the destreamer
+class data_source_counter: public data_source
+	{
+	public:
+	data_source_counter(){ nals = 0; }
+	void write( const uint8_t * data, size_t bytes ){ nals++; }
+	size_t nals;
+	};
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+static vector<uint8_t> load_file( const char * fname )
+{
+vector<uint8_t> data;
+FILE * f = fopen( fname, "rb" );
+if( f == NULL )
+	{
+	cout<<"Couldn't open "<<fname<<endl;
+	exit(4);
+	}
+uint8_t block[65536];
+size_t n;
+while( ( n = fread( block, 1, sizeof( block ), f ) ) > 0 )
+	{
+	data.insert( data.end(), block, block + n );
+	}
+fclose( f );
+return data;
+}
+
+//slices of up to 1200 bytes behind both start code lengths, with runs of
+//zeros thrown in to exercise the near misses, and now and then a start
+//code with nothing after it
+static vector<uint8_t> synthetic_stream( size_t bytes )
+{
+static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+vector<uint8_t> data;
+srand( 1 );
+while( data.size() < bytes )
+	{
+	if( rand() % 50 == 0 )
+		{
+		data.insert( data.end(), start_code, start_code + sizeof( start_code ) );
+		}
+	if( rand() % 4 )
+		{
+		data.push_back( 0 );
+		}
+	data.push_back( 0 );
+	data.push_back( 0 );
+	data.push_back( 1 );
+	size_t len = 1 + rand() % 1200;
+	for( size_t i = 0; i < len; ++i )
+		{
+		int r = rand() % 64;
+		data.push_back( r < 8 ? 0 : r == 8 ? 1 : (uint8_t)rand() );
+		}
+	}
+return data;
+}
+
+template< typename Destreamer >
+static vector< vector<uint8_t> > split( const vector<uint8_t> & stream, size_t block, size_t * bad_padding )
+{
+Destreamer ds;
+data_source_collector collector;
+ds.server.register_callback( &collector );
+for( size_t pos = 0; pos < stream.size(); pos += block )
+	{
+	size_t n = stream.size() - pos < block ? stream.size() - pos : block;
+	ds.write( &stream[pos], n );
+	}
+*bad_padding = collector.bad_padding;
+return collector.nals;
+}
+
+//the same from nal_file_reader, through a window of window_size, with
+//what follows each NAL checked as the collector does
+static vector< vector<uint8_t> > read_file( const char * fname, size_t window_size, size_t * bad_padding )
+{
+static const uint8_t zeros[PACKET_PADDING_SIZE] = { 0 };
+static const uint8_t start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+vector< vector<uint8_t> > nals;
+*bad_padding = 0;
+nal_file_reader reader( fname, window_size );
+const uint8_t * data;
+size_t bytes;
+while( reader.next( &data, &bytes ) )
+	{
+	nals.push_back( vector<uint8_t>( data, data + bytes ) );
+	if( memcmp( &data[bytes], zeros, sizeof( zeros ) ) != 0 &&
+	    memcmp( &data[bytes], start_code, sizeof( start_code ) ) != 0 )
+		{
+		( *bad_padding )++;
+		}
+	}
+return nals;
+}
+
+static double copy_ratio( const reference_destreamer & ds )
+{
+return 1.0;
+}
+
+static double copy_ratio( const x264_destreamer & ds )
+{
+return ds.copy_ratio();
+}
+
+template< typename Destreamer >
+static double throughput( const vector<uint8_t> & stream, size_t block, size_t * nals, double * copied )
+{
+Destreamer ds;
+data_source_counter counter;
+ds.server.register_callback( &counter );
+size_t total = 0;
+double start = now();
+while( now() - start < 1.0 )
+	{
+	for( size_t pos = 0; pos < stream.size(); pos += block )
+		{
+		size_t n = stream.size() - pos < block ? stream.size() - pos : block;
+		ds.write( &stream[pos], n );
+		}
+	total += stream.size();
+	}
+*nals = counter.nals;
+*copied = copy_ratio( ds );
+return total / ( now() - start ) / 1e9;
+}
+
+int main( int num_args, const char * const args[] )
+{
+vector<uint8_t> stream;
+const char * fname = "bench_x264_destreamer.264";
+if( num_args == 2 )
+	{
+	fname = args[1];
+	stream = load_file( fname );
+	}
+else
+	{
+	cout<<"usage:"<<args[0]<<" [input_file], using a synthetic stream"<<endl;
+	stream = synthetic_stream( 16 * 1024 * 1024 );
+	FILE * f = fopen( fname, "wb" );
+	if( f == NULL || fwrite( &stream[0], 1, stream.size(), f ) != stream.size() )
+		{
+		cout<<"Couldn't write "<<fname<<endl;
+		exit(4);
+		}
+	fclose( f );
+	}
+
+size_t bad_padding;
+vector< vector<uint8_t> > expected = split<reference_destreamer>( stream, stream.size(), &bad_padding );
+cout<<stream.size()<<" bytes, "<<expected.size()<<" NALs"<<endl;
+
+int failures = 0;
+static const size_t blocks[] = { 1, 2, 3, 5, 7, 64, 1500, 65536, 0 };
+for( size_t i = 0; i < sizeof( blocks ) / sizeof( blocks[0] ); ++i )
+	{
+	size_t block = blocks[i] ? blocks[i] : stream.size();
+	if( split<x264_destreamer>( stream, block, &bad_padding ) != expected || bad_padding )
+		{
+		cout<<"MISMATCH with "<<block<<" byte writes"<<endl;
+		failures++;
+		}
+	}
+
+//nal_file_reader splits a file the same way, but also hands out the NAL
+//after the last start code, which the destreamers keep waiting for more of
+static const size_t windows[] = { 4096, 65536, 8 * 1024 * 1024 };
+for( size_t i = 0; i < sizeof( windows ) / sizeof( windows[0] ); ++i )
+	{
+	vector< vector<uint8_t> > got = read_file( fname, windows[i], &bad_padding );
+	if( got.size() != expected.size() + 1 || !equal( expected.begin(), expected.end(), got.begin() ) || bad_padding )
+		{
+		cout<<"MISMATCH from nal_file_reader with a "<<windows[i]<<" byte window"<<endl;
+		failures++;
+		}
+	}
+if( num_args != 2 )
+	{
+	unlink( fname );
+	}
+
+size_t nals;
+double copied;
+static const size_t bench_blocks[] = { 1500, 65536 };
+for( size_t i = 0; i < sizeof( bench_blocks ) / sizeof( bench_blocks[0] ); ++i )
+	{
+	double before = throughput<reference_destreamer>( stream, bench_blocks[i], &nals, &copied );
+	double after = throughput<x264_destreamer>( stream, bench_blocks[i], &nals, &copied );
+	printf( "%6i byte writes: byte at a time %.3f GB/s, block scanner %.3f GB/s, %.3f bytes copied per byte\n", (int)bench_blocks[i], before, after, copied );
+	}
+
+return failures ? 1 : 0;
+}
@@ -2,3 +2,4 @@
 #define HEIGHT 240
 #define TCP_PORT_NUMBER 10000
 #define UDP_PORT_NUMBER 12345
+#define PACKET_PADDING_SIZE 64
@@ -3,11 +3,55 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/uio.h>
+
+#include "nal_info.h"
+#include "packet_pool.h"
 
 class data_source
 	{
 	public:
+	virtual ~data_source(){}
 	virtual void write( const uint8_t * data, size_t bytes )=0;
+
+	//sinks that want the NAL descriptor override this one
+	virtual void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		write( data, bytes );
+		}
+
+	//A batch of packets at once, typically a whole frame's NALs, so sinks
+	//that can hand them to the kernel together make one call per frame.
+	//Each entry is one packet, padded like a single write's; infos, when
+	//given, holds one descriptor per entry. Sinks that care about the
+	//descriptors override the second one too.
+	virtual void write_batch( const struct iovec * iov, int count )
+		{
+		for( int i = 0; i < count; ++i )
+			{
+			write( (const uint8_t *)iov[i].iov_base, iov[i].iov_len );
+			}
+		}
+	virtual void write_batch( const struct iovec * iov, int count, const nal_info * infos )
+		{
+		for( int i = 0; i < count; ++i )
+			{
+			write( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, infos[i] );
+			}
+		}
+
+	//Sinks that keep packets past the call override these, and wants_packets,
+	//to hold on to the pooled buffer instead of copying it. Everyone else
+	//just sees the bytes.
+	virtual bool wants_packets() const { return false; }
+	virtual void write( const packet_ref & packet )
+		{
+		write( packet.data(), packet.size() );
+		}
+	virtual void write( const packet_ref & packet, const nal_info & info )
+		{
+		write( packet.data(), packet.size(), info );
+		}
 	};
 
 #endif
@@ -0,0 +1,214 @@
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "data_source_fec.h"
+#include "gf256.h"
+
+#define FEC_SYMBOL_STRIDE ( FEC_MAX_PACKET + 2 )
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//Rows take x values above every column's y, so no row and column meet at
+//zero, and the Cauchy entry 1/(x+y) is defined throughout. Scaling a column
+//keeps every square submatrix invertible, so dividing each by its row 0
+//entry keeps the code MDS while making row 0 plain XOR.
+struct coefficient_table
+	{
+	coefficient_table()
+		{
+		for( int i = 0; i < FEC_MAX_DATA; ++i )
+			{
+			//1 / ( 1 / ( x0 + y ) )
+			uint8_t scale = FEC_MAX_DATA ^ i;
+			for( int j = 0; j < FEC_MAX_PARITY; ++j )
+				{
+				c[j][i] = gf256_mul( gf256_inv( ( FEC_MAX_DATA + j ) ^ i ), scale );
+				}
+			}
+		}
+	uint8_t c[FEC_MAX_PARITY][FEC_MAX_DATA];
+	};
+
+uint8_t fec_coefficient( int row, int column )
+{
+static const coefficient_table table;
+return table.c[row][column];
+}
+
+data_source_fec::data_source_fec( int data_packets, int parity_packets ) : symbols( FEC_MAX_DATA * FEC_SYMBOL_STRIDE )
+{
+this->data_packets = data_packets < 1 ? 1 : data_packets > FEC_MAX_DATA ? FEC_MAX_DATA : data_packets;
+this->parity_packets = parity_packets < 1 ? 1 : parity_packets > FEC_MAX_PARITY ? FEC_MAX_PARITY : parity_packets;
+count = 0;
+longest = 0;
+base = 0;
+memset( header, 0, sizeof( header ) );
+sequence = 0;
+batching = false;
+data_sent = 0;
+parity_sent = 0;
+unprotected = 0;
+encode_time = 0;
+}
+
+void data_source_fec::write( const uint8_t * data, size_t bytes )
+{
+server.broadcast( data, bytes );
+data_sent++;
+add( data, bytes );
+}
+
+void data_source_fec::write_batch( const struct iovec * iov, int packets )
+{
+batching = true;
+out.clear();
+parity_entries.clear();
+for( int i = 0; i < packets; ++i )
+	{
+	out.push_back( iov[i] );
+	add( (const uint8_t *)iov[i].iov_base, iov[i].iov_len );
+	}
+batching = false;
+
+for( size_t i = 0; i < parity_entries.size(); ++i )
+	{
+	out[parity_entries[i]].iov_base = &parity[parity_starts[i]];
+	}
+if( !out.empty() )
+	{
+	server.broadcast_batch( &out[0], out.size() );
+	}
+data_sent += packets;
+parity_sent += parity_entries.size();
+parity.clear();
+parity_starts.clear();
+}
+
+//puts a packet in the block, and closes the block when it is full or the
+//access unit ends
+void data_source_fec::add( const uint8_t * data, size_t bytes )
+{
+if( bytes < RTP_HEADER_SIZE || bytes > FEC_MAX_PACKET || ( data[0] >> 6 ) != RTP_VERSION )
+	{
+	unprotected++;
+	return;
+	}
+
+//a jump in sequence numbers is a new stream, or a gap; either way the block
+//before it is over
+uint16_t packet_sequence = ( data[2] << 8 ) | data[3];
+if( count > 0 && packet_sequence != (uint16_t)( base + count ) )
+	{
+	flush();
+	}
+if( count == 0 )
+	{
+	base = packet_sequence;
+	}
+
+uint8_t * symbol = &symbols[count * FEC_SYMBOL_STRIDE];
+symbol[0] = bytes >> 8;
+symbol[1] = bytes & 0xFF;
+memcpy( symbol + 2, data, bytes );
+memcpy( header, data, RTP_HEADER_SIZE );
+longest = bytes + 2 > longest ? bytes + 2 : longest;
+count++;
+
+if( count == data_packets || ( data[1] & 0x80 ) )
+	{
+	flush();
+	}
+}
+
+void data_source_fec::flush()
+{
+if( count == 0 )
+	{
+	return;
+	}
+double start = now();
+encode();
+encode_time += now() - start;
+count = 0;
+longest = 0;
+
+if( !batching )
+	{
+	out.clear();
+	for( size_t i = 0; i < parity_starts.size(); ++i )
+		{
+		struct iovec v;
+		v.iov_base = &parity[parity_starts[i]];
+		v.iov_len = ( i + 1 < parity_starts.size() ? parity_starts[i+1] : parity.size() ) - parity_starts[i] - PACKET_PADDING_SIZE;
+		out.push_back( v );
+		}
+	server.broadcast_batch( &out[0], out.size() );
+	parity_sent += out.size();
+	parity.clear();
+	parity_starts.clear();
+	}
+}
+
+//appends the block's parity packets to parity
+void data_source_fec::encode()
+{
+int rows = ( parity_packets * count + data_packets - 1 ) / data_packets;
+rows = rows < 1 ? 1 : rows;
+
+//the shorter symbols read as zeros out to the longest
+for( int i = 0; i < count; ++i )
+	{
+	uint8_t * symbol = &symbols[i * FEC_SYMBOL_STRIDE];
+	size_t length = ( ( symbol[0] << 8 ) | symbol[1] ) + 2;
+	memset( symbol + length, 0, longest - length );
+	}
+
+size_t packet_bytes = RTP_HEADER_SIZE + FEC_HEADER_SIZE + longest;
+for( int j = 0; j < rows; ++j )
+	{
+	size_t start = parity.size();
+	parity.resize( start + packet_bytes + PACKET_PADDING_SIZE, 0 );
+	uint8_t * p = &parity[start];
+
+	//timestamp and SSRC are the data's, the sequence number the parity's own
+	memcpy( p, header, RTP_HEADER_SIZE );
+	p[0] = RTP_VERSION << 6;
+	p[1] = FEC_PAYLOAD_TYPE;
+	p[2] = sequence >> 8;
+	p[3] = sequence & 0xFF;
+	sequence++;
+
+	uint8_t * f = p + RTP_HEADER_SIZE;
+	f[0] = base >> 8;
+	f[1] = base & 0xFF;
+	f[2] = count;
+	f[3] = rows;
+	f[4] = j;
+	f[5] = 0;
+	f[6] = longest >> 8;
+	f[7] = longest & 0xFF;
+
+	uint8_t * row = f + FEC_HEADER_SIZE;
+	for( int i = 0; i < count; ++i )
+		{
+		gf256_mul_add( row, &symbols[i * FEC_SYMBOL_STRIDE], fec_coefficient( j, i ), longest );
+		}
+
+	parity_starts.push_back( start );
+	if( batching )
+		{
+		struct iovec v;
+		v.iov_base = NULL;
+		v.iov_len = packet_bytes;
+		parity_entries.push_back( out.size() );
+		out.push_back( v );
+		}
+	}
+}
@@ -0,0 +1,85 @@
+#ifndef DATA_SOURCE_FEC_H
+#define DATA_SOURCE_FEC_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "data_source_rtp.h"
+#include "packet_server.h"
+
+//payload type of the parity packets, next to RTP_PAYLOAD_TYPE
+#define FEC_PAYLOAD_TYPE 97
+
+//limits on a block, which keep the parity matrix's rows and columns apart
+//in GF(256)
+#define FEC_MAX_DATA 64
+#define FEC_MAX_PARITY 16
+
+//the biggest packet protected; bigger ones go out without parity
+#define FEC_MAX_PACKET 2048
+
+//what follows the RTP header of a parity packet: the first data packet's
+//sequence number, how many data packets and parity packets the block has,
+//this one's row, a spare byte, and the length of the parity that follows
+#define FEC_HEADER_SIZE 8
+
+//Each data packet is protected as a symbol: its length in two bytes, then
+//the packet, RTP header included, zero padded to the block's longest. Row j
+//of the parity is the sum over the block of coefficient( j, i ) times
+//symbol i, with the coefficients a Cauchy matrix scaled so row 0 is all
+//ones. Row 0 alone is plain XOR parity, and any n of the block's data and
+//parity symbols give back the n data ones.
+uint8_t fec_coefficient( int row, int column );
+
+//Adds Reed-Solomon parity to a stream of RTP packets, as they come from a
+//data_source_rtp, on the way to a data_source_udp. Packets are gathered into
+//blocks of up to data_packets, and a block is also cut short at the end of
+//an access unit, its marker bit, so a frame never waits on the next one. A
+//full block gets parity_packets parity packets, a short one proportionally
+//fewer but at least one: 10 and 2 sends a 3 packet frame with 1. Data
+//packets pass straight through, and a block's parity follows its last one.
+//A batch goes out as one, parity included.
+class data_source_fec: public data_source
+	{
+	public:
+	data_source_fec( int data_packets = 10, int parity_packets = 2 );
+	void write( const uint8_t * data, size_t bytes );
+	void write_batch( const struct iovec * iov, int count );
+
+	//sends parity for the packets gathered so far
+	void flush();
+	packet_server server;
+
+	uint64_t data_sent;
+	uint64_t parity_sent;
+	uint64_t unprotected;   //too big, or not RTP
+	double encode_time;     //seconds spent computing parity
+
+	private:
+	void add( const uint8_t * data, size_t bytes );
+	void encode();
+
+	int data_packets;
+	int parity_packets;
+
+	//the block so far, a symbol per data packet FEC_MAX_PACKET + 2 apart
+	std::vector<uint8_t> symbols;
+	int count;
+	size_t longest;       //symbol bytes, length included
+	uint16_t base;        //first data packet's sequence number
+	uint8_t header[RTP_HEADER_SIZE];   //the last data packet's, for timestamp and SSRC
+	uint16_t sequence;    //the parity packets' own
+
+	//parity packets, each followed by padding, and a batch's packets; the
+	//parity entries of out hold offsets into parity until it stops growing
+	std::vector<uint8_t> parity;
+	std::vector<size_t> parity_starts;
+	std::vector<struct iovec> out;
+	std::vector<size_t> parity_entries;
+	bool batching;
+	};
+
+#endif
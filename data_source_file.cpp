@@ -1,4 +1,5 @@
 #include "data_source_file.h"
+#include "writev_all.h"
 
 #include <iostream>
 #include <fcntl.h>
@@ -7,7 +8,10 @@
 
 data_source_file::data_source_file( const char * fname )
 {
-fd = open( fname, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP );
+offset = 0;
+name = fname;
+index = NULL;
+fd = open( fname, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP );
 if( fd < 0 )
 	{
 	std::cout<<"Couldn't open "<<fname<<std::endl;
@@ -16,13 +20,52 @@ if( fd < 0 )
 
 data_source_file::~data_source_file()
 {
+delete index;
+
 if( fd != -1 )
 	{
 	close( fd );
 	}
 }
 
+//the offset only moves by what made it to the file, so the index never
+//points past the end of it
 void data_source_file::write( const uint8_t * data, size_t bytes )
 {
-::write( fd, data, bytes );
+struct iovec v = make_iovec( data, bytes );
+offset += writev_all( fd, &v, 1 );
+}
+
+void data_source_file::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( index == NULL )
+	{
+	index = new nal_index_writer( name );
+	}
+uint64_t at = offset;
+write( data, bytes );
+if( offset - at == bytes )
+	{
+	index->add( info, at, bytes );
+	}
+}
+
+void data_source_file::write_batch( const struct iovec * iov, int count )
+{
+offset += writev_all( fd, iov, count );
+}
+
+void data_source_file::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+if( index == NULL )
+	{
+	index = new nal_index_writer( name );
+	}
+uint64_t at = offset;
+write_batch( iov, count );
+for( int i = 0; i < count && at + iov[i].iov_len <= offset; ++i )
+	{
+	index->add( infos[i], at, iov[i].iov_len );
+	at += iov[i].iov_len;
+	}
 }
@@ -1,19 +1,28 @@
 #ifndef DATA_SOURCE_FILE_H
 #define DATA_SOURCE_FILE_H
 
+#include <string>
 #include <stddef.h>
 #include <stdint.h>
 #include "data_source.h"
+#include "nal_index.h"
 
-//writes output to a file
+//writes output to a file, and a <file>.idx index next to it once the
+//producer starts describing its NALs. Batches go out in one writev()
 class data_source_file: public data_source
 	{
 	public:
 	data_source_file(const char * fname);
 	~data_source_file();
 	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
 	private:
 	int fd;
+	uint64_t offset;
+	std::string name;
+	nal_index_writer * index;
 	};
 
 #endif
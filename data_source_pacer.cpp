@@ -0,0 +1,261 @@
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "config.h"
+#include "data_source_pacer.h"
+
+static uint64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+data_source_pacer::data_source_pacer( int spread_us, size_t datagram_size ) : spread_us( spread_us ), datagram_size( datagram_size )
+{
+queued_bytes = 0;
+paced_frames.store( 0 );
+paced_datagrams.store( 0 );
+delay_us.store( 0 );
+delay_max_us.store( 0 );
+stopping.store( false );
+timer = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC );
+wake = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+if( timer < 0 || wake < 0 )
+	{
+	printf( "PACER: no timerfd or eventfd, frames go at once\n" );
+	return;
+	}
+if( spread_us <= 0 )
+	{
+	return;
+	}
+worker = std::thread( &data_source_pacer::run, this );
+}
+
+data_source_pacer::~data_source_pacer()
+{
+if( worker.joinable() )
+	{
+	stopping.store( true );
+	uint64_t one = 1;
+	if( ::write( wake, &one, sizeof( one ) ) < 0 )
+		{
+		//it looks at stopping every 100ms anyway
+		}
+	worker.join();
+	}
+if( timer >= 0 )
+	{
+	close( timer );
+	}
+if( wake >= 0 )
+	{
+	close( wake );
+	}
+for( size_t i = 0; i < spares.size(); ++i )
+	{
+	delete spares[i];
+	}
+}
+
+void data_source_pacer::write( const uint8_t * data, size_t bytes )
+{
+struct iovec v;
+v.iov_base = (void *)data;
+v.iov_len = bytes;
+write_batch( &v, 1 );
+}
+
+//copies the frame, cut into datagrams as it will be sent. It goes at the
+//rate that gets everything waiting out within spread_us
+void data_source_pacer::write_batch( const struct iovec * iov, int count )
+{
+if( !worker.joinable() )
+	{
+	server.broadcast_batch( iov, count );
+	return;
+	}
+paced_frame * f = NULL;
+	{
+	std::lock_guard<std::mutex> hold( lock );
+	if( !spares.empty() )
+		{
+		f = spares.back();
+		spares.pop_back();
+		}
+	}
+if( f == NULL )
+	{
+	f = new paced_frame;
+	}
+f->bytes.clear();
+f->sizes.clear();
+f->payload = 0;
+size_t room = 0;
+for( int i = 0; i < count; ++i )
+	{
+	const uint8_t * p = (const uint8_t *)iov[i].iov_base;
+	size_t left = iov[i].iov_len;
+	while( left > 0 )
+		{
+		if( room == 0 )
+			{
+			if( !f->sizes.empty() )
+				{
+				f->bytes.insert( f->bytes.end(), PACKET_PADDING_SIZE, 0 );
+				}
+			f->sizes.push_back( 0 );
+			room = datagram_size > 0 ? datagram_size : left;
+			}
+		size_t n = left < room ? left : room;
+		f->bytes.insert( f->bytes.end(), p, p + n );
+		f->sizes.back() += n;
+		f->payload += n;
+		p += n;
+		left -= n;
+		room -= n;
+		}
+	if( datagram_size == 0 )
+		{
+		room = 0;
+		}
+	}
+if( f->sizes.empty() )
+	{
+	std::lock_guard<std::mutex> hold( lock );
+	spares.push_back( f );
+	return;
+	}
+f->bytes.insert( f->bytes.end(), PACKET_PADDING_SIZE, 0 );
+f->written_us = now_us();
+
+	{
+	std::lock_guard<std::mutex> hold( lock );
+	queued_bytes += f->payload;
+	f->rate = queued_bytes * 1e6 / spread_us;
+	queue.push_back( f );
+	}
+uint64_t one = 1;
+if( ::write( wake, &one, sizeof( one ) ) < 0 )
+	{
+	//already woken
+	}
+}
+
+void data_source_pacer::write_batch( const struct iovec * iov, int count, const nal_info * )
+{
+write_batch( iov, count );
+}
+
+//sends the frames queued, a few datagrams at a time as the bucket fills,
+//until told to stop and there are none left
+void data_source_pacer::run()
+{
+double tokens = PACER_BURST_BYTES;
+uint64_t last = now_us();
+std::vector<struct iovec> due;
+while( true )
+	{
+	paced_frame * f = NULL;
+		{
+		std::lock_guard<std::mutex> hold( lock );
+		if( !queue.empty() )
+			{
+			f = queue.front();
+			queue.pop_front();
+			}
+		}
+	if( f == NULL )
+		{
+		if( stopping.load() )
+			{
+			break;
+			}
+		struct pollfd descriptor;
+		descriptor.fd = wake;
+		descriptor.events = POLLIN;
+		uint64_t value;
+		if( poll( &descriptor, 1, 100 ) > 0 && ::read( wake, &value, sizeof( value ) ) < 0 )
+			{
+			//woken by someone else
+			}
+		continue;
+		}
+
+	double rate = f->rate;
+	size_t offset = 0;
+	size_t i = 0;
+	while( i < f->sizes.size() )
+		{
+		uint64_t now = now_us();
+		double most = PACER_BURST_BYTES > f->sizes[i] ? PACER_BURST_BYTES : f->sizes[i];
+		tokens += ( now - last ) * rate / 1e6;
+		tokens = tokens > most ? most : tokens;
+		last = now;
+
+		//as many as the bucket holds, or a wait until it holds the next
+		due.clear();
+		size_t o = offset;
+		while( i + due.size() < f->sizes.size() && f->sizes[i + due.size()] <= tokens )
+			{
+			struct iovec v;
+			v.iov_base = &f->bytes[o];
+			v.iov_len = f->sizes[i + due.size()];
+			tokens -= v.iov_len;
+			o += v.iov_len + PACKET_PADDING_SIZE;
+			due.push_back( v );
+			}
+		if( due.empty() )
+			{
+			uint64_t at = now + (uint64_t)( ( f->sizes[i] - tokens ) * 1e6 / rate ) + 1;
+			struct itimerspec when;
+			memset( &when, 0, sizeof( when ) );
+			when.it_value.tv_sec = at / 1000000;
+			when.it_value.tv_nsec = ( at % 1000000 ) * 1000;
+			uint64_t expirations;
+			if( timerfd_settime( timer, TFD_TIMER_ABSTIME, &when, NULL ) == 0 &&
+				::read( timer, &expirations, sizeof( expirations ) ) < 0 )
+				{
+				//interrupted, the bucket is looked at again anyway
+				}
+
+			//frames backing up behind this one hurry it along
+			std::lock_guard<std::mutex> hold( lock );
+			if( !queue.empty() && queue.back()->rate > rate )
+				{
+				rate = queue.back()->rate;
+				}
+			continue;
+			}
+		server.broadcast_batch( &due[0], due.size() );
+		paced_datagrams += due.size();
+		i += due.size();
+		offset = o;
+		}
+
+	uint64_t delay = now_us() - f->written_us;
+	paced_frames++;
+	delay_us += delay;
+	if( delay > delay_max_us.load() )
+		{
+		delay_max_us.store( delay );
+		}
+	std::lock_guard<std::mutex> hold( lock );
+	queued_bytes -= f->payload;
+	spares.push_back( f );
+	}
+}
+
+void data_source_pacer::report() const
+{
+uint64_t frames = paced_frames.load();
+printf( "PACER: %llu frames in %llu datagrams paced over %.2f ms, adding %.2f ms on average, %.2f ms at most\n",
+	(unsigned long long)frames, (unsigned long long)paced_datagrams.load(), spread_us / 1e3,
+	frames ? delay_us.load() / 1e3 / frames : 0.0, delay_max_us.load() / 1e3 );
+}
@@ -0,0 +1,77 @@
+#ifndef DATA_SOURCE_PACER_H
+#define DATA_SOURCE_PACER_H
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "packet_server.h"
+
+//bytes that may go at once after the pacer has been idle, or a datagram's
+//worth if that is more
+#define PACER_BURST_BYTES 3000
+
+//Spreads each frame over spread_us on its way to a data_source_udp, so a
+//Wifi access point isn't handed a frame as one burst to overflow its queue
+//with. A batch is a frame, each entry a datagram, or with a datagram_size
+//a byte stream cut into datagrams of that size. write_batch() copies it and
+//returns, and a thread of its own broadcasts the datagrams, each followed by
+//PACKET_PADDING_SIZE zero bytes, as a token bucket lets it: filling at the
+//frame's bytes over spread_us, faster when frames back up so that none
+//waits much more than that, and waiting on a timerfd in between.
+class data_source_pacer: public data_source
+	{
+	public:
+	data_source_pacer( int spread_us, size_t datagram_size = 0 );
+
+	//sends what is queued first
+	~data_source_pacer();
+	void write( const uint8_t * data, size_t bytes );
+	void write_batch( const struct iovec * iov, int count );
+
+	//the datagrams leave a few at a time, no longer making up the access
+	//units the descriptors would describe
+	void write_batch( const struct iovec * iov, int count, const nal_info * );
+	packet_server server;
+
+	//prints the counters below
+	void report() const;
+
+	std::atomic<uint64_t> paced_frames;
+	std::atomic<uint64_t> paced_datagrams;
+	std::atomic<uint64_t> delay_us;       //from written to last datagram sent, summed
+	std::atomic<uint64_t> delay_max_us;
+
+	private:
+	void run();
+
+	//a frame's datagrams end to end, each followed by padding, the bytes
+	//they add up to, the rate to send them at in bytes per second, and
+	//when it was written
+	struct paced_frame
+		{
+		std::vector<uint8_t> bytes;
+		std::vector<size_t> sizes;
+		size_t payload;
+		double rate;
+		uint64_t written_us;
+		};
+	int spread_us;
+	size_t datagram_size;
+	std::mutex lock;
+	std::deque<paced_frame *> queue;
+	std::vector<paced_frame *> spares;   //sent, for reuse
+	size_t queued_bytes;
+	int timer;
+	int wake;
+	std::thread worker;
+	std::atomic<bool> stopping;
+	};
+
+#endif
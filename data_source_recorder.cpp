@@ -0,0 +1,469 @@
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "data_source_recorder.h"
+
+static uint64_t now_ns()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000000ULL + temp.tv_nsec;
+}
+
+data_source_recorder::data_source_recorder( const char * fname, bool try_uring ) : full( RECORD_BUFFERS ), empty( RECORD_BUFFERS )
+{
+name = fname;
+offset = 0;
+current = NULL;
+allocated = 0;
+preallocated = 0;
+can_preallocate = true;
+index = NULL;
+nals = 0;
+dropped = 0;
+dropped_bytes = 0;
+write_time = 0;
+peak_write_time = 0;
+buffers_written.store( 0 );
+bytes_written.store( 0 );
+write_errors.store( 0 );
+latency_ns.store( 0 );
+peak_latency_ns.store( 0 );
+sleeping.store( false );
+stopping.store( false );
+
+fd = open( fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP );
+if( fd < 0 )
+	{
+	printf( "Couldn't open %s\n", fname );
+	uring = false;
+	return;
+	}
+uring = try_uring && ring.init( RECORD_BUFFERS );
+printf( "Recording to %s with %s\n", fname, method() );
+worker = std::thread( &data_source_recorder::run, this );
+}
+
+data_source_recorder::~data_source_recorder()
+{
+flush();
+if( worker.joinable() )
+	{
+		{
+		std::lock_guard<std::mutex> guard( lock );
+		stopping.store( true );
+		}
+	wake.notify_one();
+	worker.join();
+	}
+
+if( fd != -1 )
+	{
+	//let go of what was allocated past the end
+	if( ftruncate( fd, offset ) < 0 )
+		{
+		printf( "Couldn't trim %s\n", name.c_str() );
+		}
+	close( fd );
+	}
+delete index;
+for( size_t i = 0; i < buffers.size(); ++i )
+	{
+	free( buffers[i]->data );
+	delete buffers[i];
+	}
+}
+
+void data_source_recorder::write( const uint8_t * data, size_t bytes )
+{
+uint64_t start = now_ns();
+add( data, bytes, NULL );
+double t = ( now_ns() - start ) / 1e9;
+write_time += t;
+peak_write_time = t > peak_write_time ? t : peak_write_time;
+}
+
+void data_source_recorder::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+uint64_t start = now_ns();
+add( data, bytes, &info );
+double t = ( now_ns() - start ) / 1e9;
+write_time += t;
+peak_write_time = t > peak_write_time ? t : peak_write_time;
+}
+
+void data_source_recorder::add( const uint8_t * data, size_t bytes, const nal_info * info )
+{
+if( fd < 0 )
+	{
+	return;
+	}
+std::lock_guard<std::mutex> hold( current_lock );
+
+//a NAL goes in whole or not at all, so there must be buffers for it
+size_t room = current ? RECORD_BUFFER_SIZE - current->bytes : 0;
+if( bytes > room )
+	{
+	size_t more = ( bytes - room + RECORD_BUFFER_SIZE - 1 ) / RECORD_BUFFER_SIZE;
+	if( more > empty.size() + RECORD_BUFFERS - allocated )
+		{
+		dropped++;
+		dropped_bytes += bytes;
+		return;
+		}
+	}
+
+if( current == NULL )
+	{
+	current = take_buffer();
+	}
+if( info )
+	{
+	record_nal nal;
+	nal.info = *info;
+	nal.offset = offset;
+	nal.bytes = bytes;
+	current->nals.push_back( nal );
+	}
+nals++;
+
+while( true )
+	{
+	size_t n = RECORD_BUFFER_SIZE - current->bytes;
+	n = bytes < n ? bytes : n;
+	memcpy( current->data + current->bytes, data, n );
+	current->bytes += n;
+	offset += n;
+	data += n;
+	bytes -= n;
+	if( current->bytes == RECORD_BUFFER_SIZE )
+		{
+		hand_over();
+		}
+	if( bytes == 0 )
+		{
+		break;
+		}
+	if( current == NULL )
+		{
+		current = take_buffer();
+		}
+	}
+
+//a trickle of data still reaches the card
+if( current && now_ns() - current->started_ns > RECORD_FLUSH_MS * 1000000ULL )
+	{
+	hand_over();
+	}
+}
+
+void data_source_recorder::flush()
+{
+std::lock_guard<std::mutex> hold( current_lock );
+if( current && current->bytes > 0 )
+	{
+	hand_over();
+	}
+}
+
+//a buffer the writer is done with, or a new one; add() has made sure one
+//of them is there
+record_buffer * data_source_recorder::take_buffer()
+{
+record_buffer * buffer;
+size_t ticket;
+record_buffer ** p = empty.claim( &ticket );
+if( p )
+	{
+	buffer = *p;
+	empty.release( ticket );
+	}
+else
+	{
+	buffer = new record_buffer;
+	void * data = NULL;
+	if( posix_memalign( &data, 4096, RECORD_BUFFER_SIZE ) != 0 )
+		{
+		printf( "Couldn't allocate a recording buffer\n" );
+		abort();
+		}
+	buffer->data = (uint8_t *)data;
+	buffer->nals.reserve( 1024 );
+	buffers.push_back( buffer );
+	allocated++;
+	}
+buffer->bytes = 0;
+buffer->written = 0;
+buffer->offset = offset;
+buffer->started_ns = now_ns();
+buffer->nals.clear();
+return buffer;
+}
+
+void data_source_recorder::hand_over()
+{
+current->handed_ns = now_ns();
+
+//only ever as many buffers as there are slots, but one may be in the
+//middle of being taken out
+record_buffer ** p;
+while( ( p = full.reserve() ) == NULL )
+	{
+	std::this_thread::yield();
+	}
+*p = current;
+full.publish();
+current = NULL;
+
+//publish() is sequentially consistent, so either the writer sees the
+//buffer before it sleeps or we see it asleep here
+if( sleeping.load() )
+	{
+	std::lock_guard<std::mutex> guard( lock );
+	wake.notify_one();
+	}
+}
+
+//the buffer being gathered into, once it has gone RECORD_FLUSH_MS without
+//a write() to hand it over, so a recording that pauses still reaches the
+//card. Taken only while the producer isn't adding to it
+void data_source_recorder::take_stale( std::vector<record_buffer *> & waiting )
+{
+std::vector<record_buffer *> taken;
+	{
+	std::unique_lock<std::mutex> hold( current_lock, std::try_to_lock );
+	if( !hold.owns_lock() || current == NULL || current->bytes == 0 ||
+	    now_ns() - current->started_ns < RECORD_FLUSH_MS * 1000000ULL )
+		{
+		return;
+		}
+
+	//anything handed over before it goes first, for the index
+	size_t ticket;
+	record_buffer ** p;
+	while( ( p = full.claim( &ticket ) ) != NULL )
+		{
+		taken.push_back( *p );
+		full.release( ticket );
+		}
+	current->handed_ns = now_ns();
+	taken.push_back( current );
+	current = NULL;
+	}
+for( size_t i = 0; i < taken.size(); ++i )
+	{
+	prepare( taken[i] );
+	waiting.push_back( taken[i] );
+	}
+}
+
+//before a buffer is written: room for it on the card, and its NALs indexed
+void data_source_recorder::prepare( record_buffer * buffer )
+{
+while( can_preallocate && buffer->offset + buffer->bytes + RECORD_PREALLOCATE / 2 > preallocated )
+	{
+	if( fallocate( fd, FALLOC_FL_KEEP_SIZE, preallocated, RECORD_PREALLOCATE ) < 0 )
+		{
+		can_preallocate = false;
+		break;
+		}
+	preallocated += RECORD_PREALLOCATE;
+	}
+
+for( size_t i = 0; i < buffer->nals.size(); ++i )
+	{
+	if( index == NULL )
+		{
+		index = new nal_index_writer( name );
+		}
+	record_nal & nal = buffer->nals[i];
+	index->add( nal.info, nal.offset, nal.bytes );
+	}
+}
+
+//io_uring finished with a write, which may have been short
+void data_source_recorder::completed( record_buffer * buffer, int result, std::vector<record_buffer *> & waiting )
+{
+if( result > 0 )
+	{
+	bytes_written += result;
+	buffer->written += result;
+	}
+if( result > 0 && buffer->written < buffer->bytes )
+	{
+	waiting.insert( waiting.begin(), buffer );
+	}
+else
+	{
+	written( buffer, result == 0 ? -EIO : result );
+	}
+}
+
+//io_uring won't take writes any more: what it has is waited for, and what
+//it never took goes with pwrite() along with everything after
+void data_source_recorder::stop_uring( std::vector<record_buffer *> & waiting )
+{
+uint64_t user_data;
+int result;
+while( ring.complete( &user_data, &result, true ) )
+	{
+	completed( (record_buffer *)user_data, result, waiting );
+	}
+waiting.insert( waiting.begin(), submitting.begin(), submitting.end() );
+submitting.clear();
+uring.store( false );
+}
+
+//a buffer is on its way to the card, or failed to be; either way it can
+//be filled again
+void data_source_recorder::written( record_buffer * buffer, int result )
+{
+if( result < 0 && write_errors++ == 0 )
+	{
+	printf( "Couldn't write %s: %s\n", name.c_str(), strerror( -result ) );
+	}
+
+uint64_t l = now_ns() - buffer->handed_ns;
+latency_ns += l;
+if( l > peak_latency_ns.load( std::memory_order_relaxed ) )
+	{
+	peak_latency_ns.store( l, std::memory_order_relaxed );
+	}
+buffers_written++;
+
+record_buffer ** p;
+while( ( p = empty.reserve() ) == NULL )
+	{
+	std::this_thread::yield();
+	}
+*p = buffer;
+empty.publish();
+}
+
+void data_source_recorder::run()
+{
+std::vector<record_buffer *> waiting;
+while( true )
+	{
+	size_t ticket;
+	record_buffer ** p;
+	while( ( p = full.claim( &ticket ) ) != NULL )
+		{
+		record_buffer * buffer = *p;
+		full.release( ticket );
+		prepare( buffer );
+		waiting.push_back( buffer );
+		}
+
+	if( uring.load() )
+		{
+		size_t queued = 0;
+		while( queued < waiting.size() )
+			{
+			record_buffer * buffer = waiting[queued];
+			if( !ring.write( fd, buffer->data + buffer->written, buffer->bytes - buffer->written,
+			                 buffer->offset + buffer->written, (uintptr_t)buffer ) )
+				{
+				break;
+				}
+			submitting.push_back( buffer );
+			queued++;
+			}
+		waiting.erase( waiting.begin(), waiting.begin() + queued );
+		bool submitted = ring.submit();
+		int error = errno;
+		submitting.erase( submitting.begin(), submitting.end() - ring.unsubmitted() );
+		if( !submitted && error != EAGAIN && error != EBUSY )
+			{
+			printf( "Couldn't submit writes to %s, going on with pwrite(): %s\n", name.c_str(), strerror( error ) );
+			stop_uring( waiting );
+			continue;
+			}
+
+		//with nothing new handed over, or the kernel short of room, wait
+		//for the card, or a millisecond with nothing on its way to it
+		bool wait = full.empty() || !submitted;
+		if( !submitted && ring.in_flight() == 0 )
+			{
+			usleep( 1000 );
+			}
+		uint64_t user_data;
+		int result;
+		while( ring.complete( &user_data, &result, wait ) )
+			{
+			completed( (record_buffer *)user_data, result, waiting );
+			wait = false;
+			}
+		}
+	else
+		{
+		for( size_t i = 0; i < waiting.size(); ++i )
+			{
+			record_buffer * buffer = waiting[i];
+			int result = 0;
+			while( buffer->written < buffer->bytes )
+				{
+				ssize_t n = pwrite( fd, buffer->data + buffer->written, buffer->bytes - buffer->written,
+				                    buffer->offset + buffer->written );
+				if( n < 0 && errno == EINTR )
+					{
+					continue;
+					}
+				if( n <= 0 )
+					{
+					result = n < 0 ? -errno : -EIO;
+					break;
+					}
+				bytes_written += n;
+				buffer->written += n;
+				}
+			written( buffer, result );
+			}
+		waiting.clear();
+		}
+
+	if( !waiting.empty() || ring.in_flight() > 0 || !submitting.empty() || !full.empty() )
+		{
+		continue;
+		}
+	if( stopping.load() )
+		{
+		if( full.empty() )
+			{
+			return;
+			}
+		continue;
+		}
+	std::unique_lock<std::mutex> guard( lock );
+	sleeping.store( true );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	bool stale = false;
+	while( full.empty() && !stopping.load() && !stale )
+		{
+		stale = wake.wait_for( guard, std::chrono::milliseconds( RECORD_FLUSH_MS ) ) == std::cv_status::timeout;
+		}
+	sleeping.store( false );
+	guard.unlock();
+	if( stale )
+		{
+		take_stale( waiting );
+		}
+	}
+}
+
+void data_source_recorder::report()
+{
+uint64_t n = buffers_written.load();
+printf( "Recording %s with %s: %llu NALs, %llu dropped (%llu bytes), %.3f ms in write() all told, %.3f ms at most\n",
+	name.c_str(), method(), (unsigned long long)nals, (unsigned long long)dropped, (unsigned long long)dropped_bytes,
+	write_time * 1e3, peak_write_time * 1e3 );
+printf( "  %llu bytes in %llu buffers written, %.2f ms on average and %.2f ms at most from handing over, %llu errors\n",
+	(unsigned long long)bytes_written.load(), (unsigned long long)n,
+	n ? latency_ns.load() / 1e6 / n : 0.0, peak_latency_ns.load() / 1e6, (unsigned long long)write_errors.load() );
+}
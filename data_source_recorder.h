@@ -0,0 +1,133 @@
+#ifndef DATA_SOURCE_RECORDER_H
+#define DATA_SOURCE_RECORDER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "io_ring.h"
+#include "nal_index.h"
+#include "nal_info.h"
+#include "spsc_ring.h"
+
+//NALs are gathered into buffers this big, page aligned, before writing
+#define RECORD_BUFFER_SIZE ( 1 << 20 )
+
+//buffers there may be at most, gathering or being written; past that
+//NALs are dropped rather than the producer kept waiting
+#define RECORD_BUFFERS 16
+
+//the file is allocated this far ahead of what has been written
+#define RECORD_PREALLOCATE ( 64 << 20 )
+
+//a buffer not yet full is written anyway once it is this old, handed over
+//by the next write() or, if none comes, taken by the writer
+#define RECORD_FLUSH_MS 250
+
+//a NAL gathered, for the index
+struct record_nal
+	{
+	nal_info info;
+	uint64_t offset;
+	size_t bytes;
+	};
+
+struct record_buffer
+	{
+	uint8_t * data;
+	size_t bytes;
+	size_t written;
+	uint64_t offset;            //in the file
+	uint64_t started_ns;        //first NAL in
+	uint64_t handed_ns;         //handed to the writer
+	std::vector<record_nal> nals;
+	};
+
+//Records to a file, and an index next to it as data_source_file does,
+//without ever holding up the producer. write() only copies into a large
+//page aligned buffer; full ones go to a thread of its own that writes
+//them with io_uring, several at a time, or with pwrite() where io_uring
+//can't be had, and keeps the file allocated well ahead of them with
+//fallocate(), which is slow on some cards. If io_uring stops taking
+//writes the rest go with pwrite(). The index is written from
+//that thread too. If the card falls so far behind that RECORD_BUFFERS
+//are all waiting, whole NALs are dropped and counted, and the recording
+//and its index carry on without them.
+class data_source_recorder: public data_source
+	{
+	public:
+	//try_uring false goes straight to pwrite()
+	data_source_recorder( const char * fname, bool try_uring = true );
+	~data_source_recorder();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+
+	//hands over what has been gathered, without waiting for it to be written
+	void flush();
+
+	//"io_uring" or "pwrite"
+	const char * method() const { return uring.load() ? "io_uring" : "pwrite"; }
+
+	//prints what writing has cost the producer, and how long the card took
+	void report();
+
+	//producer side
+	uint64_t nals;
+	uint64_t dropped;
+	uint64_t dropped_bytes;
+	double write_time;          //spent in write(), all told
+	double peak_write_time;
+
+	//writer side
+	std::atomic<uint64_t> buffers_written;
+	std::atomic<uint64_t> bytes_written;
+	std::atomic<uint64_t> write_errors;
+	std::atomic<uint64_t> latency_ns;       //handing over to written, all told
+	std::atomic<uint64_t> peak_latency_ns;
+
+	private:
+	void add( const uint8_t * data, size_t bytes, const nal_info * info );
+	record_buffer * take_buffer();
+	void hand_over();
+	void run();
+	void take_stale( std::vector<record_buffer *> & waiting );
+	void prepare( record_buffer * buffer );
+	void completed( record_buffer * buffer, int result, std::vector<record_buffer *> & waiting );
+	void stop_uring( std::vector<record_buffer *> & waiting );
+	void written( record_buffer * buffer, int result );
+
+	int fd;
+	std::string name;
+	uint64_t offset;
+
+	//producer side, but for the writer taking current once it is stale
+	std::mutex current_lock;
+	record_buffer * current;
+	size_t allocated;
+	std::vector<record_buffer *> buffers;   //all of them, to free
+
+	spsc_ring<record_buffer *> full;        //producer to writer
+	spsc_ring<record_buffer *> empty;       //writer to producer
+
+	//writer side
+	std::atomic<bool> uring;
+	io_ring ring;
+	std::vector<record_buffer *> submitting;   //queued on the ring, not yet taken by the kernel
+	uint64_t preallocated;
+	bool can_preallocate;
+	nal_index_writer * index;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	std::atomic<bool> sleeping;
+	std::atomic<bool> stopping;
+	std::thread worker;
+	};
+
+#endif
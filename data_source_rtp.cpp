@@ -0,0 +1,194 @@
+#include <random>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "data_source_rtp.h"
+
+static uint64_t wall_clock_us()
+{
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+//RFC 3550 wants the sequence number and timestamp to start at random values
+static uint32_t random32()
+{
+static std::random_device device;
+return device();
+}
+
+data_source_rtp::data_source_rtp( size_t packet_size, uint32_t ssrc ) : packet_size( packet_size ), ssrc( ssrc )
+{
+//a FU-A needs room for its two header bytes and at least one more
+if( this->packet_size < RTP_HEADER_SIZE + 3 )
+	{
+	this->packet_size = RTP_HEADER_SIZE + 3;
+	}
+if( this->ssrc == 0 )
+	{
+	this->ssrc = random32();
+	}
+sequence = random32();
+timestamp_offset = random32();
+au_timestamp_us = 0;
+packets = 0;
+fragmented_nals = 0;
+access_units = 0;
+}
+
+data_source_rtp::~data_source_rtp()
+{
+flush();
+}
+
+//for producers that don't describe their packets
+void data_source_rtp::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+parser.parse( data, bytes, info );
+write( data, bytes, info );
+}
+
+void data_source_rtp::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( info.access_unit_start )
+	{
+	flush();
+	}
+if( au_timestamp_us == 0 )
+	{
+	au_timestamp_us = info.timestamp_us ? info.timestamp_us : wall_clock_us();
+	}
+if( info.nal_unit_type != NAL_FILLER )
+	{
+	packetize( data, bytes );
+	}
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void data_source_rtp::write_batch( const struct iovec * iov, int count )
+{
+flush();
+au_timestamp_us = wall_clock_us();
+for( int i = 0; i < count; ++i )
+	{
+	const uint8_t * data = (const uint8_t *)iov[i].iov_base;
+	nal_info info;
+	parser.parse( data, iov[i].iov_len, info );
+	if( info.nal_unit_type != NAL_FILLER )
+		{
+		packetize( data, iov[i].iov_len );
+		}
+	}
+flush();
+}
+
+void data_source_rtp::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+for( int i = 0; i < count; ++i )
+	{
+	write( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, infos[i] );
+	}
+}
+
+//room for a packet's header and payload at the end of the buffer, the
+//header to be filled in by flush
+uint8_t * data_source_rtp::add_packet( size_t payload_bytes )
+{
+size_t start = buffer.size();
+packet_starts.push_back( start );
+buffer.resize( start + RTP_HEADER_SIZE + payload_bytes + PACKET_PADDING_SIZE );
+return &buffer[start + RTP_HEADER_SIZE];
+}
+
+void data_source_rtp::packetize( const uint8_t * data, size_t bytes )
+{
+//the start code, of either length, doesn't go over RTP
+const uint8_t * end = data + bytes;
+while( data < end && *data == 0 )
+	{
+	data++;
+	}
+if( data < end && *data == 1 )
+	{
+	data++;
+	}
+if( data >= end )
+	{
+	return;
+	}
+bytes = end - data;
+
+size_t max_payload = packet_size - RTP_HEADER_SIZE;
+if( bytes <= max_payload )
+	{
+	memcpy( add_packet( bytes ), data, bytes );
+	return;
+	}
+
+//FU-A: the NAL header's F and NRI bits go in the indicator, its type in
+//the FU header, and the header byte itself isn't sent
+uint8_t indicator = ( data[0] & 0xE0 ) | RTP_FU_A;
+uint8_t type = data[0] & 0x1F;
+const uint8_t * p = data + 1;
+size_t fragment = max_payload - 2;
+bool first = true;
+while( p < end )
+	{
+	size_t n = (size_t)( end - p ) < fragment ? end - p : fragment;
+	uint8_t * payload = add_packet( n + 2 );
+	payload[0] = indicator;
+	payload[1] = type | ( first ? 0x80 : 0 ) | ( p + n == end ? 0x40 : 0 );
+	memcpy( payload + 2, p, n );
+	p += n;
+	first = false;
+	}
+fragmented_nals++;
+}
+
+void data_source_rtp::flush()
+{
+if( packet_starts.empty() )
+	{
+	au_timestamp_us = 0;
+	return;
+	}
+
+uint32_t timestamp = timestamp_offset + (uint32_t)( au_timestamp_us * ( RTP_CLOCK_RATE / 1000 ) / 1000 );
+size_t count = packet_starts.size();
+iov.resize( count );
+for( size_t i = 0; i < count; ++i )
+	{
+	size_t start = packet_starts[i];
+	size_t end = i + 1 < count ? packet_starts[i+1] : buffer.size();
+	uint8_t * header = &buffer[start];
+	header[0] = RTP_VERSION << 6;
+	header[1] = RTP_PAYLOAD_TYPE | ( i + 1 == count ? 0x80 : 0 );
+	header[2] = sequence >> 8;
+	header[3] = sequence & 0xFF;
+	header[4] = timestamp >> 24;
+	header[5] = ( timestamp >> 16 ) & 0xFF;
+	header[6] = ( timestamp >> 8 ) & 0xFF;
+	header[7] = timestamp & 0xFF;
+	header[8] = ssrc >> 24;
+	header[9] = ( ssrc >> 16 ) & 0xFF;
+	header[10] = ( ssrc >> 8 ) & 0xFF;
+	header[11] = ssrc & 0xFF;
+	sequence++;
+	iov[i].iov_base = header;
+	iov[i].iov_len = end - start - PACKET_PADDING_SIZE;
+	}
+
+server.broadcast_batch( &iov[0], count );
+packets += count;
+access_units++;
+buffer.clear();
+packet_starts.clear();
+au_timestamp_us = 0;
+}
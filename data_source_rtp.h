@@ -0,0 +1,99 @@
+#ifndef DATA_SOURCE_RTP_H
+#define DATA_SOURCE_RTP_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "packet_server.h"
+
+//largest RTP packet sent by default, header included, leaving room for
+//IP and UDP headers and a tunnel or two inside a 1500 byte MTU
+#define RTP_DEFAULT_PACKET_SIZE 1400
+
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+#define RTP_CLOCK_RATE 90000
+
+//dynamic payload type, a=rtpmap:96 H264/90000 in the SDP
+#define RTP_PAYLOAD_TYPE 96
+
+//RFC 6184 packet types beyond the NAL unit types, in the same 5 bits
+#define RTP_STAP_A 24
+#define RTP_FU_A 28
+
+//RTCP transport layer feedback, and its generic NACK format (RFC 4585)
+#define RTCP_RTPFB 205
+#define RTCP_NACK 1
+
+//RTCP receiver reports (RFC 3550), and the application-defined packet
+//viewers send along with them with what the rate_controller also needs
+#define RTCP_RR 201
+#define RTCP_APP 204
+#define RTCP_APP_RATE "RATE"
+
+//what a viewer reports back: RFC 3550's loss and jitter, and from its own
+//APP packet how the one-way delay stands, measured from the RTP timestamps
+//of the last packets of frames, and the rate the stream arrived at
+struct receiver_report
+	{
+	uint64_t received_us;   //when the sender got it, on CLOCK_MONOTONIC
+	double fraction_lost;   //since the viewer's last report
+	uint32_t cumulative_lost;
+	uint32_t jitter_us;     //interarrival jitter
+	int32_t queuing_us;     //one-way delay above the least lately seen
+	int32_t delay_trend_us; //how fast it is changing, per second
+	uint32_t received_kbps;
+	};
+
+//Packetizes NALs into RTP packets per RFC 6184, in non-interleaved mode.
+//A NAL that fits goes in a packet of its own without its start code, and
+//a bigger one is cut into FU-A fragments. The packets of an access unit
+//share its timestamp, on the 90kHz clock, and the last one has the marker
+//bit set. They are held until the access unit is known to be complete,
+//from the descriptors as the access_unit_assembler does, and broadcast
+//together with broadcast_batch, each followed by PACKET_PADDING_SIZE zero
+//bytes, so a data_source_udp sends a frame with one sendmmsg(). Filler
+//NALs are left out, as they only mark the end of the access unit.
+class data_source_rtp: public data_source
+	{
+	public:
+	//an ssrc of 0 picks a random one
+	data_source_rtp( size_t packet_size = RTP_DEFAULT_PACKET_SIZE, uint32_t ssrc = 0 );
+	~data_source_rtp();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+
+	//a batch without descriptors is taken to be one access unit
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
+
+	//sends the access unit gathered so far, marker bit and all
+	void flush();
+	packet_server server;
+
+	uint64_t packets;
+	uint64_t fragmented_nals;
+	uint64_t access_units;
+
+	private:
+	void packetize( const uint8_t * data, size_t bytes );
+	uint8_t * add_packet( size_t payload_bytes );
+
+	nal_parser parser;
+	size_t packet_size;
+	uint32_t ssrc;
+	uint16_t sequence;
+	uint32_t timestamp_offset;
+	uint64_t au_timestamp_us;   //first NAL's, 0 until the access unit has one
+
+	//the access unit's packets end to end, each followed by padding
+	std::vector<uint8_t> buffer;
+	std::vector<size_t> packet_starts;
+	std::vector<struct iovec> iov;
+	};
+
+#endif
@@ -0,0 +1,292 @@
+#define __STDC_CONSTANT_MACROS
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/dict.h>
+#include <libavutil/mem.h>
+}
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+
+#include "data_source_segment_muxer.h"
+#include "start_code.h"
+
+static int64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (int64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+//the clock the producers stamp access units with
+static int64_t wall_clock_us()
+{
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+return (int64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+data_source_segment_muxer::data_source_segment_muxer( const char * name, double segment_seconds, uint64_t budget_bytes )
+{
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT( 58, 9, 100 )
+av_register_all();
+#endif
+
+std::string path = name;
+size_t dot = path.rfind( '.' );
+prefix = dot == std::string::npos ? path : path.substr( 0, dot );
+extension = dot == std::string::npos ? ".ts" : path.substr( dot );
+format = extension == ".mp4" ? "mp4" : "mpegts";
+segment_us = segment_seconds * 1e6;
+budget = budget_bytes;
+
+context = NULL;
+stream = NULL;
+packet = av_packet_alloc();
+parser = av_parser_init( AV_CODEC_ID_H264 );
+if( parser )
+	{
+	parser->flags |= PARSER_FLAG_COMPLETE_FRAMES;
+	}
+parser_context = avcodec_alloc_context3( NULL );
+
+first_us = -1;
+segment_start_us = 0;
+last_pts_us = -1;
+access_units = 0;
+skipped = 0;
+segments = 0;
+pruned = 0;
+errors = 0;
+mux_time = 0;
+}
+
+data_source_segment_muxer::~data_source_segment_muxer()
+{
+close_segment();
+av_packet_free( &packet );
+if( parser )
+	{
+	av_parser_close( parser );
+	}
+avcodec_free_context( &parser_context );
+}
+
+//for producers that don't describe their access units
+void data_source_segment_muxer::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+nals.parse( data, bytes, info );
+mux( data, bytes, info );
+}
+
+void data_source_segment_muxer::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+mux( data, bytes, info );
+}
+
+void data_source_segment_muxer::mux( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+int64_t start = now_us();
+
+//an access unit with parameter sets leads off a GOP, even when the
+//descriptor is only of its first NAL
+bool key = info.recovery_point || info.parameter_set;
+int64_t t = info.timestamp_us ? (int64_t)info.timestamp_us : wall_clock_us();
+if( first_us < 0 )
+	{
+	if( !key )
+		{
+		skipped++;
+		return;
+		}
+	first_us = t;
+	}
+
+//MP4 wants every timestamp after the last
+int64_t pts = t - first_us;
+if( pts <= last_pts_us )
+	{
+	pts = last_pts_us + 1;
+	}
+
+if( key && ( context == NULL || pts - segment_start_us >= segment_us ) )
+	{
+	close_segment();
+	open_segment( data, bytes, pts );
+	}
+if( context == NULL )
+	{
+	skipped++;
+	return;
+	}
+
+AVRational microseconds = { 1, 1000000 };
+packet->data = (uint8_t *)data;
+packet->size = bytes;
+packet->stream_index = stream->index;
+packet->pts = packet->dts = av_rescale_q( pts, microseconds, stream->time_base );
+packet->flags = key ? AV_PKT_FLAG_KEY : 0;
+if( av_write_frame( context, packet ) < 0 )
+	{
+	errors++;
+	}
+av_packet_unref( packet );
+last_pts_us = pts;
+access_units++;
+mux_time += ( now_us() - start ) / 1e6;
+}
+
+void data_source_segment_muxer::open_segment( const uint8_t * data, size_t bytes, int64_t pts_us )
+{
+char number[32];
+snprintf( number, sizeof( number ), "_%05llu", (unsigned long long)segments );
+std::string fname = prefix + number + extension;
+
+//the picture size, from the SPS in the access unit
+uint8_t * out;
+int out_size;
+int width = WIDTH;
+int height = HEIGHT;
+if( parser )
+	{
+	av_parser_parse2( parser, parser_context, &out, &out_size, data, bytes, AV_NOPTS_VALUE, AV_NOPTS_VALUE, 0 );
+	if( parser->width > 0 && parser->height > 0 )
+		{
+		width = parser->width;
+		height = parser->height;
+		}
+	}
+
+//and its parameter sets, which MP4 keeps in the header; an access unit
+//without them, at an intra refresh recovery point, leaves the last ones
+std::vector<uint8_t> sets;
+const uint8_t * end = data + bytes;
+const uint8_t * nal = find_start_code( data, end );
+while( nal != end )
+	{
+	const uint8_t * payload = nal + 3;
+	const uint8_t * next = find_start_code( payload, end );
+	const uint8_t * nal_end = next;
+	while( nal_end > payload && nal_end[-1] == 0 )
+		{
+		nal_end--;
+		}
+	int type = payload < end ? payload[0] & 0x1F : 0;
+	if( type == NAL_SPS || type == NAL_PPS )
+		{
+		static const uint8_t start_code[] = { 0, 0, 0, 1 };
+		sets.insert( sets.end(), start_code, start_code + 4 );
+		sets.insert( sets.end(), payload, nal_end );
+		}
+	nal = next;
+	}
+if( !sets.empty() )
+	{
+	extradata.swap( sets );
+	}
+
+if( avformat_alloc_output_context2( &context, NULL, format, fname.c_str() ) < 0 || context == NULL )
+	{
+	printf( "Couldn't set up %s\n", fname.c_str() );
+	context = NULL;
+	errors++;
+	return;
+	}
+stream = avformat_new_stream( context, NULL );
+AVRational ninety_khz = { 1, 90000 };
+stream->time_base = ninety_khz;
+AVCodecParameters * par = stream->codecpar;
+par->codec_type = AVMEDIA_TYPE_VIDEO;
+par->codec_id = AV_CODEC_ID_H264;
+par->width = width;
+par->height = height;
+if( !extradata.empty() )
+	{
+	par->extradata = (uint8_t *)av_mallocz( extradata.size() + AV_INPUT_BUFFER_PADDING_SIZE );
+	memcpy( par->extradata, &extradata[0], extradata.size() );
+	par->extradata_size = extradata.size();
+	}
+
+AVDictionary * options = NULL;
+if( strcmp( format, "mp4" ) == 0 )
+	{
+	//a fragment per GOP, so what was written survives the recording
+	//being cut off
+	av_dict_set( &options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0 );
+	}
+int result = avio_open( &context->pb, fname.c_str(), AVIO_FLAG_WRITE );
+if( result >= 0 )
+	{
+	result = avformat_write_header( context, &options );
+	}
+av_dict_free( &options );
+if( result < 0 )
+	{
+	printf( "Couldn't start %s\n", fname.c_str() );
+	avio_closep( &context->pb );
+	avformat_free_context( context );
+	context = NULL;
+	stream = NULL;
+	errors++;
+	return;
+	}
+
+segment_start_us = pts_us;
+segments++;
+files.push_back( fname );
+prune();
+}
+
+void data_source_segment_muxer::close_segment()
+{
+if( context == NULL )
+	{
+	return;
+	}
+av_write_trailer( context );
+avio_closep( &context->pb );
+avformat_free_context( context );
+context = NULL;
+stream = NULL;
+}
+
+//deletes the oldest segments, but never the one being written, until the
+//rest fit the budget
+void data_source_segment_muxer::prune()
+{
+if( budget == 0 )
+	{
+	return;
+	}
+std::vector<uint64_t> sizes;
+uint64_t total = 0;
+for( size_t i = 0; i < files.size(); ++i )
+	{
+	struct stat st;
+	sizes.push_back( stat( files[i].c_str(), &st ) == 0 ? st.st_size : 0 );
+	total += sizes.back();
+	}
+size_t i = 0;
+while( total > budget && files.size() > 1 )
+	{
+	unlink( files.front().c_str() );
+	total -= sizes[i++];
+	files.pop_front();
+	pruned++;
+	}
+}
+
+void data_source_segment_muxer::report()
+{
+printf( "Segments: %llu access units in %llu %s segments, %llu skipped, %llu pruned, %llu errors, %.3f ms muxing per access unit\n",
+	(unsigned long long)access_units, (unsigned long long)segments, format, (unsigned long long)skipped,
+	(unsigned long long)pruned, (unsigned long long)errors, access_units ? mux_time * 1e3 / access_units : 0.0 );
+}
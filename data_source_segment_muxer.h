@@ -0,0 +1,84 @@
+#ifndef DATA_SOURCE_SEGMENT_MUXER_H
+#define DATA_SOURCE_SEGMENT_MUXER_H
+
+#ifndef UINT64_C
+    #define UINT64_C(c) c ## ULL
+#endif
+
+extern "C"
+{
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+
+//how long a segment runs unless asked otherwise
+#define SEGMENT_DEFAULT_SECONDS 60
+
+//Muxes whole access units, as an access_unit_assembler gives them, into a
+//series of MPEG-TS or fragmented MP4 files with libavformat. A segment
+//starts at a recovery point once the last one has run its length, so each
+//can be played on its own. PTS are the access units' timestamp_us, from 0
+//at the start of the recording: the capture time where the producer knows
+//it, but from an x264_destreamer only when each NAL came off the pipe, and
+//for access units with none, when they reach the muxer, by the same
+//CLOCK_REALTIME. Once the segments add up to more than the budget the oldest
+//are deleted. Muxing and writing take their time, so register this as an
+//async callback, which then drops to the next recovery point rather than
+//hold up the stream.
+class data_source_segment_muxer: public data_source
+	{
+	public:
+	//name ends .ts or .mp4, and segments are numbered in between, so
+	//rec.ts records rec_00000.ts, rec_00001.ts and on. A budget_bytes of 0
+	//keeps every segment
+	data_source_segment_muxer( const char * name, double segment_seconds = SEGMENT_DEFAULT_SECONDS, uint64_t budget_bytes = 0 );
+	~data_source_segment_muxer();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	void report();
+
+	uint64_t access_units;
+	uint64_t skipped;       //with no segment open, waiting for a recovery point
+	uint64_t segments;
+	uint64_t pruned;
+	uint64_t errors;
+	double mux_time;
+
+	private:
+	void mux( const uint8_t * data, size_t bytes, const nal_info & info );
+	void open_segment( const uint8_t * data, size_t bytes, int64_t pts_us );
+	void close_segment();
+	void prune();
+
+	std::string prefix;
+	std::string extension;
+	const char * format;
+	int64_t segment_us;
+	uint64_t budget;
+
+	AVFormatContext * context;
+	AVStream * stream;
+	AVPacket * packet;
+
+	//finds the picture size in the SPS, which MP4 needs up front
+	AVCodecParserContext * parser;
+	AVCodecContext * parser_context;
+	std::vector<uint8_t> extradata;   //the latest SPS and PPS, start codes and all
+
+	int64_t first_us;                 //timestamp that is PTS 0, -1 until then
+	int64_t segment_start_us;
+	int64_t last_pts_us;
+	std::deque<std::string> files;    //oldest first, the open one last
+	nal_parser nals;
+	};
+
+#endif
@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "data_source_seqpacket.h"
+
+static const uint8_t zeros[PACKET_PADDING_SIZE] = { 0 };
+
+data_source_seqpacket::data_source_seqpacket( const char * path, bool per_access_unit ) : per_access_unit( per_access_unit )
+{
+nals = 0;
+messages = 0;
+dropped = 0;
+too_big = 0;
+changed.store( false );
+client_count.store( 0 );
+stopping.store( false );
+snprintf( this->path, sizeof( this->path ), "%s", path );
+
+struct sockaddr_un addr;
+memset( &addr, 0, sizeof( addr ) );
+addr.sun_family = AF_UNIX;
+snprintf( addr.sun_path, sizeof( addr.sun_path ), "%s", path );
+
+//a socket left by a server that died is in the way
+unlink( path );
+sockfd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+if( sockfd < 0 || bind( sockfd, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 || listen( sockfd, 16 ) < 0 )
+	{
+	printf( "SEQPACKET: couldn't listen on %s: %s\n", path, strerror( errno ) );
+	if( sockfd >= 0 )
+		{
+		close( sockfd );
+		}
+	sockfd = -1;
+	max_message = 0;
+	return;
+	}
+
+//a message has to fit the sending socket's buffer, which the kernel may
+//not let be as big as asked
+int size = SEQPACKET_MAX_MESSAGE;
+socklen_t length = sizeof( size );
+setsockopt( sockfd, SOL_SOCKET, SO_SNDBUF, &size, sizeof( size ) );
+getsockopt( sockfd, SOL_SOCKET, SO_SNDBUF, &size, &length );
+max_message = (size_t)size - 32 < SEQPACKET_MAX_MESSAGE ? (size_t)size - 32 : SEQPACKET_MAX_MESSAGE;
+printf( "SEQPACKET: serving %s, a message per %s, up to %i KB\n", path, per_access_unit ? "access unit" : "NAL", (int)( max_message >> 10 ) );
+
+acceptor = std::thread( &data_source_seqpacket::accept_loop, this );
+}
+
+data_source_seqpacket::~data_source_seqpacket()
+{
+flush();
+if( acceptor.joinable() )
+	{
+	stopping.store( true );
+	acceptor.join();
+	}
+if( sockfd >= 0 )
+	{
+	close( sockfd );
+	unlink( path );
+	}
+update_clients();
+while( !clients_list.empty() )
+	{
+	close_client( 0 );
+	}
+}
+
+void data_source_seqpacket::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+parser.parse( data, bytes, info );
+write( data, bytes, info );
+}
+
+void data_source_seqpacket::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( !per_access_unit )
+	{
+	struct iovec v;
+	v.iov_base = (void *)data;
+	v.iov_len = bytes;
+	send( &v, &info, 1 );
+	return;
+	}
+
+//gathered until the access unit is known to be complete
+if( info.access_unit_start )
+	{
+	flush();
+	}
+frame.insert( frame.end(), data, data + bytes );
+nal_sizes.push_back( bytes );
+frame_infos.push_back( info );
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void data_source_seqpacket::flush()
+{
+if( nal_sizes.empty() )
+	{
+	return;
+	}
+frame_iov.clear();
+size_t offset = 0;
+for( size_t i = 0; i < nal_sizes.size(); ++i )
+	{
+	struct iovec v;
+	v.iov_base = &frame[offset];
+	v.iov_len = nal_sizes[i];
+	frame_iov.push_back( v );
+	offset += nal_sizes[i];
+	}
+send( &frame_iov[0], &frame_infos[0], frame_iov.size() );
+frame.clear();
+nal_sizes.clear();
+frame_infos.clear();
+}
+
+void data_source_seqpacket::write_batch( const struct iovec * iov, int count )
+{
+batch_infos.resize( count );
+for( int i = 0; i < count; ++i )
+	{
+	batch_infos[i] = nal_info();
+	parser.parse( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, batch_infos[i] );
+	batch_infos[i].access_unit_end = i == count - 1;
+	}
+write_batch( iov, count, &batch_infos[0] );
+}
+
+//straight from the caller's buffers
+void data_source_seqpacket::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+flush();
+if( count > 0 )
+	{
+	send( iov, infos, count );
+	}
+}
+
+//cuts the NALs into messages, a NAL each or as many as fit, and sends
+//them to every subscriber
+void data_source_seqpacket::send( const struct iovec * iov, const nal_info * infos, int count )
+{
+update_clients();
+nals += count;
+
+//the NALs that fit a message, and which messages they start, each of
+//those a recovery point or not. One that fits none is dropped, and so
+//is everything after it until a recovery point
+kept.clear();
+firsts.clear();
+message_resumes.clear();
+size_t message_bytes = 0;
+for( int i = 0; i < count; ++i )
+	{
+	bool resume = recovery.resumes( infos[i] );
+
+	size_t bytes = sizeof( seqpacket_nal ) + iov[i].iov_len + PACKET_PADDING_SIZE;
+	if( sizeof( seqpacket_header ) + bytes > max_message )
+		{
+		too_big++;
+		for( size_t c = 0; c < clients_list.size(); ++c )
+			{
+			clients_list[c]->synced = false;
+			}
+		continue;
+		}
+	size_t in_message = kept.size() - ( firsts.empty() ? 0 : firsts.back() );
+	if( !per_access_unit || firsts.empty() || in_message == SEQPACKET_MAX_NALS || message_bytes + bytes > max_message )
+		{
+		firsts.push_back( kept.size() );
+		message_resumes.push_back( resume );
+		message_bytes = sizeof( seqpacket_header );
+		}
+	kept.push_back( i );
+	message_bytes += bytes;
+	}
+size_t n = firsts.size();
+firsts.push_back( kept.size() );
+
+//each message: its header, its NALs' table, then the NALs with their
+//padding. Everything is in place before any pointer into it is taken
+headers.resize( n );
+tables.resize( kept.size() );
+pieces.clear();
+piece_starts.clear();
+for( size_t m = 0; m < n; ++m )
+	{
+	headers[m].magic = SEQPACKET_MAGIC;
+	headers[m].count = firsts[m + 1] - firsts[m];
+	piece_starts.push_back( pieces.size() );
+	pieces.push_back( iovec() );
+	pieces.push_back( iovec() );
+	for( size_t k = firsts[m]; k < firsts[m + 1]; ++k )
+		{
+		tables[k].info = infos[kept[k]];
+		tables[k].bytes = iov[kept[k]].iov_len;
+		pieces.push_back( iov[kept[k]] );
+		struct iovec padding;
+		padding.iov_base = (void *)zeros;
+		padding.iov_len = PACKET_PADDING_SIZE;
+		pieces.push_back( padding );
+		}
+	}
+piece_starts.push_back( pieces.size() );
+
+mmsgs.resize( n );
+if( n > 0 )
+	{
+	memset( &mmsgs[0], 0, n * sizeof( mmsgs[0] ) );
+	}
+for( size_t m = 0; m < n; ++m )
+	{
+	struct iovec * p = &pieces[piece_starts[m]];
+	p[0].iov_base = &headers[m];
+	p[0].iov_len = sizeof( seqpacket_header );
+	p[1].iov_base = &tables[firsts[m]];
+	p[1].iov_len = headers[m].count * sizeof( seqpacket_nal );
+	mmsgs[m].msg_hdr.msg_iov = p;
+	mmsgs[m].msg_hdr.msg_iovlen = piece_starts[m + 1] - piece_starts[m];
+	}
+messages += n;
+
+for( size_t c = 0; c < clients_list.size(); )
+	{
+	seqpacket_client * client = clients_list[c];
+
+	//one that has missed something starts again at a recovery point
+	size_t first = 0;
+	if( !client->synced )
+		{
+		while( first < n && !message_resumes[first] )
+			{
+			first++;
+			}
+		client->dropped += first;
+		dropped += first;
+		client->synced = first < n;
+		}
+
+	bool gone = false;
+	while( first < n )
+		{
+		int rc = sendmmsg( client->fd, &mmsgs[first], n - first, MSG_DONTWAIT | MSG_NOSIGNAL );
+		if( rc < 0 )
+			{
+			if( errno == EINTR )
+				{
+				continue;
+				}
+			if( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS )
+				{
+				client->synced = false;
+				client->dropped += n - first;
+				dropped += n - first;
+				break;
+				}
+			gone = true;
+			break;
+			}
+		client->messages += rc;
+		first += rc;
+		}
+	if( gone )
+		{
+		close_client( c );
+		continue;
+		}
+	c++;
+	}
+}
+
+//takes on the subscribers the acceptor has accepted
+void data_source_seqpacket::update_clients()
+{
+if( !changed.load() )
+	{
+	return;
+	}
+std::lock_guard<std::mutex> guard( clients_lock );
+changed.store( false );
+for( size_t i = 0; i < joining.size(); ++i )
+	{
+	clients_list.push_back( joining[i] );
+	}
+joining.clear();
+}
+
+void data_source_seqpacket::close_client( size_t i )
+{
+seqpacket_client * client = clients_list[i];
+printf( "SEQPACKET: subscriber gone, %llu messages sent, %llu dropped\n",
+	(unsigned long long)client->messages, (unsigned long long)client->dropped );
+close( client->fd );
+delete client;
+clients_list[i] = clients_list.back();
+clients_list.pop_back();
+client_count--;
+}
+
+void data_source_seqpacket::accept_loop()
+{
+struct pollfd descriptor;
+descriptor.fd = sockfd;
+descriptor.events = POLLIN;
+while( !stopping.load() )
+	{
+	if( poll( &descriptor, 1, 100 ) <= 0 )
+		{
+		continue;
+		}
+	int fd = accept4( sockfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+	if( fd < 0 )
+		{
+		continue;
+		}
+	int size = SEQPACKET_MAX_MESSAGE;
+	setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof( size ) );
+
+	seqpacket_client * client = new seqpacket_client;
+	client->fd = fd;
+	client->synced = false;
+	client->messages = 0;
+	client->dropped = 0;
+	std::lock_guard<std::mutex> guard( clients_lock );
+	joining.push_back( client );
+	changed.store( true );
+	client_count++;
+	}
+}
+
+size_t data_source_seqpacket::clients()
+{
+return client_count.load();
+}
+
+void data_source_seqpacket::report()
+{
+printf( "SEQPACKET: %i subscribers, %llu NALs in %llu messages, %llu messages dropped, %llu NALs too big\n",
+	(int)clients(), (unsigned long long)nals, (unsigned long long)messages,
+	(unsigned long long)dropped, (unsigned long long)too_big );
+}
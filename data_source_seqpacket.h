@@ -0,0 +1,132 @@
+#ifndef DATA_SOURCE_SEQPACKET_H
+#define DATA_SOURCE_SEQPACKET_H
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+
+//where processes on the same host find the stream by default
+#define SEQPACKET_PATH "/tmp/h264_stream.sock"
+
+//the largest message either end handles; the socket buffers may make it
+//smaller
+#define SEQPACKET_MAX_MESSAGE ( 4 << 20 )
+
+//NALs in a message at most, so its pieces fit one sendmsg()
+#define SEQPACKET_MAX_NALS 256
+
+#define SEQPACKET_MAGIC 0x4E414C53
+
+//Each message starts with a seqpacket_header, then a seqpacket_nal for
+//each of its NALs, then the NALs end to end, each followed by
+//PACKET_PADDING_SIZE zero bytes.
+struct seqpacket_header
+	{
+	uint32_t magic;
+	uint32_t count;
+	};
+
+struct seqpacket_nal
+	{
+	nal_info info;
+	uint32_t bytes;
+	};
+
+//a local subscriber
+struct seqpacket_client
+	{
+	int fd;
+	bool synced;        //has started at a recovery point
+	uint64_t messages;
+	uint64_t dropped;
+	};
+
+//Serves the stream to any number of processes on the same host, over a
+//Unix domain SOCK_SEQPACKET socket, a message per NAL or per access unit.
+//Messages keep their boundaries, and carry each NAL's descriptor and
+//length, so a seqpacket_reader has no start codes to look for and nothing
+//to parse. A thread of its own accepts subscribers; the producer sends to
+//them itself, gathering the pieces of each message with sendmmsg() and
+//never copying a NAL that comes in a batch, and never waits. A subscriber
+//whose socket is full, or that has just connected, is sent nothing until
+//an access unit starts with an IDR, a recovery point SEI or parameter
+//sets. An access unit too big for one message goes in several, split
+//between NALs.
+class data_source_seqpacket: public data_source
+	{
+	public:
+	data_source_seqpacket( const char * path = SEQPACKET_PATH, bool per_access_unit = false );
+	~data_source_seqpacket();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+
+	//a batch is taken to be one access unit
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
+
+	//sends the access unit gathered so far, when sending per access unit
+	void flush();
+
+	size_t clients();
+	void report();
+
+	uint64_t nals;
+	uint64_t messages;      //sent, to each subscriber
+	uint64_t dropped;       //messages a subscriber missed
+	uint64_t too_big;       //NALs bigger than a message can be
+
+	private:
+	void send( const struct iovec * iov, const nal_info * infos, int count );
+	void update_clients();
+	void close_client( size_t i );
+	void accept_loop();
+
+	int sockfd;
+	char path[108];
+	bool per_access_unit;
+	size_t max_message;
+	nal_parser parser;
+	recovery_tracker recovery;
+
+	//descriptors for a batch that came without them
+	std::vector<nal_info> batch_infos;
+
+	//the access unit being gathered, when not given as a batch
+	std::vector<uint8_t> frame;
+	std::vector<size_t> nal_sizes;
+	std::vector<nal_info> frame_infos;
+	std::vector<struct iovec> frame_iov;
+
+	//reused from send to send: the NALs that fit a message, where each
+	//message starts among them, its header, their tables, the pieces all
+	//those make up, and a message per group of pieces
+	std::vector<int> kept;
+	std::vector<size_t> firsts;
+	std::vector<bool> message_resumes;
+	std::vector<seqpacket_header> headers;
+	std::vector<seqpacket_nal> tables;
+	std::vector<struct iovec> pieces;
+	std::vector<size_t> piece_starts;
+	std::vector<struct mmsghdr> mmsgs;
+
+	std::vector<seqpacket_client *> clients_list;   //the producer's
+
+	//accepted, for the producer to take on
+	std::mutex clients_lock;
+	std::vector<seqpacket_client *> joining;
+	std::atomic<bool> changed;
+	std::atomic<size_t> client_count;
+
+	std::atomic<bool> stopping;
+	std::thread acceptor;
+	};
+
+#endif
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_source_shm.h"
+
+//a record's size in the ring, its header and the padding included
+static size_t record_size( size_t bytes )
+{
+size_t size = SHM_RECORD_ALIGN + bytes + PACKET_PADDING_SIZE;
+return ( size + SHM_RECORD_ALIGN - 1 ) & ~(size_t)( SHM_RECORD_ALIGN - 1 );
+}
+
+data_source_shm::data_source_shm( const char * name, size_t capacity )
+{
+head = 0;
+skipping = false;
+nals = 0;
+bytes_written = 0;
+dropped = 0;
+dropped_bytes = 0;
+wakes = 0;
+if( ring.create( name, capacity ) )
+	{
+	printf( "SHM: sending to %s, %i KB\n", name, (int)( ring.header->capacity >> 10 ) );
+	}
+}
+
+data_source_shm::~data_source_shm()
+{
+if( ring.is_open() )
+	{
+	ring.header->closed.store( 1 );
+	ring.wake();
+	}
+}
+
+void data_source_shm::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+parser.parse( data, bytes, info );
+write( data, bytes, info );
+}
+
+void data_source_shm::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+add( data, bytes, info );
+publish();
+}
+
+//a batch is taken to be one access unit
+void data_source_shm::write_batch( const struct iovec * iov, int count )
+{
+for( int i = 0; i < count; ++i )
+	{
+	nal_info info;
+	parser.parse( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, info );
+	info.access_unit_end = i == count - 1;
+	add( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, info );
+	}
+publish();
+}
+
+void data_source_shm::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+for( int i = 0; i < count; ++i )
+	{
+	add( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, infos[i] );
+	}
+publish();
+}
+
+//copies a NAL into the ring, without publishing it yet
+void data_source_shm::add( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( !ring.is_open() )
+	{
+	return;
+	}
+bool resume = recovery.resumes( info );
+if( skipping && !resume )
+	{
+	dropped++;
+	dropped_bytes += bytes;
+	return;
+	}
+
+//a record never wraps; one that won't fit before the end of the ring
+//goes at the start, after a record skipping the rest
+shm_ring_header * header = ring.header;
+size_t size = record_size( bytes );
+size_t offset = head & ring.mask;
+size_t to_end = header->capacity - offset;
+size_t needed = size <= to_end ? size : to_end + size;
+uint64_t tail = header->tail.load( std::memory_order_acquire );
+if( size > header->capacity / 2 || head + needed - tail > header->capacity )
+	{
+	skipping = true;
+	dropped++;
+	dropped_bytes += bytes;
+	return;
+	}
+skipping = false;
+if( size > to_end )
+	{
+	shm_record * wrap = (shm_record *)( ring.data + offset );
+	wrap->bytes = SHM_WRAP;
+	wrap->size = to_end;
+	head += to_end;
+	offset = 0;
+	}
+
+shm_record * record = (shm_record *)( ring.data + offset );
+record->bytes = bytes;
+record->size = size;
+record->info = info;
+uint8_t * payload = ring.data + offset + SHM_RECORD_ALIGN;
+memcpy( payload, data, bytes );
+memset( payload + bytes, 0, size - SHM_RECORD_ALIGN - bytes );
+head += size;
+nals++;
+bytes_written += bytes;
+}
+
+//hands what has been added to the viewer, waking it if it sleeps. The
+//stores to head and loads of waiting are sequentially consistent, as the
+//viewer's are the other way round, so one of the two always sees the other
+void data_source_shm::publish()
+{
+if( !ring.is_open() || head == ring.header->head.load( std::memory_order_relaxed ) )
+	{
+	return;
+	}
+ring.header->head.store( head );
+if( ring.header->waiting.load() )
+	{
+	ring.wake();
+	wakes++;
+	}
+}
+
+void data_source_shm::report()
+{
+printf( "SHM: %llu NALs, %llu bytes, %llu wakes, %llu dropped (%llu bytes)\n",
+	(unsigned long long)nals, (unsigned long long)bytes_written, (unsigned long long)wakes,
+	(unsigned long long)dropped, (unsigned long long)dropped_bytes );
+}
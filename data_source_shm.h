@@ -0,0 +1,55 @@
+#ifndef DATA_SOURCE_SHM_H
+#define DATA_SOURCE_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "shm_ring.h"
+
+//Hands NALs to a viewer on the same host through a ring in shared memory,
+//which an shm_reader reads from the other end. Each NAL is copied into the
+//ring once, with its descriptor, and the viewer reads it in place, so NAL
+//boundaries survive and nothing is parsed twice. A batch is published as
+//one access unit, with a single futex wake if the viewer is asleep, so a
+//frame costs at most one syscall here. Undescribed NALs are parsed on the
+//way in.
+//
+//The encoder never waits for the viewer. A NAL that finds the ring full is
+//dropped, and so is everything after it until an access unit starts with
+//an IDR, a recovery point SEI or parameter sets, as an async_sink dropping
+//to a recovery point does.
+class data_source_shm: public data_source
+	{
+	public:
+	data_source_shm( const char * name = SHM_RING_NAME, size_t capacity = SHM_RING_SIZE );
+	~data_source_shm();
+	bool is_open() const { return ring.is_open(); }
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
+
+	//prints what went through, and what was dropped
+	void report();
+
+	uint64_t nals;
+	uint64_t bytes_written;
+	uint64_t dropped;
+	uint64_t dropped_bytes;
+	uint64_t wakes;
+
+	private:
+	void add( const uint8_t * data, size_t bytes, const nal_info & info );
+	void publish();
+
+	shm_ring ring;
+	uint64_t head;          //as far as written, ahead of what is published
+	bool skipping;
+	recovery_tracker recovery;
+	nal_parser parser;
+	};
+
+#endif
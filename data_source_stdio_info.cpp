@@ -3,5 +3,14 @@
 
 void data_source_stdio_info::write( const uint8_t * data, size_t bytes )
 {
-fprintf(stdout,"packet %i: %i bytes\n", ++num_packets, bytes);
+fprintf(stdout,"packet %i: %zu bytes\n", ++num_packets, bytes);
+}
+
+void data_source_stdio_info::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+fprintf(stdout,"packet %i: %zu bytes, type %i, ref_idc %i%s%s%s\n", ++num_packets, bytes,
+	info.nal_unit_type, info.nal_ref_idc,
+	info.access_unit_start ? ", access unit start" : "",
+	info.parameter_set ? ", parameter set" : "",
+	info.sei ? ", SEI" : "" );
 }
@@ -6,11 +6,12 @@
 
 #include "data_source.h"
 
-//Prints out packet size and count
+//Prints out packet size and count, and the NAL descriptor when there is one
 class data_source_stdio_info: public data_source
 	{
 	public:
 	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
 
 	private:
 	int num_packets = 0;
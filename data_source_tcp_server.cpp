@@ -1,27 +1,57 @@
 #include <iostream>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <linux/sockios.h>
 
 #include "data_source_tcp_server.h"
+#include "packet_pool.h"
+
+//how long closing waits for clients to take what is queued for them
+#define TCP_CLOSE_TIMEOUT_MS 1000
+
+static uint64_t now_ms()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000ULL + temp.tv_nsec / 1000000;
+}
 
 data_source_tcp_server::data_source_tcp_server( int portno )
 {
-socklen_t clilen;
-struct sockaddr_in serv_addr, cli_addr;
+struct sockaddr_in serv_addr;
 
-sockfd = socket(AF_INET, SOCK_STREAM, 0);
+epfd = -1;
+wakefd = -1;
+changed.store( false );
+unsent_limit.store( 0 );
+send_buffer.store( 0 );
+frames_skipped = 0;
+overflows = 0;
+peak_queued.store( 0 );
+connected.store( 0 );
+idle.store( false );
+stopping.store( false );
+
+sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 if (sockfd >= 0)
 	{
 	int flag;
 
+	//accepted sockets inherit it
 	flag = 1;
 	if( setsockopt(sockfd,IPPROTO_TCP,TCP_NODELAY,(char *) &flag,sizeof(int) )< 0 )
 		{
@@ -40,37 +70,80 @@ if (sockfd >= 0)
 	serv_addr.sin_port = htons(portno);
 	if (bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) >= 0)
 		{
-		listen(sockfd,1);
-		clilen = sizeof(cli_addr);
+		listen(sockfd,16);
 		printf("Listening on port %i\n",portno);
-		fd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
-		if (fd >= 0)
-			{
-			printf("Server connected port %i\n",portno);
-			}
-		else
-			{
-			printf("ERROR on accept\n");
-			}
 		}
 	else
 		{
 		printf("ERROR on binding\n");
+		close( sockfd );
+		sockfd = -1;
 		}
 	}
 else
 	{
 	printf("ERROR opening socket\n");
 	}
+
+if( sockfd < 0 )
+	{
+	return;
+	}
+
+epfd = epoll_create1( EPOLL_CLOEXEC );
+wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+if( epfd < 0 || wakefd < 0 )
+	{
+	printf("ERROR creating epoll or eventfd\n");
+	return;
+	}
+
+struct epoll_event event;
+memset( &event, 0, sizeof( event ) );
+event.events = EPOLLIN;
+event.data.ptr = &sockfd;
+epoll_ctl( epfd, EPOLL_CTL_ADD, sockfd, &event );
+event.data.ptr = &wakefd;
+epoll_ctl( epfd, EPOLL_CTL_ADD, wakefd, &event );
+
+worker = std::thread( &data_source_tcp_server::run, this );
 }
 
 data_source_tcp_server::~data_source_tcp_server()
 {
-if( fd != -1 )
+if( worker.joinable() )
+	{
+	stopping.store( true );
+	uint64_t one = 1;
+	::write( wakefd, &one, sizeof( one ) );
+	worker.join();
+	}
+
+for( size_t i = 0; i < active.size(); ++i )
+	{
+	close( active[i]->fd );
+	}
+for( size_t i = 0; i < clients_list.size(); ++i )
 	{
-	close( fd );
+	delete clients_list[i];
+	}
+for( size_t i = 0; i < joining.size(); ++i )
+	{
+	delete joining[i];
+	}
+for( size_t i = 0; i < leaving.size(); ++i )
+	{
+	delete leaving[i];
 	}
 
+if( wakefd != -1 )
+	{
+	close( wakefd );
+	}
+if( epfd != -1 )
+	{
+	close( epfd );
+	}
 if( sockfd != -1 )
 	{
 	close(sockfd);
@@ -79,5 +152,513 @@ if( sockfd != -1 )
 
 void data_source_tcp_server::write( const uint8_t * data, size_t bytes )
 {
-::write( fd, data, bytes );
+update_clients();
+if( !clients_list.empty() )
+	{
+	enqueue( packet_pool::shared().copy( data, bytes ), NULL );
+	}
+}
+
+void data_source_tcp_server::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+update_clients();
+if( !clients_list.empty() || info.parameter_set )
+	{
+	enqueue( packet_pool::shared().copy( data, bytes ), &info );
+	}
+else
+	{
+	//no one to send it to, but the tracker still has to see it
+	recovery.resumes( info );
+	}
+}
+
+void data_source_tcp_server::write( const packet_ref & packet )
+{
+update_clients();
+enqueue( packet, NULL );
+}
+
+void data_source_tcp_server::write( const packet_ref & packet, const nal_info & info )
+{
+update_clients();
+enqueue( packet, &info );
+}
+
+void data_source_tcp_server::bound_latency( size_t unsent_bytes, size_t send_buffer )
+{
+this->send_buffer.store( send_buffer );
+unsent_limit.store( unsent_bytes );
+}
+
+//takes on the clients the server thread has accepted, and lets it have back
+//the ones it has closed
+void data_source_tcp_server::update_clients()
+{
+if( !changed.load() )
+	{
+	return;
+	}
+std::lock_guard<std::mutex> guard( clients_lock );
+changed.store( false );
+for( size_t i = 0; i < joining.size(); ++i )
+	{
+	joining[i]->synced = false;
+	clients_list.push_back( joining[i] );
+	}
+joining.clear();
+for( size_t i = 0; i < clients_list.size(); )
+	{
+	if( clients_list[i]->closed.load() )
+		{
+		leaving.push_back( clients_list[i] );
+		clients_list[i] = clients_list.back();
+		clients_list.pop_back();
+		}
+	else
+		{
+		++i;
+		}
+	}
+}
+
+void data_source_tcp_server::enqueue( const packet_ref & packet, const nal_info * info )
+{
+bool resume = true;
+if( info )
+	{
+	resume = recovery.resumes( *info );
+	if( info->nal_unit_type == NAL_SPS )
+		{
+		sps = packet;
+		}
+	else if( info->nal_unit_type == NAL_PPS )
+		{
+		pps = packet;
+		}
+	}
+
+bool bounded = unsent_limit.load( std::memory_order_relaxed ) != 0;
+bool frame_start = info && info->access_unit_start;
+bool queued = false;
+for( size_t i = 0; i < clients_list.size(); ++i )
+	{
+	tcp_client * client = clients_list[i];
+	if( client->closed.load( std::memory_order_relaxed ) )
+		{
+		continue;
+		}
+
+	//a viewer behind with its last frame misses whole frames, until one
+	//it can start from finds it caught up
+	if( client->lagging )
+		{
+		if( !frame_start || !resume || behind( client ) )
+			{
+			client->frames_skipped += frame_start;
+			frames_skipped += frame_start;
+			client->dropped++;
+			continue;
+			}
+		client->lagging = false;
+		}
+	else if( bounded && frame_start && client->synced && behind( client ) )
+		{
+		client->lagging = true;
+		client->synced = false;
+		client->frames_skipped++;
+		frames_skipped++;
+		client->dropped++;
+		continue;
+		}
+
+	if( client->synced && push( client, packet ) )
+		{
+		queued = true;
+		continue;
+		}
+	if( client->synced )
+		{
+		//too slow: what it has queued goes, and it waits for a way back in,
+		//which this packet may itself be
+		drop_all( client );
+		client->synced = false;
+		client->overflows++;
+		overflows++;
+		}
+	if( !resume || !start( client, packet, info ) )
+		{
+		client->dropped++;
+		continue;
+		}
+	queued = true;
+	}
+
+//the server thread says it is idle before it last looks at the queues, so
+//either it sees this packet or we see it idle here
+if( queued && idle.load() )
+	{
+	uint64_t one = 1;
+	::write( wakefd, &one, sizeof( one ) );
+	}
+}
+
+//a client joining at an IDR without its own parameter sets, or coming back
+//after dropping them, needs the latest ones first
+bool data_source_tcp_server::start( tcp_client * client, const packet_ref & packet, const nal_info * info )
+{
+if( info && info->nal_unit_type != NAL_SPS && !sps.empty() && !pps.empty() )
+	{
+	push( client, sps );
+	push( client, pps );
+	}
+client->synced = push( client, packet );
+return client->synced;
+}
+
+bool data_source_tcp_server::push( tcp_client * client, const packet_ref & packet )
+{
+packet_ref * p = client->queue.reserve();
+if( p == NULL )
+	{
+	//the slot may be the one the server thread is moving a packet out of
+	if( client->queue.size() < client->queue.capacity() )
+		{
+		while( ( p = client->queue.reserve() ) == NULL )
+			{
+			std::this_thread::yield();
+			}
+		}
+	else
+		{
+		return false;
+		}
+	}
+*p = packet;
+client->queue.publish();
+return true;
+}
+
+//whether the server thread still has packets for the client it couldn't
+//hand to the kernel
+bool data_source_tcp_server::behind( tcp_client * client )
+{
+return !client->queue.empty() || client->backed_up.load();
+}
+
+void data_source_tcp_server::drop_all( tcp_client * client )
+{
+size_t first;
+size_t n = client->queue.claim_all( &first );
+for( size_t i = first; i < first + n; ++i )
+	{
+	client->dropped++;
+	client->queue.at( i ).reset();
+	client->queue.release( i );
+	}
+}
+
+//producer side, like the writes
+void data_source_tcp_server::report()
+{
+std::lock_guard<std::mutex> guard( clients_lock );
+printf( "TCP server: %i clients\n", (int)clients_list.size() );
+for( size_t i = 0; i < clients_list.size(); ++i )
+	{
+	tcp_client * client = clients_list[i];
+	printf( "  %s: %llu bytes sent, %llu most queued in the kernel, %llu packets dropped, %llu frames skipped, %llu overflows, %i queued%s\n",
+		client->address, (unsigned long long)client->sent_bytes.load(), (unsigned long long)client->peak_queued.load(),
+		(unsigned long long)client->dropped, (unsigned long long)client->frames_skipped, (unsigned long long)client->overflows,
+		(int)client->queue.size(), client->closed.load() ? ", closed" : "" );
+	}
+}
+
+//whether any client the server thread can write to has something to send
+bool data_source_tcp_server::pending()
+{
+for( size_t i = 0; i < active.size(); ++i )
+	{
+	tcp_client * client = active[i];
+	if( client->writable && ( client->first < client->sending.size() || !client->queue.empty() ) )
+		{
+		return true;
+		}
+	}
+return false;
+}
+
+void data_source_tcp_server::run()
+{
+struct epoll_event events[16];
+uint64_t deadline = 0;
+while( true )
+	{
+	for( size_t i = 0; i < active.size(); )
+		{
+		if( !active[i]->writable || send( active[i] ) )
+			{
+			++i;
+			}
+		}
+
+		{
+		std::lock_guard<std::mutex> guard( clients_lock );
+		for( size_t i = 0; i < leaving.size(); ++i )
+			{
+			delete leaving[i];
+			}
+		leaving.clear();
+		}
+
+	int timeout = -1;
+	if( stopping.load() )
+		{
+		//send what is queued to whoever will take it, but not forever
+		if( deadline == 0 )
+			{
+			deadline = now_ms() + TCP_CLOSE_TIMEOUT_MS;
+			}
+		bool left = false;
+		for( size_t i = 0; i < active.size(); ++i )
+			{
+			left = left || active[i]->first < active[i]->sending.size() || !active[i]->queue.empty();
+			}
+		if( !left || now_ms() >= deadline )
+			{
+			return;
+			}
+		timeout = 10;
+		}
+
+	idle.store( true );
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	if( pending() )
+		{
+		idle.store( false );
+		continue;
+		}
+	int n = epoll_wait( epfd, events, 16, timeout );
+	idle.store( false );
+
+	for( int i = 0; i < n; ++i )
+		{
+		if( events[i].data.ptr == &sockfd )
+			{
+			accept_clients();
+			continue;
+			}
+		if( events[i].data.ptr == &wakefd )
+			{
+			uint64_t count;
+			::read( wakefd, &count, sizeof( count ) );
+			continue;
+			}
+		tcp_client * client = (tcp_client *)events[i].data.ptr;
+		if( client->closed.load() )
+			{
+			continue;
+			}
+		if( events[i].events & ( EPOLLERR | EPOLLHUP | EPOLLRDHUP ) )
+			{
+			close_client( client );
+			continue;
+			}
+		if( events[i].events & EPOLLIN )
+			{
+			//viewers have nothing to say, but reading finds them gone
+			uint8_t discard[256];
+			ssize_t r;
+			while( ( r = recv( client->fd, discard, sizeof( discard ), MSG_DONTWAIT ) ) > 0 )
+				{
+				}
+			if( r == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) )
+				{
+				close_client( client );
+				continue;
+				}
+			}
+		if( events[i].events & EPOLLOUT )
+			{
+			client->writable = true;
+			}
+		}
+	}
+}
+
+void data_source_tcp_server::accept_clients()
+{
+while( true )
+	{
+	struct sockaddr_in cli_addr;
+	socklen_t clilen = sizeof(cli_addr);
+	int fd = accept4( sockfd, (struct sockaddr *) &cli_addr, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC );
+	if( fd < 0 )
+		{
+		if( errno == EINTR || errno == ECONNABORTED )
+			{
+			continue;
+			}
+		return;
+		}
+
+	tcp_client * client = new tcp_client( fd, TCP_CLIENT_QUEUE_DEPTH );
+	char host[INET_ADDRSTRLEN];
+	inet_ntop( AF_INET, &cli_addr.sin_addr, host, sizeof( host ) );
+	snprintf( client->address, sizeof( client->address ), "%s:%i", host, ntohs( cli_addr.sin_port ) );
+	client->synced = false;
+	client->lagging = false;
+	client->dropped = 0;
+	client->frames_skipped = 0;
+	client->overflows = 0;
+	client->first = 0;
+	client->offset = 0;
+	client->writable = true;
+	client->backed_up.store( false );
+	client->sent_bytes.store( 0 );
+	client->peak_queued.store( 0 );
+	client->closed.store( false );
+
+	//the kernel wakes us for more only once it is down to unsent_bytes,
+	//and refuses more than that but for the odd write
+	int unsent = unsent_limit.load();
+	if( unsent && setsockopt( fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &unsent, sizeof( unsent ) ) < 0 )
+		{
+		printf("Unable to set TCP_NOTSENT_LOWAT\n");
+		}
+	int buffer = send_buffer.load();
+	if( buffer && setsockopt( fd, SOL_SOCKET, SO_SNDBUF, &buffer, sizeof( buffer ) ) < 0 )
+		{
+		printf("Unable to set SO_SNDBUF\n");
+		}
+
+	struct epoll_event event;
+	memset( &event, 0, sizeof( event ) );
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = client;
+	epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &event );
+	active.push_back( client );
+	connected++;
+	printf("Server connected %s\n",client->address);
+
+		{
+		std::lock_guard<std::mutex> guard( clients_lock );
+		joining.push_back( client );
+		changed.store( true );
+		}
+	}
+}
+
+//sends what the client has queued until it is all gone or the socket is
+//full; returns false if the client had to be closed
+bool data_source_tcp_server::send( tcp_client * client )
+{
+std::vector<packet_ref> & sending = client->sending;
+while( true )
+	{
+	//take packets out of the queue, so the producer can drop what is left
+	//there without cutting one that is half sent
+	if( client->first > 0 )
+		{
+		sending.erase( sending.begin(), sending.begin() + client->first );
+		client->first = 0;
+		}
+	while( sending.size() < TCP_SEND_BATCH )
+		{
+		size_t ticket;
+		packet_ref * p = client->queue.claim( &ticket );
+		if( p == NULL )
+			{
+			break;
+			}
+		sending.push_back( std::move( *p ) );
+		client->queue.release( ticket );
+		}
+	if( sending.empty() )
+		{
+		client->backed_up.store( false );
+		return true;
+		}
+
+	iov.resize( sending.size() );
+	for( size_t i = 0; i < sending.size(); ++i )
+		{
+		iov[i].iov_base = sending[i].data();
+		iov[i].iov_len = sending[i].size();
+		}
+	iov[0].iov_base = (uint8_t *)iov[0].iov_base + client->offset;
+	iov[0].iov_len -= client->offset;
+
+	struct msghdr msg;
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov[0];
+	msg.msg_iovlen = iov.size();
+	ssize_t n = sendmsg( client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT );
+	if( n < 0 )
+		{
+		if( errno == EINTR )
+			{
+			continue;
+			}
+		if( errno == EAGAIN || errno == EWOULDBLOCK )
+			{
+			//EPOLLOUT says when there is room again
+			client->writable = false;
+			client->backed_up.store( true );
+			return true;
+			}
+		close_client( client );
+		return false;
+		}
+	client->sent_bytes += n;
+
+	//sent and not yet acknowledged, or not sent: how far behind the viewer
+	//the kernel has let it get
+	int queued;
+	if( ioctl( client->fd, SIOCOUTQ, &queued ) == 0 && (uint64_t)queued > client->peak_queued.load( std::memory_order_relaxed ) )
+		{
+		client->peak_queued.store( queued, std::memory_order_relaxed );
+		if( (uint64_t)queued > peak_queued.load( std::memory_order_relaxed ) )
+			{
+			peak_queued.store( queued, std::memory_order_relaxed );
+			}
+		}
+
+	size_t left = n;
+	while( left > 0 )
+		{
+		size_t rest = sending[client->first].size() - client->offset;
+		if( left < rest )
+			{
+			client->offset += left;
+			break;
+			}
+		left -= rest;
+		sending[client->first].reset();
+		client->first++;
+		client->offset = 0;
+		}
+	}
+}
+
+//stops sending to the client; the producer hands it back to be deleted
+void data_source_tcp_server::close_client( tcp_client * client )
+{
+printf("Server disconnected %s\n",client->address);
+epoll_ctl( epfd, EPOLL_CTL_DEL, client->fd, NULL );
+close( client->fd );
+client->sending.clear();
+client->first = 0;
+client->offset = 0;
+for( size_t i = 0; i < active.size(); ++i )
+	{
+	if( active[i] == client )
+		{
+		active[i] = active.back();
+		active.pop_back();
+		break;
+		}
+	}
+connected--;
+client->closed.store( true );
+changed.store( true );
 }
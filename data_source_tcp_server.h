@@ -1,21 +1,139 @@
 #ifndef DATA_SOURCE_TCP_SERVER_H
 #define DATA_SOURCE_TCP_SERVER_H
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include <stddef.h>
 #include <stdint.h>
+
 #include "data_source.h"
+#include "nal_info.h"
+#include "spsc_ring.h"
+
+//packets queued per client before it is dropped back to a recovery point
+#define TCP_CLIENT_QUEUE_DEPTH 512
+
+//packets per sendmsg() to a client
+#define TCP_SEND_BATCH 64
+
+//what a viewer's socket may hold not yet sent when latency is bounded,
+//enough to keep a link of a few Mbit/s busy between frames
+#define TCP_DEFAULT_UNSENT_BYTES 16384
+
+//one viewer: the producer queues packets, the server's thread sends them
+struct tcp_client
+	{
+	tcp_client( int fd, size_t depth ) : fd( fd ), queue( depth ) {}
+	int fd;
+	char address[32];
+	spsc_ring<packet_ref> queue;
+
+	//producer side
+	bool synced;               //has started at a recovery point
+	bool lagging;              //skipping frames to catch up
+	uint64_t dropped;
+	uint64_t frames_skipped;
+	uint64_t overflows;        //its queue filled, back to a recovery point
+
+	//server thread side
+	std::vector<packet_ref> sending;   //taken from the queue, from first on
+	size_t first;
+	size_t offset;                     //bytes of sending[first] already sent
+	bool writable;
+	std::atomic<bool> backed_up;       //has unsent packets and a full socket
+	std::atomic<uint64_t> sent_bytes;
+	std::atomic<uint64_t> peak_queued; //most the kernel has held, SIOCOUTQ
+	std::atomic<bool> closed;
+	};
 
-//creates a TCP server, blocks until connect, then forwards data
+//Listens for viewers without blocking, on a thread of its own that accepts
+//any number of them and sends each what the producer writes from an epoll
+//loop. Each client has its own bounded queue of references to the packet,
+//copied once into a pooled buffer however many clients there are, so the
+//producer only ever queues and never waits on a socket. A client that lets
+//its queue fill, or has just connected, is passed nothing until the next
+//recovery point, as a packet_server's OVERFLOW_DROP_TO_RECOVERY does, and
+//then gets the latest SPS and PPS ahead of it, so the first thing it sees
+//is a stream it can decode. Undescribed packets can't be told apart, so
+//with those a client gets everything from when it connects, and a full
+//queue is just emptied. Queued packets are sent, for up to a second, before
+//the server closes.
 class data_source_tcp_server: public data_source
 	{
 	public:
 	data_source_tcp_server(int portno);
 	~data_source_tcp_server();
 	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	bool wants_packets() const { return true; }
+	void write( const packet_ref & packet );
+	void write( const packet_ref & packet, const nal_info & info );
+
+	//Keeps latency bounded for viewers that connect after: their sockets
+	//hold no more than unsent_bytes not yet sent, with TCP_NOTSENT_LOWAT,
+	//and send_buffer, if not 0, fixes SO_SNDBUF. A viewer still sending
+	//one frame when the next starts has fallen behind, and whole frames
+	//are skipped until it has caught up and a recovery point comes. Only
+	//described packets show where frames start.
+	void bound_latency( size_t unsent_bytes = TCP_DEFAULT_UNSENT_BYTES, size_t send_buffer = 0 );
+
+	//fixes SO_SNDBUF for viewers that connect after, latency bounded or
+	//not, so the kernel holds no more than that for each
+	void limit_send_buffer( size_t bytes ) { send_buffer.store( bytes ); }
+
+	//viewers connected right now
+	size_t clients() const { return connected.load(); }
+
+	//prints each client's queue, the most its socket held, and what it
+	//has been sent and missed
+	void report();
+
+	//over every viewer: frames skipped to bound latency, queues that filled,
+	//and the most any one socket has held
+	uint64_t frames_skipped;
+	uint64_t overflows;
+	std::atomic<uint64_t> peak_queued;
 
 	private:
+	void enqueue( const packet_ref & packet, const nal_info * info );
+	bool start( tcp_client * client, const packet_ref & packet, const nal_info * info );
+	bool push( tcp_client * client, const packet_ref & packet );
+	void drop_all( tcp_client * client );
+	bool behind( tcp_client * client );
+	void update_clients();
+	void run();
+	void accept_clients();
+	bool send( tcp_client * client );
+	void close_client( tcp_client * client );
+	bool pending();
+
 	int sockfd;
-	int fd;
+	int epfd;
+	int wakefd;
+
+	//producer side
+	std::vector<tcp_client*> clients_list;
+	packet_ref sps;
+	packet_ref pps;
+	recovery_tracker recovery;
+
+	//handed between the producer and the server thread
+	std::mutex clients_lock;
+	std::vector<tcp_client*> joining;
+	std::vector<tcp_client*> leaving;
+	std::atomic<bool> changed;
+	std::atomic<size_t> unsent_limit;   //0 unless latency is bounded
+	std::atomic<size_t> send_buffer;
+
+	//server thread side
+	std::vector<tcp_client*> active;
+	std::vector<struct iovec> iov;
+	std::atomic<size_t> connected;
+	std::atomic<bool> idle;
+	std::atomic<bool> stopping;
+	std::thread worker;
 	};
 
 #endif
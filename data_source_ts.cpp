@@ -0,0 +1,362 @@
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "data_source_ts.h"
+
+//a PES header with a PTS: start code, stream id, length, flags, the
+//header's length and the PTS itself
+#define TS_PES_HEADER_SIZE 14
+
+//an adaptation field with just its flags and a PCR
+#define TS_PCR_ADAPTATION_SIZE 8
+
+#define TS_PAYLOAD_SIZE ( TS_PACKET_SIZE - 4 )
+
+static const uint8_t access_unit_delimiter[] = { 0x00, 0x00, 0x00, 0x01, NAL_AUD, 0xF0 };
+static const uint8_t start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+static const uint8_t zeros[PACKET_PADDING_SIZE] = { 0 };
+
+static uint64_t wall_clock_us()
+{
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+//the CRC of PSI sections: polynomial 0x04C11DB7, MSB first, no final xor
+static uint32_t crc32_mpeg( const uint8_t * data, size_t bytes )
+{
+uint32_t crc = 0xFFFFFFFF;
+for( size_t i = 0; i < bytes; ++i )
+	{
+	crc ^= (uint32_t)data[i] << 24;
+	for( int bit = 0; bit < 8; ++bit )
+		{
+		crc = crc & 0x80000000 ? ( crc << 1 ) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+return crc;
+}
+
+//appends the CRC to a section, its length already in place
+static size_t finish_section( uint8_t * section, size_t bytes )
+{
+uint32_t crc = crc32_mpeg( section, bytes );
+section[bytes] = crc >> 24;
+section[bytes + 1] = ( crc >> 16 ) & 0xFF;
+section[bytes + 2] = ( crc >> 8 ) & 0xFF;
+section[bytes + 3] = crc & 0xFF;
+return bytes + 4;
+}
+
+data_source_ts::data_source_ts( bool per_slice, size_t packets_per_datagram ) : per_slice( per_slice ), packets_per_datagram( packets_per_datagram )
+{
+if( this->packets_per_datagram < 1 )
+	{
+	this->packets_per_datagram = 1;
+	}
+pat_continuity = 0;
+pmt_continuity = 0;
+video_continuity = 0;
+last_tables_us = 0;
+in_access_unit = false;
+au_timestamp_us = 0;
+au_random_access = false;
+au_started = false;
+in_datagram = 0;
+packets = 0;
+datagrams = 0;
+access_units = 0;
+tables = 0;
+stuffing = 0;
+}
+
+data_source_ts::~data_source_ts()
+{
+flush();
+}
+
+//for producers that don't describe their packets
+void data_source_ts::write( const uint8_t * data, size_t bytes )
+{
+nal_info info;
+parser.parse( data, bytes, info );
+write( data, bytes, info );
+}
+
+void data_source_ts::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( info.access_unit_start )
+	{
+	flush();
+	}
+if( !in_access_unit )
+	{
+	start_access_unit( info );
+	}
+au_random_access = au_random_access || info.recovery_point || info.parameter_set;
+if( info.nal_unit_type != NAL_FILLER )
+	{
+	add_nal( data, bytes );
+	}
+
+//slice by slice, the parameter sets and SEI before the first one go with
+//it, by when it is known whether a decoder can start there
+if( per_slice && info.vcl() )
+	{
+	add_pes( !au_started, false );
+	au_started = true;
+	send();
+	}
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void data_source_ts::write_batch( const struct iovec * iov, int count )
+{
+flush();
+for( int i = 0; i < count; ++i )
+	{
+	const uint8_t * data = (const uint8_t *)iov[i].iov_base;
+	nal_info info;
+	parser.parse( data, iov[i].iov_len, info );
+	info.access_unit_start = i == 0;
+	info.access_unit_end = i == count - 1;
+	write( data, iov[i].iov_len, info );
+	}
+}
+
+void data_source_ts::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+for( int i = 0; i < count; ++i )
+	{
+	write( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, infos[i] );
+	}
+}
+
+//room for the PES header, filled in once the length is known, then the
+//delimiter H.264 in TS wants at the start of every access unit
+void data_source_ts::start_access_unit( const nal_info & info )
+{
+in_access_unit = true;
+au_timestamp_us = info.timestamp_us ? info.timestamp_us : wall_clock_us();
+au_random_access = false;
+au_started = false;
+pes.assign( TS_PES_HEADER_SIZE, 0 );
+if( info.nal_unit_type != NAL_AUD )
+	{
+	pes.insert( pes.end(), access_unit_delimiter, access_unit_delimiter + sizeof( access_unit_delimiter ) );
+	}
+}
+
+//TS carries Annex B, so a NAL without a start code is given one
+void data_source_ts::add_nal( const uint8_t * data, size_t bytes )
+{
+bool has_start_code = bytes >= 3 && data[0] == 0 && data[1] == 0 &&
+	( data[2] == 1 || ( bytes >= 4 && data[2] == 0 && data[3] == 1 ) );
+if( !has_start_code )
+	{
+	pes.insert( pes.end(), start_code, start_code + sizeof( start_code ) );
+	}
+pes.insert( pes.end(), data, data + bytes );
+}
+
+void data_source_ts::flush()
+{
+if( !in_access_unit )
+	{
+	return;
+	}
+
+//all of it gathered, or what came after the last slice
+if( !au_started || !pes.empty() )
+	{
+	add_pes( !au_started, !per_slice );
+	}
+send();
+in_access_unit = false;
+access_units++;
+}
+
+//the PAT and PMT for the one program, version 0 as they never change
+void data_source_ts::add_tables()
+{
+uint8_t section[32];
+section[0] = 0x00;
+section[1] = 0xB0;
+section[2] = 13;
+section[3] = 0x00;
+section[4] = 0x01;
+section[5] = 0xC1;
+section[6] = 0x00;
+section[7] = 0x00;
+section[8] = TS_PROGRAM_NUMBER >> 8;
+section[9] = TS_PROGRAM_NUMBER & 0xFF;
+section[10] = 0xE0 | ( TS_PID_PMT >> 8 );
+section[11] = TS_PID_PMT & 0xFF;
+add_section( TS_PID_PAT, pat_continuity, section, finish_section( section, 12 ) );
+
+section[0] = 0x02;
+section[1] = 0xB0;
+section[2] = 18;
+section[3] = TS_PROGRAM_NUMBER >> 8;
+section[4] = TS_PROGRAM_NUMBER & 0xFF;
+section[5] = 0xC1;
+section[6] = 0x00;
+section[7] = 0x00;
+section[8] = 0xE0 | ( TS_PID_VIDEO >> 8 );   //the PCR comes with the video
+section[9] = TS_PID_VIDEO & 0xFF;
+section[10] = 0xF0;
+section[11] = 0x00;
+section[12] = TS_STREAM_TYPE_H264;
+section[13] = 0xE0 | ( TS_PID_VIDEO >> 8 );
+section[14] = TS_PID_VIDEO & 0xFF;
+section[15] = 0xF0;
+section[16] = 0x00;
+add_section( TS_PID_PMT, pmt_continuity, section, finish_section( section, 17 ) );
+
+last_tables_us = au_timestamp_us;
+tables++;
+}
+
+void data_source_ts::add_section( uint16_t pid, uint8_t & continuity, const uint8_t * section, size_t bytes )
+{
+uint8_t * payload = add_packet( pid, true, continuity, 0 );
+payload[0] = 0;     //pointer field
+memcpy( payload + 1, section, bytes );
+memset( payload + 1 + bytes, 0xFF, TS_PAYLOAD_SIZE - 1 - bytes );
+}
+
+//cuts what is in pes into packets, the last stuffed to fill it. The PES
+//header and the PCR are only there when it starts a PES; bounded gives
+//the PES its length, when it fits
+void data_source_ts::add_pes( bool unit_start, bool bounded )
+{
+uint64_t clock = au_timestamp_us * ( TS_CLOCK_RATE / 1000 ) / 1000;
+if( unit_start )
+	{
+	if( au_random_access || last_tables_us == 0 || au_timestamp_us < last_tables_us ||
+		au_timestamp_us - last_tables_us >= TS_TABLE_INTERVAL_MS * 1000 )
+		{
+		add_tables();
+		}
+
+	size_t length = pes.size() - 6;
+	uint64_t pts = ( clock + TS_PTS_DELAY_MS * ( TS_CLOCK_RATE / 1000 ) ) & 0x1FFFFFFFFULL;
+	uint8_t * header = &pes[0];
+	header[0] = 0x00;
+	header[1] = 0x00;
+	header[2] = 0x01;
+	header[3] = TS_STREAM_ID_VIDEO;
+	header[4] = bounded && length <= 0xFFFF ? length >> 8 : 0;
+	header[5] = bounded && length <= 0xFFFF ? length & 0xFF : 0;
+	header[6] = 0x84;   //data alignment: it starts with the delimiter
+	header[7] = 0x80;   //a PTS and nothing else
+	header[8] = 5;
+	header[9] = 0x21 | ( ( pts >> 29 ) & 0x0E );
+	header[10] = ( pts >> 22 ) & 0xFF;
+	header[11] = 0x01 | ( ( pts >> 14 ) & 0xFE );
+	header[12] = ( pts >> 7 ) & 0xFF;
+	header[13] = 0x01 | ( ( pts << 1 ) & 0xFE );
+	}
+
+size_t offset = 0;
+bool first = unit_start;
+while( offset < pes.size() )
+	{
+	size_t adaptation = first ? TS_PCR_ADAPTATION_SIZE : 0;
+	size_t n = pes.size() - offset;
+	if( n >= TS_PAYLOAD_SIZE - adaptation )
+		{
+		n = TS_PAYLOAD_SIZE - adaptation;
+		}
+	else
+		{
+		stuffing += TS_PAYLOAD_SIZE - adaptation - n;
+		adaptation = TS_PAYLOAD_SIZE - n;
+		}
+
+	uint8_t * p = add_packet( TS_PID_VIDEO, first, video_continuity, adaptation );
+	if( adaptation > 0 )
+		{
+		p[0] = adaptation - 1;
+		}
+	if( adaptation > 1 )
+		{
+		p[1] = 0;
+		size_t used = 2;
+		if( first )
+			{
+			//the PCR: a 33 bit base on the 90kHz clock and a 9 bit
+			//extension counting the 27MHz clock up to 300
+			uint64_t base = clock & 0x1FFFFFFFFULL;
+			uint32_t extension = ( au_timestamp_us * 27 ) % 300;
+			p[1] = 0x10 | ( au_random_access ? 0x40 : 0 );
+			p[2] = base >> 25;
+			p[3] = ( base >> 17 ) & 0xFF;
+			p[4] = ( base >> 9 ) & 0xFF;
+			p[5] = ( base >> 1 ) & 0xFF;
+			p[6] = ( ( base & 1 ) << 7 ) | 0x7E | ( extension >> 8 );
+			p[7] = extension & 0xFF;
+			used = TS_PCR_ADAPTATION_SIZE;
+			}
+		memset( p + used, 0xFF, adaptation - used );
+		}
+	memcpy( p + adaptation, &pes[offset], n );
+	offset += n;
+	first = false;
+	}
+pes.clear();
+}
+
+//a packet's header at the end of the buffer, starting another datagram
+//when this one is full, and where the adaptation field goes in it
+uint8_t * data_source_ts::add_packet( uint16_t pid, bool unit_start, uint8_t & continuity, size_t adaptation_bytes )
+{
+if( in_datagram == packets_per_datagram )
+	{
+	buffer.insert( buffer.end(), zeros, zeros + PACKET_PADDING_SIZE );
+	in_datagram = 0;
+	}
+if( in_datagram == 0 )
+	{
+	datagram_starts.push_back( buffer.size() );
+	}
+size_t start = buffer.size();
+buffer.resize( start + TS_PACKET_SIZE );
+uint8_t * header = &buffer[start];
+header[0] = TS_SYNC_BYTE;
+header[1] = ( unit_start ? 0x40 : 0 ) | ( pid >> 8 );
+header[2] = pid & 0xFF;
+header[3] = ( adaptation_bytes ? 0x30 : 0x10 ) | continuity;
+continuity = ( continuity + 1 ) & 0x0F;
+in_datagram++;
+packets++;
+return header + 4;
+}
+
+void data_source_ts::send()
+{
+if( datagram_starts.empty() )
+	{
+	return;
+	}
+buffer.insert( buffer.end(), zeros, zeros + PACKET_PADDING_SIZE );
+size_t count = datagram_starts.size();
+iov.resize( count );
+for( size_t i = 0; i < count; ++i )
+	{
+	size_t end = i + 1 < count ? datagram_starts[i + 1] : buffer.size();
+	iov[i].iov_base = &buffer[datagram_starts[i]];
+	iov[i].iov_len = end - datagram_starts[i] - PACKET_PADDING_SIZE;
+	}
+server.broadcast_batch( &iov[0], count );
+datagrams += count;
+buffer.clear();
+datagram_starts.clear();
+in_datagram = 0;
+}
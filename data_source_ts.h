@@ -0,0 +1,111 @@
+#ifndef DATA_SOURCE_TS_H
+#define DATA_SOURCE_TS_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "packet_server.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+
+//7 packets, 1316 bytes, is what fits a 1500 byte MTU and what GStreamer's
+//mpegtsmux and most others put in a datagram
+#define TS_PACKETS_PER_DATAGRAM 7
+
+//the PIDs used, and the one program they make up
+#define TS_PID_PAT 0x0000
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x0100
+#define TS_PROGRAM_NUMBER 1
+#define TS_STREAM_TYPE_H264 0x1B
+#define TS_STREAM_ID_VIDEO 0xE0
+
+#define TS_CLOCK_RATE 90000
+
+//PAT and PMT go out before every access unit a decoder can start at, and
+//at least this often besides
+#define TS_TABLE_INTERVAL_MS 100
+
+//how far the PTS is ahead of the PCR sent with it. Receivers that keep to
+//the PCR hold a frame that long; gst_recv.sh doesn't, with sync=false
+#define TS_PTS_DELAY_MS 10
+
+//Muxes NALs into an MPEG-TS with one program and one H.264 stream (ISO
+//13818-1), without libavformat, so data_source_udp can send it to
+//gst_recv.sh or anything else that takes TS over UDP. Each access unit is
+//a PES starting with an access unit delimiter, added when the encoder
+//didn't put one there, with a PTS from its capture time, and its first TS
+//packet carries the PCR. The packets go out a datagram's worth at a time,
+//broadcast together with broadcast_batch, each datagram followed by
+//PACKET_PADDING_SIZE zero bytes. Filler NALs are left out, as they only
+//mark the end of the access unit. Every datagram but a batch's last is
+//full, so a data_source_udp with a segment_size of 7 packets sends them
+//just as they are, through UDP_SEGMENT where it can.
+//
+//An access unit is normally held until it is known to be complete, so its
+//PES can be given a length and a demuxer can pass it on as soon as it has
+//the last packet, instead of waiting for the next one to start. With
+//per_slice, each NAL is sent as soon as it is written, its last packet
+//stuffed, in a PES of unbounded length: the first slices leave earlier but
+//most demuxers then hold the access unit until the next begins.
+class data_source_ts: public data_source
+	{
+	public:
+	data_source_ts( bool per_slice = false, size_t packets_per_datagram = TS_PACKETS_PER_DATAGRAM );
+	~data_source_ts();
+	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+
+	//a batch without descriptors is taken to be one access unit
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
+
+	//sends the access unit gathered so far
+	void flush();
+	packet_server server;
+
+	uint64_t packets;
+	uint64_t datagrams;
+	uint64_t access_units;
+	uint64_t tables;        //times PAT and PMT were sent
+	uint64_t stuffing;      //bytes of adaptation field stuffing
+
+	private:
+	void start_access_unit( const nal_info & info );
+	void add_nal( const uint8_t * data, size_t bytes );
+	void add_tables();
+	void add_section( uint16_t pid, uint8_t & continuity, const uint8_t * section, size_t bytes );
+	void add_pes( bool unit_start, bool bounded );
+	uint8_t * add_packet( uint16_t pid, bool unit_start, uint8_t & continuity, size_t adaptation_bytes );
+	void send();
+
+	nal_parser parser;
+	bool per_slice;
+	size_t packets_per_datagram;
+	uint8_t pat_continuity;
+	uint8_t pmt_continuity;
+	uint8_t video_continuity;
+	uint64_t last_tables_us;    //0 until they have been sent
+
+	//the access unit under way: when it was captured, whether a decoder
+	//could start there, and whether any of it has been packetized yet
+	bool in_access_unit;
+	uint64_t au_timestamp_us;
+	bool au_random_access;
+	bool au_started;
+
+	//the PES, or the part of it not yet packetized, then the datagrams
+	//it makes, end to end, each followed by padding
+	std::vector<uint8_t> pes;
+	std::vector<uint8_t> buffer;
+	std::vector<size_t> datagram_starts;
+	size_t in_datagram;
+	std::vector<struct iovec> iov;
+	};
+
+#endif
@@ -1,4 +1,5 @@
 //RSA: bits taken from http://www.gamedev.net/topic/310343-udp-client-server-echo-example/
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -9,32 +10,81 @@
 #include <unistd.h>
 #include <string.h>
 #include <sys/time.h>
+#include <net/if.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <time.h>
 
 #include "config.h"
+#include "data_source_rtp.h"
+
+//packets per sendmmsg() call
+#define UDP_BATCH_SIZE 64
+
+//segments the kernel takes per UDP_SEGMENT send, and bytes per send
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES 65000
+
+#ifndef SOL_UDP
+	#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+	#define UDP_SEGMENT 103
+#endif
 
 #include <iostream>
 #include "data_source_udp.h"
 
-data_source_udp::data_source_udp( const char * hostname, int portno )
+//with getaddrinfo, as viewers make these from their own threads
+static bool resolve( const char * hostname, int portno, struct sockaddr_in & address )
+{
+struct addrinfo hints;
+struct addrinfo *h;
+memset(&hints, 0, sizeof(hints));
+hints.ai_family = AF_INET;
+hints.ai_socktype = SOCK_DGRAM;
+if(getaddrinfo(hostname, NULL, &hints, &h) != 0)
+	{
+	printf("UDP: unknown host '%s' \n", hostname);
+	return false;
+	}
+memcpy(&address, h->ai_addr, sizeof(address));
+address.sin_port = htons(portno);
+freeaddrinfo(h);
+
+char text[INET_ADDRSTRLEN];
+inet_ntop(AF_INET, &address.sin_addr, text, sizeof(text));
+printf("UDP: sending data to '%s' (IP : %s%s) \n", hostname, text, IN_MULTICAST( ntohl( address.sin_addr.s_addr ) ) ? ", multicast" : "");
+return true;
+}
+
+static uint64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+data_source_udp::data_source_udp( const char * hostname, int portno, size_t segment_size ) : segment_size( segment_size )
 {
 sd = -1;
-int rc, i, n, echoLen, error;
-struct sockaddr_in cliAddr, echoServAddr;
-struct hostent *h;
+use_gso = false;
+history = NULL;
+stopping.store( false );
+send_errors.store( 0 );
+failed.store( false );
+pacing_us = 0;
+kernel_paced_frames.store( 0 );
+int rc;
+struct sockaddr_in cliAddr;
 
 /* get server IP address */
-h = gethostbyname(hostname);
-if(h==NULL)
+struct sockaddr_in remoteServAddr;
+if( !resolve( hostname, portno, remoteServAddr ) )
 	{
-	printf("UDP: unknown host '%s' \n", hostname);
 	exit(1);
 	}
-
-printf("UDP: sending data to '%s' (IP : %s) \n", h->h_name, inet_ntoa(*(struct in_addr *)h->h_addr_list[0]));
-
-remoteServAddr.sin_family = h->h_addrtype;
-memcpy((char *) &remoteServAddr.sin_addr.s_addr, h->h_addr_list[0], h->h_length);
-remoteServAddr.sin_port = htons(UDP_PORT_NUMBER);
+destinations.push_back( remoteServAddr );
 
 /* socket creation */
 sd = socket(AF_INET,SOCK_DGRAM,0);
@@ -56,23 +106,575 @@ if(rc<0)
 	sd=-1;
 	}
 
+/* the host may be a broadcast address */
+int flag = 1;
+if( sd >= 0 && setsockopt( sd, SOL_SOCKET, SO_BROADCAST, &flag, sizeof( flag ) ) < 0 )
+	{
+	printf("UDP: unable to set SO_BROADCAST\n");
+	}
+
+/* kernels without UDP GSO don't know the option */
+flag = 0;
+if( sd >= 0 && segment_size > 0 )
+	{
+	use_gso = setsockopt( sd, SOL_UDP, UDP_SEGMENT, &flag, sizeof( flag ) ) == 0;
+	printf("UDP: %i byte segments, %s\n", (int)segment_size, use_gso ? "cut by the kernel" : "no UDP_SEGMENT, using sendmmsg");
+	}
 }
 
 data_source_udp::~data_source_udp()
 {
+flush();
+stop_feedback();
+delete history;
 if( sd >= 0 )
 	{
 	close( sd );
 	}
 }
 
-void data_source_udp::write( const uint8_t * data, size_t bytes )
+bool data_source_udp::add_destination( const char * hostname, int portno )
 {
-if( sendto(sd, data, bytes, 0, (struct sockaddr *) &remoteServAddr, sizeof(remoteServAddr)) < 0 )
+struct sockaddr_in address;
+if( !resolve( hostname, portno, address ) )
+	{
+	return false;
+	}
+destinations.push_back( address );
+return true;
+}
+
+bool data_source_udp::multicast( int ttl, const char * interface, bool loopback )
+{
+if( sd < 0 )
+	{
+	return false;
+	}
+bool ok = true;
+unsigned char value = ttl;
+if( setsockopt( sd, IPPROTO_IP, IP_MULTICAST_TTL, &value, sizeof( value ) ) < 0 )
+	{
+	printf("UDP: unable to set IP_MULTICAST_TTL\n");
+	ok = false;
+	}
+value = loopback;
+if( setsockopt( sd, IPPROTO_IP, IP_MULTICAST_LOOP, &value, sizeof( value ) ) < 0 )
+	{
+	printf("UDP: unable to set IP_MULTICAST_LOOP\n");
+	ok = false;
+	}
+if( interface )
+	{
+	struct ip_mreqn request;
+	memset( &request, 0, sizeof( request ) );
+	if( inet_pton( AF_INET, interface, &request.imr_address ) != 1 )
+		{
+		request.imr_ifindex = if_nametoindex( interface );
+		}
+	if( setsockopt( sd, IPPROTO_IP, IP_MULTICAST_IF, &request, sizeof( request ) ) < 0 )
+		{
+		printf("UDP: unable to send multicast on '%s'\n", interface);
+		ok = false;
+		}
+	}
+return ok;
+}
+
+//from whichever thread sends, so the socket stays open, unused, until the
+//destructor has stopped the others
+void data_source_udp::fail()
+{
+if( !failed.exchange( true ) )
 	{
 	printf("UDP: could not send data\n");
-	close(sd);
-	sd=-1;
 	}
 }
 
+void data_source_udp::write( const uint8_t * data, size_t bytes )
+{
+if( sd < 0 || failed.load() )
+	{
+	return;
+	}
+struct iovec v;
+v.iov_base = (void *)data;
+v.iov_len = bytes;
+if( pacing_us )
+	{
+	write_batch( &v, 1 );
+	return;
+	}
+if( destinations.size() == 1 && history == NULL )
+	{
+	if( sendto(sd, data, bytes, 0, (struct sockaddr *) &destinations[0], sizeof(destinations[0])) < 0 )
+		{
+		fail();
+		}
+	return;
+	}
+send_datagrams( &v, 1 );
+}
+
+//gathers NALs until the access unit is known to be complete
+void data_source_udp::write( const uint8_t * data, size_t bytes, const nal_info & info )
+{
+if( info.access_unit_start )
+	{
+	flush();
+	}
+frame.insert( frame.end(), data, data + bytes );
+nal_sizes.push_back( bytes );
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void data_source_udp::flush()
+{
+if( nal_sizes.empty() )
+	{
+	return;
+	}
+frame_iov.clear();
+size_t offset = 0;
+for( size_t i = 0; i < nal_sizes.size(); ++i )
+	{
+	struct iovec v;
+	v.iov_base = &frame[offset];
+	v.iov_len = nal_sizes[i];
+	frame_iov.push_back( v );
+	offset += nal_sizes[i];
+	}
+write_batch( &frame_iov[0], frame_iov.size() );
+
+frame.clear();
+nal_sizes.clear();
+}
+
+void data_source_udp::write_batch( const struct iovec * iov, int count )
+{
+if( sd < 0 || failed.load() || count <= 0 )
+	{
+	return;
+	}
+if( pacing_us )
+	{
+	kernel_paced( iov, count );
+	}
+if( segment_size > 0 )
+	{
+	send_segmented( iov, count );
+	}
+else
+	{
+	send_datagrams( iov, count );
+	}
+}
+
+//a whole access unit goes straight out, anything else is gathered by its
+//descriptors as write() gathers NALs
+void data_source_udp::write_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+bool whole = nal_sizes.empty() && count > 0 && infos[count - 1].access_unit_end;
+for( int i = 1; whole && i < count; ++i )
+	{
+	whole = !infos[i].access_unit_start;
+	}
+if( whole )
+	{
+	write_batch( iov, count );
+	return;
+	}
+for( int i = 0; i < count; ++i )
+	{
+	write( (const uint8_t *)iov[i].iov_base, iov[i].iov_len, infos[i] );
+	}
+}
+
+//a datagram per entry, and per destination. Each goes to every viewer
+//before the next, so none has to wait for the whole frame to go to the
+//others first
+void data_source_udp::send_datagrams( const struct iovec * iov, int count )
+{
+if( history )
+	{
+	history->keep( iov, count );
+	}
+size_t viewers = destinations.size();
+messages.resize( count * viewers );
+memset( &messages[0], 0, messages.size() * sizeof( messages[0] ) );
+for( int i = 0; i < count; ++i )
+	{
+	for( size_t d = 0; d < viewers; ++d )
+		{
+		struct mmsghdr & m = messages[i * viewers + d];
+		m.msg_hdr.msg_name = &destinations[d];
+		m.msg_hdr.msg_namelen = sizeof( destinations[d] );
+		m.msg_hdr.msg_iov = (struct iovec *)&iov[i];
+		m.msg_hdr.msg_iovlen = 1;
+		}
+	}
+send_messages( messages.size() );
+}
+
+//the first count messages, UDP_BATCH_SIZE to a sendmmsg(). Returns false
+//if the socket has failed
+bool data_source_udp::send_messages( size_t count )
+{
+//sendmmsg may stop short, carry on from the first unsent packet
+size_t sent = 0;
+while( sent < count )
+	{
+	size_t n = count - sent < UDP_BATCH_SIZE ? count - sent : UDP_BATCH_SIZE;
+	int rc = sendmmsg( sd, &messages[sent], n, 0 );
+	if( rc < 0 )
+		{
+		if( errno == EINTR )
+			{
+			continue;
+			}
+
+		//one viewer out of reach mustn't cut off the others
+		if( destinations.size() > 1 )
+			{
+			send_errors++;
+			sent++;
+			continue;
+			}
+		fail();
+		return false;
+		}
+	sent += rc;
+	}
+return true;
+}
+
+//the entries as one byte stream, cut into segment_size datagrams
+void data_source_udp::send_segmented( const struct iovec * iov, int count )
+{
+//cut the entries into pieces, no piece crossing a segment boundary
+pieces.clear();
+segment_starts.clear();
+size_t room = 0;
+for( int i = 0; i < count; ++i )
+	{
+	const uint8_t * p = (const uint8_t *)iov[i].iov_base;
+	size_t left = iov[i].iov_len;
+	while( left > 0 )
+		{
+		if( room == 0 )
+			{
+			segment_starts.push_back( pieces.size() );
+			room = segment_size;
+			}
+		size_t n = left < room ? left : room;
+		struct iovec v;
+		v.iov_base = (void *)p;
+		v.iov_len = n;
+		pieces.push_back( v );
+		p += n;
+		left -= n;
+		room -= n;
+		}
+	}
+size_t segments = segment_starts.size();
+segment_starts.push_back( pieces.size() );
+
+//the kernel cuts up to its limit of segments per send
+size_t per_send = UDP_GSO_MAX_BYTES / segment_size;
+per_send = per_send < UDP_GSO_MAX_SEGMENTS ? per_send : UDP_GSO_MAX_SEGMENTS;
+size_t done = 0;
+size_t refused = 0;     //segments of the send UDP_SEGMENT was refused for
+size_t served = 0;      //and the destinations they had already gone to
+while( use_gso && per_send > 1 && done < segments )
+	{
+	size_t n = segments - done < per_send ? segments - done : per_send;
+	size_t first = segment_starts[done];
+	size_t d = 0;
+	while( d < destinations.size() && send_gso( &pieces[first], segment_starts[done + n] - first, destinations[d] ) )
+		{
+		d++;
+		}
+	if( d < destinations.size() )
+		{
+		refused = n;
+		served = d;
+		break;
+		}
+	done += n;
+	}
+if( failed.load() || done == segments )
+	{
+	return;
+	}
+
+//otherwise a datagram per segment, and per destination, from sendmmsg,
+//but none again to a destination that already has it
+size_t viewers = destinations.size();
+messages.resize( ( segments - done ) * viewers );
+memset( &messages[0], 0, messages.size() * sizeof( messages[0] ) );
+size_t queued = 0;
+for( size_t i = 0; i < segments - done; ++i )
+	{
+	size_t first = segment_starts[done + i];
+	for( size_t d = i < refused ? served : 0; d < viewers; ++d )
+		{
+		struct mmsghdr & m = messages[queued++];
+		m.msg_hdr.msg_name = &destinations[d];
+		m.msg_hdr.msg_namelen = sizeof( destinations[d] );
+		m.msg_hdr.msg_iov = &pieces[first];
+		m.msg_hdr.msg_iovlen = segment_starts[done + i + 1] - first;
+		}
+	}
+send_messages( queued );
+}
+
+//one send to one destination, cut into segment_size datagrams by the
+//kernel. Returns false if the kernel or the device won't, having stopped
+//using UDP_SEGMENT, or the socket has failed
+bool data_source_udp::send_gso( struct iovec * iov, int count, const struct sockaddr_in & destination )
+{
+char control[CMSG_SPACE( sizeof( uint16_t ) )];
+memset( control, 0, sizeof( control ) );
+
+struct msghdr message;
+memset( &message, 0, sizeof( message ) );
+message.msg_name = (void *)&destination;
+message.msg_namelen = sizeof( destination );
+message.msg_iov = iov;
+message.msg_iovlen = count;
+message.msg_control = control;
+message.msg_controllen = sizeof( control );
+
+struct cmsghdr * cmsg = CMSG_FIRSTHDR( &message );
+cmsg->cmsg_level = SOL_UDP;
+cmsg->cmsg_type = UDP_SEGMENT;
+cmsg->cmsg_len = CMSG_LEN( sizeof( uint16_t ) );
+uint16_t size = segment_size;
+memcpy( CMSG_DATA( cmsg ), &size, sizeof( size ) );
+
+while( sendmsg( sd, &message, 0 ) < 0 )
+	{
+	if( errno == EINTR )
+		{
+		continue;
+		}
+	if( errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP )
+		{
+		printf("UDP: UDP_SEGMENT refused, using sendmmsg\n");
+		use_gso = false;
+		return false;
+		}
+	if( destinations.size() > 1 )
+		{
+		send_errors++;
+		return true;
+		}
+	fail();
+	return false;
+	}
+return true;
+}
+
+void data_source_udp::retransmit( int history_ms, int playout_ms )
+{
+if( sd < 0 || feedback.joinable() )
+	{
+	return;
+	}
+history = new rtp_send_history( history_ms, playout_ms );
+feedback = std::thread( &data_source_udp::feedback_loop, this );
+}
+
+void data_source_udp::receive_reports()
+{
+if( sd < 0 || feedback.joinable() )
+	{
+	return;
+	}
+feedback = std::thread( &data_source_udp::feedback_loop, this );
+}
+
+void data_source_udp::take_reports( std::vector<receiver_report> & reports )
+{
+receiver_reports.take( reports );
+}
+
+void data_source_udp::stop_feedback()
+{
+if( feedback.joinable() )
+	{
+	stopping.store( true );
+	feedback.join();
+	}
+}
+
+//reads RTCP off the socket until told to stop, answering NACKs and
+//keeping receiver reports
+void data_source_udp::feedback_loop()
+{
+uint8_t buffer[1500];
+struct pollfd descriptor;
+descriptor.fd = sd;
+descriptor.events = POLLIN;
+while( !stopping.load() && !failed.load() )
+	{
+	if( poll( &descriptor, 1, 100 ) <= 0 )
+		{
+		continue;
+		}
+	struct sockaddr_in from;
+	socklen_t from_size = sizeof( from );
+	ssize_t n = recvfrom( sd, buffer, sizeof( buffer ), MSG_DONTWAIT, (struct sockaddr *)&from, &from_size );
+	if( n <= 0 )
+		{
+		continue;
+		}
+
+	//a compound packet, each part's length in 32 bit words less one
+	const uint8_t * p = buffer;
+	const uint8_t * end = buffer + n;
+	const uint8_t * rr = NULL;
+	const uint8_t * app = NULL;
+	while( p + 4 <= end )
+		{
+		size_t length = ( ( ( p[2] << 8 ) | p[3] ) + 1 ) * 4;
+		if( p + length > end || ( p[0] >> 6 ) != RTP_VERSION )
+			{
+			break;
+			}
+		if( p[1] == RTCP_RR && ( p[0] & 0x1F ) >= 1 && length >= 32 )
+			{
+			rr = p;
+			}
+		if( p[1] == RTCP_APP && length >= 24 && memcmp( p + 8, RTCP_APP_RATE, 4 ) == 0 )
+			{
+			app = p;
+			}
+		if( p[1] == RTCP_RTPFB && ( p[0] & 0x1F ) == RTCP_NACK && length >= 16 && history )
+			{
+			uint64_t now = now_us();
+			history->nack_arrived( ( ( p[12] << 8 ) | p[13] ) + 1, now );
+			for( const uint8_t * f = p + 12; f + 4 <= p + length; f += 4 )
+				{
+				uint16_t first = ( f[0] << 8 ) | f[1];
+				uint16_t bitmap = ( f[2] << 8 ) | f[3];
+				nack( first, now, from );
+				for( int b = 0; b < 16; ++b )
+					{
+					if( bitmap & ( 1 << b ) )
+						{
+						nack( first + 1 + b, now, from );
+						}
+					}
+				}
+			}
+		p += length;
+		}
+	if( rr )
+		{
+		receiver_reports.arrived( rr, app, now_us() );
+		}
+	}
+}
+
+//resends a packet if it is still kept and can make its frame, only to the
+//viewer that asked where it is one of the destinations. Viewers NACK from
+//a port of their own, so they are known by address alone
+void data_source_udp::nack( uint16_t sequence, uint64_t now, const struct sockaddr_in & from )
+{
+if( !history->find( sequence, now, resend ) )
+	{
+	return;
+	}
+size_t first = 0;
+size_t end = destinations.size();
+for( size_t d = 0; d < destinations.size(); ++d )
+	{
+	if( destinations[d].sin_addr.s_addr == from.sin_addr.s_addr )
+		{
+		first = d;
+		end = d + 1;
+		break;
+		}
+	}
+bool resent = false;
+for( size_t d = first; d < end; ++d )
+	{
+	resent |= sendto( sd, &resend[0], resend.size(), 0, (struct sockaddr *)&destinations[d], sizeof( destinations[d] ) ) >= 0;
+	}
+if( resent )
+	{
+	history->retransmitted++;
+	}
+}
+
+bool data_source_udp::pace_in_kernel( int spread_us )
+{
+if( sd < 0 || spread_us <= 0 )
+	{
+	return false;
+	}
+
+//unlimited until the first frame
+unsigned int rate = ~0U;
+if( setsockopt( sd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof( rate ) ) < 0 )
+	{
+	printf( "UDP: SO_MAX_PACING_RATE refused\n" );
+	return false;
+	}
+
+//fq paces a UDP_SEGMENT send as one packet
+pacing_us = spread_us;
+use_gso = false;
+char qdisc[32] = "";
+FILE * f = fopen( "/proc/sys/net/core/default_qdisc", "r" );
+if( f )
+	{
+	if( fscanf( f, "%31s", qdisc ) != 1 )
+		{
+		qdisc[0] = 0;
+		}
+	fclose( f );
+	}
+printf( "UDP: frames paced by the kernel over %i us%s%s\n", spread_us,
+	strcmp( qdisc, "fq" ) ? ", if the interface has the fq qdisc; the default is " : "", strcmp( qdisc, "fq" ) ? qdisc : "" );
+return true;
+}
+
+//the kernel sends the frame over pacing_us, every copy of it included.
+//When the last datagram leaves isn't known here, so no delay is recorded
+void data_source_udp::kernel_paced( const struct iovec * iov, int count )
+{
+size_t bytes = 0;
+for( int i = 0; i < count; ++i )
+	{
+	bytes += iov[i].iov_len;
+	}
+bytes *= destinations.size();
+unsigned int rate = (unsigned int)( bytes * 1000000 / pacing_us );
+setsockopt( sd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof( rate ) );
+kernel_paced_frames++;
+}
+
+void data_source_udp::report() const
+{
+if( history )
+	{
+	history->report();
+	}
+if( kernel_paced_frames.load() )
+	{
+	printf( "UDP: %llu frames paced over %.2f ms by the kernel, delay not measured\n",
+		(unsigned long long)kernel_paced_frames.load(), pacing_us / 1e3 );
+	}
+if( receiver_reports.received.load() )
+	{
+	printf( "UDP: %llu receiver reports\n", (unsigned long long)receiver_reports.received.load() );
+	}
+if( destinations.size() > 1 )
+	{
+	printf( "UDP: %i destinations, %llu datagrams not sent\n", (int)destinations.size(), (unsigned long long)send_errors.load() );
+	}
+}
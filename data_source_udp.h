@@ -1,21 +1,107 @@
 #ifndef DATA_SOURCE_UDP_H
 #define DATA_SOURCE_UDP_H
 
+#include <atomic>
+#include <thread>
+#include <vector>
 #include <stddef.h>
 #include <stdint.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 #include "data_source.h"
+#include "data_source_rtp.h"
+#include "receiver_report_queue.h"
+#include "rtp_send_history.h"
 
-//sends a UDP packet per write (unless fragged)
+//Sends a datagram per write, and an access unit, gathered from described
+//NALs or given as a batch, with as few syscalls as it can: one sendmmsg(),
+//or with a segment_size (normally x264's slice-max-size) the access unit as
+//a byte stream cut into datagrams of that size, through UDP_SEGMENT where
+//the kernel has it. Every datagram goes to each destination. With RTP,
+//retransmit() answers the viewers' NACKs from an rtp_send_history, and the
+//same thread keeps their receiver reports for the rate_controller.
 class data_source_udp: public data_source
 	{
 	public:
-	data_source_udp(const char * hostname, int portno);
+	data_source_udp(const char * hostname, int portno, size_t segment_size = 0);
 	~data_source_udp();
 	void write( const uint8_t * data, size_t bytes );
+	void write( const uint8_t * data, size_t bytes, const nal_info & info );
+	void write_batch( const struct iovec * iov, int count );
+	void write_batch( const struct iovec * iov, int count, const nal_info * infos );
+
+	//sends whatever access unit has been gathered so far
+	void flush();
+
+	//whether UDP_SEGMENT is being used, and a way to turn it off to compare
+	bool gso() const { return use_gso; }
+	void disable_gso() { use_gso = false; }
+
+	//another viewer to send the stream to. Add them before retransmit(),
+	//from the thread that writes
+	bool add_destination( const char * hostname, int portno );
+	size_t destination_count() const { return destinations.size(); }
+
+	//for a multicast group: how many routers the datagrams may cross, the
+	//interface to send them on, by name or address, NULL for the default,
+	//and whether they are looped back to viewers on this host
+	bool multicast( int ttl, const char * interface = NULL, bool loopback = true );
+
+	//keeps history_ms worth of sent packets to answer NACKs with
+	void retransmit( int history_ms, int playout_ms );
+	const rtp_send_history * retransmission() const { return history; }
+
+	//keeps the viewers' receiver reports, without keeping anything to
+	//resend unless retransmit() is called first
+	void receive_reports();
+
+	//moves the reports that came since the last call to reports
+	void take_reports( std::vector<receiver_report> & reports );
+
+	//has the kernel spread each access unit over spread_us, through
+	//SO_MAX_PACING_RATE, which only the fq qdisc honours. False if the
+	//socket won't; a data_source_pacer does it by timer anywhere
+	bool pace_in_kernel( int spread_us );
+
+	//prints the retransmission counters and send_errors
+	void report() const;
+
+	std::atomic<uint64_t> send_errors;   //datagrams a viewer was skipped for
+	std::atomic<uint64_t> kernel_paced_frames;
+
 	private:
+	void send_datagrams( const struct iovec * iov, int count );
+	void send_segmented( const struct iovec * iov, int count );
+	bool send_gso( struct iovec * pieces, int count, const struct sockaddr_in & destination );
+	bool send_messages( size_t count );
+	void fail();
+	void feedback_loop();
+	void nack( uint16_t sequence, uint64_t now, const struct sockaddr_in & from );
+	void stop_feedback();
+	void kernel_paced( const struct iovec * iov, int count );
+
+	rtp_send_history * history;   //NULL unless retransmitting
+	std::vector<uint8_t> resend;
+	receiver_report_queue receiver_reports;
+	std::thread feedback;
+	std::atomic<bool> stopping;
+
 	int sd;
-	struct sockaddr_in remoteServAddr;
+	std::atomic<bool> failed;   //set by whichever thread sends, sd closed by the destructor
+	std::vector<struct sockaddr_in> destinations;
+	size_t segment_size;
+	bool use_gso;
+	int pacing_us;              //by the kernel, 0 if not
+
+	//the access unit being gathered, and its NALs' lengths
+	std::vector<uint8_t> frame;
+	std::vector<size_t> nal_sizes;
+	std::vector<struct iovec> frame_iov;
+
+	//reused from send to send
+	std::vector<struct iovec> pieces;
+	std::vector<size_t> segment_starts;   //first piece of each datagram
+	std::vector<struct mmsghdr> messages;   //a datagram for each destination
 	};
 
 #endif
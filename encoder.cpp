@@ -16,10 +16,26 @@ extern "C" {
 #include <deque>
 #include <algorithm>
 
+#include <signal.h>
+#include <unistd.h>
+
 #include "config.h"
+#include "data_source_seqpacket.h"
+#include "data_source_shm.h"
+#include "writev_all.h"
 
 using namespace std;
 
+// set by SIGINT or SIGTERM, so the capture loop ends and the local sink is
+// deleted, which is how a viewer on the shm ring or seqpacket socket learns
+// the encoder has gone
+static volatile sig_atomic_t stopping = 0;
+
+void stop( int )
+{
+    stopping = 1;
+}
+
 
 __u32 string_to_fourcc( const string& fourcc )
 {
@@ -182,9 +198,20 @@ double stdev( const Cont& v )
 int main( int argc, char** argv )
 {
     string device = "/dev/video0";
-    if( argc == 2 )
+    if( argc >= 2 )
         device = argv[1];
 
+    // "shm" hands frames to viewer_shm through shared memory instead of
+    // writing them to stdout, and "seqpacket" serves them, a message per
+    // frame, to any number of seqpacket_readers on this host
+    data_source * local = NULL;
+    data_source_shm * shm = NULL;
+    data_source_seqpacket * seqpacket = NULL;
+    if( argc >= 3 && string( argv[2] ) == "shm" )
+        local = shm = new data_source_shm();
+    if( argc >= 3 && string( argv[2] ) == "seqpacket" )
+        local = seqpacket = new data_source_seqpacket( SEQPACKET_PATH, true );
+
     VideoCapture dev( device );
 
     cerr << "IO Methods:" << endl;
@@ -366,16 +393,24 @@ int main( int argc, char** argv )
 
     double prv = 0;
 
+    // each frame's NALs go out straight from x264's buffer in one writev(),
+    // and this is reused from frame to frame so encoding doesn't allocate
+    vector< struct iovec > iov;
+
+    //send out the first NAL header, each frame sends the next one's
+    static const unsigned char nal_header[4] = {0x00,0x00,0x00,0x01};
+    struct iovec first_header = make_iovec( nal_header, sizeof( nal_header ) );
+    if( local == NULL )
+        writev_all( STDOUT_FILENO, &first_header, 1 );
+
+    signal( SIGINT, stop );
+    signal( SIGTERM, stop );
+
     dev.StartCapture();
-    while( true )
+    while( !stopping )
     {
         prv = now();
 
-        //send out the NAL header
-        static const char nal_header[4] = {0x00,0x00,0x00,0x01};
-        fwrite( (const char*)nal_header, 1, sizeof( nal_header ), stdout );
-        fflush( stdout );
-
         const VideoCapture::Buffer& b = dev.LockFrame();
         uint8_t* ptr = reinterpret_cast< unsigned char* >( const_cast< char* >( b.start ) );
 
@@ -411,22 +446,47 @@ int main( int argc, char** argv )
         x264_picture_t pic_out;
         x264_encoder_encode( encoder, &nals, &num_nals, &pic_in, &pic_out );
 
-        // dump nals into a buffer
-        vector< unsigned char > buf;
-        for( int i = 0; i < num_nals; ++i )
+        // nothing came out, the header we sent is still waiting for a NAL
+        if( num_nals <= 0 )
+            continue;
+
+        iov.clear();
+        size_t frame_bytes = 0;
+        if( local )
         {
-            uint8_t* beg = nals[i].p_payload;
-            uint8_t* end = nals[i].p_payload + nals[i].i_payload;
-            buf.insert( buf.end(), beg, end );
+            // both keep NAL boundaries, so the frame goes in whole, start
+            // codes and all, as one access unit
+            for( int i = 0; i < num_nals; ++i )
+                iov.push_back( make_iovec( nals[i].p_payload, nals[i].i_payload ) );
+
+            acc["3 - encode(ms):    "].push_back( ( now() - prv ) * 1000.0 );
+
+            local->write_batch( &iov[0], iov.size() );
+            frame_bytes = iovec_bytes( &iov[0], iov.size() );
         }
+        else
+        {
+            // everything except the first NAL header, which we already sent
+            for( int i = 0; i < num_nals; ++i )
+            {
+                int skip = ( i == 0 ) ? 4 : 0;
+                iov.push_back( make_iovec( nals[i].p_payload + skip, nals[i].i_payload - skip ) );
+            }
 
-        acc["3 - encode(ms):    "].push_back( ( now() - prv ) * 1000.0 );
+            // a filler NAL can only come last in an access unit, so it tells
+            // the viewer's access_unit_assembler the frame is complete. The next
+            // frame's header follows straight away, so the viewer's destreamer
+            // can pass the filler on without waiting for the next frame
+            static const unsigned char end_of_frame[6] = { 0x00, 0x00, 0x00, 0x01, 0x0C, 0x80 };
+            iov.push_back( make_iovec( end_of_frame, sizeof( end_of_frame ) ) );
+            iov.push_back( make_iovec( nal_header, sizeof( nal_header ) ) );
 
-		//send everything except the first NAL header, which we already sent
-        fwrite( (const char*)&buf[4], 1, buf.size(), stdout );
-        fflush( stdout );
+            acc["3 - encode(ms):    "].push_back( ( now() - prv ) * 1000.0 );
+
+            frame_bytes = writev_all( STDOUT_FILENO, &iov[0], iov.size() );
+        }
 
-        acc["4 - bytes/frame:   "].push_back( buf.size() );
+        acc["4 - bytes/frame:   "].push_back( frame_bytes );
 
         static double start = now();
         if( now() - start > 5.0 )
@@ -443,6 +503,10 @@ int main( int argc, char** argv )
                 cerr << "\t" << "Stdev: " << ( stdev( arr ) );
                 cerr << endl;
             }
+            if( shm )
+                shm->report();
+            if( seqpacket )
+                seqpacket->report();
             cerr << endl;
 
             start = now();
@@ -451,6 +515,7 @@ int main( int argc, char** argv )
 
     dev.StopCapture();
     x264_encoder_close( encoder );
+    delete local;
 
     return 0;
 }
@@ -5,6 +5,7 @@ extern "C" {
 #include <libavutil/pixfmt.h>
 #include <x264.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 }
@@ -20,6 +21,14 @@ extern "C" {
 #include <algorithm>
 
 #include "config.h"
+#include "access_unit_assembler.h"
+#include "data_source_fec.h"
+#include "data_source_pacer.h"
+#include "data_source_rtp.h"
+#include "data_source_tcp_server.h"
+#include "data_source_ts.h"
+#include "data_source_udp.h"
+#include "rate_controller.h"
 
 using namespace std;
 
@@ -150,6 +159,17 @@ double now()
 }
 
 
+// the clock nal_info timestamps are in, which the sinks stamp PTS and
+// RTP timestamps from
+uint64_t wall_clock_us()
+{
+    timespec temp;
+    clock_gettime( CLOCK_REALTIME, &temp );
+
+    return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+
 template< typename Cont >
 double median( const Cont& arr )
 {
@@ -187,12 +207,41 @@ int main( int argc, char** argv )
     string device = "/dev/video0";
     string ip = "192.168.0.255";
     unsigned short port = UDP_PORT_NUMBER;
+    bool rtp_mode = false;
+    bool fec_mode = false;
+    bool tcp_mode = false;
+    bool ts_mode = false;
+    int ttl = 1;
+    const char * interface = NULL;
+    int pace_percent = 0;
+    bool kernel_pacing = false;
     if( argc >= 2 )
         device = argv[1];
     if( argc >= 3 )
         ip = argv[2];
     if( argc >= 4 )
         port = atoi( argv[3] );
+    if( argc >= 5 )
+    {
+        // fec is RTP with parity packets added
+        fec_mode = string( argv[4] ) == "fec";
+        rtp_mode = fec_mode || string( argv[4] ) == "rtp";
+        // tcp listens on the port for viewers instead, ip unused
+        tcp_mode = string( argv[4] ) == "tcp";
+        // ts is MPEG-TS, for gst_recv.sh to play as it is
+        ts_mode = string( argv[4] ) == "ts";
+    }
+    // for a multicast group, how far it may go and the interface it goes on
+    if( argc >= 6 )
+        ttl = atoi( argv[5] );
+    if( argc >= 7 )
+        interface = argv[6];
+    // spread each frame over this much of the frame interval, in percent,
+    // by SO_MAX_PACING_RATE if followed by "kernel"
+    if( argc >= 8 )
+        pace_percent = atoi( argv[7] );
+    if( argc >= 9 )
+        kernel_pacing = string( argv[8] ) == "kernel";
 
     VideoCapture dev( device );
 
@@ -375,31 +424,63 @@ int main( int argc, char** argv )
 
     double prv = 0;
 
-    /* Create socket for sending/receiving datagrams */
-    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if( sock < 0 )
-    {
-        cerr << "cannot open socket" <<endl;
-        exit( EXIT_FAILURE );
-    }
-
-
-    /* Set socket to allow broadcast */
-    int broadcastPermission = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (void *) &broadcastPermission, 
-          sizeof(broadcastPermission)) < 0)
+    // slices are sized to fit a datagram, and the sink cuts on the same size.
+    // Over RTP each packet is a datagram of its own, a slice in each but for
+    // the odd one too big that goes as FU-A fragments. FEC adds 2 parity
+    // packets for every 10, fewer for small frames.
+    // ip may be a multicast group, or a comma separated list of viewers who
+    // each get every datagram from the same sendmmsg() calls
+    vector< string > destinations;
+    istringstream ips( ip );
+    for( string d; getline( ips, d, ',' ); )
+        destinations.push_back( d );
+    // MPEG-TS goes 7 packets a datagram, so cut on that size instead
+    size_t segment_size = rtp_mode ? 0 : ts_mode ? TS_PACKETS_PER_DATAGRAM * TS_PACKET_SIZE : packetsize;
+    data_source_udp udp( destinations[0].c_str(), port, segment_size );
+    for( size_t i = 1; i < destinations.size(); ++i )
+        udp.add_destination( destinations[i].c_str(), port );
+    if( IN_MULTICAST( ntohl( inet_addr( destinations[0].c_str() ) ) ) )
+        udp.multicast( ttl, interface );
+    // a frame sent at once can overflow an access point's queue, so it may
+    // be spread over part of the frame interval, by the kernel where it can
+    int spread_us = pace_percent * 10000 / f;
+    bool paced = pace_percent > 0 && !( kernel_pacing && udp.pace_in_kernel( spread_us ) );
+    data_source_pacer pacer( paced ? spread_us : 0, segment_size );
+    pacer.server.register_callback( &udp );
+    data_source * out = paced ? (data_source *)&pacer : (data_source *)&udp;
+    data_source_fec fec( 10, 2 );
+    fec.server.register_callback( out );
+    data_source_rtp rtp;
+    rtp.server.register_callback( fec_mode ? (data_source *)&fec : out );
+
+    // answer the viewers' NACKs while a resent packet can still make its
+    // frame, giving viewers 100ms to show it
+    if( rtp_mode )
+        udp.retransmit( 500, 100 );
+    data_source_ts ts;
+    ts.server.register_callback( out );
+    data_source & sink = rtp_mode ? (data_source &)rtp : ts_mode ? (data_source &)ts : *out;
+
+    // over TCP frames go whole to each viewer, and a viewer that can't keep
+    // up skips to the next keyframe rather than falling further behind
+    data_source_tcp_server * tcp = NULL;
+    access_unit_assembler frames;
+    if( tcp_mode )
     {
-        cerr << "failed to setsockopt(SO_BROADCAST)" <<endl;
-        exit( EXIT_FAILURE );
+        tcp = new data_source_tcp_server( port );
+        tcp->bound_latency();
+        frames.server.register_callback( tcp );
     }
 
-    /* Construct local address structure */
-    struct sockaddr_in broadcastAddr;
-    memset(&broadcastAddr, 0, sizeof(broadcastAddr));     /* Zero out structure */
-    broadcastAddr.sin_family = AF_INET;                   /* Internet address family */
-    broadcastAddr.sin_addr.s_addr = inet_addr(ip.c_str());/* Broadcast IP address */
-    broadcastAddr.sin_port = htons(port);                 /* Broadcast port */
+    // over RTP the viewers report back what got through, and the rate
+    // follows their link, up to ten times what it starts at
+    rate_controller control( maxrate, RATE_MIN_KBPS, 10 * maxrate );
+    vector< receiver_report > reports;
 
+    // reused from frame to frame, so sending doesn't allocate
+    vector< struct iovec > iov;
+    vector< nal_info > infos;
+    nal_parser parser;
 
     dev.StartCapture();
     while( true )
@@ -407,6 +488,7 @@ int main( int argc, char** argv )
         prv = now();
 
         const VideoCapture::Buffer& b = dev.LockFrame();
+        uint64_t capture_us = wall_clock_us();
         uint8_t* ptr = reinterpret_cast< unsigned char* >( const_cast< char* >( b.start ) );
 
         acc["1 - capture(ms):    "].push_back( ( now() - prv ) * 1000.0 );
@@ -435,37 +517,62 @@ int main( int argc, char** argv )
 
         prv = now();
 
+        // a new rate takes effect from this frame, the VBV buffer still
+        // a frame's worth so no frame waits behind the one before
+        if( rtp_mode )
+        {
+            udp.take_reports( reports );
+            int rate = control.update( reports, (uint64_t)( prv * 1e6 ) );
+            if( rate != param.rc.i_bitrate )
+            {
+                x264_encoder_parameters( encoder, &param );
+                param.rc.i_bitrate = rate;
+                param.rc.i_vbv_max_bitrate = rate;
+                param.rc.i_vbv_buffer_size = max( rate / f, 1 );
+                x264_encoder_reconfig( encoder, &param );
+            }
+        }
+
         // Encode frame
         x264_nal_t* nals;
         int num_nals;
         x264_picture_t pic_out;
+
+        // the capture time rides through x264 as the PTS, which zerolatency
+        // leaves alone, so the NALs that come out carry their own frame's time
+        pic_in.i_pts = capture_us;
         x264_encoder_encode( encoder, &nals, &num_nals, &pic_in, &pic_out );
 
-        // dump nals into a buffer
-        vector< unsigned char > buf;
+        acc["3 - encode(ms):    "].push_back( ( now() - prv ) * 1000.0 );
+
+        // straight from x264's buffer, the whole frame in one sendmmsg()
+        // or UDP_SEGMENT send. Each NAL is described, so the TS and RTP
+        // stages stamp the frame with when it was captured, not when it
+        // reached them
+        iov.resize( num_nals );
+        infos.resize( num_nals );
+        size_t frame_bytes = 0;
         for( int i = 0; i < num_nals; ++i )
         {
-            uint8_t* beg = nals[i].p_payload;
-            uint8_t* end = nals[i].p_payload + nals[i].i_payload;
-            buf.insert( buf.end(), beg, end );
+            iov[i].iov_base = nals[i].p_payload;
+            iov[i].iov_len = nals[i].i_payload;
+            frame_bytes += nals[i].i_payload;
+
+            parser.parse( nals[i].p_payload, nals[i].i_payload, infos[i] );
+            infos[i].access_unit_start = i == 0;
+            infos[i].access_unit_end = i == num_nals - 1;
+            infos[i].timestamp_us = pic_out.i_pts;
         }
-
-        acc["3 - encode(ms):    "].push_back( ( now() - prv ) * 1000.0 );
-
-		//send everything except the first NAL header, which we already sent
-                 /* Broadcast sendString in datagram to clients every 3 seconds*/
-        //int txSize = buf.size()-4;
-        //if (sendto(sock, (const char*)&buf[4], txSize, 0, (struct sockaddr *) 
-        int txSize = buf.size();
-        if (sendto(sock, (const char*)&buf[0], txSize, 0, (struct sockaddr *) 
-               &broadcastAddr, sizeof(broadcastAddr)) != txSize)
+        if( num_nals > 0 && tcp_mode )
         {
-            cerr << "failed to sendto" <<endl;
-            exit( EXIT_FAILURE );
+            frames.write_batch( &iov[0], num_nals );
+            frames.flush();
         }
-        cerr <<"Sent "<<txSize<<" bytes"<<endl;
+        else if( num_nals > 0 )
+            sink.write_batch( &iov[0], num_nals, &infos[0] );
+        cerr <<"Sent "<<frame_bytes<<" bytes"<<endl;
 
-        acc["4 - bytes/frame:   "].push_back( buf.size() );
+        acc["4 - bytes/frame:   "].push_back( frame_bytes );
 
         static double start = now();
         if( now() - start > 5.0 )
@@ -482,6 +589,14 @@ int main( int argc, char** argv )
                 cerr << "\t" << "Stdev: " << ( stdev( arr ) );
                 cerr << endl;
             }
+            if( rtp_mode || pace_percent > 0 )
+                udp.report();
+            if( paced )
+                pacer.report();
+            if( rtp_mode )
+                control.report();
+            if( tcp_mode )
+                tcp->report();
             cerr << endl;
 
             start = now();
@@ -490,6 +605,7 @@ int main( int argc, char** argv )
 
     dev.StopCapture();
     x264_encoder_close( encoder );
+    delete tcp;
 
     return 0;
 }
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "data_source_rtp.h"
+#include "fec_decoder.h"
+#include "gf256.h"
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//inverts the n by n matrix a in place by Gauss-Jordan elimination; the
+//Cauchy submatrices recovery uses always have an inverse
+static bool invert( uint8_t * a, int n )
+{
+uint8_t inverse[FEC_MAX_PARITY * FEC_MAX_PARITY];
+memset( inverse, 0, n * n );
+for( int i = 0; i < n; ++i )
+	{
+	inverse[i * n + i] = 1;
+	}
+
+for( int col = 0; col < n; ++col )
+	{
+	int pivot = col;
+	while( pivot < n && a[pivot * n + col] == 0 )
+		{
+		pivot++;
+		}
+	if( pivot == n )
+		{
+		return false;
+		}
+	for( int k = 0; k < n; ++k )
+		{
+		uint8_t t = a[col * n + k];
+		a[col * n + k] = a[pivot * n + k];
+		a[pivot * n + k] = t;
+		t = inverse[col * n + k];
+		inverse[col * n + k] = inverse[pivot * n + k];
+		inverse[pivot * n + k] = t;
+		}
+
+	uint8_t scale = gf256_inv( a[col * n + col] );
+	for( int k = 0; k < n; ++k )
+		{
+		a[col * n + k] = gf256_mul( a[col * n + k], scale );
+		inverse[col * n + k] = gf256_mul( inverse[col * n + k], scale );
+		}
+
+	for( int row = 0; row < n; ++row )
+		{
+		uint8_t factor = a[row * n + col];
+		if( row == col || factor == 0 )
+			{
+			continue;
+			}
+		for( int k = 0; k < n; ++k )
+			{
+			a[row * n + k] ^= gf256_mul( factor, a[col * n + k] );
+			inverse[row * n + k] ^= gf256_mul( factor, inverse[col * n + k] );
+			}
+		}
+	}
+
+memcpy( a, inverse, n * n );
+return true;
+}
+
+fec_decoder::fec_decoder() : history( FEC_HISTORY ), blocks( FEC_PENDING_BLOCKS )
+{
+for( size_t i = 0; i < history.size(); ++i )
+	{
+	history[i].used = false;
+	history[i].sequence = 0;
+	history[i].length = 0;
+	history[i].symbol.resize( FEC_MAX_PACKET + 2 );
+	}
+for( size_t i = 0; i < blocks.size(); ++i )
+	{
+	blocks[i].used = false;
+	blocks[i].done = false;
+	blocks[i].base = 0;
+	blocks[i].count = 0;
+	blocks[i].length = 0;
+	blocks[i].rows = 0;
+	blocks[i].parity.resize( FEC_MAX_PARITY * ( FEC_MAX_PACKET + 2 ) );
+	}
+next_block = 0;
+data_packets = 0;
+parity_packets = 0;
+recovered = 0;
+unrecovered = 0;
+decode_time = 0;
+}
+
+void fec_decoder::write( const uint8_t * data, size_t bytes )
+{
+if( bytes >= RTP_HEADER_SIZE + FEC_HEADER_SIZE && ( data[0] >> 6 ) == RTP_VERSION && ( data[1] & 0x7F ) == FEC_PAYLOAD_TYPE )
+	{
+	parity_packets++;
+	add_parity( data, bytes );
+	return;
+	}
+data_packets++;
+server.broadcast( data, bytes );
+keep( data, bytes );
+}
+
+void fec_decoder::keep( const uint8_t * data, size_t bytes )
+{
+if( bytes < RTP_HEADER_SIZE || bytes > FEC_MAX_PACKET )
+	{
+	return;
+	}
+uint16_t sequence = ( data[2] << 8 ) | data[3];
+kept_packet & slot = history[sequence % history.size()];
+slot.used = true;
+slot.sequence = sequence;
+slot.length = bytes + 2;
+slot.symbol[0] = bytes >> 8;
+slot.symbol[1] = bytes & 0xFF;
+memcpy( &slot.symbol[2], data, bytes );
+}
+
+fec_decoder::kept_packet * fec_decoder::find( uint16_t sequence )
+{
+kept_packet & slot = history[sequence % history.size()];
+return slot.used && slot.sequence == sequence ? &slot : NULL;
+}
+
+int fec_decoder::missing( const pending_block & block )
+{
+int n = 0;
+for( int i = 0; i < block.count; ++i )
+	{
+	if( find( block.base + i ) == NULL )
+		{
+		n++;
+		}
+	}
+return n;
+}
+
+void fec_decoder::add_parity( const uint8_t * data, size_t bytes )
+{
+const uint8_t * f = data + RTP_HEADER_SIZE;
+uint16_t base = ( f[0] << 8 ) | f[1];
+int count = f[2];
+int rows = f[3];
+int row = f[4];
+size_t length = ( f[6] << 8 ) | f[7];
+if( count < 1 || count > FEC_MAX_DATA || rows > FEC_MAX_PARITY || row >= rows ||
+    length > FEC_MAX_PACKET + 2 || bytes < RTP_HEADER_SIZE + FEC_HEADER_SIZE + length )
+	{
+	return;
+	}
+
+pending_block * block = NULL;
+for( size_t i = 0; i < blocks.size(); ++i )
+	{
+	if( blocks[i].used && blocks[i].base == base && blocks[i].count == count && blocks[i].length == length )
+		{
+		block = &blocks[i];
+		break;
+		}
+	}
+if( block == NULL )
+	{
+	//the oldest block makes way, counting what it never got back
+	block = &blocks[next_block];
+	next_block = ( next_block + 1 ) % blocks.size();
+	if( block->used && !block->done )
+		{
+		unrecovered += missing( *block );
+		}
+	block->used = true;
+	block->done = false;
+	block->base = base;
+	block->count = count;
+	block->length = length;
+	block->rows = 0;
+	}
+if( block->done || ( block->rows & ( 1u << row ) ) )
+	{
+	return;
+	}
+memcpy( &block->parity[row * length], f + FEC_HEADER_SIZE, length );
+block->rows |= 1u << row;
+recover( *block );
+}
+
+//rebuilds the block's missing packets once there is a parity row for each
+void fec_decoder::recover( pending_block & block )
+{
+lost.clear();
+for( int i = 0; i < block.count; ++i )
+	{
+	if( find( block.base + i ) == NULL )
+		{
+		lost.push_back( i );
+		}
+	}
+if( lost.empty() )
+	{
+	block.done = true;
+	return;
+	}
+used_rows.clear();
+for( int j = 0; j < FEC_MAX_PARITY && used_rows.size() < lost.size(); ++j )
+	{
+	if( block.rows & ( 1u << j ) )
+		{
+		used_rows.push_back( j );
+		}
+	}
+if( used_rows.size() < lost.size() )
+	{
+	return;
+	}
+
+double start = now();
+int n = lost.size();
+size_t length = block.length;
+
+//each row's parity less what the packets that did arrive put in it leaves
+//a combination of just the missing ones
+syndromes.resize( n * length );
+for( int a = 0; a < n; ++a )
+	{
+	uint8_t * s = &syndromes[a * length];
+	memcpy( s, &block.parity[used_rows[a] * length], length );
+	for( int i = 0; i < block.count; ++i )
+		{
+		kept_packet * kept = find( block.base + i );
+		if( kept == NULL )
+			{
+			continue;
+			}
+		if( kept->length < length )
+			{
+			memset( &kept->symbol[kept->length], 0, length - kept->length );
+			}
+		gf256_mul_add( s, &kept->symbol[0], fec_coefficient( used_rows[a], i ), length );
+		}
+	}
+
+uint8_t matrix[FEC_MAX_PARITY * FEC_MAX_PARITY];
+for( int a = 0; a < n; ++a )
+	{
+	for( int b = 0; b < n; ++b )
+		{
+		matrix[a * n + b] = fec_coefficient( used_rows[a], lost[b] );
+		}
+	}
+block.done = true;
+if( !invert( matrix, n ) )
+	{
+	unrecovered += n;
+	return;
+	}
+
+rebuilt.resize( length + PACKET_PADDING_SIZE );
+for( int b = 0; b < n; ++b )
+	{
+	memset( &rebuilt[0], 0, rebuilt.size() );
+	for( int a = 0; a < n; ++a )
+		{
+		gf256_mul_add( &rebuilt[0], &syndromes[a * length], matrix[b * n + a], length );
+		}
+	size_t bytes = ( rebuilt[0] << 8 ) | rebuilt[1];
+	uint16_t sequence = ( rebuilt[4] << 8 ) | rebuilt[5];
+	if( bytes < RTP_HEADER_SIZE || bytes + 2 > length || sequence != (uint16_t)( block.base + lost[b] ) )
+		{
+		unrecovered++;
+		continue;
+		}
+	keep( &rebuilt[2], bytes );
+	server.broadcast( &rebuilt[2], bytes );
+	recovered++;
+	}
+decode_time += now() - start;
+}
+
+void fec_decoder::report() const
+{
+printf( "FEC: %llu data packets, %llu parity, %llu recovered, %llu not, %.3f ms rebuilding\n",
+	(unsigned long long)data_packets, (unsigned long long)parity_packets,
+	(unsigned long long)recovered, (unsigned long long)unrecovered, decode_time * 1e3 );
+}
@@ -0,0 +1,75 @@
+#ifndef FEC_DECODER_H
+#define FEC_DECODER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "data_source_fec.h"
+#include "packet_server.h"
+
+//data packets kept for rebuilding others, and blocks waiting on parity
+#define FEC_HISTORY 256
+#define FEC_PENDING_BLOCKS 8
+
+//Takes the parity packets a data_source_fec added back out of an RTP
+//stream, using them to rebuild the data packets that never arrived. It goes
+//in front of an rtp_depacketizer, one packet per write. Data packets are
+//passed on as they come and kept for a while. When a block's parity shows
+//some are missing, and enough of it has arrived to make up for them, they
+//are rebuilt and passed on too, late, for the depacketizer's reorder window
+//to put back in place. Parity follows its block's data, so a lost slice is
+//normally back before the next frame starts.
+class fec_decoder: public data_source
+	{
+	public:
+	fec_decoder();
+	void write( const uint8_t * data, size_t bytes );
+	packet_server server;
+
+	//prints the counters below
+	void report() const;
+
+	uint64_t data_packets;
+	uint64_t parity_packets;
+	uint64_t recovered;
+	uint64_t unrecovered;   //missing from blocks given up on
+	double decode_time;     //seconds spent rebuilding
+
+	private:
+	struct kept_packet
+		{
+		bool used;
+		uint16_t sequence;
+		size_t length;                  //of the symbol, length bytes included
+		std::vector<uint8_t> symbol;
+		};
+	struct pending_block
+		{
+		bool used;
+		bool done;
+		uint16_t base;
+		int count;
+		size_t length;
+		uint32_t rows;                  //bit per parity row received
+		std::vector<uint8_t> parity;    //FEC_MAX_PARITY rows of length
+		};
+	void keep( const uint8_t * data, size_t bytes );
+	kept_packet * find( uint16_t sequence );
+	void add_parity( const uint8_t * data, size_t bytes );
+	int missing( const pending_block & block );
+	void recover( pending_block & block );
+
+	std::vector<kept_packet> history;   //indexed by sequence number modulo its size
+	std::vector<pending_block> blocks;
+	size_t next_block;
+
+	//reused from block to block
+	std::vector<int> lost;
+	std::vector<int> used_rows;
+	std::vector<uint8_t> syndromes;
+	std::vector<uint8_t> rebuilt;
+	};
+
+#endif
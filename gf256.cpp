@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include "gf256.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define GF256_X86
+	#include <immintrin.h>
+#endif
+
+struct gf256_tables
+	{
+	gf256_tables()
+		{
+		int x = 1;
+		for( int i = 0; i < 255; ++i )
+			{
+			exp[i] = x;
+			exp[i + 255] = x;
+			log[x] = i;
+			x <<= 1;
+			if( x & 0x100 )
+				{
+				x ^= 0x11D;
+				}
+			}
+		exp[510] = exp[0];
+		exp[511] = exp[1];
+		log[0] = 0;
+		}
+	uint8_t exp[512];
+	uint8_t log[256];
+	};
+
+//built on first use, so other files' static constructors can use it too
+static const gf256_tables & get_tables()
+{
+static const gf256_tables tables;
+return tables;
+}
+
+uint8_t gf256_mul( uint8_t a, uint8_t b )
+{
+if( a == 0 || b == 0 )
+	{
+	return 0;
+	}
+const gf256_tables & tables = get_tables();
+return tables.exp[tables.log[a] + tables.log[b]];
+}
+
+uint8_t gf256_inv( uint8_t a )
+{
+const gf256_tables & tables = get_tables();
+return tables.exp[255 - tables.log[a]];
+}
+
+static void mul_add_c( uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes )
+{
+if( c == 1 )
+	{
+	for( size_t i = 0; i < bytes; ++i )
+		{
+		dst[i] ^= src[i];
+		}
+	return;
+	}
+const gf256_tables & tables = get_tables();
+const uint8_t * exp = tables.exp + tables.log[c];
+for( size_t i = 0; i < bytes; ++i )
+	{
+	if( src[i] )
+		{
+		dst[i] ^= exp[tables.log[src[i]]];
+		}
+	}
+}
+
+#ifdef GF256_X86
+//c times each value of the low nibble, and of the high nibble; their XOR is
+//c times the byte
+static void nibble_tables( uint8_t c, uint8_t * low, uint8_t * high )
+{
+for( int x = 0; x < 16; ++x )
+	{
+	low[x] = gf256_mul( c, x );
+	high[x] = gf256_mul( c, x << 4 );
+	}
+}
+
+__attribute__((target("ssse3")))
+static void mul_add_ssse3( uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes )
+{
+uint8_t low[16], high[16];
+nibble_tables( c, low, high );
+const __m128i tlow = _mm_loadu_si128( (const __m128i *)low );
+const __m128i thigh = _mm_loadu_si128( (const __m128i *)high );
+const __m128i mask = _mm_set1_epi8( 0x0F );
+
+size_t i = 0;
+for( ; i + 16 <= bytes; i += 16 )
+	{
+	__m128i v = _mm_loadu_si128( (const __m128i *)( src + i ) );
+	__m128i l = _mm_shuffle_epi8( tlow, _mm_and_si128( v, mask ) );
+	__m128i h = _mm_shuffle_epi8( thigh, _mm_and_si128( _mm_srli_epi64( v, 4 ), mask ) );
+	__m128i d = _mm_loadu_si128( (const __m128i *)( dst + i ) );
+	_mm_storeu_si128( (__m128i *)( dst + i ), _mm_xor_si128( d, _mm_xor_si128( l, h ) ) );
+	}
+mul_add_c( dst + i, src + i, c, bytes - i );
+}
+
+__attribute__((target("avx2")))
+static void mul_add_avx2( uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes )
+{
+uint8_t low[16], high[16];
+nibble_tables( c, low, high );
+//pshufb looks up within each 128 bit lane, so both lanes get the tables
+const __m256i tlow = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *)low ) );
+const __m256i thigh = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i *)high ) );
+const __m256i mask = _mm256_set1_epi8( 0x0F );
+
+size_t i = 0;
+for( ; i + 32 <= bytes; i += 32 )
+	{
+	__m256i v = _mm256_loadu_si256( (const __m256i *)( src + i ) );
+	__m256i l = _mm256_shuffle_epi8( tlow, _mm256_and_si256( v, mask ) );
+	__m256i h = _mm256_shuffle_epi8( thigh, _mm256_and_si256( _mm256_srli_epi64( v, 4 ), mask ) );
+	__m256i d = _mm256_loadu_si256( (const __m256i *)( dst + i ) );
+	_mm256_storeu_si256( (__m256i *)( dst + i ), _mm256_xor_si256( d, _mm256_xor_si256( l, h ) ) );
+	}
+mul_add_c( dst + i, src + i, c, bytes - i );
+}
+#endif
+
+typedef void (*kernel)( uint8_t *, const uint8_t *, uint8_t, size_t );
+
+static kernel pick_kernel( const char ** name )
+{
+#ifdef GF256_X86
+__builtin_cpu_init();
+if( __builtin_cpu_supports( "avx2" ) )
+	{
+	*name = "avx2";
+	return mul_add_avx2;
+	}
+if( __builtin_cpu_supports( "ssse3" ) )
+	{
+	*name = "ssse3";
+	return mul_add_ssse3;
+	}
+#endif
+*name = "c";
+return mul_add_c;
+}
+
+static const char * best_kernel_name;
+static const kernel best_kernel = pick_kernel( &best_kernel_name );
+
+void gf256_mul_add( uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes )
+{
+if( c == 0 )
+	{
+	return;
+	}
+best_kernel( dst, src, c, bytes );
+}
+
+const char * gf256_kernel()
+{
+return best_kernel_name;
+}
+
+bool gf256_mul_add_with( const char * name, uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes )
+{
+kernel k = NULL;
+if( strcmp( name, "c" ) == 0 )
+	{
+	k = mul_add_c;
+	}
+#ifdef GF256_X86
+if( strcmp( name, "ssse3" ) == 0 && __builtin_cpu_supports( "ssse3" ) )
+	{
+	k = mul_add_ssse3;
+	}
+if( strcmp( name, "avx2" ) == 0 && __builtin_cpu_supports( "avx2" ) )
+	{
+	k = mul_add_avx2;
+	}
+#endif
+if( k == NULL )
+	{
+	return false;
+	}
+if( c != 0 )
+	{
+	k( dst, src, c, bytes );
+	}
+return true;
+}
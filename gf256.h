@@ -0,0 +1,25 @@
+#ifndef GF256_H
+#define GF256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//arithmetic in GF(2^8) with the polynomial x^8+x^4+x^3+x^2+1 (0x11D), the
+//one Reed-Solomon erasure codes usually use. Addition is XOR.
+uint8_t gf256_mul( uint8_t a, uint8_t b );
+uint8_t gf256_inv( uint8_t a );   //a must not be 0
+
+//dst[i] ^= c * src[i] for bytes bytes: the one operation FEC encoding and
+//decoding spend their time in. Picks the widest of AVX2, SSSE3 (both using
+//pshufb as a pair of 16 entry lookup tables, one per nibble) or plain C at
+//startup.
+void gf256_mul_add( uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes );
+
+//the kernel gf256_mul_add ended up with
+const char * gf256_kernel();
+
+//gf256_mul_add with the kernel named "avx2", "ssse3" or "c", for tests to
+//compare them. False, with dst untouched, if the CPU or build lacks it
+bool gf256_mul_add_with( const char * kernel, uint8_t * dst, const uint8_t * src, uint8_t c, size_t bytes );
+
+#endif
@@ -0,0 +1,44 @@
+#include <iostream>
+#include <cstdlib>
+
+#include "nal_file_reader.h"
+#include "nal_index.h"
+#include "nal_info.h"
+
+//rebuilds the .idx of a recording made before indexes existed; raw Annex B
+//has no timestamps, so frames are assumed to be evenly spaced
+int main(int num_args, const char * const args[] )
+{
+if( num_args < 2 || num_args > 3 )
+	{
+	std::cout<<"usage:"<<args[0]<<" input_file [fps]"<<std::endl;
+	exit(4);
+	}
+double fps = ( num_args == 3 ) ? atof( args[2] ) : 30.0;
+
+nal_file_reader reader(args[1]);
+if( !reader.is_open() )
+	{
+	exit(4);
+	}
+
+nal_index_writer index(args[1]);
+nal_parser parser;
+uint64_t frames = 0;
+
+const uint8_t * data;
+size_t bytes;
+while( reader.next( &data, &bytes ) )
+	{
+	nal_info info;
+	parser.parse( data, bytes, info );
+	if( info.access_unit_start )
+		{
+		frames++;
+		}
+	info.timestamp_us = ( frames ? frames - 1 : 0 ) * 1e6 / fps;
+	index.add( info, reader.offset(), bytes );
+	}
+
+std::cout<<"indexed "<<frames<<" frames"<<std::endl;
+}
@@ -0,0 +1,161 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "io_ring.h"
+
+io_ring::io_ring()
+{
+fd = -1;
+entries = 0;
+queued = 0;
+pending = 0;
+sq_map = cq_map = sqes_map = MAP_FAILED;
+sq_map_size = cq_map_size = sqes_map_size = 0;
+}
+
+io_ring::~io_ring()
+{
+if( sqes_map != MAP_FAILED )
+	{
+	munmap( sqes_map, sqes_map_size );
+	}
+if( cq_map != MAP_FAILED && cq_map != sq_map )
+	{
+	munmap( cq_map, cq_map_size );
+	}
+if( sq_map != MAP_FAILED )
+	{
+	munmap( sq_map, sq_map_size );
+	}
+if( fd != -1 )
+	{
+	close( fd );
+	}
+}
+
+bool io_ring::init( unsigned entries )
+{
+#ifdef __NR_io_uring_setup
+struct io_uring_params params;
+memset( &params, 0, sizeof( params ) );
+fd = syscall( __NR_io_uring_setup, entries, &params );
+if( fd < 0 )
+	{
+	fd = -1;
+	return false;
+	}
+this->entries = params.sq_entries;
+
+//the rings are shared with the kernel; newer kernels map both at once
+sq_map_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof( struct io_uring_cqe );
+bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+if( single && cq_map_size > sq_map_size )
+	{
+	sq_map_size = cq_map_size;
+	}
+sq_map = mmap( NULL, sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+if( sq_map == MAP_FAILED )
+	{
+	return false;
+	}
+cq_map = single ? sq_map : mmap( NULL, cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+if( cq_map == MAP_FAILED )
+	{
+	return false;
+	}
+sqes_map_size = params.sq_entries * sizeof( struct io_uring_sqe );
+sqes_map = mmap( NULL, sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+if( sqes_map == MAP_FAILED )
+	{
+	return false;
+	}
+
+uint8_t * sq = (uint8_t *)sq_map;
+uint8_t * cq = (uint8_t *)cq_map;
+sq_head = (unsigned *)( sq + params.sq_off.head );
+sq_tail = (unsigned *)( sq + params.sq_off.tail );
+sq_mask = (unsigned *)( sq + params.sq_off.ring_mask );
+sq_array = (unsigned *)( sq + params.sq_off.array );
+cq_head = (unsigned *)( cq + params.cq_off.head );
+cq_tail = (unsigned *)( cq + params.cq_off.tail );
+cq_mask = (unsigned *)( cq + params.cq_off.ring_mask );
+sqes = (struct io_uring_sqe *)sqes_map;
+cqes = (struct io_uring_cqe *)( cq + params.cq_off.cqes );
+return true;
+#else
+return false;
+#endif
+}
+
+bool io_ring::write( int fd, const void * data, size_t bytes, uint64_t offset, uint64_t user_data )
+{
+unsigned tail = *sq_tail;
+unsigned head = __atomic_load_n( sq_head, __ATOMIC_ACQUIRE );
+if( tail - head >= entries || pending + queued >= entries )
+	{
+	return false;
+	}
+unsigned index = tail & *sq_mask;
+struct io_uring_sqe * sqe = &sqes[index];
+memset( sqe, 0, sizeof( *sqe ) );
+sqe->opcode = IORING_OP_WRITE;
+sqe->fd = fd;
+sqe->addr = (uint64_t)(uintptr_t)data;
+sqe->len = bytes;
+sqe->off = offset;
+sqe->user_data = user_data;
+sq_array[index] = index;
+__atomic_store_n( sq_tail, tail + 1, __ATOMIC_RELEASE );
+queued++;
+return true;
+}
+
+bool io_ring::submit()
+{
+while( queued > 0 )
+	{
+	int n = syscall( __NR_io_uring_enter, fd, queued, 0, 0, NULL, 0 );
+	if( n < 0 )
+		{
+		if( errno == EINTR )
+			{
+			continue;
+			}
+		return false;
+		}
+	queued -= n;
+	pending += n;
+	}
+return true;
+}
+
+bool io_ring::complete( uint64_t * user_data, int * result, bool wait )
+{
+while( true )
+	{
+	unsigned head = *cq_head;
+	if( head != __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE ) )
+		{
+		struct io_uring_cqe * cqe = &cqes[head & *cq_mask];
+		*user_data = cqe->user_data;
+		*result = cqe->res;
+		__atomic_store_n( cq_head, head + 1, __ATOMIC_RELEASE );
+		pending--;
+		return true;
+		}
+	if( !wait || pending == 0 )
+		{
+		return false;
+		}
+	int n = syscall( __NR_io_uring_enter, fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 );
+	if( n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY )
+		{
+		return false;
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//A minimal io_uring for writes at file offsets, through the system calls
+//themselves rather than liburing. init() returns false where the kernel
+//has no io_uring or won't let us have one, and the caller should fall back
+//to pwrite(). One thread at a time: queue writes, submit() them, then
+//collect their completions with complete().
+class io_ring
+	{
+	public:
+	io_ring();
+	~io_ring();
+	bool init( unsigned entries );
+
+	//queues a write, returning false if the submission queue is full
+	bool write( int fd, const void * data, size_t bytes, uint64_t offset, uint64_t user_data );
+
+	//hands everything queued to the kernel. False if it wouldn't take it
+	//all, with errno EAGAIN or EBUSY if it will once completions have been
+	//collected, anything else if it won't; what it didn't take stays queued
+	bool submit();
+	unsigned unsubmitted() const { return queued; }
+
+	//takes the next completion, waiting for one if asked to, or returns
+	//false if there is none; result is what write() would have returned,
+	//or -errno
+	bool complete( uint64_t * user_data, int * result, bool wait );
+
+	//written but not yet complete
+	unsigned in_flight() const { return pending; }
+
+	private:
+	int fd;
+	unsigned entries;
+	unsigned queued;
+	unsigned pending;
+
+	void * sq_map;
+	size_t sq_map_size;
+	void * cq_map;
+	size_t cq_map_size;
+	void * sqes_map;
+	size_t sqes_map_size;
+
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned * sq_mask;
+	unsigned * sq_array;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned * cq_mask;
+	struct io_uring_sqe * sqes;
+	struct io_uring_cqe * cqes;
+	};
+
+#endif
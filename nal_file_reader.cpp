@@ -0,0 +1,189 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "start_code.h"
+
+#include "nal_file_reader.h"
+
+nal_file_reader::nal_file_reader( const char * fname, size_t window_size )
+{
+struct stat statbuf;
+
+window = NULL;
+window_offset = 0;
+window_bytes = 0;
+this->window_size = window_size;
+pos = 0;
+nal_offset = 0;
+synced = false;
+file_size = 0;
+
+fd = open( fname, O_RDONLY );
+if( fd < 0 || fstat( fd, &statbuf ) < 0 )
+	{
+	printf("Failed to open %s\n",fname);
+	if( fd >= 0 )
+		{
+		close( fd );
+		fd = -1;
+		}
+	return;
+	}
+file_size = statbuf.st_size;
+printf("opened %s, size=%llu\n",fname,(unsigned long long)file_size);
+}
+
+nal_file_reader::~nal_file_reader()
+{
+if( window != NULL )
+	{
+	munmap( window, window_bytes );
+	}
+if( fd >= 0 )
+	{
+	close( fd );
+	}
+}
+
+//maps at least [offset, offset+bytes) of the file, or up to its end
+bool nal_file_reader::map( uint64_t offset, size_t bytes )
+{
+uint64_t page = sysconf( _SC_PAGESIZE );
+uint64_t start = offset - offset % page;
+uint64_t length = offset - start + bytes;
+if( start + length > file_size )
+	{
+	length = file_size - start;
+	}
+
+if( window != NULL )
+	{
+	munmap( window, window_bytes );
+	window = NULL;
+	}
+
+void * p = mmap( NULL, length, PROT_READ, MAP_SHARED, fd, start );
+if( p == MAP_FAILED )
+	{
+	printf("Failed to map %llu bytes at %llu\n",(unsigned long long)length,(unsigned long long)start);
+	return false;
+	}
+madvise( p, length, MADV_SEQUENTIAL );
+window = (uint8_t*)p;
+window_offset = start;
+window_bytes = length;
+return true;
+}
+
+//first 00 00 00 01 starting at or after from
+const uint8_t * nal_file_reader::find_code( const uint8_t * from, const uint8_t * end ) const
+{
+const uint8_t * scan = from + 1;
+while( scan < end )
+	{
+	const uint8_t * code = find_start_code( scan, end );
+	if( code == end )
+		{
+		break;
+		}
+	if( code[-1] == 0 )
+		{
+		return code - 1;
+		}
+	scan = code + 3;
+	}
+return end;
+}
+
+void nal_file_reader::seek( uint64_t offset )
+{
+pos = offset < file_size ? offset : file_size;
+synced = false;
+}
+
+bool nal_file_reader::next( const uint8_t ** data, size_t * bytes )
+{
+size_t want = window_size;
+bool remap = window == NULL || pos < window_offset || pos >= window_offset + window_bytes;
+while( fd >= 0 && pos < file_size )
+	{
+	if( remap )
+		{
+		if( !map( pos, want ) )
+			{
+			return false;
+			}
+		remap = false;
+		}
+
+	const uint8_t * start = window + ( pos - window_offset );
+	const uint8_t * end = window + window_bytes;
+	bool at_eof = window_offset + window_bytes == file_size;
+
+	if( !synced )
+		{
+		const uint8_t * code = find_code( start, end );
+		if( code != end )
+			{
+			pos = window_offset + ( code - window );
+			synced = true;
+			}
+		else if( at_eof )
+			{
+			pos = file_size;
+			}
+		else
+			{
+			//keep the last bytes, a start code may straddle the window
+			pos = window_offset + window_bytes - 3;
+			remap = true;
+			}
+		continue;
+		}
+
+	//a NAL of only a start code is merged into the next one, as
+	//x264_destreamer does
+	const uint8_t * code = find_code( start + 1, end );
+	while( code != end && code - start <= 4 )
+		{
+		code = find_code( code + 1, end );
+		}
+	if( code != end && end - code >= PACKET_PADDING_SIZE )
+		{
+		*data = start;
+		*bytes = code - start;
+		nal_offset = pos;
+		pos += *bytes;
+		return true;
+		}
+
+	if( at_eof )
+		{
+		//the last NAL, or one too near the end to be padded by what follows
+		size_t n = ( code != end ) ? code - start : end - start;
+		tail.assign( start, start + n );
+		tail.resize( n + PACKET_PADDING_SIZE, 0 );
+		*data = &tail[0];
+		*bytes = n;
+		nal_offset = pos;
+		pos += n;
+		return true;
+		}
+
+	//the NAL runs past the window, so move the window up to it, growing
+	//it if the NAL already started the window
+	if( pos - window_offset < (uint64_t)sysconf( _SC_PAGESIZE ) )
+		{
+		want = window_bytes * 2;
+		}
+	remap = true;
+	}
+
+printf("end of stream\n");
+return false;
+}
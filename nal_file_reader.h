@@ -0,0 +1,47 @@
+#ifndef NAL_FILE_READER_H
+#define NAL_FILE_READER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+//Reads the NALs of an Annex B file through a sliding mmap window, so memory
+//use stays the same whatever the size of the file. NALs are split on
+//00 00 00 01 like x264_destreamer, and a start code with nothing after it
+//is merged into the next NAL as it is there. Each NAL handed out is
+//followed by at least PACKET_PADDING_SIZE readable bytes, zeros when it
+//ends the file, and stays valid until the next call. Any number may be
+//open at once.
+class nal_file_reader
+	{
+	public:
+	nal_file_reader( const char * fname, size_t window_size = 8 * 1024 * 1024 );
+	~nal_file_reader();
+	bool is_open() const { return fd >= 0; }
+	uint64_t size() const { return file_size; }
+
+	//returns false at the end of the file
+	bool next( const uint8_t ** data, size_t * bytes );
+
+	//file offset of the NAL last returned by next()
+	uint64_t offset() const { return nal_offset; }
+
+	//continue from the first start code at or after offset
+	void seek( uint64_t offset );
+
+	private:
+	bool map( uint64_t offset, size_t bytes );
+	const uint8_t * find_code( const uint8_t * from, const uint8_t * end ) const;
+	int fd;
+	uint64_t file_size;
+	uint8_t * window;
+	uint64_t window_offset;
+	size_t window_bytes;
+	size_t window_size;
+	uint64_t pos;
+	uint64_t nal_offset;
+	bool synced;
+	std::vector<uint8_t> tail;
+	};
+
+#endif
@@ -0,0 +1,172 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nal_index.h"
+
+nal_index_writer::nal_index_writer( const std::string & recording )
+{
+entries = 0;
+last_recovery = NAL_INDEX_NO_RECOVERY;
+pending = false;
+memset( &entry, 0x00, sizeof( entry ) );
+
+std::string fname = recording + ".idx";
+fd = open( fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP );
+if( fd < 0 )
+	{
+	printf("Couldn't open %s\n",fname.c_str());
+	return;
+	}
+
+nal_index_header header;
+memset( &header, 0x00, sizeof( header ) );
+memcpy( header.magic, NAL_INDEX_MAGIC, sizeof( header.magic ) );
+header.version = NAL_INDEX_VERSION;
+header.entry_size = sizeof( nal_index_entry );
+if( ::write( fd, &header, sizeof( header ) ) != sizeof( header ) )
+	{
+	printf("Couldn't write %s\n",fname.c_str());
+	close( fd );
+	fd = -1;
+	}
+}
+
+nal_index_writer::~nal_index_writer()
+{
+flush();
+if( fd >= 0 )
+	{
+	close( fd );
+	}
+}
+
+void nal_index_writer::add( const nal_info & info, uint64_t offset, size_t bytes )
+{
+if( info.access_unit_start )
+	{
+	flush();
+	}
+
+if( !pending )
+	{
+	//a lone end marker belongs to the access unit already written
+	if( info.access_unit_end && !info.vcl() )
+		{
+		return;
+		}
+	memset( &entry, 0x00, sizeof( entry ) );
+	entry.offset = offset;
+	entry.timestamp_us = info.timestamp_us;
+	pending = true;
+	}
+
+entry.bytes += bytes;
+entry.nal_types |= 1u << info.nal_unit_type;
+if( info.recovery_point )
+	{
+	entry.flags |= NAL_INDEX_RECOVERY_POINT;
+	}
+if( info.nal_unit_type == NAL_SLICE_IDR )
+	{
+	entry.flags |= NAL_INDEX_IDR;
+	}
+
+if( info.access_unit_end )
+	{
+	flush();
+	}
+}
+
+void nal_index_writer::flush()
+{
+if( !pending )
+	{
+	return;
+	}
+pending = false;
+
+if( entry.flags & NAL_INDEX_RECOVERY_POINT )
+	{
+	last_recovery = entries;
+	}
+entry.recovery = last_recovery;
+entries++;
+
+if( fd >= 0 && ::write( fd, &entry, sizeof( entry ) ) != sizeof( entry ) )
+	{
+	printf("Couldn't write index entry\n");
+	}
+}
+
+nal_index::nal_index( const std::string & recording )
+{
+map = NULL;
+map_bytes = 0;
+entry = NULL;
+count = 0;
+
+std::string fname = recording + ".idx";
+int fd = open( fname.c_str(), O_RDONLY );
+struct stat statbuf;
+if( fd < 0 || fstat( fd, &statbuf ) < 0 || (size_t)statbuf.st_size < sizeof( nal_index_header ) )
+	{
+	printf("Couldn't open %s\n",fname.c_str());
+	if( fd >= 0 )
+		{
+		close( fd );
+		}
+	return;
+	}
+
+map_bytes = statbuf.st_size;
+map = mmap( NULL, map_bytes, PROT_READ, MAP_SHARED, fd, 0 );
+close( fd );
+if( map == MAP_FAILED )
+	{
+	printf("Couldn't map %s\n",fname.c_str());
+	map = NULL;
+	return;
+	}
+
+const nal_index_header * header = (const nal_index_header *)map;
+if( memcmp( header->magic, NAL_INDEX_MAGIC, sizeof( header->magic ) ) != 0 ||
+    header->version != NAL_INDEX_VERSION || header->entry_size != sizeof( nal_index_entry ) )
+	{
+	printf("%s is not a version %i index\n",fname.c_str(),NAL_INDEX_VERSION);
+	return;
+	}
+
+entry = (const nal_index_entry *)( header + 1 );
+count = ( map_bytes - sizeof( nal_index_header ) ) / sizeof( nal_index_entry );
+}
+
+nal_index::~nal_index()
+{
+if( map != NULL )
+	{
+	munmap( map, map_bytes );
+	}
+}
+
+size_t nal_index::find( uint64_t timestamp_us ) const
+{
+size_t lo = 0;
+size_t hi = count;
+while( hi - lo > 1 )
+	{
+	size_t mid = lo + ( hi - lo ) / 2;
+	if( entry[mid].timestamp_us <= timestamp_us )
+		{
+		lo = mid;
+		}
+	else
+		{
+		hi = mid;
+		}
+	}
+return lo;
+}
@@ -0,0 +1,85 @@
+#ifndef NAL_INDEX_H
+#define NAL_INDEX_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nal_info.h"
+
+//Sidecar index for an Annex B recording, written next to it as <file>.idx:
+//a 16 byte header then one fixed size entry per access unit, in file order.
+//Each entry carries the index of the nearest recovery point at or before
+//it, so replay can start decoding anywhere without scanning the recording.
+#define NAL_INDEX_MAGIC   "NALIDX1"
+#define NAL_INDEX_VERSION 2
+
+#define NAL_INDEX_RECOVERY_POINT 0x01  //an IDR, or a recovery point SEI (intra refresh)
+#define NAL_INDEX_IDR            0x02
+
+//the recovery of an entry with no recovery point at or before it
+#define NAL_INDEX_NO_RECOVERY 0xFFFFFFFF
+
+struct nal_index_header
+	{
+	char magic[8];
+	uint32_t version;
+	uint32_t entry_size;
+	};
+
+struct nal_index_entry
+	{
+	uint64_t offset;        //of the access unit's first NAL in the recording
+	//the first NAL's nal_info::timestamp_us, whatever clock the producer
+	//used: arrival on CLOCK_REALTIME from x264_destreamer when viewer_stdin
+	//records, or the frame's place at a nominal rate when index_264
+	//rebuilds the index
+	uint64_t timestamp_us;
+	uint32_t bytes;
+	uint32_t recovery;      //entry to start decoding from to show this one, or NAL_INDEX_NO_RECOVERY
+	uint32_t nal_types;     //bit n set if the access unit has a NAL of type n
+	uint32_t flags;
+	};
+
+//appends entries as NALs go by; an entry is written once its access unit ends
+class nal_index_writer
+	{
+	public:
+	nal_index_writer( const std::string & recording );
+	~nal_index_writer();
+	void add( const nal_info & info, uint64_t offset, size_t bytes );
+	void flush();
+
+	private:
+	int fd;
+	uint32_t entries;
+	uint32_t last_recovery;
+	bool pending;
+	nal_index_entry entry;
+	};
+
+//maps an index for lookups
+class nal_index
+	{
+	public:
+	nal_index( const std::string & recording );
+	~nal_index();
+	bool is_open() const { return entry != NULL; }
+	size_t size() const { return count; }
+	const nal_index_entry & operator[]( size_t i ) const { return entry[i]; }
+
+	//last entry stamped at or before timestamp_us (or the first one)
+	size_t find( uint64_t timestamp_us ) const;
+
+	//where to start decoding to show entry i, NAL_INDEX_NO_RECOVERY if
+	//nothing before it can be decoded
+	size_t recovery_point( size_t i ) const { return entry[i].recovery; }
+
+	private:
+	void * map;
+	size_t map_bytes;
+	const nal_index_entry * entry;
+	size_t count;
+	};
+
+#endif
@@ -0,0 +1,298 @@
+#include <string.h>
+
+#include "nal_info.h"
+
+//reads exp-golomb codes from an RBSP, skipping emulation prevention bytes
+class bit_reader
+	{
+	public:
+	bit_reader( const uint8_t * data, size_t bytes )
+		{
+		p = data;
+		end = data + bytes;
+		zeros = 0;
+		bit = 0;
+		}
+
+	bool more() const { return p < end; }
+	size_t bytes_left() const { return end - p; }
+
+	int read_bit()
+		{
+		if( p >= end )
+			{
+			return 0;
+			}
+		int b = ( *p >> ( 7 - bit ) ) & 1;
+		if( ++bit == 8 )
+			{
+			bit = 0;
+			zeros = ( *p == 0 ) ? zeros + 1 : 0;
+			p++;
+			if( zeros >= 2 && p < end && *p == 0x03 )
+				{
+				p++;
+				zeros = 0;
+				}
+			}
+		return b;
+		}
+
+	uint32_t read_bits( int n )
+		{
+		uint32_t v = 0;
+		while( n-- > 0 )
+			{
+			v = ( v << 1 ) | read_bit();
+			}
+		return v;
+		}
+
+	//returns -1 for a malformed code
+	int read_ue()
+		{
+		int leading = 0;
+		while( more() && read_bit() == 0 )
+			{
+			if( ++leading > 30 )
+				{
+				return -1;
+				}
+			}
+		return (int)( ( 1u << leading ) - 1 + read_bits( leading ) );
+		}
+
+	int read_se()
+		{
+		int k = read_ue();
+		return ( k & 1 ) ? ( k + 1 ) / 2 : -( k / 2 );
+		}
+
+	private:
+	const uint8_t * p;
+	const uint8_t * end;
+	int zeros;
+	int bit;
+	};
+
+//skips a leading 00 00 01 or 00 00 00 01, if there is one
+static const uint8_t * skip_start_code( const uint8_t * data, size_t bytes )
+{
+size_t i = 0;
+while( i < bytes && i < 3 && data[i] == 0 )
+	{
+	i++;
+	}
+if( i >= 2 && i < bytes && data[i] == 1 )
+	{
+	return data + i + 1;
+	}
+return data;
+}
+
+nal_info::nal_info()
+{
+nal_unit_type = NAL_UNKNOWN;
+nal_ref_idc = 0;
+first_mb_in_slice = -1;
+frame_num = -1;
+access_unit_start = false;
+access_unit_end = false;
+parameter_set = false;
+sei = false;
+recovery_point = false;
+timestamp_us = 0;
+}
+
+recovery_tracker::recovery_tracker()
+{
+in_prefix = false;
+}
+
+bool recovery_tracker::resumes( const nal_info & info )
+{
+if( info.access_unit_start )
+	{
+	in_prefix = true;
+	}
+bool resume = ( info.recovery_point || info.parameter_set ) && ( info.access_unit_start || in_prefix );
+if( info.vcl() )
+	{
+	in_prefix = false;
+	}
+return resume;
+}
+
+nal_parser::nal_parser()
+{
+seen_vcl = true;
+last_frame_num = -1;
+memset( sps_log2_max_frame_num, 0, sizeof( sps_log2_max_frame_num ) );
+memset( sps_separate_colour_plane, 0, sizeof( sps_separate_colour_plane ) );
+memset( pps_sps_id, 0xFF, sizeof( pps_sps_id ) );
+}
+
+//only as far as log2_max_frame_num, see 7.3.2.1.1
+void nal_parser::parse_sps( const uint8_t * rbsp, size_t bytes )
+{
+bit_reader br( rbsp, bytes );
+int profile_idc = br.read_bits( 8 );
+br.read_bits( 16 );
+int sps_id = br.read_ue();
+if( sps_id < 0 || sps_id > 31 )
+	{
+	return;
+	}
+
+bool separate_colour_plane = false;
+if( profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244 ||
+    profile_idc == 44  || profile_idc == 83  || profile_idc == 86  || profile_idc == 118 ||
+    profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134 ||
+    profile_idc == 135 )
+	{
+	int chroma_format_idc = br.read_ue();
+	if( chroma_format_idc == 3 )
+		{
+		separate_colour_plane = br.read_bit();
+		}
+	br.read_ue(); //bit_depth_luma_minus8
+	br.read_ue(); //bit_depth_chroma_minus8
+	br.read_bit(); //qpprime_y_zero_transform_bypass_flag
+	if( br.read_bit() ) //seq_scaling_matrix_present_flag
+		{
+		int lists = ( chroma_format_idc == 3 ) ? 12 : 8;
+		for( int i = 0; i < lists; ++i )
+			{
+			if( !br.read_bit() )
+				{
+				continue;
+				}
+			int size = ( i < 6 ) ? 16 : 64;
+			int last_scale = 8;
+			int next_scale = 8;
+			for( int j = 0; j < size && next_scale != 0; ++j )
+				{
+				next_scale = ( last_scale + br.read_se() + 256 ) % 256;
+				last_scale = next_scale ? next_scale : last_scale;
+				}
+			}
+		}
+	}
+
+int log2_max_frame_num_minus4 = br.read_ue();
+if( log2_max_frame_num_minus4 < 0 || log2_max_frame_num_minus4 > 12 )
+	{
+	return;
+	}
+sps_log2_max_frame_num[sps_id] = log2_max_frame_num_minus4 + 4;
+sps_separate_colour_plane[sps_id] = separate_colour_plane;
+}
+
+void nal_parser::parse_pps( const uint8_t * rbsp, size_t bytes )
+{
+bit_reader br( rbsp, bytes );
+int pps_id = br.read_ue();
+int sps_id = br.read_ue();
+if( pps_id >= 0 && pps_id <= 255 && sps_id >= 0 && sps_id <= 31 )
+	{
+	pps_sps_id[pps_id] = sps_id;
+	}
+}
+
+//walks the sei_message()s of 7.3.2.3 looking for payloadType 6
+bool nal_parser::sei_has_recovery_point( const uint8_t * rbsp, size_t bytes )
+{
+bit_reader br( rbsp, bytes );
+//the last byte is rbsp_trailing_bits
+for( int messages = 0; messages < 16 && br.bytes_left() > 1; ++messages )
+	{
+	int type = 0;
+	int size = 0;
+	int byte;
+	while( ( byte = br.read_bits( 8 ) ) == 0xFF )
+		{
+		type += 255;
+		}
+	type += byte;
+	while( ( byte = br.read_bits( 8 ) ) == 0xFF )
+		{
+		size += 255;
+		}
+	size += byte;
+
+	if( type == 6 )
+		{
+		return true;
+		}
+	while( size-- > 0 && br.more() )
+		{
+		br.read_bits( 8 );
+		}
+	}
+return false;
+}
+
+void nal_parser::parse( const uint8_t * data, size_t bytes, nal_info & info )
+{
+info = nal_info();
+
+const uint8_t * header = skip_start_code( data, bytes );
+const uint8_t * end = data + bytes;
+if( header >= end )
+	{
+	return;
+	}
+
+info.nal_unit_type = *header & 0x1F;
+info.nal_ref_idc = ( *header >> 5 ) & 0x03;
+info.parameter_set = info.nal_unit_type == NAL_SPS || info.nal_unit_type == NAL_PPS;
+info.sei = info.nal_unit_type == NAL_SEI;
+info.recovery_point = info.nal_unit_type == NAL_SLICE_IDR;
+
+if( info.vcl() )
+	{
+	bit_reader br( header + 1, end - header - 1 );
+	info.first_mb_in_slice = br.read_ue();
+	br.read_ue(); //slice_type
+	int pps_id = br.read_ue();
+	if( pps_id >= 0 && pps_id <= 255 && pps_sps_id[pps_id] != 0xFF )
+		{
+		int sps_id = pps_sps_id[pps_id];
+		if( sps_log2_max_frame_num[sps_id] )
+			{
+			if( sps_separate_colour_plane[sps_id] )
+				{
+				br.read_bits( 2 );
+				}
+			info.frame_num = br.read_bits( sps_log2_max_frame_num[sps_id] );
+			}
+		}
+	bool new_frame = info.frame_num >= 0 && last_frame_num >= 0 && info.frame_num != last_frame_num;
+	info.access_unit_start = seen_vcl && ( info.first_mb_in_slice == 0 || new_frame );
+	last_frame_num = info.frame_num;
+	seen_vcl = true;
+	}
+else if( info.nal_unit_type == NAL_AUD || info.nal_unit_type == NAL_SEI ||
+         info.parameter_set || ( info.nal_unit_type >= 14 && info.nal_unit_type <= 18 ) )
+	{
+	info.access_unit_start = seen_vcl;
+	seen_vcl = false;
+	if( info.nal_unit_type == NAL_SPS )
+		{
+		parse_sps( header + 1, end - header - 1 );
+		}
+	else if( info.nal_unit_type == NAL_PPS )
+		{
+		parse_pps( header + 1, end - header - 1 );
+		}
+	else if( info.sei )
+		{
+		info.recovery_point = sei_has_recovery_point( header + 1, end - header - 1 );
+		}
+	}
+else if( info.nal_unit_type == NAL_FILLER || info.nal_unit_type == NAL_END_SEQUENCE ||
+         info.nal_unit_type == NAL_END_STREAM )
+	{
+	info.access_unit_end = true;
+	}
+}
@@ -0,0 +1,79 @@
+#ifndef NAL_INFO_H
+#define NAL_INFO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//H.264 nal_unit_type values
+enum
+	{
+	NAL_UNKNOWN      = 0,
+	NAL_SLICE        = 1,
+	NAL_SLICE_IDR    = 5,
+	NAL_SEI          = 6,
+	NAL_SPS          = 7,
+	NAL_PPS          = 8,
+	NAL_AUD          = 9,
+	NAL_END_SEQUENCE = 10,
+	NAL_END_STREAM   = 11,
+	NAL_FILLER       = 12
+	};
+
+//per-packet descriptor handed to sinks along with the bytes, describing
+//the first NAL in the packet so sinks never need to parse payload
+struct nal_info
+	{
+	nal_info();
+	uint8_t nal_unit_type;
+	uint8_t nal_ref_idc;
+	int first_mb_in_slice;   //-1 for anything but a slice
+	int frame_num;           //-1 for anything but a slice, or before its SPS
+	bool access_unit_start;  //first NAL of a new access unit
+	bool access_unit_end;    //known to be the last NAL of its access unit
+	bool parameter_set;      //SPS or PPS
+	bool sei;
+	bool recovery_point;     //IDR slice, or SEI with a recovery point (intra refresh)
+	uint64_t timestamp_us;   //capture time if the producer knows it, else arrival, 0 if neither
+	bool vcl() const { return nal_unit_type >= NAL_SLICE && nal_unit_type <= NAL_SLICE_IDR; }
+	};
+
+//Fills in a nal_info for each NAL of a stream, in order. Access unit starts
+//follow 7.4.1.2.3: an AUD, SPS, PPS or SEI after slices starts one, as does
+//a slice after slices with first_mb_in_slice of zero or a new frame_num.
+//Filler data, end of sequence and end of stream can only come last in an
+//access unit, so they mark its end; the encoders append a filler NAL to
+//every frame for that reason. SPS and PPS are tracked to find frame_num.
+//The parser leaves timestamp_us alone, that is the producer's to fill in.
+class nal_parser
+	{
+	public:
+	nal_parser();
+	void parse( const uint8_t * data, size_t bytes, nal_info & info );
+
+	private:
+	void parse_sps( const uint8_t * rbsp, size_t bytes );
+	void parse_pps( const uint8_t * rbsp, size_t bytes );
+	bool sei_has_recovery_point( const uint8_t * rbsp, size_t bytes );
+	bool seen_vcl;
+	int last_frame_num;
+	uint8_t sps_log2_max_frame_num[32];  //0 until that SPS is seen
+	bool sps_separate_colour_plane[32];
+	uint8_t pps_sps_id[256];             //0xFF until that PPS is seen
+	};
+
+//Follows a stream's descriptors, in order, to tell which packets a decoder
+//can start from: parameter sets, an IDR or a recovery point SEI, before any
+//slice of their access unit. Every described packet has to go through
+//resumes(), even ones that are then dropped, so it knows where access
+//units begin.
+class recovery_tracker
+	{
+	public:
+	recovery_tracker();
+	bool resumes( const nal_info & info );
+
+	private:
+	bool in_prefix;    //since the last access unit start, no slice yet
+	};
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+
+#include "packet_pool.h"
+
+static size_t class_size( int size_class )
+{
+return (size_t)2048 << ( 2 * size_class );
+}
+
+static packet_buffer * allocate( packet_pool * pool, size_t capacity, int size_class )
+{
+void * data;
+if( posix_memalign( &data, 64, capacity + PACKET_PADDING_SIZE ) != 0 )
+	{
+	printf( "packet_pool: couldn't allocate %lu bytes\n", (unsigned long)capacity );
+	exit( 1 );
+	}
+packet_buffer * buffer = new packet_buffer;
+buffer->data = (uint8_t*)data;
+buffer->bytes = 0;
+buffer->capacity = capacity;
+buffer->size_class = size_class;
+buffer->refs.store( 0 );
+buffer->pool = pool;
+return buffer;
+}
+
+static void deallocate( packet_buffer * buffer )
+{
+free( buffer->data );
+delete buffer;
+}
+
+packet_ref::packet_ref( const packet_ref & other ) : buffer( other.buffer )
+{
+if( buffer )
+	{
+	buffer->refs.fetch_add( 1, std::memory_order_relaxed );
+	}
+}
+
+packet_ref & packet_ref::operator=( const packet_ref & other )
+{
+if( other.buffer )
+	{
+	other.buffer->refs.fetch_add( 1, std::memory_order_relaxed );
+	}
+reset();
+buffer = other.buffer;
+return *this;
+}
+
+packet_ref & packet_ref::operator=( packet_ref && other )
+{
+if( this != &other )
+	{
+	reset();
+	buffer = other.buffer;
+	other.buffer = NULL;
+	}
+return *this;
+}
+
+void packet_ref::resize( size_t bytes )
+{
+buffer->bytes = bytes;
+memset( buffer->data + bytes, 0, PACKET_PADDING_SIZE );
+}
+
+void packet_ref::reset()
+{
+if( buffer && buffer->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+	{
+	buffer->pool->recycle( buffer );
+	}
+buffer = NULL;
+}
+
+packet_pool::packet_pool()
+{
+for( int i = 0; i < PACKET_POOL_CLASSES; ++i )
+	{
+	class_count[i] = 0;
+	}
+buffers_allocated.store( 0 );
+buffers_in_use.store( 0 );
+}
+
+packet_pool::~packet_pool()
+{
+for( int i = 0; i < PACKET_POOL_CLASSES; ++i )
+	{
+	for( size_t j = 0; j < free_buffers[i].size(); ++j )
+		{
+		deallocate( free_buffers[i][j] );
+		}
+	}
+}
+
+static int size_class_for( size_t bytes )
+{
+int size_class = 0;
+while( size_class < PACKET_POOL_CLASSES && class_size( size_class ) < bytes )
+	{
+	size_class++;
+	}
+return size_class < PACKET_POOL_CLASSES ? size_class : -1;
+}
+
+//a new buffer, with room saved for it on its free list
+packet_buffer * packet_pool::create( int size_class, size_t bytes )
+{
+buffers_allocated++;
+if( size_class < 0 )
+	{
+	return allocate( this, bytes, -1 );
+	}
+	{
+	std::lock_guard<std::mutex> guard( lock );
+	class_count[size_class]++;
+	free_buffers[size_class].reserve( class_count[size_class] );
+	}
+return allocate( this, class_size( size_class ), size_class );
+}
+
+packet_ref packet_pool::get( size_t bytes )
+{
+int size_class = size_class_for( bytes );
+
+packet_buffer * buffer = NULL;
+if( size_class >= 0 )
+	{
+	std::lock_guard<std::mutex> guard( lock );
+	if( !free_buffers[size_class].empty() )
+		{
+		buffer = free_buffers[size_class].back();
+		free_buffers[size_class].pop_back();
+		}
+	}
+if( buffer == NULL )
+	{
+	buffer = create( size_class, bytes );
+	}
+
+buffers_in_use++;
+buffer->refs.store( 1, std::memory_order_relaxed );
+packet_ref packet( buffer );
+packet.resize( bytes );
+return packet;
+}
+
+packet_ref packet_pool::copy( const uint8_t * data, size_t bytes )
+{
+packet_ref packet = get( bytes );
+memcpy( packet.data(), data, bytes );
+return packet;
+}
+
+void packet_pool::preallocate( size_t bytes, size_t count )
+{
+int size_class = size_class_for( bytes );
+if( size_class < 0 )
+	{
+	return;
+	}
+for( size_t i = 0; i < count; ++i )
+	{
+	packet_buffer * buffer = create( size_class, bytes );
+	std::lock_guard<std::mutex> guard( lock );
+	free_buffers[size_class].push_back( buffer );
+	}
+}
+
+void packet_pool::recycle( packet_buffer * buffer )
+{
+buffers_in_use--;
+if( buffer->size_class < 0 )
+	{
+	deallocate( buffer );
+	return;
+	}
+std::lock_guard<std::mutex> guard( lock );
+free_buffers[buffer->size_class].push_back( buffer );
+}
+
+packet_pool & packet_pool::shared()
+{
+static packet_pool pool;
+return pool;
+}
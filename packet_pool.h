@@ -0,0 +1,94 @@
+#ifndef PACKET_POOL_H
+#define PACKET_POOL_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+//size classes, each four times the one before, from 2KB to 2MB
+#define PACKET_POOL_CLASSES 6
+
+class packet_pool;
+
+//a pooled buffer, always followed by PACKET_PADDING_SIZE readable bytes
+struct packet_buffer
+	{
+	uint8_t * data;
+	size_t bytes;
+	size_t capacity;        //not counting the padding
+	int size_class;         //-1 for one too big for the pool
+	std::atomic<int> refs;
+	packet_pool * pool;
+	};
+
+//Counted reference to a packet_buffer. Copies share the buffer, which goes
+//back to its pool when the last one lets go. Safe to copy and release from
+//any thread, but the bytes are only meant to be written before the packet
+//is shared.
+class packet_ref
+	{
+	public:
+	packet_ref() : buffer( NULL ) {}
+	packet_ref( const packet_ref & other );
+	packet_ref( packet_ref && other ) : buffer( other.buffer ) { other.buffer = NULL; }
+	~packet_ref() { reset(); }
+	packet_ref & operator=( const packet_ref & other );
+	packet_ref & operator=( packet_ref && other );
+
+	uint8_t * data() const { return buffer->data; }
+	size_t size() const { return buffer->bytes; }
+	size_t capacity() const { return buffer->capacity; }
+	bool empty() const { return buffer == NULL; }
+	int use_count() const { return buffer ? buffer->refs.load() : 0; }
+
+	//sets the packet's length, which must fit the capacity, and zeroes the
+	//padding after it
+	void resize( size_t bytes );
+	void reset();
+
+	private:
+	friend class packet_pool;
+	explicit packet_ref( packet_buffer * buffer ) : buffer( buffer ) {}
+	packet_buffer * buffer;
+	};
+
+//Hands out padded buffers in a few fixed sizes, from 2KB to 2MB, keeping
+//released ones on a free list per size instead of freeing them, so once the
+//pipeline has warmed up it stops allocating. Bigger packets get a buffer of
+//their own that is freed when released. Buffers are 64 byte aligned.
+class packet_pool
+	{
+	public:
+	packet_pool();
+	~packet_pool();
+
+	//a buffer with room for at least bytes, its length set to bytes
+	packet_ref get( size_t bytes );
+	packet_ref copy( const uint8_t * data, size_t bytes );
+
+	//fills the free list with count buffers big enough for bytes, so a
+	//pipeline allocates nothing even the first time its queues fill up
+	void preallocate( size_t bytes, size_t count );
+
+	//buffers allocated so far, and how many of those are handed out
+	uint64_t allocated() const { return buffers_allocated.load(); }
+	uint64_t in_use() const { return buffers_in_use.load(); }
+
+	//the pool packet_server copies into for its async sinks
+	static packet_pool & shared();
+
+	private:
+	friend class packet_ref;
+	void recycle( packet_buffer * buffer );
+	packet_buffer * create( int size_class, size_t bytes );
+
+	std::mutex lock;
+	std::vector<packet_buffer*> free_buffers[PACKET_POOL_CLASSES];
+	size_t class_count[PACKET_POOL_CLASSES];   //buffers of each size, so the free lists never grow
+	std::atomic<uint64_t> buffers_allocated;
+	std::atomic<uint64_t> buffers_in_use;
+	};
+
+#endif
@@ -1,20 +1,140 @@
 #include <stdint.h>
+#include <stdio.h>
 #include "packet_server.h"
 
+packet_server::packet_server()
+{
+packet_targets = 0;
+}
+
+packet_server::~packet_server()
+{
+for (std::list<async_sink*>::iterator iterator = async_targets.begin(), end = async_targets.end(); iterator != end; ++iterator)
+	{
+	delete *iterator;
+	}
+}
+
 void packet_server::broadcast( const uint8_t*data, size_t bytes)
 {
+if( packet_targets )
+	{
+	broadcast( packet_pool::shared().copy( data, bytes ) );
+	return;
+	}
 for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
 	{
 	(*iterator)->write( data, bytes );
 	}
 }
 
+void packet_server::broadcast( const uint8_t*data, size_t bytes, const nal_info & info )
+{
+if( packet_targets )
+	{
+	broadcast( packet_pool::shared().copy( data, bytes ), info );
+	return;
+	}
+for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+	{
+	(*iterator)->write( data, bytes, info );
+	}
+}
+
+void packet_server::broadcast( const packet_ref & packet )
+{
+for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+	{
+	(*iterator)->write( packet );
+	}
+}
+
+void packet_server::broadcast( const packet_ref & packet, const nal_info & info )
+{
+for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+	{
+	(*iterator)->write( packet, info );
+	}
+}
+
+//callbacks that keep packets get each entry in a pooled buffer shared
+//between them, the rest get the whole batch in one call
+void packet_server::broadcast_batch( const struct iovec * iov, int count )
+{
+for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+	{
+	if( !(*iterator)->wants_packets() )
+		{
+		(*iterator)->write_batch( iov, count );
+		}
+	}
+for( int i = 0; i < count && packet_targets; ++i )
+	{
+	packet_ref packet = packet_pool::shared().copy( (const uint8_t *)iov[i].iov_base, iov[i].iov_len );
+	for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+		{
+		if( (*iterator)->wants_packets() )
+			{
+			(*iterator)->write( packet );
+			}
+		}
+	}
+}
+
+void packet_server::broadcast_batch( const struct iovec * iov, int count, const nal_info * infos )
+{
+for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+	{
+	if( !(*iterator)->wants_packets() )
+		{
+		(*iterator)->write_batch( iov, count, infos );
+		}
+	}
+for( int i = 0; i < count && packet_targets; ++i )
+	{
+	packet_ref packet = packet_pool::shared().copy( (const uint8_t *)iov[i].iov_base, iov[i].iov_len );
+	for (std::list<data_source*>::iterator iterator = targets.begin(), end = targets.end(); iterator != end; ++iterator)
+		{
+		if( (*iterator)->wants_packets() )
+			{
+			(*iterator)->write( packet, infos[i] );
+			}
+		}
+	}
+}
+
 void packet_server::register_callback( data_source * source )
 {
 targets.push_back( source );
+if( source->wants_packets() )
+	{
+	packet_targets++;
+	}
+}
+
+void packet_server::register_async_callback( data_source * source, size_t depth, overflow_policy policy )
+{
+async_sink * sink = new async_sink( source, depth, policy );
+async_targets.push_back( sink );
+register_callback( sink );
 }
 
 size_t packet_server::num_targets( void )
 {
-targets.size();
+return targets.size();
+}
+
+void packet_server::report( void )
+{
+int n = 0;
+for (std::list<async_sink*>::iterator iterator = async_targets.begin(), end = async_targets.end(); iterator != end; ++iterator, ++n)
+	{
+	async_sink * sink = *iterator;
+	printf( "sink %i (%s): depth %i/%i max %i, %llu written, %llu dropped (%llu bytes), %llu blocked, latency %.1f us avg %.1f us max\n",
+		n, overflow_policy_name( sink->policy() ),
+		(int)sink->depth(), (int)sink->capacity(), (int)sink->max_depth(),
+		(unsigned long long)sink->written.load(), (unsigned long long)sink->dropped.load(),
+		(unsigned long long)sink->dropped_bytes.load(), (unsigned long long)sink->blocked.load(),
+		sink->average_latency_us(), sink->max_latency_us() );
+	}
 }
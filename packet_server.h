@@ -4,19 +4,39 @@
 #include <list>
 #include <stdint.h>
 
+#include "async_sink.h"
 #include "data_source.h"
 
-//broadcast calls each registered callback with data/bytes
+//broadcast calls each registered callback with data/bytes, and the NAL
+//descriptor when the producer has one. Callbacks registered as async get
+//their own queue and thread, so a slow one can't hold up the others, and
+//shed load by their overflow policy once their queue is full. Callbacks
+//that keep packets, async ones included, are handed a pooled buffer: a
+//producer's bytes are copied into one once per broadcast and shared by all
+//of them, while the rest still get the producer's bytes directly.
 class packet_server
 	{
 	public:
+	packet_server();
+	~packet_server();
 	void broadcast( const uint8_t * data, size_t bytes);
+	void broadcast( const uint8_t * data, size_t bytes, const nal_info & info );
+	void broadcast( const packet_ref & packet );
+	void broadcast( const packet_ref & packet, const nal_info & info );
+	void broadcast_batch( const struct iovec * iov, int count );
+	void broadcast_batch( const struct iovec * iov, int count, const nal_info * infos );
 	void register_callback( data_source * target );
+	void register_async_callback( data_source * target, size_t depth = 256, overflow_policy policy = OVERFLOW_DROP_TO_RECOVERY );
 	size_t num_targets();
 
+	//prints queue depth, drops and enqueue to write latency per async callback
+	void report();
+
 	private:
 
 	std::list<data_source*> targets;
+	std::list<async_sink*> async_targets;
+	size_t packet_targets;   //how many want packet_refs
 	};
 
 #endif
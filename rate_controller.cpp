@@ -0,0 +1,94 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rate_controller.h"
+
+rate_controller::rate_controller( int start_kbps, int min_kbps, int max_kbps ) : min_kbps( min_kbps ), max_kbps( max_kbps )
+{
+kbps = start_kbps < min_kbps ? min_kbps : start_kbps > max_kbps ? max_kbps : start_kbps;
+heard = false;
+last_report_us = 0;
+hold_until_us = 0;
+memset( &latest, 0, sizeof( latest ) );
+reports = 0;
+cuts = 0;
+holds = 0;
+silences = 0;
+}
+
+int rate_controller::update( const std::vector<receiver_report> & reports, uint64_t now_us )
+{
+if( reports.empty() )
+	{
+	if( heard && now_us - last_report_us >= RATE_SILENCE_MS * 1000 )
+		{
+		kbps = kbps / 2 < min_kbps ? min_kbps : kbps / 2;
+		last_report_us = now_us;
+		silences++;
+		}
+	return rate();
+	}
+
+//growth goes by the time since the last reports, however often they come
+double elapsed = heard ? ( now_us - last_report_us ) / 1e6 : 0;
+heard = true;
+last_report_us = now_us;
+this->reports += reports.size();
+
+double target = max_kbps;
+bool held = false;
+for( size_t i = 0; i < reports.size(); ++i )
+	{
+	const receiver_report & r = reports[i];
+	bool full = r.fraction_lost >= RATE_HIGH_LOSS ||
+		( r.queuing_us > RATE_TARGET_QUEUING_MS * 1000 && r.delay_trend_us >= 0 ) ||
+		r.delay_trend_us > RATE_TREND_LIMIT_MS * 1000;
+	double t;
+	if( full )
+		{
+		t = RATE_BACKOFF * ( r.received_kbps > 0 && r.received_kbps < kbps ? r.received_kbps : kbps );
+		}
+	else if( r.fraction_lost > RATE_LOW_LOSS || r.queuing_us > RATE_TARGET_QUEUING_MS * 500 || now_us < hold_until_us )
+		{
+		t = kbps;
+		held = true;
+		}
+	else
+		{
+		//an encoder with little to say sends less than it may, which
+		//tells nothing of what the link would take
+		t = kbps * pow( 1 + RATE_INCREASE_PER_S, elapsed );
+		double headroom = RATE_HEADROOM * r.received_kbps;
+		if( t > headroom )
+			{
+			t = headroom > kbps ? headroom : kbps;
+			}
+		}
+	if( t <= target )
+		{
+		target = t;
+		latest = r;
+		}
+	}
+
+if( target < kbps )
+	{
+	cuts++;
+	hold_until_us = now_us + RATE_HOLD_MS * 1000;
+	}
+else if( held && target == kbps )
+	{
+	holds++;
+	}
+kbps = target < min_kbps ? min_kbps : target > max_kbps ? max_kbps : target;
+return rate();
+}
+
+void rate_controller::report() const
+{
+printf( "RATE: %i kbps, %llu reports, %llu cuts, %llu holds, %llu silences; worst viewer: %.1f%% lost, %.1f ms queuing, %+.1f ms/s, %.1f ms jitter, %u kbps\n",
+	rate(), (unsigned long long)reports, (unsigned long long)cuts, (unsigned long long)holds,
+	(unsigned long long)silences, latest.fraction_lost * 100, latest.queuing_us / 1e3,
+	latest.delay_trend_us / 1e3, latest.jitter_us / 1e3, latest.received_kbps );
+}
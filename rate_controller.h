@@ -0,0 +1,75 @@
+#ifndef RATE_CONTROLLER_H
+#define RATE_CONTROLLER_H
+
+#include <vector>
+#include <stdint.h>
+
+#include "data_source_rtp.h"
+
+//the range the rate is kept in, by default
+#define RATE_MIN_KBPS 100
+#define RATE_MAX_KBPS 4000
+
+//queuing a viewer may report, still growing, before the rate comes down
+#define RATE_TARGET_QUEUING_MS 40
+
+//one-way delay growing faster than this, per second, means the link is
+//full whatever the queue is yet
+#define RATE_TREND_LIMIT_MS 100
+
+//loss above which the rate comes down, and below which it may grow
+#define RATE_HIGH_LOSS 0.10
+#define RATE_LOW_LOSS 0.02
+
+//how far under what got through the rate goes once the link is full
+#define RATE_BACKOFF 0.85
+
+//growth per second while nothing says the link is full, never beyond
+//half as much again as what the viewers get
+#define RATE_INCREASE_PER_S 0.15
+#define RATE_HEADROOM 1.5
+
+//after a cut, time for the queue to drain before growing again
+#define RATE_HOLD_MS 500
+
+//without a report for this long the rate halves, and again each time
+#define RATE_SILENCE_MS 1000
+
+//Picks the rate to encode at from the viewers' receiver reports, to use
+//what the link has without a queue building up in it. A viewer whose
+//queuing is past RATE_TARGET_QUEUING_MS and not falling, whose one-way
+//delay grows faster than RATE_TREND_LIMIT_MS a second, or that loses more
+//than RATE_HIGH_LOSS, has the rate cut to RATE_BACKOFF of what it is
+//getting; otherwise the rate grows by RATE_INCREASE_PER_S, unless the
+//loss or the queue are high enough to hold it. With several viewers, the
+//one worst off decides. Reports stopping altogether is taken as the link
+//being gone, and the rate halves until they come back.
+class rate_controller
+	{
+	public:
+	rate_controller( int start_kbps, int min_kbps = RATE_MIN_KBPS, int max_kbps = RATE_MAX_KBPS );
+
+	//the rate to encode at now, given the reports that came since the
+	//last call, of which there may be none. Times are on CLOCK_MONOTONIC
+	int update( const std::vector<receiver_report> & reports, uint64_t now_us );
+	int rate() const { return (int)kbps; }
+
+	//prints the counters below and the latest report
+	void report() const;
+
+	uint64_t reports;
+	uint64_t cuts;
+	uint64_t holds;
+	uint64_t silences;
+
+	private:
+	double kbps;
+	int min_kbps;
+	int max_kbps;
+	bool heard;
+	uint64_t last_report_us;
+	uint64_t hold_until_us;
+	receiver_report latest;
+	};
+
+#endif
@@ -0,0 +1,43 @@
+#include "receiver_report_queue.h"
+
+receiver_report_queue::receiver_report_queue()
+{
+received.store( 0 );
+}
+
+void receiver_report_queue::arrived( const uint8_t * rr, const uint8_t * app, uint64_t now )
+{
+const uint8_t * block = rr + 8;
+receiver_report report;
+report.received_us = now;
+report.fraction_lost = block[4] / 256.0;
+report.cumulative_lost = ( block[5] << 16 ) | ( block[6] << 8 ) | block[7];
+uint32_t jitter = ( (uint32_t)block[12] << 24 ) | ( block[13] << 16 ) | ( block[14] << 8 ) | block[15];
+report.jitter_us = (uint64_t)jitter * 1000000 / RTP_CLOCK_RATE;
+report.queuing_us = 0;
+report.delay_trend_us = 0;
+report.received_kbps = 0;
+if( app )
+	{
+	const uint8_t * data = app + 12;
+	report.queuing_us = (int32_t)( ( (uint32_t)data[0] << 24 ) | ( data[1] << 16 ) | ( data[2] << 8 ) | data[3] );
+	report.delay_trend_us = (int32_t)( ( (uint32_t)data[4] << 24 ) | ( data[5] << 16 ) | ( data[6] << 8 ) | data[7] );
+	report.received_kbps = ( (uint32_t)data[8] << 24 ) | ( data[9] << 16 ) | ( data[10] << 8 ) | data[11];
+	}
+received++;
+
+//only the latest matter to anyone not taking them
+std::lock_guard<std::mutex> hold( lock );
+if( pending.size() >= RECEIVER_REPORTS_KEPT )
+	{
+	pending.erase( pending.begin() );
+	}
+pending.push_back( report );
+}
+
+void receiver_report_queue::take( std::vector<receiver_report> & reports )
+{
+reports.clear();
+std::lock_guard<std::mutex> hold( lock );
+reports.swap( pending );
+}
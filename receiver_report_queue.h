@@ -0,0 +1,35 @@
+#ifndef RECEIVER_REPORT_QUEUE_H
+#define RECEIVER_REPORT_QUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+#include "data_source_rtp.h"
+
+//reports kept until taken, the oldest dropped first
+#define RECEIVER_REPORTS_KEPT 64
+
+//The viewers' receiver reports as they come to a data_source_udp, parsed
+//from RTCP, until the encoder's rate_controller takes them.
+class receiver_report_queue
+	{
+	public:
+	receiver_report_queue();
+
+	//the first report block of a receiver report, and the APP packet that
+	//came with it, or NULL
+	void arrived( const uint8_t * rr, const uint8_t * app, uint64_t now );
+
+	//moves the reports that came since the last call to reports
+	void take( std::vector<receiver_report> & reports );
+
+	std::atomic<uint64_t> received;
+
+	private:
+	std::mutex lock;
+	std::vector<receiver_report> pending;
+	};
+
+#endif
@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+
+#include "data_source_rtp.h"
+#include "rtp_depacketizer.h"
+
+static const uint8_t start_code_bytes[4] = { 0x00, 0x00, 0x00, 0x01 };
+
+static uint64_t wall_clock_us()
+{
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+rtp_depacketizer::rtp_depacketizer( size_t reorder_depth )
+{
+//a power of two, so the slots stay in order as sequence numbers wrap
+size_t slots = 1;
+while( slots < reorder_depth && slots < 32768 )
+	{
+	slots *= 2;
+	}
+window.resize( slots );
+for( size_t i = 0; i < window.size(); ++i )
+	{
+	window[i].used = false;
+	}
+nacks.resize( RTP_NACK_SLOTS );
+for( size_t i = 0; i < nacks.size(); ++i )
+	{
+	nacks[i].sequence = 0;
+	nacks[i].state = NACK_NONE;
+	}
+held = 0;
+next = 0;
+highest = 0;
+started = false;
+ssrc = 0;
+fragment_ok = false;
+packets = 0;
+lost = 0;
+reordered = 0;
+late = 0;
+duplicates = 0;
+invalid = 0;
+nals = 0;
+nals_dropped = 0;
+nacked = 0;
+nack_recovered = 0;
+nack_late = 0;
+nack_wasted = 0;
+reports_sent = 0;
+restart_statistics( 0, 0 );
+}
+
+void rtp_depacketizer::write( const uint8_t * data, size_t bytes )
+{
+if( bytes < RTP_HEADER_SIZE || ( data[0] >> 6 ) != RTP_VERSION )
+	{
+	invalid++;
+	return;
+	}
+uint16_t sequence = ( data[2] << 8 ) | data[3];
+uint32_t packet_ssrc = ( (uint32_t)data[8] << 24 ) | ( data[9] << 16 ) | ( data[10] << 8 ) | data[11];
+uint64_t now = wall_clock_us();
+packets++;
+
+if( !started || packet_ssrc != ssrc )
+	{
+	flush();
+	started = true;
+	ssrc = packet_ssrc;
+	next = sequence;
+	highest = sequence;
+	restart_statistics( sequence, now );
+	}
+arrived( data, bytes, now );
+if( feedback.num_targets() > 0 && now - last_report_us >= RTP_REPORT_INTERVAL_MS * 1000 )
+	{
+	send_report( now );
+	}
+
+int16_t ahead = (int16_t)( sequence - next );
+nack_arrived( sequence, ahead >= 0 );
+if( ahead < 0 )
+	{
+	late++;
+	return;
+	}
+received_packets++;
+int16_t beyond = (int16_t)( sequence - highest );
+if( beyond < 0 )
+	{
+	reordered++;
+	}
+else
+	{
+	//ask for the ones skipped over, if there is time to wait for them
+	if( beyond > 1 && (size_t)beyond <= window.size() && feedback.num_targets() > 0 )
+		{
+		send_nack( highest + 1, beyond - 1 );
+		}
+	if( sequence < highest )
+		{
+		cycles += 65536;
+		}
+	highest = sequence;
+	}
+
+//in order, with nothing waiting: no need to hold on to it
+if( ahead == 0 && held == 0 )
+	{
+	deliver( data, bytes );
+	next++;
+	return;
+	}
+
+//too far ahead for the window: give up on what it is waiting for, and
+//skip the rest of a long gap in one go once nothing is held
+while( (size_t)ahead >= window.size() )
+	{
+	if( held == 0 )
+		{
+		lost += ahead;
+		drop_fragment();
+		next = sequence;
+		ahead = 0;
+		break;
+		}
+	advance();
+	ahead--;
+	}
+
+held_packet & slot = window[sequence % window.size()];
+if( slot.used )
+	{
+	duplicates++;
+	received_packets--;
+	return;
+	}
+slot.used = true;
+slot.bytes.assign( data, data + bytes );
+held++;
+
+while( window[next % window.size()].used )
+	{
+	advance();
+	}
+}
+
+//delivers the next packet, or gives up on it
+void rtp_depacketizer::advance()
+{
+held_packet & slot = window[next % window.size()];
+if( slot.used )
+	{
+	deliver( &slot.bytes[0], slot.bytes.size() );
+	slot.used = false;
+	held--;
+	}
+else
+	{
+	lost++;
+	drop_fragment();
+	nack_entry & entry = nacks[next % nacks.size()];
+	if( entry.sequence == next && entry.state == NACK_WAITING )
+		{
+		entry.state = NACK_GIVEN_UP;
+		}
+	}
+next++;
+}
+
+void rtp_depacketizer::flush()
+{
+while( held > 0 )
+	{
+	advance();
+	}
+}
+
+void rtp_depacketizer::deliver( const uint8_t * data, size_t bytes )
+{
+const uint8_t * end = data + bytes;
+bool marker = data[1] & 0x80;
+
+//skip the CSRCs and any header extension, and trim any padding
+const uint8_t * p = data + RTP_HEADER_SIZE + 4 * ( data[0] & 0x0F );
+if( ( data[0] & 0x10 ) && p + 4 <= end )
+	{
+	p += 4 + 4 * ( ( p[2] << 8 ) | p[3] );
+	}
+if( ( data[0] & 0x20 ) && end > p )
+	{
+	end -= end[-1];
+	}
+if( p >= end )
+	{
+	invalid++;
+	return;
+	}
+
+uint8_t type = p[0] & 0x1F;
+if( type >= 1 && type <= 23 )
+	{
+	emit( NULL, p, end - p, marker );
+	}
+else if( type == RTP_STAP_A )
+	{
+	p++;
+	while( p + 2 <= end )
+		{
+		size_t n = ( p[0] << 8 ) | p[1];
+		p += 2;
+		if( n == 0 || p + n > end )
+			{
+			invalid++;
+			break;
+			}
+		emit( NULL, p, n, marker && p + n == end );
+		p += n;
+		}
+	}
+else if( type == RTP_FU_A && end - p > 2 )
+	{
+	bool first = p[1] & 0x80;
+	bool last = p[1] & 0x40;
+	if( first )
+		{
+		drop_fragment();
+		fragment.assign( start_code_bytes, start_code_bytes + 4 );
+		fragment.push_back( ( p[0] & 0xE0 ) | ( p[1] & 0x1F ) );
+		fragment_ok = true;
+		}
+	if( fragment_ok )
+		{
+		fragment.insert( fragment.end(), p + 2, end );
+		if( last )
+			{
+			size_t n = fragment.size();
+			fragment.resize( n + PACKET_PADDING_SIZE, 0 );
+			emit( &fragment[0], NULL, n, marker );
+			fragment.clear();
+			fragment_ok = false;
+			}
+		}
+	else if( last )
+		{
+		//its first fragment never came, and drop_fragment had nothing to count
+		nals_dropped++;
+		}
+	}
+else
+	{
+	invalid++;
+	}
+}
+
+//a loss in the middle of a FU-A loses the whole NAL
+void rtp_depacketizer::drop_fragment()
+{
+if( fragment_ok )
+	{
+	nals_dropped++;
+	}
+fragment.clear();
+fragment_ok = false;
+}
+
+//broadcasts a NAL, either already laid out with its start code and padding
+//in whole, or a bare one from data that gets both added
+void rtp_depacketizer::emit( const uint8_t * whole, const uint8_t * data, size_t bytes, bool end )
+{
+if( whole == NULL )
+	{
+	nal.resize( 4 + bytes + PACKET_PADDING_SIZE );
+	memcpy( &nal[0], start_code_bytes, 4 );
+	memcpy( &nal[4], data, bytes );
+	memset( &nal[4 + bytes], 0, PACKET_PADDING_SIZE );
+	whole = &nal[0];
+	bytes += 4;
+	}
+
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+
+nal_info info;
+parser.parse( whole, bytes, info );
+info.access_unit_end |= end;
+info.timestamp_us = (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+server.broadcast( whole, bytes, info );
+nals++;
+}
+
+//follows up a NACKed packet turning up, in time for its turn or not
+void rtp_depacketizer::nack_arrived( uint16_t sequence, bool in_time )
+{
+nack_entry & entry = nacks[sequence % nacks.size()];
+if( entry.sequence != sequence || entry.state == NACK_NONE )
+	{
+	return;
+	}
+if( entry.state == NACK_ARRIVED )
+	{
+	nack_wasted++;
+	}
+else if( entry.state == NACK_GIVEN_UP || !in_time )
+	{
+	nack_late++;
+	}
+else
+	{
+	nack_recovered++;
+	}
+entry.state = NACK_ARRIVED;
+}
+
+//one generic NACK for count sequence numbers from first on: each entry is
+//one of them and a bitmap of the 16 after it
+void rtp_depacketizer::send_nack( uint16_t first, int count )
+{
+int entries = ( count + 16 ) / 17;
+size_t bytes = 12 + 4 * entries;
+nack_packet.assign( bytes + PACKET_PADDING_SIZE, 0 );
+uint8_t * p = &nack_packet[0];
+p[0] = ( RTP_VERSION << 6 ) | RTCP_NACK;
+p[1] = RTCP_RTPFB;
+p[2] = ( bytes / 4 - 1 ) >> 8;
+p[3] = ( bytes / 4 - 1 ) & 0xFF;
+//our own SSRC stays 0, as we send nothing else
+p[8] = ssrc >> 24;
+p[9] = ( ssrc >> 16 ) & 0xFF;
+p[10] = ( ssrc >> 8 ) & 0xFF;
+p[11] = ssrc & 0xFF;
+
+for( int i = 0; i < count; ++i )
+	{
+	uint16_t sequence = first + i;
+	uint8_t * f = p + 12 + 4 * ( i / 17 );
+	if( i % 17 == 0 )
+		{
+		f[0] = sequence >> 8;
+		f[1] = sequence & 0xFF;
+		}
+	else
+		{
+		uint16_t bit = 1 << ( i % 17 - 1 );
+		f[2] |= bit >> 8;
+		f[3] |= bit & 0xFF;
+		}
+	nack_entry & entry = nacks[sequence % nacks.size()];
+	entry.sequence = sequence;
+	entry.state = NACK_WAITING;
+	}
+nacked += count;
+feedback.broadcast( p, bytes );
+}
+
+//a new sender, or a new stream from it
+void rtp_depacketizer::restart_statistics( uint16_t sequence, uint64_t now )
+{
+cycles = 0;
+base_sequence = sequence;
+received_packets = 0;
+expected_prior = 0;
+received_prior = 0;
+bytes_since_report = 0;
+last_report_us = now;
+have_transit = false;
+first_transit = 0;
+last_transit = 0;
+jitter = 0;
+have_delay = false;
+smoothed_delay_us = 0;
+reported_delay_us = 0;
+least_delay_us = 0;
+previous_least_delay_us = 0;
+delay_window_start_us = now;
+}
+
+//the jitter of RFC 3550 A.8 from every packet, and the one-way delay from
+//the last of each frame, which has waited behind the rest of it
+void rtp_depacketizer::arrived( const uint8_t * data, size_t bytes, uint64_t now )
+{
+bytes_since_report += bytes;
+uint32_t timestamp = ( (uint32_t)data[4] << 24 ) | ( data[5] << 16 ) | ( data[6] << 8 ) | data[7];
+uint32_t transit = (uint32_t)( now * ( RTP_CLOCK_RATE / 1000 ) / 1000 ) - timestamp;
+if( !have_transit )
+	{
+	have_transit = true;
+	first_transit = transit;
+	last_transit = transit;
+	}
+int32_t d = (int32_t)( transit - last_transit );
+jitter += ( ( d < 0 ? -(double)d : (double)d ) - jitter ) / 16;
+last_transit = transit;
+
+if( !( data[1] & 0x80 ) )
+	{
+	return;
+	}
+int64_t delay = (int64_t)(int32_t)( transit - first_transit ) * 1000000 / RTP_CLOCK_RATE;
+if( !have_delay )
+	{
+	have_delay = true;
+	smoothed_delay_us = delay;
+	reported_delay_us = delay;
+	least_delay_us = delay;
+	previous_least_delay_us = delay;
+	}
+if( now - delay_window_start_us >= RTP_DELAY_WINDOW_MS * 1000 )
+	{
+	previous_least_delay_us = least_delay_us;
+	least_delay_us = delay;
+	delay_window_start_us = now;
+	}
+least_delay_us = delay < least_delay_us ? delay : least_delay_us;
+smoothed_delay_us += ( delay - smoothed_delay_us ) / 4;
+}
+
+//a receiver report and the APP packet that goes with it, in one compound
+//packet, on the counts since the last one (RFC 3550 A.3)
+void rtp_depacketizer::send_report( uint64_t now )
+{
+uint32_t extended = cycles + highest;
+uint64_t expected = extended - base_sequence + 1;
+int64_t expected_interval = expected - expected_prior;
+int64_t lost_interval = expected_interval - (int64_t)( received_packets - received_prior );
+int fraction = expected_interval <= 0 || lost_interval <= 0 ? 0 : (int)( ( lost_interval << 8 ) / expected_interval );
+fraction = fraction > 255 ? 255 : fraction;
+int64_t cumulative = (int64_t)expected - (int64_t)received_packets;
+cumulative = cumulative < 0 ? 0 : cumulative > 0x7FFFFF ? 0x7FFFFF : cumulative;
+expected_prior = expected;
+received_prior = received_packets;
+
+uint64_t elapsed = now - last_report_us;
+int64_t least = least_delay_us < previous_least_delay_us ? least_delay_us : previous_least_delay_us;
+int32_t queuing = have_delay ? (int32_t)( smoothed_delay_us - least ) : 0;
+int32_t trend = have_delay && elapsed ? (int32_t)( ( smoothed_delay_us - reported_delay_us ) * 1e6 / elapsed ) : 0;
+uint32_t kbps = elapsed ? (uint32_t)( bytes_since_report * 8000 / elapsed ) : 0;
+uint32_t jitter_units = (uint32_t)jitter;
+reported_delay_us = smoothed_delay_us;
+bytes_since_report = 0;
+last_report_us = now;
+
+//our own SSRC stays 0 in both, as we send nothing else
+report_packet.assign( 56 + PACKET_PADDING_SIZE, 0 );
+uint8_t * p = &report_packet[0];
+p[0] = ( RTP_VERSION << 6 ) | 1;
+p[1] = RTCP_RR;
+p[3] = 7;
+p[8] = ssrc >> 24;
+p[9] = ( ssrc >> 16 ) & 0xFF;
+p[10] = ( ssrc >> 8 ) & 0xFF;
+p[11] = ssrc & 0xFF;
+p[12] = fraction;
+p[13] = cumulative >> 16;
+p[14] = ( cumulative >> 8 ) & 0xFF;
+p[15] = cumulative & 0xFF;
+p[16] = extended >> 24;
+p[17] = ( extended >> 16 ) & 0xFF;
+p[18] = ( extended >> 8 ) & 0xFF;
+p[19] = extended & 0xFF;
+p[20] = jitter_units >> 24;
+p[21] = ( jitter_units >> 16 ) & 0xFF;
+p[22] = ( jitter_units >> 8 ) & 0xFF;
+p[23] = jitter_units & 0xFF;
+
+uint8_t * app = p + 32;
+app[0] = RTP_VERSION << 6;
+app[1] = RTCP_APP;
+app[3] = 5;
+memcpy( app + 8, RTCP_APP_RATE, 4 );
+uint32_t values[3] = { (uint32_t)queuing, (uint32_t)trend, kbps };
+for( int i = 0; i < 3; ++i )
+	{
+	app[12 + 4 * i] = values[i] >> 24;
+	app[13 + 4 * i] = ( values[i] >> 16 ) & 0xFF;
+	app[14 + 4 * i] = ( values[i] >> 8 ) & 0xFF;
+	app[15 + 4 * i] = values[i] & 0xFF;
+	}
+reports_sent++;
+feedback.broadcast( p, 56 );
+}
+
+void rtp_depacketizer::report() const
+{
+printf( "RTP: %llu packets, %llu lost, %llu reordered, %llu late, %llu duplicates, %llu invalid, %llu NALs, %llu dropped\n",
+	(unsigned long long)packets, (unsigned long long)lost, (unsigned long long)reordered,
+	(unsigned long long)late, (unsigned long long)duplicates, (unsigned long long)invalid,
+	(unsigned long long)nals, (unsigned long long)nals_dropped );
+if( nacked )
+	{
+	printf( "RTP: %llu NACKed, %llu recovered, %llu too late, %llu wasted\n",
+		(unsigned long long)nacked, (unsigned long long)nack_recovered,
+		(unsigned long long)nack_late, (unsigned long long)nack_wasted );
+	}
+}
@@ -0,0 +1,141 @@
+#ifndef RTP_DEPACKETIZER_H
+#define RTP_DEPACKETIZER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+#include "packet_server.h"
+
+//packets held back waiting for a missing one, by default
+#define RTP_REORDER_DEPTH 16
+
+//sequence numbers whose NACKs are followed up
+#define RTP_NACK_SLOTS 1024
+
+//how often receiver reports go back, far more often than RFC 3550's
+//5 seconds, for the encoder's rate to follow the link
+#define RTP_REPORT_INTERVAL_MS 100
+
+//how long the least one-way delay seen is remembered, to tell queuing
+//from the clocks' offset
+#define RTP_DELAY_WINDOW_MS 5000
+
+//Turns RTP packets, one per write, back into NALs as data_source_rtp sent
+//them. Packets are put back in sequence order: one that arrives early waits
+//for the ones before it in a window of reorder_depth packets, rounded up to
+//a power of two, and a missing one is given up on as lost once the window
+//fills, or at flush(). Single NAL, STAP-A and FU-A payloads are understood,
+//and a FU-A NAL missing any fragment is dropped whole. Each NAL is broadcast
+//with a 00 00 00 01 start code in front, PACKET_PADDING_SIZE zero bytes
+//after, and its nal_info stamped with the time it was delivered; the last
+//NAL of a packet with the marker bit set is marked as the end of its access
+//unit. A change of SSRC starts over, as the sender has.
+//
+//With anything registered on feedback, a gap is NACKed the moment the
+//packet after it arrives, with an RTCP generic NACK (RFC 4585) covering
+//each run of up to 17 missing packets in 4 bytes, for the viewer to send
+//back to a data_source_udp that keeps what it sent. The window has to be
+//deep enough to wait out a round trip for the resent packets to count.
+//Every RTP_REPORT_INTERVAL_MS it also sends a receiver report (RFC 3550),
+//with loss and interarrival jitter, and an APP packet named RATE with
+//what a receiver_report needs besides: how far the one-way delay of the
+//last packets of frames is above the least lately seen, how fast it is
+//changing, and the rate the stream came in at.
+class rtp_depacketizer: public data_source
+	{
+	public:
+	rtp_depacketizer( size_t reorder_depth = RTP_REORDER_DEPTH );
+	void write( const uint8_t * data, size_t bytes );
+
+	//delivers whatever is held, giving up on the gaps
+	void flush();
+	packet_server server;
+	packet_server feedback;
+
+	//prints the counters below
+	void report() const;
+
+	uint64_t packets;       //valid ones received, duplicates included
+	uint64_t lost;          //sequence numbers given up on
+	uint64_t reordered;     //arrived after a later one, but in time
+	uint64_t late;          //arrived after its turn, repeats of delivered ones too
+	uint64_t duplicates;    //repeats of ones still held
+	uint64_t invalid;       //not RTP, or a payload that makes no sense
+	uint64_t nals;
+	uint64_t nals_dropped;  //fragmented ones missing a piece
+	uint64_t nacked;        //sequence numbers asked for again
+	uint64_t nack_recovered;
+	uint64_t nack_late;     //came back after being given up on
+	uint64_t nack_wasted;   //came twice, the first copy having been late, not lost
+	uint64_t reports_sent;
+
+	private:
+	struct held_packet
+		{
+		bool used;
+		std::vector<uint8_t> bytes;
+		};
+	void advance();
+	void deliver( const uint8_t * data, size_t bytes );
+	void emit( const uint8_t * whole, const uint8_t * data, size_t bytes, bool end );
+	void drop_fragment();
+	void nack_arrived( uint16_t sequence, bool in_time );
+	void send_nack( uint16_t first, int count );
+	void restart_statistics( uint16_t sequence, uint64_t now );
+	void arrived( const uint8_t * data, size_t bytes, uint64_t now );
+	void send_report( uint64_t now );
+
+	nal_parser parser;
+	std::vector<held_packet> window;   //indexed by sequence number modulo its size
+	size_t held;
+	uint16_t next;                     //the sequence number to deliver next
+	uint16_t highest;
+	bool started;
+	uint32_t ssrc;
+
+	//the NAL being put back together from FU-A fragments, start code first
+	std::vector<uint8_t> fragment;
+	bool fragment_ok;
+
+	//the NAL being broadcast, reused
+	std::vector<uint8_t> nal;
+
+	//what became of each NACKed sequence number
+	enum nack_state { NACK_NONE, NACK_WAITING, NACK_GIVEN_UP, NACK_ARRIVED };
+	struct nack_entry
+		{
+		uint16_t sequence;
+		nack_state state;
+		};
+	std::vector<nack_entry> nacks;
+	std::vector<uint8_t> nack_packet;
+
+	//for receiver reports: sequence numbers extended past their wrap, and
+	//the packets expected and received by the last report
+	uint32_t cycles;
+	uint32_t base_sequence;
+	uint64_t received_packets;
+	uint64_t expected_prior;
+	uint64_t received_prior;
+	uint64_t bytes_since_report;
+	uint64_t last_report_us;
+
+	//transit times, on the RTP clock, for the jitter, and the delay of
+	//the last packets of frames relative to the first's
+	bool have_transit;
+	bool have_delay;
+	uint32_t first_transit;
+	uint32_t last_transit;
+	double jitter;
+	double smoothed_delay_us;
+	double reported_delay_us;
+	int64_t least_delay_us;           //in this window
+	int64_t previous_least_delay_us;  //in the one before
+	uint64_t delay_window_start_us;
+	std::vector<uint8_t> report_packet;
+	};
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "data_source_rtp.h"
+#include "rtp_send_history.h"
+
+static uint64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+rtp_send_history::rtp_send_history( int history_ms, int playout_ms )
+{
+history.resize( RTP_HISTORY_SLOTS );
+for( size_t i = 0; i < history.size(); ++i )
+	{
+	history[i].used = false;
+	}
+history_us = (uint64_t)history_ms * 1000;
+playout_us = (uint64_t)playout_ms * 1000;
+frame_timestamp = 0;
+frame_start_us = 0;
+packets_kept.store( 0 );
+nacks.store( 0 );
+requested.store( 0 );
+retransmitted.store( 0 );
+too_late.store( 0 );
+not_kept.store( 0 );
+rtt_us.store( 0 );
+}
+
+//with the time their frame is due
+void rtp_send_history::keep( const struct iovec * iov, int count )
+{
+uint64_t now = now_us();
+std::lock_guard<std::mutex> hold( lock );
+for( int i = 0; i < count; ++i )
+	{
+	const uint8_t * p = (const uint8_t *)iov[i].iov_base;
+	size_t bytes = iov[i].iov_len;
+	if( bytes < RTP_HEADER_SIZE || ( p[0] >> 6 ) != RTP_VERSION || ( p[1] & 0x7F ) != RTP_PAYLOAD_TYPE )
+		{
+		continue;
+		}
+	uint32_t timestamp = ( (uint32_t)p[4] << 24 ) | ( p[5] << 16 ) | ( p[6] << 8 ) | p[7];
+	if( timestamp != frame_timestamp || frame_start_us == 0 )
+		{
+		frame_timestamp = timestamp;
+		frame_start_us = now;
+		}
+	uint16_t sequence = ( p[2] << 8 ) | p[3];
+	sent_packet & slot = history[sequence % history.size()];
+	slot.used = true;
+	slot.sequence = sequence;
+	slot.sent_us = now;
+	slot.deadline_us = frame_start_us + playout_us;
+	slot.bytes.assign( p, p + bytes );
+	packets_kept++;
+	}
+}
+
+void rtp_send_history::nack_arrived( uint16_t after, uint64_t now )
+{
+nacks++;
+std::lock_guard<std::mutex> hold( lock );
+sent_packet & slot = history[after % history.size()];
+if( slot.used && slot.sequence == after && now - slot.sent_us < history_us )
+	{
+	uint64_t sample = now - slot.sent_us;
+	uint64_t rtt = rtt_us.load();
+	rtt_us.store( rtt ? ( 7 * rtt + sample ) / 8 : sample );
+	}
+}
+
+bool rtp_send_history::find( uint16_t sequence, uint64_t now, std::vector<uint8_t> & bytes )
+{
+requested++;
+std::lock_guard<std::mutex> hold( lock );
+sent_packet & slot = history[sequence % history.size()];
+if( !slot.used || slot.sequence != sequence || now - slot.sent_us > history_us )
+	{
+	not_kept++;
+	return false;
+	}
+if( now + rtt_us.load() / 2 > slot.deadline_us )
+	{
+	too_late++;
+	return false;
+	}
+bytes = slot.bytes;
+return true;
+}
+
+void rtp_send_history::report() const
+{
+printf( "UDP: %llu packets kept, %llu NACKs for %llu, %llu resent (%.2f%%), %llu too late, %llu not kept, rtt %.2f ms\n",
+	(unsigned long long)packets_kept.load(), (unsigned long long)nacks.load(), (unsigned long long)requested.load(),
+	(unsigned long long)retransmitted.load(), packets_kept.load() ? 100.0 * retransmitted.load() / packets_kept.load() : 0.0,
+	(unsigned long long)too_late.load(), (unsigned long long)not_kept.load(), rtt_us.load() / 1e3 );
+}
@@ -0,0 +1,61 @@
+#ifndef RTP_SEND_HISTORY_H
+#define RTP_SEND_HISTORY_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+//sent packets kept, whatever the history's length
+#define RTP_HISTORY_SLOTS 1024
+
+//The RTP packets a data_source_udp sent, kept history_ms to answer NACKs
+//with. A packet is only handed back while it can still arrive before its
+//frame is due, playout_ms after the frame's first packet went out, going by
+//half the round trip measured from the NACKs themselves.
+class rtp_send_history
+	{
+	public:
+	rtp_send_history( int history_ms, int playout_ms );
+
+	//remembers the media packets among those about to be sent
+	void keep( const struct iovec * iov, int count );
+
+	//a NACK whose first lost packet is after - 1, a round trip from when
+	//after went out
+	void nack_arrived( uint16_t after, uint64_t now );
+
+	//copies the packet to bytes if it is kept and can still make its frame
+	bool find( uint16_t sequence, uint64_t now, std::vector<uint8_t> & bytes );
+
+	void report() const;
+
+	std::atomic<uint64_t> packets_kept;
+	std::atomic<uint64_t> nacks;
+	std::atomic<uint64_t> requested;
+	std::atomic<uint64_t> retransmitted;
+	std::atomic<uint64_t> too_late;   //would have missed their frame
+	std::atomic<uint64_t> not_kept;   //gone from the history, or never in it
+	std::atomic<uint64_t> rtt_us;     //smoothed
+
+	private:
+	//by sequence number modulo RTP_HISTORY_SLOTS
+	struct sent_packet
+		{
+		bool used;
+		uint16_t sequence;
+		uint64_t sent_us;
+		uint64_t deadline_us;
+		std::vector<uint8_t> bytes;
+		};
+	std::vector<sent_packet> history;
+	std::mutex lock;
+	uint64_t history_us;
+	uint64_t playout_us;
+	uint32_t frame_timestamp;
+	uint64_t frame_start_us;
+	};
+
+#endif
@@ -0,0 +1,116 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "seqpacket_reader.h"
+
+seqpacket_reader::seqpacket_reader()
+{
+fd = -1;
+messages = 0;
+nals = 0;
+bytes_read = 0;
+malformed = 0;
+}
+
+seqpacket_reader::~seqpacket_reader()
+{
+if( fd >= 0 )
+	{
+	close( fd );
+	}
+}
+
+bool seqpacket_reader::open( const char * path, int timeout_ms )
+{
+struct sockaddr_un addr;
+memset( &addr, 0, sizeof( addr ) );
+addr.sun_family = AF_UNIX;
+snprintf( addr.sun_path, sizeof( addr.sun_path ), "%s", path );
+for( int waited = 0; ; waited += 10 )
+	{
+	fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+	if( fd >= 0 && connect( fd, (struct sockaddr *)&addr, sizeof( addr ) ) == 0 )
+		{
+		break;
+		}
+	if( fd >= 0 )
+		{
+		close( fd );
+		fd = -1;
+		}
+	if( timeout_ms >= 0 && waited >= timeout_ms )
+		{
+		return false;
+		}
+	usleep( 10000 );
+	}
+
+//as big as any message can be, and the padding after the last NAL is
+//sent with it
+buffer.resize( SEQPACKET_MAX_MESSAGE );
+printf( "SEQPACKET: subscribed to %s\n", path );
+return true;
+}
+
+bool seqpacket_reader::read( int timeout_ms )
+{
+if( fd < 0 )
+	{
+	return false;
+	}
+if( timeout_ms >= 0 )
+	{
+	struct pollfd descriptor;
+	descriptor.fd = fd;
+	descriptor.events = POLLIN;
+	if( poll( &descriptor, 1, timeout_ms ) == 0 )
+		{
+		return true;
+		}
+	}
+
+ssize_t n = recv( fd, &buffer[0], buffer.size(), MSG_TRUNC );
+if( n < 0 && errno == EINTR )
+	{
+	return true;
+	}
+if( n <= 0 )
+	{
+	close( fd );
+	fd = -1;
+	return false;
+	}
+messages++;
+
+//the table and the NALs it describes must all be there
+const uint8_t * p = &buffer[0];
+const uint8_t * end = p + n;
+const seqpacket_header * header = (const seqpacket_header *)p;
+const seqpacket_nal * table = (const seqpacket_nal *)( p + sizeof( seqpacket_header ) );
+if( (size_t)n > buffer.size() || (size_t)n < sizeof( seqpacket_header ) || header->magic != SEQPACKET_MAGIC ||
+	header->count > ( n - sizeof( seqpacket_header ) ) / sizeof( seqpacket_nal ) )
+	{
+	malformed++;
+	return true;
+	}
+const uint8_t * nal = (const uint8_t *)( table + header->count );
+for( uint32_t i = 0; i < header->count; ++i )
+	{
+	if( table[i].bytes + PACKET_PADDING_SIZE > (size_t)( end - nal ) )
+		{
+		malformed++;
+		return true;
+		}
+	server.broadcast( nal, table[i].bytes, table[i].info );
+	nals++;
+	bytes_read += table[i].bytes;
+	nal += table[i].bytes + PACKET_PADDING_SIZE;
+	}
+return true;
+}
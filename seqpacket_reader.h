@@ -0,0 +1,41 @@
+#ifndef SEQPACKET_READER_H
+#define SEQPACKET_READER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "data_source_seqpacket.h"
+#include "packet_server.h"
+
+//A subscriber to a data_source_seqpacket. Each message read is broadcast
+//NAL by NAL, with the descriptors the server sent, straight from the
+//receive buffer: no start codes are looked for and nothing is parsed.
+//NALs are followed by PACKET_PADDING_SIZE zero bytes and only valid
+//during the call. Any number of processes may subscribe at once.
+class seqpacket_reader
+	{
+	public:
+	seqpacket_reader();
+	~seqpacket_reader();
+
+	//waits up to timeout_ms, -1 for ever, for the server to be listening
+	bool open( const char * path = SEQPACKET_PATH, int timeout_ms = -1 );
+	bool is_open() const { return fd >= 0; }
+
+	//reads and broadcasts a message, first waiting up to timeout_ms for one,
+	//-1 for as long as it takes. Returns false once the server has gone
+	bool read( int timeout_ms = -1 );
+	packet_server server;
+
+	uint64_t messages;
+	uint64_t nals;
+	uint64_t bytes_read;
+	uint64_t malformed;     //cut short or not from a data_source_seqpacket
+
+	private:
+	int fd;
+	std::vector<uint8_t> buffer;
+	};
+
+#endif
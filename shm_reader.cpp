@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shm_reader.h"
+
+static uint64_t now_ms()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000 + temp.tv_nsec / 1000000;
+}
+
+shm_reader::shm_reader()
+{
+synced = false;
+nals = 0;
+bytes_read = 0;
+skipped = 0;
+sleeps = 0;
+reported_death = false;
+}
+
+bool shm_reader::open( const char * name, int timeout_ms )
+{
+for( int waited = 0; !ring.open( name ); waited += 10 )
+	{
+	if( timeout_ms >= 0 && waited >= timeout_ms )
+		{
+		return false;
+		}
+	usleep( 10000 );
+	}
+
+//what is already in the ring is old news
+ring.header->tail.store( ring.header->head.load() );
+synced = false;
+printf( "SHM: reading from %s\n", name );
+return true;
+}
+
+bool shm_reader::read( int timeout_ms )
+{
+if( !ring.is_open() )
+	{
+	return false;
+	}
+shm_ring_header * header = ring.header;
+uint64_t tail = header->tail.load( std::memory_order_relaxed );
+uint64_t head = header->head.load( std::memory_order_acquire );
+
+//nothing yet: say so, then look once more before sleeping, in the
+//opposite order to the encoder publishing and then looking for sleepers.
+//The sleep is cut into SHM_LIVENESS_MS slices, so an encoder that was
+//killed, and never set closed, isn't waited on for ever
+if( head == tail && timeout_ms != 0 )
+	{
+	header->waiting.store( 1 );
+	uint64_t give_up = timeout_ms >= 0 ? now_ms() + timeout_ms : 0;
+	while( true )
+		{
+		uint32_t seen = header->wake.load();
+		head = header->head.load();
+		if( head != tail || ring.producer_gone() )
+			{
+			break;
+			}
+		int slice = SHM_LIVENESS_MS;
+		if( timeout_ms >= 0 )
+			{
+			uint64_t now = now_ms();
+			if( now >= give_up )
+				{
+				break;
+				}
+			slice = give_up - now < SHM_LIVENESS_MS ? give_up - now : SHM_LIVENESS_MS;
+			}
+		ring.wait( seen, slice );
+		sleeps++;
+		}
+	head = header->head.load( std::memory_order_acquire );
+	header->waiting.store( 0, std::memory_order_relaxed );
+	}
+if( head == tail )
+	{
+	if( ring.producer_gone() && !header->closed.load() && !reported_death )
+		{
+		printf( "SHM: the encoder died without closing the ring\n" );
+		reported_death = true;
+		}
+	return !ring.producer_gone();
+	}
+
+while( tail != head )
+	{
+	const shm_record * record = (const shm_record *)( ring.data + ( tail & ring.mask ) );
+	if( record->bytes != SHM_WRAP )
+		{
+		const nal_info & info = record->info;
+		//every record goes through the tracker, synced or not
+		bool resume = recovery.resumes( info );
+		synced = synced || resume;
+		if( synced )
+			{
+			server.broadcast( (const uint8_t *)record + SHM_RECORD_ALIGN, record->bytes, info );
+			nals++;
+			bytes_read += record->bytes;
+			}
+		else
+			{
+			skipped++;
+			}
+		}
+	tail += record->size;
+	header->tail.store( tail, std::memory_order_release );
+	}
+return true;
+}
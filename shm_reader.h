@@ -0,0 +1,45 @@
+#ifndef SHM_READER_H
+#define SHM_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "packet_server.h"
+#include "shm_ring.h"
+
+//The viewer's end of a data_source_shm. Each NAL is broadcast with the
+//descriptor the encoder's end gave it, straight from the ring, and is only
+//valid during the call; it is followed by PACKET_PADDING_SIZE zero bytes.
+//Each record's room goes back to the encoder as soon as its sinks return.
+//A reader that starts mid-stream passes nothing until an access unit
+//starts with an IDR, a recovery point SEI or parameter sets.
+class shm_reader
+	{
+	public:
+	shm_reader();
+
+	//waits up to timeout_ms, -1 for ever, for an encoder to create the ring
+	bool open( const char * name = SHM_RING_NAME, int timeout_ms = -1 );
+	bool is_open() const { return ring.is_open(); }
+
+	//broadcasts whatever has been published, first waiting up to timeout_ms
+	//for something to be, -1 for as long as it takes. Returns false once
+	//the encoder has gone, closing the ring or killed before it could, and
+	//everything it sent has been read
+	bool read( int timeout_ms = -1 );
+	packet_server server;
+
+	uint64_t nals;
+	uint64_t bytes_read;
+	uint64_t skipped;       //waiting for a recovery point
+	uint64_t sleeps;
+
+	private:
+
+	shm_ring ring;
+	bool synced;
+	bool reported_death;
+	recovery_tracker recovery;
+	};
+
+#endif
@@ -0,0 +1,168 @@
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shm_ring.h"
+
+//the header has a page to itself, so the ring starts page aligned
+#define SHM_HEADER_SIZE 4096
+
+static_assert( sizeof( shm_ring_header ) <= SHM_HEADER_SIZE, "shm_ring_header outgrew its page" );
+static_assert( sizeof( shm_record ) <= SHM_RECORD_ALIGN, "shm_record outgrew its line" );
+static_assert( ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "atomics shared between processes must be lock free" );
+
+shm_ring::shm_ring()
+{
+header = NULL;
+data = NULL;
+mask = 0;
+name[0] = 0;
+owner = false;
+mapped = 0;
+}
+
+shm_ring::~shm_ring()
+{
+unmap();
+}
+
+void shm_ring::unmap()
+{
+if( header )
+	{
+	munmap( header, mapped );
+	}
+if( owner )
+	{
+	shm_unlink( name );
+	}
+header = NULL;
+data = NULL;
+owner = false;
+}
+
+bool shm_ring::create( const char * name, size_t capacity )
+{
+unmap();
+size_t n = SHM_RECORD_ALIGN;
+while( n < capacity )
+	{
+	n <<= 1;
+	}
+
+//a ring left by a producer that died goes, along with any viewer still
+//waiting on it
+shm_unlink( name );
+int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0600 );
+if( fd < 0 )
+	{
+	printf( "SHM: couldn't create %s: %s\n", name, strerror( errno ) );
+	return false;
+	}
+mapped = SHM_HEADER_SIZE + n;
+void * p = MAP_FAILED;
+if( ftruncate( fd, mapped ) == 0 )
+	{
+	p = mmap( NULL, mapped, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0 );
+	}
+close( fd );
+if( p == MAP_FAILED )
+	{
+	printf( "SHM: couldn't map %s: %s\n", name, strerror( errno ) );
+	shm_unlink( name );
+	return false;
+	}
+snprintf( this->name, sizeof( this->name ), "%s", name );
+owner = true;
+
+//fresh from ftruncate it is all zeros; the magic goes in last, so a
+//consumer never sees a header half filled in
+header = new( p ) shm_ring_header;
+header->header_size = SHM_HEADER_SIZE;
+header->capacity = n;
+header->closed.store( 0 );
+header->producer = getpid();
+header->head.store( 0 );
+header->wake.store( 0 );
+header->tail.store( 0 );
+header->waiting.store( 0 );
+std::atomic_thread_fence( std::memory_order_release );
+header->magic = SHM_RING_MAGIC;
+data = (uint8_t *)p + SHM_HEADER_SIZE;
+mask = n - 1;
+return true;
+}
+
+bool shm_ring::open( const char * name )
+{
+unmap();
+int fd = shm_open( name, O_RDWR, 0 );
+if( fd < 0 )
+	{
+	return false;
+	}
+struct stat st;
+void * p = MAP_FAILED;
+if( fstat( fd, &st ) == 0 && st.st_size > SHM_HEADER_SIZE )
+	{
+	p = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0 );
+	}
+close( fd );
+if( p == MAP_FAILED )
+	{
+	return false;
+	}
+mapped = st.st_size;
+header = (shm_ring_header *)p;
+
+//no magic yet is a producer still setting up
+uint32_t magic = *(volatile uint32_t *)&header->magic;
+std::atomic_thread_fence( std::memory_order_acquire );
+if( magic != SHM_RING_MAGIC || header->header_size != SHM_HEADER_SIZE || header->header_size + header->capacity != mapped )
+	{
+	if( magic != 0 )
+		{
+		printf( "SHM: %s isn't a ring this build knows\n", name );
+		}
+	unmap();
+	return false;
+	}
+data = (uint8_t *)p + header->header_size;
+mask = header->capacity - 1;
+return true;
+}
+
+//not FUTEX_PRIVATE_FLAG: the futex is shared between processes
+void shm_ring::wait( uint32_t seen, int timeout_ms )
+{
+struct timespec timeout;
+timeout.tv_sec = timeout_ms / 1000;
+timeout.tv_nsec = ( timeout_ms % 1000 ) * 1000000L;
+syscall( SYS_futex, (uint32_t *)&header->wake, FUTEX_WAIT, seen, timeout_ms < 0 ? NULL : &timeout, NULL, 0 );
+}
+
+void shm_ring::wake()
+{
+header->wake.fetch_add( 1 );
+syscall( SYS_futex, (uint32_t *)&header->wake, FUTEX_WAKE, 1, NULL, NULL, 0 );
+}
+
+//kill() with no signal only asks whether the process is there; EPERM is
+//one that is, run by someone else
+bool shm_ring::producer_gone() const
+{
+if( header->closed.load() )
+	{
+	return true;
+	}
+return kill( header->producer, 0 ) != 0 && errno == ESRCH;
+}
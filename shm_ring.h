@@ -0,0 +1,88 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nal_info.h"
+
+//the ring the encoder and a viewer on the same host share, by default
+#define SHM_RING_NAME "/h264_stream"
+
+//bytes of NALs the ring holds; a NAL may take up to half of it
+#define SHM_RING_SIZE ( 8 << 20 )
+
+#define SHM_RING_MAGIC 0x4E414C52
+
+//records start on cache lines, with the NAL after a line of header
+#define SHM_RECORD_ALIGN 64
+
+//a record's bytes when it only skips the rest of the ring, so the next
+//one starts at the beginning and no record wraps
+#define SHM_WRAP 0xFFFFFFFF
+
+//how often a waiting consumer looks whether the producer is still there
+#define SHM_LIVENESS_MS 200
+
+//At the start of the shared memory, ahead of the ring itself. head and
+//tail count bytes from the start of the stream, and each is written by
+//one side only, on cache lines of their own.
+struct shm_ring_header
+	{
+	uint32_t magic;
+	uint32_t header_size;
+	uint64_t capacity;
+	std::atomic<uint32_t> closed;       //the producer has gone
+	int32_t producer;                   //its pid, for when it dies before it can say so
+
+	alignas( 64 ) std::atomic<uint64_t> head;     //published by the producer
+	std::atomic<uint32_t> wake;                   //bumped, and a futex, to wake the consumer
+
+	alignas( 64 ) std::atomic<uint64_t> tail;     //consumed by the consumer
+	std::atomic<uint32_t> waiting;                //the consumer is, or is about to be, asleep on wake
+	};
+
+//Each NAL in the ring, its bytes SHM_RECORD_ALIGN on from the start of its
+//record and followed by PACKET_PADDING_SIZE zero bytes.
+struct shm_record
+	{
+	uint32_t bytes;
+	uint32_t size;          //of the whole record, padding included
+	nal_info info;
+	};
+
+//Maps the shared memory for either side. The producer creates it, under a
+//name in /dev/shm so a viewer started on its own can find it, and unlinks
+//the name when it goes; the consumer opens it by that name.
+class shm_ring
+	{
+	public:
+	shm_ring();
+	~shm_ring();
+
+	//capacity is rounded up to a power of two
+	bool create( const char * name, size_t capacity );
+	bool open( const char * name );
+	bool is_open() const { return header != NULL; }
+
+	shm_ring_header * header;
+	uint8_t * data;
+	size_t mask;
+
+	//the consumer sleeps on header->wake while it still reads seen, for at
+	//most timeout_ms, -1 for as long as it takes; the producer wakes it
+	void wait( uint32_t seen, int timeout_ms );
+	void wake();
+
+	//whether the producer closed the ring, or died without closing it
+	bool producer_gone() const;
+
+	private:
+	void unmap();
+	char name[256];
+	bool owner;
+	size_t mapped;
+	};
+
+#endif
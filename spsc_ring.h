@@ -0,0 +1,128 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+
+//Bounded lock-free ring for one producer thread and one consumer thread.
+//Slots are constructed once and reused in place, so a slot holding a
+//buffer keeps its capacity from one lap to the next. Each slot carries a
+//sequence number saying whose turn it is, so besides the consumer the
+//producer may also claim the oldest slot, to throw it away when the ring
+//is full.
+template< typename T >
+class spsc_ring
+	{
+	public:
+	//capacity is rounded up to a power of two
+	spsc_ring( size_t capacity )
+		{
+		size_t n = 1;
+		while( n < capacity )
+			{
+			n <<= 1;
+			}
+		cells = new cell[n];
+		for( size_t i = 0; i < n; ++i )
+			{
+			cells[i].sequence.store( i );
+			}
+		mask = n - 1;
+		head.store( 0 );
+		tail.store( 0 );
+		}
+
+	~spsc_ring()
+		{
+		delete [] cells;
+		}
+
+	size_t capacity() const { return mask + 1; }
+	size_t size() const
+		{
+		size_t t = tail.load( std::memory_order_acquire );
+		size_t h = head.load( std::memory_order_acquire );
+		return h > t ? h - t : 0;
+		}
+	bool empty() const { return size() == 0; }
+
+	//producer: the slot to fill next, or NULL if it is still queued or
+	//being claimed
+	T * reserve()
+		{
+		size_t h = head.load( std::memory_order_relaxed );
+		cell & c = cells[h & mask];
+		if( c.sequence.load( std::memory_order_acquire ) != h )
+			{
+			return NULL;
+			}
+		return &c.value;
+		}
+
+	//producer: hands the reserved slot to the consumer
+	void publish()
+		{
+		size_t h = head.load( std::memory_order_relaxed );
+		cells[h & mask].sequence.store( h + 1, std::memory_order_release );
+		head.store( h + 1, std::memory_order_seq_cst );
+		}
+
+	//either side: takes the oldest published slot out of the ring, or
+	//returns NULL if there is none. The slot is the caller's until release()
+	T * claim( size_t * ticket )
+		{
+		size_t t = tail.load( std::memory_order_relaxed );
+		while( true )
+			{
+			cell & c = cells[t & mask];
+			if( c.sequence.load( std::memory_order_acquire ) != t + 1 )
+				{
+				return NULL;
+				}
+			if( tail.compare_exchange_weak( t, t + 1 ) )
+				{
+				*ticket = t;
+				return &c.value;
+				}
+			}
+		}
+
+	//producer: claims every published slot at once, so the consumer can't
+	//take one from the middle. Returns how many, from *first on
+	size_t claim_all( size_t * first )
+		{
+		size_t h = head.load( std::memory_order_relaxed );
+		size_t t = tail.load( std::memory_order_relaxed );
+		while( t < h && !tail.compare_exchange_weak( t, h ) )
+			{
+			}
+		*first = t;
+		return t < h ? h - t : 0;
+		}
+
+	T & at( size_t ticket ) { return cells[ticket & mask].value; }
+
+	//gives a claimed slot back for the producer's next lap
+	void release( size_t ticket )
+		{
+		cells[ticket & mask].sequence.store( ticket + mask + 1, std::memory_order_seq_cst );
+		}
+
+	private:
+	struct cell
+		{
+		std::atomic< size_t > sequence;
+		T value;
+		};
+
+	//not copyable
+	spsc_ring( const spsc_ring & );
+	spsc_ring & operator=( const spsc_ring & );
+
+	cell * cells;
+	size_t mask;
+	alignas( 64 ) std::atomic< size_t > head;
+	alignas( 64 ) std::atomic< size_t > tail;
+	};
+
+#endif
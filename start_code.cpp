@@ -0,0 +1,133 @@
+#include <string.h>
+
+#include "start_code.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+	#define START_CODE_X86
+	#include <immintrin.h>
+#endif
+
+//checks the last few bytes a vector loop could not cover
+static const uint8_t * find_start_code_tail( const uint8_t * begin, const uint8_t * p, const uint8_t * end )
+{
+//matches starting up to two bytes back have their 01 at or after p
+p = ( p - begin > 2 ) ? p - 2 : begin;
+for( ; p + 2 < end; ++p )
+	{
+	if( p[0] == 0 && p[1] == 0 && p[2] == 1 )
+		{
+		return p;
+		}
+	}
+return end;
+}
+
+//memchr for the 01, then look behind it for the two zeros
+static const uint8_t * find_start_code_memchr( const uint8_t * begin, const uint8_t * end )
+{
+const uint8_t * p = begin + 2;
+while( p < end )
+	{
+	p = (const uint8_t *)memchr( p, 0x01, end - p );
+	if( p == NULL )
+		{
+		return end;
+		}
+	if( p[-1] == 0 && p[-2] == 0 )
+		{
+		return p - 2;
+		}
+	p++;
+	}
+return end;
+}
+
+#ifdef START_CODE_X86
+//Each vector produces a mask of zero bytes and a mask of 01 bytes. A start
+//code ends where a 01 follows two zeros, so the zero mask is shifted up by
+//one and two bits, carrying the top bits of the previous vector along.
+#ifdef __SSE2__
+static const uint8_t * find_start_code_sse2( const uint8_t * begin, const uint8_t * end )
+{
+const __m128i zero = _mm_setzero_si128();
+const __m128i one = _mm_set1_epi8( 1 );
+const uint8_t * p = begin;
+uint32_t zprev = 0;
+
+for( ; end - p >= 16; p += 16 )
+	{
+	__m128i v = _mm_loadu_si128( (const __m128i *)p );
+	uint32_t z = _mm_movemask_epi8( _mm_cmpeq_epi8( v, zero ) );
+	uint32_t o = _mm_movemask_epi8( _mm_cmpeq_epi8( v, one ) );
+	if( o )
+		{
+		uint32_t zz = ( z << 2 ) | ( zprev >> 14 );
+		uint32_t m = o & zz & ( zz >> 1 );
+		if( m )
+			{
+			return p + __builtin_ctz( m ) - 2;
+			}
+		}
+	zprev = z;
+	}
+
+return find_start_code_tail( begin, p, end );
+}
+#endif
+
+__attribute__((target("avx2")))
+static const uint8_t * find_start_code_avx2( const uint8_t * begin, const uint8_t * end )
+{
+const __m256i zero = _mm256_setzero_si256();
+const __m256i one = _mm256_set1_epi8( 1 );
+const uint8_t * p = begin;
+uint64_t zprev = 0;
+
+for( ; end - p >= 32; p += 32 )
+	{
+	__m256i v = _mm256_loadu_si256( (const __m256i *)p );
+	uint64_t z = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( v, zero ) );
+	uint64_t o = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi8( v, one ) );
+	if( o )
+		{
+		uint64_t zz = ( z << 2 ) | ( zprev >> 30 );
+		uint64_t m = o & zz & ( zz >> 1 );
+		if( m )
+			{
+			return p + __builtin_ctzll( m ) - 2;
+			}
+		}
+	zprev = z;
+	}
+
+return find_start_code_tail( begin, p, end );
+}
+#endif
+
+typedef const uint8_t * (*scanner)( const uint8_t *, const uint8_t * );
+
+static scanner pick_scanner( void )
+{
+#ifdef START_CODE_X86
+__builtin_cpu_init();
+if( __builtin_cpu_supports( "avx2" ) )
+	{
+	return find_start_code_avx2;
+	}
+#ifdef __SSE2__
+return find_start_code_sse2;
+#endif
+#endif
+return find_start_code_memchr;
+}
+
+static const scanner best_scanner = pick_scanner();
+
+const uint8_t * find_start_code( const uint8_t * begin, const uint8_t * end )
+{
+if( end - begin < 3 )
+	{
+	return end;
+	}
+return best_scanner( begin, end );
+}
@@ -0,0 +1,13 @@
+#ifndef START_CODE_H
+#define START_CODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+//returns a pointer to the first 00 00 01 lying entirely within [begin,end),
+//or end if there is none. A four byte start code is one whose match is
+//preceded by another zero byte; checking that is left to the caller since
+//that byte may belong to a previous block.
+const uint8_t * find_start_code( const uint8_t * begin, const uint8_t * end );
+
+#endif
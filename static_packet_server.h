@@ -0,0 +1,85 @@
+#ifndef STATIC_PACKET_SERVER_H
+#define STATIC_PACKET_SERVER_H
+
+#include <tuple>
+#include <type_traits>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "nal_info.h"
+
+//The same broadcast as packet_server, for a set of sinks fixed at compile
+//time. Sinks are held by reference in a tuple and called by their own
+//class's write(), not through the vtable, so the compiler can inline the
+//whole fan out. Sinks don't have to derive from data_source, only have the
+//write() overloads that get called. Built with make_static_packet_server.
+template< typename... Sinks >
+class static_packet_server
+	{
+	public:
+	static_packet_server( Sinks &... sinks ) : sinks( sinks... ) {}
+
+	void broadcast( const uint8_t * data, size_t bytes )
+		{
+		fan_out<0>::write( sinks, data, bytes );
+		}
+
+	void broadcast( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		fan_out<0>::write( sinks, data, bytes, info );
+		}
+
+	static size_t num_targets() { return sizeof...( Sinks ); }
+
+	private:
+	typedef std::tuple< Sinks &... > sink_tuple;
+
+	//a sink that doesn't take descriptors gets the bytes alone, as
+	//data_source's default would have done
+	template< typename Sink >
+	static auto write_described( Sink & sink, const uint8_t * data, size_t bytes, const nal_info & info, int )
+		-> decltype( sink.Sink::write( data, bytes, info ), void() )
+		{
+		sink.Sink::write( data, bytes, info );
+		}
+	template< typename Sink >
+	static void write_described( Sink & sink, const uint8_t * data, size_t bytes, const nal_info & info, long )
+		{
+		sink.Sink::write( data, bytes );
+		}
+
+	//calls sink I then recurses to I+1, ending past the last one
+	template< size_t I, bool done = ( I == sizeof...( Sinks ) ) >
+	struct fan_out
+		{
+		typedef typename std::remove_reference< typename std::tuple_element< I, sink_tuple >::type >::type sink;
+
+		static void write( sink_tuple & sinks, const uint8_t * data, size_t bytes )
+			{
+			std::get<I>( sinks ).sink::write( data, bytes );
+			fan_out< I + 1 >::write( sinks, data, bytes );
+			}
+		static void write( sink_tuple & sinks, const uint8_t * data, size_t bytes, const nal_info & info )
+			{
+			write_described( std::get<I>( sinks ), data, bytes, info, 0 );
+			fan_out< I + 1 >::write( sinks, data, bytes, info );
+			}
+		};
+
+	template< size_t I >
+	struct fan_out< I, true >
+		{
+		static void write( sink_tuple &, const uint8_t *, size_t ) {}
+		static void write( sink_tuple &, const uint8_t *, size_t, const nal_info & ) {}
+		};
+
+	sink_tuple sinks;
+	};
+
+template< typename... Sinks >
+static_packet_server< Sinks... > make_static_packet_server( Sinks &... sinks )
+{
+return static_packet_server< Sinks... >( sinks... );
+}
+
+#endif
@@ -33,4 +33,14 @@ server.broadcast(test2,my_strlen(test2));
 
 server.broadcast(test3,my_strlen(test3));
 
+//a batch goes to each callback in one call
+static uint8_t test4[]="Batch ";
+static uint8_t test5[]="of two\n";
+struct iovec batch[2];
+batch[0].iov_base = test4;
+batch[0].iov_len = my_strlen(test4);
+batch[1].iov_base = test5;
+batch[1].iov_len = my_strlen(test5);
+server.broadcast_batch(batch,2);
+
 }
@@ -2,18 +2,43 @@
 #include <cstdlib>
 #include "data_source_stdio_info.h"
 #include "data_source_ocv_avcodec.h"
+#include "nal_file_reader.h"
+#include "nal_index.h"
 #include "packet_server.h"
-#include "destreamer.h"
 
 int main(int num_args, const char * const args[] )
 {
-if( num_args !=2 )
+if( num_args < 2 || num_args > 3 )
 	{
-	std::cout<<"usage:"<<args[0]<<" input_file"<<std::endl;
+	std::cout<<"usage:"<<args[0]<<" input_file [start_seconds]"<<std::endl;
 	exit(4);
 	}
 
-open_264(args[1]);
+nal_file_reader reader(args[1]);
+if( !reader.is_open() )
+	{
+	exit(4);
+	}
+
+//jump to the requested time, starting at the recovery point before it
+if( num_args == 3 )
+	{
+	nal_index index(args[1]);
+	if( !index.is_open() || index.size() == 0 )
+		{
+		std::cout<<"no index, run index_264 first"<<std::endl;
+		exit(4);
+		}
+	uint64_t target = index[0].timestamp_us + atof( args[2] ) * 1e6;
+	size_t entry = index.recovery_point( index.find( target ) );
+	if( entry == NAL_INDEX_NO_RECOVERY )
+		{
+		std::cout<<"no recovery point before then, starting at the beginning"<<std::endl;
+		entry = 0;
+		}
+	std::cout<<"starting at frame "<<entry<<", offset "<<index[entry].offset<<std::endl;
+	reader.seek( index[entry].offset );
+	}
 
 packet_server server;
 
@@ -25,10 +50,10 @@ server.register_callback(&viewer);
 data_source_stdio_info stdio_info;
 server.register_callback(&stdio_info);
 
-while( get_next_block() )
+const uint8_t * data;
+size_t bytes;
+while( reader.next( &data, &bytes ) )
 	{
-	server.broadcast(&ds.buffer[ds.last_pos], ds.cur_pos-ds.last_pos);
+	server.broadcast(data, bytes);
 	}
-
-close_264();
 }
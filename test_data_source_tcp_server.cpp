@@ -1,4 +1,5 @@
 #include <cstring>
+#include <unistd.h>
 
 #include "config.h"
 
@@ -22,6 +23,12 @@ server.register_callback(&stdio_info);
 data_source_tcp_server tcp_src(TCP_PORT_NUMBER);
 server.register_callback(&tcp_src);
 
+//the server doesn't wait for a viewer, but this test does
+while( tcp_src.clients() == 0 )
+	{
+	usleep( 10000 );
+	}
+
 server.broadcast(test1,my_strlen(test1));
 server.broadcast(test2,my_strlen(test2));
 server.broadcast(test3,my_strlen(test3));
@@ -26,4 +26,14 @@ server.broadcast(test1,my_strlen(test1));
 server.broadcast(test2,my_strlen(test2));
 server.broadcast(test3,my_strlen(test3));
 
+//three datagrams from one sendmmsg
+struct iovec batch[3];
+batch[0].iov_base = test1;
+batch[0].iov_len = my_strlen(test1);
+batch[1].iov_base = test2;
+batch[1].iov_len = my_strlen(test2);
+batch[2].iov_base = test3;
+batch[2].iov_len = my_strlen(test3);
+server.broadcast_batch(batch,3);
+
 }
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "data_source_fec.h"
+#include "data_source_rtp.h"
+#include "fec_decoder.h"
+#include "gf256.h"
+#include "rtp_depacketizer.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+static bool is_parity( const vector<uint8_t> & packet )
+{
+return ( packet[1] & 0x7F ) == FEC_PAYLOAD_TYPE;
+}
+
+//whether got is expected with some whole NALs missing
+static bool subsequence( const vector< vector<uint8_t> > & got, const vector< vector<uint8_t> > & expected )
+{
+size_t j = 0;
+for( size_t i = 0; i < got.size(); ++i )
+	{
+	while( j < expected.size() && expected[j] != got[i] )
+		{
+		j++;
+		}
+	if( j == expected.size() )
+		{
+		return false;
+		}
+	j++;
+	}
+return true;
+}
+
+//loses the packets marked in lose, then counts what FEC brought back
+static int run( const char * name, const vector< vector<uint8_t> > & sent, const vector<bool> & lose, const vector< vector<uint8_t> > & nals, bool must_recover_all )
+{
+fec_decoder fec;
+rtp_depacketizer rtp;
+data_source_nal_collector got;
+fec.server.register_callback( &rtp );
+rtp.server.register_callback( &got );
+
+size_t lost_data = 0;
+for( size_t i = 0; i < sent.size(); ++i )
+	{
+	if( lose[i] )
+		{
+		lost_data += !is_parity( sent[i] );
+		continue;
+		}
+	fec.write( &sent[i][0], sent[i].size() );
+	}
+rtp.flush();
+
+printf( "%-22s %4i data packets lost, %4i recovered, %4i still lost, %4i of %4i NALs delivered\n",
+	name, (int)lost_data, (int)fec.recovered, (int)rtp.lost, (int)got.nals.size(), (int)nals.size() );
+bool ok = subsequence( got.nals, nals ) && fec.recovered > 0 && rtp.lost < lost_data;
+if( must_recover_all )
+	{
+	ok = ok && rtp.lost == 0 && got.nals == nals;
+	}
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+int main()
+{
+int failures = 0;
+
+//the kernel picked against the byte at a time definition
+vector<uint8_t> src( 1500 ), dst( 1500 ), expected( 1500 );
+bool kernel_ok = true;
+for( int c = 0; c < 256; c += 17 )
+	{
+	for( size_t i = 0; i < src.size(); ++i )
+		{
+		src[i] = rand();
+		dst[i] = expected[i] = rand();
+		}
+	size_t bytes = 1000 + c;
+	for( size_t i = 0; i < bytes; ++i )
+		{
+		expected[i] ^= gf256_mul( c, src[i] );
+		}
+	gf256_mul_add( &dst[1], &src[1], c, bytes - 1 );
+	expected[0] = dst[0];
+	kernel_ok = kernel_ok && dst == expected;
+	}
+cout<<( kernel_ok ? "ok   " : "FAIL " )<<gf256_kernel()<<" kernel"<<endl;
+failures += kernel_ok ? 0 : 1;
+
+//and each kernel the CPU has against the plain C one, at every
+//alignment and with every length of tail
+const char * kernels[] = { "ssse3", "avx2" };
+for( size_t k = 0; k < sizeof( kernels ) / sizeof( kernels[0] ); ++k )
+	{
+	bool available = true;
+	bool same = true;
+	vector<uint8_t> with_c( 1500 );
+	for( int c = 0; c < 256 && available; c += 5 )
+		{
+		for( size_t i = 0; i < src.size(); ++i )
+			{
+			src[i] = rand();
+			dst[i] = with_c[i] = rand();
+			}
+		size_t offset = c % 32;
+		size_t bytes = c % 3 ? 1000 + c : c % 70;
+		gf256_mul_add_with( "c", &with_c[offset], &src[offset], c, bytes );
+		available = gf256_mul_add_with( kernels[k], &dst[offset], &src[offset], c, bytes );
+		same = same && dst == with_c;
+		}
+	if( !available )
+		{
+		cout<<"skip "<<kernels[k]<<" kernel, not on this CPU"<<endl;
+		continue;
+		}
+	cout<<( same ? "ok   " : "FAIL " )<<kernels[k]<<" kernel matches c"<<endl;
+	failures += same ? 0 : 1;
+	}
+
+//one to six slices of up to 1400 bytes, as x264 cuts them with
+//slice-max-size, and an SPS and PPS every 30
+test_stream s;
+make_stream( s, 1000 );
+
+//RTP, then 10 data and 2 parity
+data_source_packet_collector wire;
+data_source_fec encoder( 10, 2 );
+	{
+	data_source_rtp packetizer;
+	packetizer.server.register_callback( &encoder );
+	encoder.server.register_callback( &wire );
+	vector< struct iovec > iov;
+	for( size_t a = 0; a < s.access_units(); ++a )
+		{
+		s.access_unit( a, iov );
+		packetizer.write_batch( &iov[0], iov.size() );
+		}
+	}
+double encode_ms = encoder.encode_time * 1e3 / s.access_units();
+printf( "%i data and %i parity packets, %.4f ms encoding per frame\n", (int)encoder.data_sent, (int)encoder.parity_sent, encode_ms );
+bool fast = encode_ms < 1.0;
+cout<<( fast ? "ok   " : "FAIL " )<<"under a millisecond per frame"<<endl;
+failures += fast ? 0 : 1;
+
+//as many losses as every block can take: the second data packet of each,
+//and the sixth of those big enough to have two parity packets
+vector<bool> lose( wire.packets.size(), false );
+int position = 0;
+for( size_t i = 0; i < wire.packets.size(); ++i )
+	{
+	if( is_parity( wire.packets[i] ) )
+		{
+		position = 0;
+		continue;
+		}
+	lose[i] = position == 1 || position == 5;
+	position++;
+	}
+failures += run( "within capacity", wire.packets, lose, s.nals, true );
+
+//5% random loss
+srand( 2 );
+for( size_t i = 0; i < lose.size(); ++i )
+	{
+	lose[i] = i > 0 && rand() % 100 < 5;
+	}
+failures += run( "5% random", wire.packets, lose, s.nals, false );
+
+//bursts: a two state Gilbert-Elliott channel losing 80% of packets while
+//bad, which it goes into 2% of the time and stays in for 3 or so packets
+srand( 3 );
+bool bad = false;
+for( size_t i = 0; i < lose.size(); ++i )
+	{
+	bad = bad ? rand() % 100 >= 30 : rand() % 100 < 2;
+	lose[i] = i > 0 && bad && rand() % 100 < 80;
+	}
+failures += run( "burst", wire.packets, lose, s.nals, false );
+
+return failures ? 1 : 0;
+}
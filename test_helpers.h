@@ -0,0 +1,277 @@
+#ifndef TEST_HELPERS_H
+#define TEST_HELPERS_H
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "data_source.h"
+#include "nal_info.h"
+
+//What the test and bench programs share: a synthetic stream, sinks that
+//keep what they are given, and a receiver for what goes out over UDP.
+
+//keeps every packet it is given, as it would have gone on the wire
+class data_source_packet_collector: public data_source
+	{
+	public:
+	void write( const uint8_t * data, size_t bytes )
+		{
+		packets.push_back( std::vector<uint8_t>( data, data + bytes ) );
+		}
+	std::vector< std::vector<uint8_t> > packets;
+	};
+
+//keeps every NAL it is given, and whether it was described as the last of
+//its access unit
+class data_source_nal_collector: public data_source
+	{
+	public:
+	void write( const uint8_t * data, size_t bytes )
+		{
+		nals.push_back( std::vector<uint8_t>( data, data + bytes ) );
+		ends.push_back( false );
+		}
+	void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		nals.push_back( std::vector<uint8_t>( data, data + bytes ) );
+		ends.push_back( info.access_unit_end );
+		}
+	std::vector< std::vector<uint8_t> > nals;
+	std::vector< bool > ends;
+	};
+
+//how make_stream builds a stream
+struct stream_shape
+	{
+	stream_shape()
+		{
+		max_slices = 6;
+		min_slice = 100;
+		max_slice = 1400;
+		huge_one_in = 0;
+		gop = 30;
+		parameter_sets = true;
+		repeat_parameter_sets = true;
+		filler = false;
+		}
+	size_t max_slices;     //one to this many slices an access unit
+	size_t min_slice;      //bytes of a slice, start code included, at least 10
+	size_t max_slice;
+	size_t huge_one_in;    //one slice in this many is 1 to 3.5MB instead, 0 for none
+	size_t gop;            //an IDR every gop access units, 0 for only the first
+	bool parameter_sets;   //an SPS and PPS before each IDR
+	bool repeat_parameter_sets;   //or only before the first, if not
+	bool filler;           //filler data ending every access unit, as the encoders do
+	};
+
+//A synthetic H.264 stream and how each NAL is described. Every NAL but the
+//filler ends with its index in nals, so a sink can tell which it was given.
+//Slices start 0x88 if they are the first of their access unit, 0x9A if
+//not, so a nal_parser finds the access units too.
+struct test_stream
+	{
+	std::vector< std::vector<uint8_t> > nals;
+	std::vector<nal_info> infos;
+	std::vector<size_t> au_starts;   //the first NAL of each access unit, then one past the last
+
+	size_t access_units() const { return au_starts.size() - 1; }
+
+	//access unit a's NALs, to write_batch
+	void access_unit( size_t a, std::vector<struct iovec> & iov ) const
+		{
+		iov.resize( au_starts[a + 1] - au_starts[a] );
+		for( size_t i = 0; i < iov.size(); ++i )
+			{
+			iov[i].iov_base = (void *)&nals[au_starts[a] + i][0];
+			iov[i].iov_len = nals[au_starts[a] + i].size();
+			}
+		}
+
+	//a NAL with the start code, header and body given, then random bytes up
+	//to bytes, then its index
+	void add( int type, int first_mb, const uint8_t * body, size_t body_bytes, size_t bytes )
+		{
+		static const uint8_t start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+		uint32_t index = nals.size();
+		std::vector<uint8_t> nal( start_code, start_code + sizeof( start_code ) );
+		nal.push_back( ( type == NAL_SLICE ? 0x40 : 0x60 ) | type );
+		nal.insert( nal.end(), body, body + body_bytes );
+		while( nal.size() + sizeof( index ) < bytes )
+			{
+			nal.push_back( rand() );
+			}
+		nal.insert( nal.end(), (uint8_t *)&index, (uint8_t *)&index + sizeof( index ) );
+
+		nal_info info;
+		info.nal_unit_type = type;
+		info.nal_ref_idc = nal[4] >> 5;
+		info.first_mb_in_slice = first_mb;
+		info.access_unit_start = au_starts.back() == nals.size();
+		info.parameter_set = type == NAL_SPS || type == NAL_PPS;
+		info.recovery_point = type == NAL_SLICE_IDR;
+		nals.push_back( nal );
+		infos.push_back( info );
+		}
+	};
+
+//count access units shaped by shape, the same ones every time
+inline void make_stream( test_stream & s, size_t count, const stream_shape & shape = stream_shape() )
+{
+static const uint8_t sps[] = { 0x64, 0x00, 0x1E, 0xAC, 0xD9 };
+static const uint8_t pps[] = { 0xEB, 0xE3, 0xCB };
+static const uint8_t first_slice[] = { 0x88 };
+static const uint8_t other_slice[] = { 0x9A };
+static const uint8_t filler[] = { 0x00, 0x00, 0x00, 0x01, 0x0C, 0xFF, 0xFF, 0x80 };
+srand( 1 );
+s.nals.clear();
+s.infos.clear();
+s.au_starts.assign( 1, 0 );
+for( size_t a = 0; a < count; ++a )
+	{
+	bool idr = shape.gop ? a % shape.gop == 0 : a == 0;
+	if( idr && shape.parameter_sets && ( a == 0 || shape.repeat_parameter_sets ) )
+		{
+		s.add( NAL_SPS, -1, sps, sizeof( sps ), 0 );
+		s.add( NAL_PPS, -1, pps, sizeof( pps ), 0 );
+		}
+	size_t slices = 1 + rand() % shape.max_slices;
+	for( size_t i = 0; i < slices; ++i )
+		{
+		size_t bytes = shape.min_slice + rand() % ( shape.max_slice - shape.min_slice );
+		if( shape.huge_one_in && rand() % shape.huge_one_in == 0 )
+			{
+			bytes = 1000000 + rand() % 2500000;
+			}
+		s.add( idr ? NAL_SLICE_IDR : NAL_SLICE, i, i == 0 ? first_slice : other_slice, 1, bytes );
+		}
+	if( shape.filler )
+		{
+		nal_info info;
+		info.nal_unit_type = NAL_FILLER;
+		s.nals.push_back( std::vector<uint8_t>( filler, filler + sizeof( filler ) ) );
+		s.infos.push_back( info );
+		}
+	s.infos.back().access_unit_end = true;
+	s.au_starts.push_back( s.nals.size() );
+	}
+}
+
+//Hands every datagram that comes to a port on loopback, or to a multicast
+//group joined there, to arrived(), on a thread of its own, with when the
+//kernel took it in, CLOCK_REALTIME, so batching up what has queued doesn't
+//bunch the arrivals together. A derived class
+//calls start() once it is built, and stop() in its destructor, before
+//anything arrived() uses goes away.
+class udp_receiver
+	{
+	public:
+	udp_receiver( int port, const char * group = NULL )
+		{
+		stopping.store( false );
+		sd = socket( AF_INET, SOCK_DGRAM, 0 );
+		struct timeval timeout = { 0, 50000 };
+		setsockopt( sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof( timeout ) );
+		int size = 16 * 1024 * 1024;
+		setsockopt( sd, SOL_SOCKET, SO_RCVBUF, &size, sizeof( size ) );
+		int flag = 1;
+		setsockopt( sd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof( flag ) );
+		setsockopt( sd, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof( flag ) );
+		struct sockaddr_in addr;
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = group ? inet_addr( group ) : htonl( INADDR_LOOPBACK );
+		addr.sin_port = htons( port );
+		if( bind( sd, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 )
+			{
+			printf( "couldn't bind port %i\n", port );
+			exit( 1 );
+			}
+		joined = true;
+		if( group )
+			{
+			struct ip_mreq request;
+			request.imr_multiaddr.s_addr = inet_addr( group );
+			request.imr_interface.s_addr = htonl( INADDR_LOOPBACK );
+			joined = setsockopt( sd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof( request ) ) == 0;
+			}
+		}
+	virtual ~udp_receiver()
+		{
+		stop();
+		close( sd );
+		}
+	void start()
+		{
+		worker = std::thread( &udp_receiver::run, this );
+		}
+	void stop()
+		{
+		if( worker.joinable() )
+			{
+			stopping.store( true );
+			worker.join();
+			}
+		}
+	bool joined;   //the multicast group, if there is one
+
+	protected:
+	virtual void arrived( const uint8_t * data, size_t bytes, const struct sockaddr_in & from, uint64_t arrival_us ) = 0;
+
+	private:
+	void run()
+		{
+		//up to 64 at once, each in a buffer of its own
+		std::vector<uint8_t> buffers( 64 * 65536 );
+		struct mmsghdr messages[64];
+		struct iovec iov[64];
+		struct sockaddr_in from[64];
+		uint8_t control[64][CMSG_SPACE( sizeof( struct timespec ) )];
+		while( !stopping.load() )
+			{
+			memset( messages, 0, sizeof( messages ) );
+			for( int i = 0; i < 64; ++i )
+				{
+				iov[i].iov_base = &buffers[i * 65536];
+				iov[i].iov_len = 65536;
+				messages[i].msg_hdr.msg_iov = &iov[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+				messages[i].msg_hdr.msg_name = &from[i];
+				messages[i].msg_hdr.msg_namelen = sizeof( from[i] );
+				messages[i].msg_hdr.msg_control = control[i];
+				messages[i].msg_hdr.msg_controllen = sizeof( control[i] );
+				}
+			int n = recvmmsg( sd, messages, 64, MSG_WAITFORONE, NULL );
+			for( int i = 0; i < n; ++i )
+				{
+				struct timespec when;
+				clock_gettime( CLOCK_REALTIME, &when );
+				struct msghdr * header = &messages[i].msg_hdr;
+				for( struct cmsghdr * c = CMSG_FIRSTHDR( header ); c; c = CMSG_NXTHDR( header, c ) )
+					{
+					if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS )
+						{
+						memcpy( &when, CMSG_DATA( c ), sizeof( when ) );
+						}
+					}
+				uint64_t arrival_us = (uint64_t)when.tv_sec * 1000000 + when.tv_nsec / 1000;
+				arrived( &buffers[i * 65536], messages[i].msg_len, from[i], arrival_us );
+				}
+			}
+		}
+
+	int sd;
+	std::atomic<bool> stopping;
+	std::thread worker;
+	};
+
+#endif
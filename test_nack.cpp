@@ -0,0 +1,141 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "data_source_rtp.h"
+#include "data_source_udp.h"
+#include "rtp_depacketizer.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define TEST_PORT 12397
+
+//a viewer that loses the first copy of every twentieth packet, NACKing
+//through a data_source_udp back to wherever the packets came from
+class receiver: public udp_receiver
+	{
+	public:
+	receiver( size_t lose_before ) : udp_receiver( TEST_PORT )
+		{
+		this->lose_before = lose_before;
+		dropped = 0;
+		back = NULL;
+		started = false;
+		first = 0;
+		seen.assign( 65536, false );
+		rtp.server.register_callback( &got );
+		start();
+		}
+	~receiver()
+		{
+		finish();
+		delete back;
+		}
+	void finish()
+		{
+		stop();
+		rtp.flush();
+		}
+	rtp_depacketizer rtp;
+	data_source_nal_collector got;
+	size_t dropped;
+
+	protected:
+	void arrived( const uint8_t * data, size_t bytes, const struct sockaddr_in & from, uint64_t arrival_us )
+		{
+		if( back == NULL )
+			{
+			back = new data_source_udp( inet_ntoa( from.sin_addr ), ntohs( from.sin_port ) );
+			rtp.feedback.register_callback( back );
+			}
+		uint16_t sequence = ( data[2] << 8 ) | data[3];
+		if( !started )
+			{
+			first = sequence;
+			started = true;
+			}
+		uint16_t index = sequence - first;
+		if( index % 20 == 7 && index < lose_before && !seen[index] )
+			{
+			seen[index] = true;
+			dropped++;
+			return;
+			}
+		rtp.write( data, bytes );
+		}
+
+	private:
+	size_t lose_before;
+	vector<bool> seen;
+	bool started;
+	uint16_t first;
+	data_source_udp * back;
+	};
+
+//sends the stream a frame every 2ms, each due playout_ms after it is sent
+static void run( const test_stream & s, int playout_ms, receiver & rx, data_source_udp & udp )
+{
+udp.retransmit( 500, playout_ms );
+data_source_rtp rtp;
+rtp.server.register_callback( &udp );
+vector< struct iovec > iov;
+for( size_t a = 0; a < s.access_units(); ++a )
+	{
+	s.access_unit( a, iov );
+	rtp.write_batch( &iov[0], iov.size() );
+	usleep( 2000 );
+	}
+usleep( 300000 );
+rx.finish();
+udp.report();
+rx.rtp.report();
+}
+
+static int check( const char * name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+int main()
+{
+//one to six slices of up to 1300 bytes, only the first access unit an IDR
+stream_shape shape;
+shape.max_slice = 1300;
+shape.gop = 0;
+shape.parameter_sets = false;
+test_stream s;
+make_stream( s, 300, shape );
+const vector< vector<uint8_t> > & nals = s.nals;
+
+int failures = 0;
+
+//plenty of time: every loss comes back, and in time
+	{
+	receiver rx( 900 );
+	data_source_udp udp( "127.0.0.1", TEST_PORT );
+	run( s, 100, rx, udp );
+	failures += check( "resent in time", rx.dropped > 0 && rx.got.nals == nals && rx.rtp.lost == 0 &&
+		udp.retransmission()->retransmitted.load() == rx.dropped && rx.rtp.nack_recovered == rx.dropped );
+	}
+
+//frames already due when sent: nothing is worth resending
+	{
+	receiver rx( 900 );
+	data_source_udp udp( "127.0.0.1", TEST_PORT );
+	run( s, 0, rx, udp );
+	failures += check( "too late to resend", rx.dropped > 0 && udp.retransmission()->retransmitted.load() == 0 &&
+		udp.retransmission()->too_late.load() == rx.dropped && rx.rtp.lost == rx.dropped );
+	}
+
+return failures ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "data_source_pacer.h"
+#include "data_source_udp.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define TEST_PORT 12399
+#define SPREAD_US 20000
+#define FRAME_US 33333
+#define DATAGRAM_SIZE 1200
+#define DATAGRAMS_PER_FRAME 20
+
+static uint64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+static int check( const string & name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+//each datagram starts with its frame and index, the rest a pattern of both
+static void fill( uint8_t * p, size_t bytes, uint32_t frame, uint32_t index )
+{
+memcpy( p, &frame, 4 );
+memcpy( p + 4, &index, 4 );
+for( size_t i = 8; i < bytes; ++i )
+	{
+	p[i] = (uint8_t)( frame * 7 + index * 3 + i );
+	}
+}
+
+static bool intact( const vector<uint8_t> & d, uint32_t frame, uint32_t index )
+{
+vector<uint8_t> expected( d.size() );
+fill( &expected[0], d.size(), frame, index );
+return d == expected;
+}
+
+//every datagram that comes to TEST_PORT, with when it came, by the wall clock
+class receiver: public udp_receiver
+	{
+	public:
+	receiver() : udp_receiver( TEST_PORT )
+		{
+		start();
+		}
+	~receiver()
+		{
+		stop();
+		}
+	size_t count()
+		{
+		std::lock_guard<std::mutex> hold( lock );
+		return datagrams.size();
+		}
+	void clear()
+		{
+		std::lock_guard<std::mutex> hold( lock );
+		arrivals.clear();
+		datagrams.clear();
+		}
+
+	mutex lock;
+	vector<uint64_t> arrivals;
+	vector< vector<uint8_t> > datagrams;
+
+	protected:
+	void arrived( const uint8_t * data, size_t bytes, const struct sockaddr_in & from, uint64_t arrival_us )
+		{
+		std::lock_guard<std::mutex> hold( lock );
+		arrivals.push_back( arrival_us );
+		datagrams.push_back( vector<uint8_t>( data, data + bytes ) );
+		}
+	};
+
+static void wait_for( receiver & rx, size_t datagrams )
+{
+uint64_t give_up = now_us() + 2000000;
+while( rx.count() < datagrams && now_us() < give_up )
+	{
+	usleep( 1000 );
+	}
+}
+
+//a frame of DATAGRAMS_PER_FRAME datagrams, as a stage would hand them over
+static void write_frame( data_source & sink, uint32_t frame )
+{
+vector<uint8_t> bytes( DATAGRAMS_PER_FRAME * DATAGRAM_SIZE );
+vector<struct iovec> iov( DATAGRAMS_PER_FRAME );
+for( uint32_t i = 0; i < DATAGRAMS_PER_FRAME; ++i )
+	{
+	fill( &bytes[i * DATAGRAM_SIZE], DATAGRAM_SIZE, frame, i );
+	iov[i].iov_base = &bytes[i * DATAGRAM_SIZE];
+	iov[i].iov_len = DATAGRAM_SIZE;
+	}
+sink.write_batch( &iov[0], iov.size() );
+}
+
+static int paced_frames( receiver & rx )
+{
+int failures = 0;
+const int frames = 10;
+uint64_t slowest_write = 0;
+	{
+	data_source_udp udp( "127.0.0.1", TEST_PORT );
+	data_source_pacer pacer( SPREAD_US );
+	pacer.server.register_callback( &udp );
+	uint64_t next = now_us();
+	for( int f = 0; f < frames; ++f )
+		{
+		uint64_t before = now_us();
+		write_frame( pacer, f );
+		uint64_t took = now_us() - before;
+		slowest_write = took > slowest_write ? took : slowest_write;
+		next += FRAME_US;
+		while( now_us() < next )
+			{
+			usleep( 500 );
+			}
+		}
+	wait_for( rx, frames * DATAGRAMS_PER_FRAME );
+	pacer.report();
+
+	failures += check( "every frame recorded", pacer.paced_frames.load() == frames &&
+		pacer.paced_datagrams.load() == frames * DATAGRAMS_PER_FRAME );
+	double average = pacer.delay_us.load() / (double)frames;
+	failures += check( "pacing delay recorded, about the spread", average > 0.7 * SPREAD_US && average < 1.5 * SPREAD_US &&
+		pacer.delay_max_us.load() < 2 * SPREAD_US );
+	}
+failures += check( "writing doesn't wait for the pacing", slowest_write < SPREAD_US / 4 );
+
+std::lock_guard<std::mutex> hold( rx.lock );
+bool in_order = rx.datagrams.size() == frames * DATAGRAMS_PER_FRAME;
+for( size_t i = 0; in_order && i < rx.datagrams.size(); ++i )
+	{
+	in_order = intact( rx.datagrams[i], i / DATAGRAMS_PER_FRAME, i % DATAGRAMS_PER_FRAME );
+	}
+failures += check( "all arrive intact and in order", in_order );
+
+//first to last datagram of a frame, and the most in any millisecond
+bool spread = in_order;
+size_t most = 0;
+for( int f = 0; in_order && f < frames; ++f )
+	{
+	uint64_t first = rx.arrivals[f * DATAGRAMS_PER_FRAME];
+	uint64_t last = rx.arrivals[( f + 1 ) * DATAGRAMS_PER_FRAME - 1];
+	spread = spread && last - first > 0.7 * SPREAD_US && last - first < 1.3 * SPREAD_US;
+	}
+for( size_t i = 0, j = 0; in_order && i < rx.arrivals.size(); ++i )
+	{
+	while( rx.arrivals[i] - rx.arrivals[j] >= 1000 )
+		{
+		j++;
+		}
+	most = i - j + 1 > most ? i - j + 1 : most;
+	}
+failures += check( "each frame spread over the interval given", spread );
+failures += check( "no more than a burst's worth at once", in_order && most <= 4 );
+return failures;
+}
+
+//frames written faster than they can be paced out go faster, so none
+//waits much more than the spread
+static int backlog( receiver & rx )
+{
+int failures = 0;
+rx.clear();
+data_source_udp udp( "127.0.0.1", TEST_PORT );
+data_source_pacer pacer( SPREAD_US );
+pacer.server.register_callback( &udp );
+for( int f = 0; f < 3; ++f )
+	{
+	write_frame( pacer, f );
+	}
+wait_for( rx, 3 * DATAGRAMS_PER_FRAME );
+failures += check( "a backlog goes out within the spread", rx.count() == 3 * DATAGRAMS_PER_FRAME &&
+	pacer.delay_max_us.load() < 1.5 * SPREAD_US );
+return failures;
+}
+
+//a write cut into datagram_size datagrams, as UDP_SEGMENT would
+static int segmented( receiver & rx )
+{
+int failures = 0;
+rx.clear();
+const size_t segment = 1000;
+const size_t bytes = 10500;
+vector<uint8_t> data( bytes );
+for( size_t i = 0; i < bytes; ++i )
+	{
+	data[i] = (uint8_t)( i * 13 );
+	}
+	{
+	data_source_udp udp( "127.0.0.1", TEST_PORT, segment );
+	data_source_pacer pacer( SPREAD_US, segment );
+	pacer.server.register_callback( &udp );
+	struct iovec iov[2];
+	iov[0].iov_base = &data[0];
+	iov[0].iov_len = 4000;
+	iov[1].iov_base = &data[4000];
+	iov[1].iov_len = bytes - 4000;
+	pacer.write_batch( iov, 2 );
+	wait_for( rx, 11 );
+	}
+
+std::lock_guard<std::mutex> hold( rx.lock );
+vector<uint8_t> joined;
+bool sizes = rx.datagrams.size() == 11;
+for( size_t i = 0; i < rx.datagrams.size(); ++i )
+	{
+	sizes = sizes && rx.datagrams[i].size() == ( i < 10 ? segment : bytes - 10 * segment );
+	joined.insert( joined.end(), rx.datagrams[i].begin(), rx.datagrams[i].end() );
+	}
+failures += check( "segmented writes paced as segments", sizes && joined == data );
+return failures;
+}
+
+//the last frame still goes out when the sink goes away
+static int drains( receiver & rx )
+{
+rx.clear();
+	{
+	data_source_udp udp( "127.0.0.1", TEST_PORT );
+	data_source_pacer pacer( SPREAD_US );
+	pacer.server.register_callback( &udp );
+	write_frame( pacer, 0 );
+	}
+wait_for( rx, DATAGRAMS_PER_FRAME );
+return check( "queued frames sent before closing", rx.count() == DATAGRAMS_PER_FRAME );
+}
+
+//a datagram too big to send fails the socket from the pacer's thread,
+//while the writer carries on writing
+static int failing( receiver & rx )
+{
+rx.clear();
+vector<uint8_t> huge( 70000 );
+	{
+	data_source_udp udp( "127.0.0.1", TEST_PORT );
+	data_source_pacer pacer( SPREAD_US );
+	pacer.server.register_callback( &udp );
+	pacer.write( &huge[0], huge.size() );
+	for( int f = 0; f < 5; ++f )
+		{
+		write_frame( pacer, f );
+		usleep( FRAME_US );
+		}
+	}
+return check( "nothing sent once a send fails", rx.count() == 0 );
+}
+
+int main()
+{
+int failures = 0;
+receiver rx;
+failures += paced_frames( rx );
+failures += backlog( rx );
+failures += segmented( rx );
+failures += drains( rx );
+failures += failing( rx );
+rx.stop();
+return failures ? 1 : 0;
+}
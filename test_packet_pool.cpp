@@ -0,0 +1,170 @@
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "access_unit_assembler.h"
+#include "data_source.h"
+#include "packet_pool.h"
+#include "packet_server.h"
+#include "x264_destreamer.h"
+
+using namespace std;
+
+//counts every operator new in the process, from any thread
+static atomic<uint64_t> allocations( 0 );
+
+void * operator new( size_t bytes )
+{
+allocations++;
+void * p = malloc( bytes ? bytes : 1 );
+if( p == NULL )
+	{
+	throw bad_alloc();
+	}
+return p;
+}
+
+void operator delete( void * p ) noexcept
+{
+free( p );
+}
+
+void operator delete( void * p, size_t ) noexcept
+{
+free( p );
+}
+
+//counts packets, and holds on to the last one like a sink that keeps them would
+class data_source_keeper: public data_source
+	{
+	public:
+	data_source_keeper(){ packets = 0; }
+	void write( const uint8_t * data, size_t bytes ){ packets++; }
+	bool wants_packets() const { return true; }
+	void write( const packet_ref & packet ){ last = packet; packets++; }
+	void write( const packet_ref & packet, const nal_info & info ){ last = packet; packets++; }
+	atomic<uint64_t> packets;
+	packet_ref last;
+	};
+
+//one frame as the encoder writes it: an IDR slice every 30 frames, a P slice
+//otherwise, then the filler NAL that ends the access unit. Slice sizes are
+//fixed so the warm-up sees the biggest frame there will be.
+static void make_frame( vector<uint8_t> & frame, int n )
+{
+static const uint8_t idr[] = { 0x00, 0x00, 0x00, 0x01, 0x65, 0x88 };
+static const uint8_t p[] = { 0x00, 0x00, 0x00, 0x01, 0x41, 0x9A };
+static const uint8_t end_of_frame[] = { 0x00, 0x00, 0x00, 0x01, 0x0C, 0x80 };
+bool key = n % 30 == 0;
+frame.clear();
+frame.insert( frame.end(), key ? idr : p, key ? idr + sizeof( idr ) : p + sizeof( p ) );
+size_t len = key ? 6000 : 900;
+for( size_t i = 0; i < len; ++i )
+	{
+	frame.push_back( 0x10 + ( ( n + i ) % 0xE0 ) );
+	}
+frame.insert( frame.end(), end_of_frame, end_of_frame + sizeof( end_of_frame ) );
+}
+
+//the way viewer_stdin reads, in arbitrary blocks
+static void feed( x264_destreamer & ds, const vector<uint8_t> & frame )
+{
+for( size_t pos = 0; pos < frame.size(); pos += 1500 )
+	{
+	size_t n = frame.size() - pos < 1500 ? frame.size() - pos : 1500;
+	ds.write( &frame[pos], n );
+	}
+}
+
+int main()
+{
+int failures = 0;
+
+//refcounting: copies share a buffer, which comes back once all let go
+	{
+	packet_pool pool;
+	packet_ref a = pool.get( 100 );
+	packet_ref b = a;
+	if( a.use_count() != 2 || a.data() != b.data() || pool.in_use() != 1 )
+		{
+		cout<<"FAILED: copies don't share the buffer"<<endl;
+		failures++;
+		}
+	for( int i = 0; i < PACKET_PADDING_SIZE; ++i )
+		{
+		if( a.data()[100 + i] != 0 )
+			{
+			cout<<"FAILED: padding isn't zeroed"<<endl;
+			failures++;
+			break;
+			}
+		}
+	uint8_t * first = a.data();
+	a.reset();
+	b.reset();
+	packet_ref c = pool.get( 200 );
+	if( pool.in_use() != 1 || pool.allocated() != 1 || c.data() != first )
+		{
+		cout<<"FAILED: released buffer wasn't reused"<<endl;
+		failures++;
+		}
+	}
+
+//steady state: destreamer, assembler and async sinks, with a synchronous
+//sink that keeps packets alongside
+x264_destreamer ds;
+access_unit_assembler au;
+data_source_keeper nal_keeper;
+data_source_keeper au_keeper;
+data_source_keeper display;
+data_source_keeper recording;
+ds.server.register_callback( &au );
+ds.server.register_callback( &nal_keeper );
+ds.server.register_async_callback( &recording, 64, OVERFLOW_BLOCK );
+au.server.register_callback( &au_keeper );
+au.server.register_async_callback( &display, 8, OVERFLOW_DROP_TO_RECOVERY );
+
+//enough buffers of both sizes in use for every queue full at once, plus
+//the ones being written and kept
+packet_pool::shared().preallocate( 2048, 64 + 8 + 8 );
+packet_pool::shared().preallocate( 8192, 64 + 8 + 8 );
+
+vector<uint8_t> frame;
+frame.reserve( 8192 );
+int n = 0;
+for( ; n < 300; ++n )
+	{
+	make_frame( frame, n );
+	feed( ds, frame );
+	}
+
+uint64_t before = allocations.load();
+uint64_t buffers = packet_pool::shared().allocated();
+for( ; n < 3300; ++n )
+	{
+	make_frame( frame, n );
+	feed( ds, frame );
+	if( n % 100 == 0 )
+		{
+		usleep( 1000 );
+		}
+	}
+uint64_t after = allocations.load();
+
+printf( "%llu allocations over %i frames after warm-up, %llu pool buffers allocated, %llu packets displayed, %llu recorded\n",
+	(unsigned long long)( after - before ), 3000,
+	(unsigned long long)packet_pool::shared().allocated(),
+	(unsigned long long)display.packets.load(), (unsigned long long)recording.packets.load() );
+if( after != before || packet_pool::shared().allocated() != buffers )
+	{
+	cout<<"FAILED: the pipeline allocates after warm-up"<<endl;
+	failures++;
+	}
+
+return failures ? 1 : 0;
+}
@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "data_source_rtp.h"
+#include "data_source_udp.h"
+#include "rate_controller.h"
+#include "rtp_depacketizer.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define TEST_PORT 12396
+#define FPS 30
+
+static uint64_t now_us()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+}
+
+static int check( const string & name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+//a viewer behind a link of the given capacity, with a queue in front of it
+//that drops what would wait more than 300ms, reporting every 100ms what a
+//rtp_depacketizer would
+class simulated_viewer
+	{
+	public:
+	simulated_viewer() : backlog_bits( 0 ), sent( 0 ), lost( 0 ), bits( 0 ), smoothed( -1 ), reported( 0 ) {}
+
+	//a frame of so many bits handed to the link at time t, in ms
+	void send( double t, double frame_bits, double capacity_kbps )
+		{
+		drain( t, capacity_kbps );
+		double packets = frame_bits / 9600 + 1;
+		sent += packets;
+		if( ( backlog_bits + frame_bits ) / capacity_kbps > 300 )
+			{
+			lost += packets;
+			return;
+			}
+		backlog_bits += frame_bits;
+		bits += frame_bits;
+
+		//its last bit arrives once everything ahead of it has
+		double delay = 5 + backlog_bits / capacity_kbps;
+		delays.push_back( delay );
+		smoothed = smoothed < 0 ? delay : smoothed + ( delay - smoothed ) / 4;
+		least.push_back( make_pair( t, delay ) );
+		while( least.front().first < t - 5000 )
+			{
+			least.pop_front();
+			}
+		}
+	receiver_report report( double interval_ms )
+		{
+		double lowest = smoothed;
+		for( size_t i = 0; i < least.size(); ++i )
+			{
+			lowest = min( lowest, least[i].second );
+			}
+		receiver_report r;
+		memset( &r, 0, sizeof( r ) );
+		r.fraction_lost = sent > 0 ? lost / sent : 0;
+		r.queuing_us = ( smoothed - lowest ) * 1000;
+		r.delay_trend_us = ( smoothed - reported ) * 1000 * 1000 / interval_ms;
+		r.received_kbps = bits / interval_ms;
+		reported = smoothed;
+		sent = 0;
+		lost = 0;
+		bits = 0;
+		return r;
+		}
+	vector<double> delays;
+
+	private:
+	void drain( double t, double capacity_kbps )
+		{
+		static const double step = 1;
+		for( ; last_t < t; last_t += step )
+			{
+			backlog_bits = max( 0.0, backlog_bits - capacity_kbps * step );
+			}
+		}
+	double backlog_bits;
+	double last_t = 0;
+	double sent;
+	double lost;
+	double bits;
+	double smoothed;
+	double reported;
+	deque< pair<double, double> > least;
+	};
+
+//the 95th percentile of frame delays, in ms
+static double percentile95( vector<double> v )
+{
+sort( v.begin(), v.end() );
+return v.empty() ? 0 : v[v.size() * 95 / 100];
+}
+
+//frames at the controller's rate, give or take a fifth as an encoder
+//would, to viewers on links of capacities that change over time; the
+//rate each second, and each viewer's frame delays each second
+static void simulate( const vector< vector<double> > & capacities, vector<double> & rates, vector< vector< vector<double> > > & delays, bool silent_at_end = false )
+{
+srand( 1 );
+size_t viewers = capacities.size();
+size_t seconds = capacities[0].size();
+vector<simulated_viewer> links( viewers );
+delays.assign( viewers, vector< vector<double> >( seconds ) );
+rates.clear();
+rate_controller control( 400 );
+vector<receiver_report> reports;
+double rate_sum = 0;
+for( size_t frame = 0; frame < seconds * FPS; ++frame )
+	{
+	double t = frame * 1000.0 / FPS;
+	size_t second = frame / FPS;
+	double bits = control.rate() * 1000.0 / FPS * ( 0.8 + 0.4 * rand() / RAND_MAX );
+	for( size_t v = 0; v < viewers; ++v )
+		{
+		size_t before = links[v].delays.size();
+		links[v].send( t, bits, capacities[v][second] );
+		if( links[v].delays.size() > before )
+			{
+			delays[v][second].push_back( links[v].delays.back() );
+			}
+		}
+
+	//every third frame is 100ms, and the reports are a frame late
+	reports.clear();
+	bool silent = silent_at_end && second + 3 >= seconds;
+	if( frame % 3 == 2 && !silent )
+		{
+		for( size_t v = 0; v < viewers; ++v )
+			{
+			reports.push_back( links[v].report( 100 ) );
+			}
+		}
+	control.update( reports, (uint64_t)( ( t + 1000.0 / FPS ) * 1000 ) );
+	rate_sum += control.rate();
+	if( frame % FPS == FPS - 1 )
+		{
+		rates.push_back( rate_sum / FPS );
+		rate_sum = 0;
+		}
+	}
+control.report();
+}
+
+static double mean( const vector<double> & v, size_t from, size_t to )
+{
+double sum = 0;
+for( size_t i = from; i < to; ++i )
+	{
+	sum += v[i];
+	}
+return sum / ( to - from );
+}
+
+static vector<double> gather( const vector< vector<double> > & per_second, size_t from, size_t to )
+{
+vector<double> all;
+for( size_t i = from; i < to; ++i )
+	{
+	all.insert( all.end(), per_second[i].begin(), per_second[i].end() );
+	}
+return all;
+}
+
+static int simulations()
+{
+int failures = 0;
+
+//1.5Mbps, down to 400kbps for ten seconds, then 1Mbps
+	{
+	vector< vector<double> > capacities( 1 );
+	for( size_t s = 0; s < 40; ++s )
+		{
+		capacities[0].push_back( s < 15 ? 1500 : s < 25 ? 400 : 1000 );
+		}
+	vector<double> rates;
+	vector< vector< vector<double> > > delays;
+	simulate( capacities, rates, delays );
+	printf( "rate at 14s %.0f, 24s %.0f, 39s %.0f kbps; 95th percentile delay %.0f ms before the drop, %.0f ms after, %.0f ms once settled\n",
+		rates[14], rates[24], rates[39], percentile95( gather( delays[0], 5, 15 ) ),
+		percentile95( gather( delays[0], 15, 25 ) ), percentile95( gather( delays[0], 17, 25 ) ) );
+	failures += check( "grows to use most of the link", mean( rates, 10, 15 ) > 0.7 * 1500 && mean( rates, 35, 40 ) > 0.7 * 1000 );
+	failures += check( "doesn't outgrow it", mean( rates, 10, 15 ) < 1500 && mean( rates, 35, 40 ) < 1000 );
+	failures += check( "comes down when it narrows", mean( rates, 17, 25 ) < 400 && mean( rates, 17, 25 ) > 0.6 * 400 );
+	failures += check( "delay bounded, and back down within two seconds of the drop",
+		percentile95( gather( delays[0], 5, 40 ) ) < 300 && percentile95( gather( delays[0], 17, 25 ) ) < 100 &&
+		percentile95( gather( delays[0], 27, 40 ) ) < 100 );
+	}
+
+//two viewers, one of them on a slow link: it decides
+	{
+	vector< vector<double> > capacities( 2, vector<double>( 20, 2000 ) );
+	capacities[1].assign( 20, 500 );
+	vector<double> rates;
+	vector< vector< vector<double> > > delays;
+	simulate( capacities, rates, delays );
+	failures += check( "the viewer worst off decides", mean( rates, 10, 20 ) < 500 && mean( rates, 10, 20 ) > 0.6 * 500 &&
+		percentile95( gather( delays[1], 10, 20 ) ) < 100 );
+	}
+
+//the reports stop
+	{
+	vector< vector<double> > capacities( 1, vector<double>( 15, 1000 ) );
+	vector<double> rates;
+	vector< vector< vector<double> > > delays;
+	simulate( capacities, rates, delays, true );
+	failures += check( "halves without reports", rates[14] < rates[11] / 2 );
+	}
+return failures;
+}
+
+//a viewer on loopback that loses every tenth packet, sending its reports
+//back to wherever the packets came from
+class receiver: public udp_receiver
+	{
+	public:
+	receiver() : udp_receiver( TEST_PORT )
+		{
+		back = NULL;
+		count = 0;
+		start();
+		}
+	~receiver()
+		{
+		stop();
+		delete back;
+		}
+	rtp_depacketizer rtp;
+
+	protected:
+	void arrived( const uint8_t * data, size_t bytes, const struct sockaddr_in & from, uint64_t arrival_us )
+		{
+		if( back == NULL )
+			{
+			back = new data_source_udp( inet_ntoa( from.sin_addr ), ntohs( from.sin_port ) );
+			rtp.feedback.register_callback( back );
+			}
+		if( ++count % 10 == 5 )
+			{
+			return;
+			}
+		rtp.write( data, bytes );
+		}
+
+	private:
+	data_source_udp * back;
+	size_t count;
+	};
+
+//two seconds of frames of five 1000 byte slices every 10ms, 4Mbps
+static int loopback()
+{
+receiver rx;
+data_source_udp udp( "127.0.0.1", TEST_PORT );
+udp.receive_reports();
+data_source_rtp rtp;
+rtp.server.register_callback( &udp );
+
+vector< vector<uint8_t> > nals( 5 );
+vector< struct iovec > iov( nals.size() );
+for( size_t i = 0; i < nals.size(); ++i )
+	{
+	nals[i].assign( 1000, 0x55 );
+	nals[i][0] = 0;
+	nals[i][1] = 0;
+	nals[i][2] = 0;
+	nals[i][3] = 1;
+	nals[i][4] = 0x41;
+	nals[i][5] = i == 0 ? 0x88 : 0x9A;
+	iov[i].iov_base = &nals[i][0];
+	iov[i].iov_len = nals[i].size();
+	}
+uint64_t start = now_us();
+for( int frame = 0; frame < 200; ++frame )
+	{
+	rtp.write_batch( &iov[0], iov.size() );
+	uint64_t due = start + ( frame + 1 ) * 10000;
+	uint64_t now = now_us();
+	if( due > now )
+		{
+		usleep( due - now );
+		}
+	}
+usleep( 200000 );
+rx.stop();
+udp.report();
+
+vector<receiver_report> reports;
+udp.take_reports( reports );
+vector<double> lost;
+vector<double> kbps;
+double worst_queuing = 0;
+double worst_jitter = 0;
+for( size_t i = 1; i < reports.size(); ++i )
+	{
+	lost.push_back( reports[i].fraction_lost );
+	kbps.push_back( reports[i].received_kbps );
+	worst_queuing = max( worst_queuing, reports[i].queuing_us / 1e3 );
+	worst_jitter = max( worst_jitter, reports[i].jitter_us / 1e3 );
+	}
+sort( lost.begin(), lost.end() );
+sort( kbps.begin(), kbps.end() );
+double median_lost = lost.empty() ? 0 : lost[lost.size() / 2];
+double median_kbps = kbps.empty() ? 0 : kbps[kbps.size() / 2];
+printf( "%i reports, median %.1f%% lost at %.0f kbps, worst queuing %.1f ms, jitter %.1f ms\n",
+	(int)reports.size(), median_lost * 100, median_kbps, worst_queuing, worst_jitter );
+
+int failures = 0;
+failures += check( "a report every 100ms", reports.size() >= 15 && reports.size() <= 25 && reports.size() == rx.rtp.reports_sent );
+failures += check( "loss and rate as they were", median_lost > 0.07 && median_lost < 0.13 && median_kbps > 0.9 * 3600 * 0.8 && median_kbps < 3600 * 1.2 );
+failures += check( "no queue to speak of on loopback", worst_queuing < 20 && worst_jitter < 20 );
+return failures;
+}
+
+int main()
+{
+int failures = 0;
+failures += simulations();
+failures += loopback();
+return failures ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "data_source_recorder.h"
+#include "nal_index.h"
+#include "nal_info.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+static int check( const string & name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+static int run( bool try_uring, const test_stream & s )
+{
+const vector< vector<uint8_t> > & nals = s.nals;
+const vector<nal_info> & infos = s.infos;
+string fname = try_uring ? "test_recorder_uring.264" : "test_recorder_pwrite.264";
+string method;
+uint64_t dropped;
+	{
+	data_source_recorder recorder( fname.c_str(), try_uring );
+	method = recorder.method();
+	for( size_t i = 0; i < nals.size(); ++i )
+		{
+		recorder.write( &nals[i][0], nals[i].size(), infos[i] );
+
+		//about 30 frames a second, sped up a hundred times
+		if( infos[i].access_unit_start )
+			{
+			usleep( 300 );
+			}
+		}
+	recorder.flush();
+	usleep( 100000 );
+	recorder.report();
+	dropped = recorder.dropped;
+	}
+
+ifstream in( fname.c_str(), ios::binary );
+vector<uint8_t> got( ( istreambuf_iterator<char>( in ) ), istreambuf_iterator<char>() );
+vector<uint8_t> expected;
+for( size_t i = 0; i < nals.size(); ++i )
+	{
+	expected.insert( expected.end(), nals[i].begin(), nals[i].end() );
+	}
+
+bool indexed;
+	{
+	nal_index index( fname );
+	indexed = index.is_open() && index.size() == s.access_units();
+	uint64_t offset = 0;
+	for( size_t i = 0, a = 0; indexed && i < nals.size(); ++i )
+		{
+		if( i == s.au_starts[a] )
+			{
+			indexed = index[a++].offset == offset;
+			}
+		offset += nals[i].size();
+		}
+	}
+unlink( fname.c_str() );
+unlink( ( fname + ".idx" ).c_str() );
+
+int failures = 0;
+failures += check( method + " recording is what was written", dropped == 0 && got == expected );
+failures += check( method + " index points at every access unit", indexed );
+return failures;
+}
+
+//a recording that stops for a while, without a flush, still reaches the
+//card once the writer finds the last buffer stale
+static int pauses( const test_stream & s )
+{
+string fname = "test_recorder_pause.264";
+bool written;
+	{
+	data_source_recorder recorder( fname.c_str() );
+	uint64_t bytes = 0;
+	for( size_t i = 0; i < s.au_starts[1]; ++i )
+		{
+		recorder.write( &s.nals[i][0], s.nals[i].size(), s.infos[i] );
+		bytes += s.nals[i].size();
+		}
+	usleep( 3 * RECORD_FLUSH_MS * 1000 );
+	written = recorder.bytes_written.load() == bytes;
+	}
+unlink( fname.c_str() );
+unlink( ( fname + ".idx" ).c_str() );
+return check( "a part full buffer is written once stale", written );
+}
+
+int main()
+{
+//access units of one to four slices, mostly small but some of several
+//buffers, the first of each GOP of 30 an IDR
+stream_shape shape;
+shape.max_slices = 4;
+shape.max_slice = 60100;
+shape.huge_one_in = 100;
+shape.parameter_sets = false;
+test_stream s;
+make_stream( s, 900, shape );
+
+int failures = 0;
+failures += run( true, s );
+failures += run( false, s );
+failures += pauses( s );
+return failures ? 1 : 0;
+}
@@ -0,0 +1,211 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "data_source_rtp.h"
+#include "rtp_depacketizer.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+static void packetize( const test_stream & s, data_source_packet_collector & out, size_t * fragmented )
+{
+data_source_rtp rtp;
+rtp.server.register_callback( &out );
+vector< struct iovec > iov;
+for( size_t a = 0; a < s.access_units(); ++a )
+	{
+	s.access_unit( a, iov );
+	rtp.write_batch( &iov[0], iov.size() );
+	}
+*fragmented = rtp.fragmented_nals;
+}
+
+//every NAL but the filler, and whether it is the last of its access unit
+static void expected_nals( const test_stream & s, vector< vector<uint8_t> > & nals, vector< bool > & ends )
+{
+for( size_t a = 0; a < s.access_units(); ++a )
+	{
+	for( size_t i = s.au_starts[a]; i + 1 < s.au_starts[a + 1]; ++i )
+		{
+		nals.push_back( s.nals[i] );
+		ends.push_back( i + 2 == s.au_starts[a + 1] );
+		}
+	}
+}
+
+//whether got is expected with some whole NALs missing
+static bool subsequence( const vector< vector<uint8_t> > & got, const vector< vector<uint8_t> > & expected )
+{
+size_t j = 0;
+for( size_t i = 0; i < got.size(); ++i )
+	{
+	while( j < expected.size() && expected[j] != got[i] )
+		{
+		j++;
+		}
+	if( j == expected.size() )
+		{
+		return false;
+		}
+	j++;
+	}
+return true;
+}
+
+static void depacketize( const vector< vector<uint8_t> > & packets, rtp_depacketizer & rtp, data_source_nal_collector & out )
+{
+rtp.server.register_callback( &out );
+for( size_t i = 0; i < packets.size(); ++i )
+	{
+	rtp.write( &packets[i][0], packets[i].size() );
+	}
+rtp.flush();
+}
+
+static int check( const char * name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+int main()
+{
+//an SPS, a PPS and slices of up to 5000 bytes, so some go as FU-A, then
+//the filler the encoders end access units with
+stream_shape shape;
+shape.max_slices = 4;
+shape.min_slice = 16;
+shape.max_slice = 5016;
+shape.gop = 10;
+shape.filler = true;
+test_stream s;
+make_stream( s, 300, shape );
+vector< vector<uint8_t> > nals;
+vector< bool > ends;
+expected_nals( s, nals, ends );
+
+data_source_packet_collector sent;
+size_t fragmented;
+packetize( s, sent, &fragmented );
+cout<<nals.size()<<" NALs in "<<sent.packets.size()<<" packets, "<<fragmented<<" fragmented"<<endl;
+
+int failures = 0;
+bool sizes_ok = true;
+for( size_t i = 0; i < sent.packets.size(); ++i )
+	{
+	sizes_ok &= sent.packets[i].size() <= RTP_DEFAULT_PACKET_SIZE;
+	}
+failures += check( "packets fit", sizes_ok && fragmented > 0 );
+
+//in order
+	{
+	rtp_depacketizer rtp;
+	data_source_nal_collector got;
+	depacketize( sent.packets, rtp, got );
+	rtp.report();
+	failures += check( "in order", got.nals == nals && got.ends == ends && rtp.lost == 0 && rtp.nals_dropped == 0 );
+	}
+
+//neighbours swapped, and every tenth packet sent twice
+	{
+	vector< vector<uint8_t> > shuffled;
+	for( size_t i = 0; i < sent.packets.size(); ++i )
+		{
+		if( i % 7 == 3 && i + 1 < sent.packets.size() )
+			{
+			shuffled.push_back( sent.packets[i+1] );
+			shuffled.push_back( sent.packets[i] );
+			i++;
+			continue;
+			}
+		shuffled.push_back( sent.packets[i] );
+		if( i % 10 == 0 )
+			{
+			shuffled.push_back( sent.packets[i] );
+			}
+		}
+	rtp_depacketizer rtp;
+	data_source_nal_collector got;
+	depacketize( shuffled, rtp, got );
+	rtp.report();
+	failures += check( "reordered and duplicated", got.nals == nals && got.ends == ends && rtp.lost == 0 && rtp.reordered > 0 && rtp.duplicates + rtp.late > 0 );
+	}
+
+//one packet in 50 lost, and one sent far too late
+	{
+	vector< vector<uint8_t> > lossy;
+	size_t dropped = 0;
+	for( size_t i = 0; i < sent.packets.size(); ++i )
+		{
+		if( i % 50 == 25 )
+			{
+			dropped++;
+			continue;
+			}
+		lossy.push_back( sent.packets[i] );
+		}
+	lossy.push_back( sent.packets[1] );
+	rtp_depacketizer rtp;
+	data_source_nal_collector got;
+	depacketize( lossy, rtp, got );
+	rtp.report();
+	failures += check( "lossy", rtp.lost == dropped && rtp.late == 1 && got.nals.size() < nals.size() && subsequence( got.nals, nals ) );
+	}
+
+//sequence numbers wrapping, from a sender whose counter starts near the top
+	{
+	vector< vector<uint8_t> > wrapped = sent.packets;
+	uint16_t first = ( wrapped[0][2] << 8 ) | wrapped[0][3];
+	for( size_t i = 0; i < wrapped.size(); ++i )
+		{
+		uint16_t sequence = ( ( wrapped[i][2] << 8 ) | wrapped[i][3] ) - first + 65500;
+		wrapped[i][2] = sequence >> 8;
+		wrapped[i][3] = sequence & 0xFF;
+		}
+	swap( wrapped[40], wrapped[41] );
+	rtp_depacketizer rtp( 10 );
+	data_source_nal_collector got;
+	depacketize( wrapped, rtp, got );
+	failures += check( "wrapping", got.nals == nals && rtp.lost == 0 );
+	}
+
+//described batches, written faster than real time, stamped with their
+//capture times rather than when they were packetized
+	{
+	data_source_packet_collector stamped;
+	data_source_rtp rtp;
+	rtp.server.register_callback( &stamped );
+	vector< struct iovec > iov;
+	for( size_t a = 0; a < 30; ++a )
+		{
+		s.access_unit( a, iov );
+		vector<nal_info> infos( s.infos.begin() + s.au_starts[a], s.infos.begin() + s.au_starts[a + 1] );
+		for( size_t i = 0; i < infos.size(); ++i )
+			{
+			infos[i].timestamp_us = 5000000000ULL + a * 33333;
+			}
+		rtp.write_batch( &iov[0], iov.size(), &infos[0] );
+		}
+	bool timestamps_ok = true;
+	size_t a = 0;
+	uint32_t first = 0;
+	for( size_t i = 0; i < stamped.packets.size(); ++i )
+		{
+		const uint8_t * p = &stamped.packets[i][0];
+		uint32_t timestamp = ( p[4] << 24 ) | ( p[5] << 16 ) | ( p[6] << 8 ) | p[7];
+		first = i == 0 ? timestamp : first;
+		uint32_t expected = ( 5000000000ULL + a * 33333 ) * 90 / 1000 - 5000000000ULL * 90 / 1000;
+		timestamps_ok = timestamps_ok && timestamp - first == expected;
+		a += p[1] & 0x80 ? 1 : 0;
+		}
+	failures += check( "timestamps from the descriptors", timestamps_ok && a == 30 );
+	}
+
+return failures ? 1 : 0;
+}
@@ -0,0 +1,314 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "data_source_segment_muxer.h"
+#include "nal_info.h"
+
+using namespace std;
+
+#define FPS 30
+#define GOP 15
+#define ACCESS_UNITS 105
+#define SEGMENT_SECONDS 1.0
+
+//the picture, in macroblocks
+#define WIDTH_MBS 4
+#define HEIGHT_MBS 3
+
+//writes an RBSP a bit at a time, then makes a NAL of it
+class bit_writer
+	{
+	public:
+	bit_writer() : bits( 0 ) {}
+	void u( int n, uint32_t v )
+		{
+		while( n-- > 0 )
+			{
+			if( bits % 8 == 0 )
+				{
+				rbsp.push_back( 0 );
+				}
+			rbsp.back() |= ( ( v >> n ) & 1 ) << ( 7 - bits % 8 );
+			bits++;
+			}
+		}
+	void ue( uint32_t v )
+		{
+		int length = 0;
+		while( ( v + 1 ) >> ( length + 1 ) )
+			{
+			length++;
+			}
+		u( length, 0 );
+		u( length + 1, v + 1 );
+		}
+	void se( int v )
+		{
+		ue( v > 0 ? 2 * v - 1 : -2 * v );
+		}
+	void align()
+		{
+		while( bits % 8 )
+			{
+			u( 1, 0 );
+			}
+		}
+	void trailing()
+		{
+		u( 1, 1 );
+		align();
+		}
+
+	//start code, header and the RBSP with emulation prevention
+	void nal( uint8_t header, vector<uint8_t> & out ) const
+		{
+		static const uint8_t start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+		out.insert( out.end(), start_code, start_code + sizeof( start_code ) );
+		out.push_back( header );
+		int zeros = 0;
+		for( size_t i = 0; i < rbsp.size(); ++i )
+			{
+			if( zeros >= 2 && rbsp[i] <= 3 )
+				{
+				out.push_back( 0x03 );
+				zeros = 0;
+				}
+			out.push_back( rbsp[i] );
+			zeros = rbsp[i] == 0 ? zeros + 1 : 0;
+			}
+		}
+
+	private:
+	vector<uint8_t> rbsp;
+	size_t bits;
+	};
+
+//A stream a decoder would take: baseline, the picture all I_PCM grey in
+//an IDR every GOP, with an SPS and PPS before it, and every P frame
+//between skipped. Only the stream is made up, not its syntax.
+static void make_access_unit( size_t a, vector<uint8_t> & au )
+{
+au.clear();
+size_t frame_num = a % GOP;
+if( frame_num == 0 )
+	{
+	bit_writer sps;
+	sps.u( 8, 66 );        //profile_idc, baseline
+	sps.u( 8, 0xC0 );      //constraint_set0 and 1
+	sps.u( 8, 10 );        //level_idc
+	sps.ue( 0 );           //seq_parameter_set_id
+	sps.ue( 0 );           //log2_max_frame_num_minus4
+	sps.ue( 2 );           //pic_order_cnt_type
+	sps.ue( 1 );           //max_num_ref_frames
+	sps.u( 1, 0 );         //gaps_in_frame_num_value_allowed_flag
+	sps.ue( WIDTH_MBS - 1 );
+	sps.ue( HEIGHT_MBS - 1 );
+	sps.u( 1, 1 );         //frame_mbs_only_flag
+	sps.u( 1, 1 );         //direct_8x8_inference_flag
+	sps.u( 1, 0 );         //frame_cropping_flag
+	sps.u( 1, 0 );         //vui_parameters_present_flag
+	sps.trailing();
+	sps.nal( 0x67, au );
+
+	bit_writer pps;
+	pps.ue( 0 );           //pic_parameter_set_id
+	pps.ue( 0 );           //seq_parameter_set_id
+	pps.u( 1, 0 );         //entropy_coding_mode_flag, CAVLC
+	pps.u( 1, 0 );         //bottom_field_pic_order_in_frame_present_flag
+	pps.ue( 0 );           //num_slice_groups_minus1
+	pps.ue( 0 );           //num_ref_idx_l0_default_active_minus1
+	pps.ue( 0 );           //num_ref_idx_l1_default_active_minus1
+	pps.u( 1, 0 );         //weighted_pred_flag
+	pps.u( 2, 0 );         //weighted_bipred_idc
+	pps.se( 0 );           //pic_init_qp_minus26
+	pps.se( 0 );           //pic_init_qs_minus26
+	pps.se( 0 );           //chroma_qp_index_offset
+	pps.u( 1, 1 );         //deblocking_filter_control_present_flag
+	pps.u( 1, 0 );         //constrained_intra_pred_flag
+	pps.u( 1, 0 );         //redundant_pic_cnt_present_flag
+	pps.trailing();
+	pps.nal( 0x68, au );
+	}
+
+bool idr = frame_num == 0;
+bit_writer slice;
+slice.ue( 0 );                  //first_mb_in_slice
+slice.ue( idr ? 7 : 5 );        //slice_type, I or P for the whole picture
+slice.ue( 0 );                  //pic_parameter_set_id
+slice.u( 4, frame_num );
+if( idr )
+	{
+	slice.ue( ( a / GOP ) % 2 );   //idr_pic_id, different from the last
+	slice.u( 1, 0 );               //no_output_of_prior_pics_flag
+	slice.u( 1, 0 );               //long_term_reference_flag
+	}
+else
+	{
+	slice.u( 1, 0 );               //num_ref_idx_active_override_flag
+	slice.u( 1, 0 );               //ref_pic_list_modification_flag_l0
+	slice.u( 1, 0 );               //adaptive_ref_pic_marking_mode_flag
+	}
+slice.se( 0 );                  //slice_qp_delta
+slice.ue( 1 );                  //disable_deblocking_filter_idc
+if( idr )
+	{
+	for( int mb = 0; mb < WIDTH_MBS * HEIGHT_MBS; ++mb )
+		{
+		slice.ue( 25 );         //I_PCM
+		slice.align();
+		for( int i = 0; i < 256 + 128; ++i )
+			{
+			slice.u( 8, 0x80 );
+			}
+		}
+	}
+else
+	{
+	slice.ue( WIDTH_MBS * HEIGHT_MBS );   //mb_skip_run
+	}
+slice.trailing();
+slice.nal( idr ? 0x65 : 0x41, au );
+}
+
+static int check( const string & name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+static string segment_name( const string & prefix, const string & extension, int n )
+{
+char number[32];
+snprintf( number, sizeof( number ), "_%05i", n );
+return prefix + number + extension;
+}
+
+//what libavformat makes of a segment: each packet's PTS, in microseconds,
+//and whether it is a keyframe, and the picture size
+struct segment
+	{
+	bool opened;
+	int width;
+	int height;
+	vector<int64_t> pts_us;
+	vector<bool> keys;
+	};
+
+static segment read_back( const string & fname )
+{
+segment s;
+s.opened = false;
+s.width = s.height = 0;
+AVFormatContext * input = NULL;
+if( avformat_open_input( &input, fname.c_str(), NULL, NULL ) < 0 )
+	{
+	return s;
+	}
+if( avformat_find_stream_info( input, NULL ) >= 0 && input->nb_streams == 1 &&
+    input->streams[0]->codecpar->codec_id == AV_CODEC_ID_H264 )
+	{
+	s.opened = true;
+	s.width = input->streams[0]->codecpar->width;
+	s.height = input->streams[0]->codecpar->height;
+	AVRational microseconds = { 1, 1000000 };
+	AVPacket * packet = av_packet_alloc();
+	while( av_read_frame( input, packet ) >= 0 )
+		{
+		s.pts_us.push_back( av_rescale_q( packet->pts, input->streams[0]->time_base, microseconds ) );
+		s.keys.push_back( packet->flags & AV_PKT_FLAG_KEY );
+		av_packet_unref( packet );
+		}
+	av_packet_free( &packet );
+	}
+avformat_close_input( &input );
+return s;
+}
+
+//ACCESS_UNITS at FPS, timestamped as if captured then but written as fast
+//as they can be, after a P frame there is nothing to decode from
+static int run( const string & extension, uint64_t budget )
+{
+string prefix = "test_segment_muxer";
+string mode = extension + ( budget ? " with a budget: " : ": " );
+int failures = 0;
+uint64_t first_us = 1000000000000ULL;
+	{
+	data_source_segment_muxer muxer( ( prefix + extension ).c_str(), SEGMENT_SECONDS, budget );
+	nal_parser parser;
+	vector<uint8_t> au;
+	make_access_unit( 1, au );
+	nal_info info;
+	parser.parse( &au[0], au.size(), info );
+	info.timestamp_us = first_us - 1000000 / FPS;
+	muxer.write( &au[0], au.size(), info );
+	for( size_t a = 0; a < ACCESS_UNITS; ++a )
+		{
+		make_access_unit( a, au );
+		parser.parse( &au[0], au.size(), info );
+		info.timestamp_us = first_us + a * 1000000 / FPS;
+		muxer.write( &au[0], au.size(), info );
+		}
+	muxer.report();
+	failures += check( mode + "starts at the first recovery point", muxer.skipped == 1 && muxer.access_units == ACCESS_UNITS && muxer.errors == 0 );
+	failures += check( mode + "a segment a second, by capture time", muxer.segments == 4 );
+	if( budget )
+		{
+		failures += check( mode + "all but the last pruned", muxer.pruned == 3 );
+		}
+	}
+
+//the segments left, each starting at an IDR a second on from the last,
+//with a frame every 1/FPS after it
+size_t expected[] = { 30, 30, 30, 15 };
+int64_t first_pts = 0;
+for( int n = 0; n < 4; ++n )
+	{
+	string fname = segment_name( prefix, extension, n );
+	if( budget && n < 3 )
+		{
+		failures += check( mode + fname + " deleted", access( fname.c_str(), F_OK ) != 0 );
+		continue;
+		}
+	segment s = read_back( fname );
+	bool ok = s.opened && s.width == WIDTH_MBS * 16 && s.height == HEIGHT_MBS * 16 &&
+		s.pts_us.size() == expected[n] && s.keys[0];
+	for( size_t i = 1; ok && i < s.pts_us.size(); ++i )
+		{
+		int64_t step = s.pts_us[i] - s.pts_us[i - 1];
+		ok = step > 1000000 / FPS - 1000 && step < 1000000 / FPS + 1000 && s.keys[i] == ( i % GOP == 0 );
+		}
+
+	//MPEG-TS keeps the PTS it is given, where MP4 may shift each file's
+	//start, so only the TS segments are checked against each other
+	if( ok && n == 0 )
+		{
+		first_pts = s.pts_us[0];
+		}
+	if( ok && extension == ".ts" && !budget )
+		{
+		int64_t start = s.pts_us[0] - first_pts;
+		ok = start > n * 1000000 - 1000 && start < n * 1000000 + 1000;
+		}
+	printf( "%s: %i packets\n", fname.c_str(), (int)s.pts_us.size() );
+	failures += check( mode + fname + " reads back", ok );
+	unlink( fname.c_str() );
+	}
+return failures;
+}
+
+int main()
+{
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT( 58, 9, 100 )
+av_register_all();
+#endif
+av_log_set_level( AV_LOG_ERROR );
+
+int failures = 0;
+failures += run( ".ts", 0 );
+failures += run( ".mp4", 0 );
+failures += run( ".ts", 1 );
+return failures ? 1 : 0;
+}
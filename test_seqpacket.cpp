@@ -0,0 +1,232 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "data_source_seqpacket.h"
+#include "nal_info.h"
+#include "seqpacket_reader.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define TEST_PATH "/tmp/test_seqpacket.sock"
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//keeps the index of every NAL it is given, and whether it came intact
+class collector: public data_source
+	{
+	public:
+	collector( const test_stream & s ) : s( s ), intact( true ) {}
+	void write( const uint8_t * data, size_t bytes )
+		{
+		intact = false;
+		}
+	void write( const uint8_t * data, size_t bytes, const nal_info & info )
+		{
+		uint32_t index;
+		memcpy( &index, data + bytes - sizeof( index ), sizeof( index ) );
+		if( bytes < 4 + sizeof( index ) || index >= s.nals.size() )
+			{
+			intact = false;
+			return;
+			}
+		const vector<uint8_t> & sent = s.nals[index];
+		bool padded = true;
+		for( int i = 0; i < PACKET_PADDING_SIZE; ++i )
+			{
+			padded = padded && data[bytes + i] == 0;
+			}
+		intact = intact && bytes == sent.size() && memcmp( data, &sent[0], bytes ) == 0 &&
+			padded && info.nal_unit_type == s.infos[index].nal_unit_type && info.access_unit_start == s.infos[index].access_unit_start;
+		indices.push_back( index );
+		}
+	const test_stream & s;
+	bool intact;
+	vector<uint32_t> indices;
+	};
+
+//a process on the same host reading everything, once it is let go
+class subscriber
+	{
+	public:
+	subscriber( const test_stream & s, bool held = false ) : sink( s )
+		{
+		reading.store( !held );
+		reader.server.register_callback( &sink );
+		if( !reader.open( TEST_PATH, 1000 ) )
+			{
+			printf( "couldn't subscribe to %s\n", TEST_PATH );
+			exit( 1 );
+			}
+		worker = thread( &subscriber::run, this );
+		}
+	~subscriber()
+		{
+		finish();
+		}
+	void finish()
+		{
+		reading.store( true );
+		if( worker.joinable() )
+			{
+			worker.join();
+			}
+		}
+	void run()
+		{
+		while( !reading.load() )
+			{
+			usleep( 1000 );
+			}
+		while( reader.read() )
+			{
+			}
+		}
+	seqpacket_reader reader;
+	collector sink;
+	atomic<bool> reading;
+
+	private:
+	thread worker;
+	};
+
+static int check( const string & name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+//every NAL from from on, in order
+static bool everything( const vector<uint32_t> & indices, size_t from, size_t to )
+{
+if( indices.size() != to - from )
+	{
+	return false;
+	}
+for( size_t i = 0; i < indices.size(); ++i )
+	{
+	if( indices[i] != from + i )
+		{
+		return false;
+		}
+	}
+return true;
+}
+
+//starts at parameter sets, and after any gap starts again at them
+static bool decodable( const test_stream & s, const vector<uint32_t> & indices )
+{
+for( size_t i = 0; i < indices.size(); ++i )
+	{
+	if( ( i == 0 || indices[i] != indices[i - 1] + 1 ) && s.infos[indices[i]].nal_unit_type != NAL_SPS )
+		{
+		return false;
+		}
+	}
+return !indices.empty();
+}
+
+static void wait_for( data_source_seqpacket & server, size_t clients )
+{
+for( int i = 0; i < 1000 && server.clients() < clients; ++i )
+	{
+	usleep( 1000 );
+	}
+}
+
+//sends the stream a NAL at a time or an access unit to a batch, a little
+//slower than a camera would so the subscribers' threads keep up on one CPU
+static double send( data_source_seqpacket & server, const test_stream & s, size_t from_au, size_t to_au, bool batches )
+{
+double slowest = 0;
+vector<struct iovec> iov;
+for( size_t a = from_au; a < to_au; ++a )
+	{
+	double start = now();
+	if( batches )
+		{
+		s.access_unit( a, iov );
+		server.write_batch( &iov[0], iov.size(), &s.infos[s.au_starts[a]] );
+		}
+	else
+		{
+		for( size_t i = s.au_starts[a]; i < s.au_starts[a + 1]; ++i )
+			{
+			server.write( &s.nals[i][0], s.nals[i].size(), s.infos[i] );
+			}
+		}
+	double took = now() - start;
+	slowest = took > slowest ? took : slowest;
+	usleep( 200 );
+	}
+return slowest;
+}
+
+static int run( bool per_access_unit, bool batches )
+{
+string mode = per_access_unit ? ( batches ? "per access unit, from batches: " : "per access unit, gathered: " ) : "per NAL: ";
+//one to four slices of up to 20KB, with an SPS, a PPS and an IDR every 30
+stream_shape shape;
+shape.max_slices = 4;
+shape.max_slice = 20100;
+test_stream s;
+make_stream( s, 3000, shape );
+size_t aus = s.access_units();
+
+//the held subscriber's socket fills well before it is let go, and the
+//late one joins between recovery points
+size_t release_au = 600;
+size_t late_au = 1000;
+size_t late_resumes = ( late_au / 30 + 1 ) * 30;
+
+data_source_seqpacket * server = new data_source_seqpacket( TEST_PATH, per_access_unit );
+subscriber fast( s );
+subscriber held( s, true );
+wait_for( *server, 2 );
+double slowest = send( *server, s, 0, release_au, batches );
+held.reading.store( true );
+slowest = max( slowest, send( *server, s, release_au, late_au, batches ) );
+subscriber late( s );
+wait_for( *server, 3 );
+slowest = max( slowest, send( *server, s, late_au, aus, batches ) );
+usleep( 100000 );
+server->report();
+uint64_t messages = server->messages;
+
+//the subscribers read what is left, then find the server gone
+delete server;
+fast.finish();
+held.finish();
+late.finish();
+
+int failures = 0;
+failures += check( mode + "a subscriber keeping up gets every NAL, intact and described", fast.sink.intact && everything( fast.sink.indices, 0, s.nals.size() ) );
+failures += check( mode + "one joining late starts at the next recovery point", late.sink.intact && everything( late.sink.indices, s.au_starts[late_resumes], s.nals.size() ) );
+failures += check( mode + "one that fell behind skipped to recovery points", held.sink.intact && held.sink.indices.size() < s.nals.size() && decodable( s, held.sink.indices ) );
+failures += check( mode + "the producer never waited on a subscriber", slowest < 0.05 );
+failures += check( mode + "a message per " + ( per_access_unit ? "access unit" : "NAL" ), messages == ( per_access_unit ? aus : s.nals.size() ) );
+printf( "held subscriber got %i of %i NALs, slowest write %.2f ms\n", (int)held.sink.indices.size(), (int)s.nals.size(), slowest * 1e3 );
+return failures;
+}
+
+int main()
+{
+int failures = 0;
+failures += run( false, false );
+failures += run( true, false );
+failures += run( true, true );
+return failures ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "config.h"
+#include "data_source_tcp_server.h"
+#include "nal_info.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+#define TEST_PORT 12398
+
+static double now()
+{
+timespec temp;
+clock_gettime( CLOCK_MONOTONIC, &temp );
+return (double)temp.tv_sec + ( (double)temp.tv_nsec / 1e9 );
+}
+
+//a viewer reading everything the server sends, once it is let go, and
+//pausing between reads if it is to be slow
+class viewer
+	{
+	public:
+	viewer( int receive_buffer, bool held = false, int pause_us = 0 )
+		{
+		this->pause_us = pause_us;
+		reading.store( !held );
+		sd = socket( AF_INET, SOCK_STREAM, 0 );
+		if( receive_buffer )
+			{
+			setsockopt( sd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof( receive_buffer ) );
+			}
+		struct sockaddr_in addr;
+		memset( &addr, 0, sizeof( addr ) );
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+		addr.sin_port = htons( TEST_PORT );
+		if( connect( sd, (struct sockaddr *)&addr, sizeof( addr ) ) < 0 )
+			{
+			printf( "couldn't connect to port %i\n", TEST_PORT );
+			exit( 1 );
+			}
+		worker = thread( &viewer::run, this );
+		}
+	~viewer()
+		{
+		finish();
+		close( sd );
+		}
+	void finish()
+		{
+		reading.store( true );
+		if( worker.joinable() )
+			{
+			worker.join();
+			}
+		}
+	void run()
+		{
+		while( !reading.load() )
+			{
+			usleep( 1000 );
+			}
+		uint8_t buffer[65536];
+		ssize_t n;
+		while( ( n = recv( sd, buffer, pause_us ? 16384 : sizeof( buffer ), 0 ) ) > 0 )
+			{
+			got.insert( got.end(), buffer, buffer + n );
+			if( pause_us )
+				{
+				usleep( pause_us );
+				}
+			}
+		}
+	vector<uint8_t> got;
+	atomic<bool> reading;
+
+	private:
+	int sd;
+	int pause_us;
+	thread worker;
+	};
+
+//which NALs of the stream a viewer got, in order, or -1 for bytes that
+//aren't one of them
+static vector<int> nals_of( const vector<uint8_t> & got, const test_stream & s )
+{
+vector<int> indices;
+size_t start = 0;
+while( start + 4 < got.size() )
+	{
+	size_t end = start + 4;
+	while( end + 4 <= got.size() && !( got[end] == 0 && got[end + 1] == 0 && got[end + 2] == 0 && got[end + 3] == 1 ) )
+		{
+		end++;
+		}
+	if( end + 4 > got.size() )
+		{
+		end = got.size();
+		}
+	int index = -1;
+	if( end - start > 8 )
+		{
+		uint32_t i;
+		memcpy( &i, &got[end - sizeof( i )], sizeof( i ) );
+		if( i < s.nals.size() && s.nals[i].size() == end - start && memcmp( &s.nals[i][0], &got[start], end - start ) == 0 )
+			{
+			index = i;
+			}
+		}
+	indices.push_back( index );
+	start = end;
+	}
+return indices;
+}
+
+//whether every run of NALs the viewer got is unbroken and starts with the
+//parameter sets and an IDR
+static bool decodable( const vector<int> & indices, const test_stream & s, int * resumes )
+{
+*resumes = 0;
+size_t i = 0;
+while( i < indices.size() )
+	{
+	//the first IDR's access unit starts at the SPS ahead of it
+	if( i + 2 >= indices.size() || indices[i] != 0 || indices[i + 1] != 1 || indices[i + 2] < 0 ||
+	    s.infos[indices[i + 2]].nal_unit_type != NAL_SLICE_IDR || !( s.infos[indices[i + 2]].access_unit_start || indices[i + 2] == 2 ) )
+		{
+		return false;
+		}
+	(*resumes)++;
+	i += 2;
+	while( i + 1 < indices.size() && indices[i + 1] == indices[i] + 1 )
+		{
+		i++;
+		}
+	i++;
+	}
+return true;
+}
+
+//a frame every millisecond, with a viewer joining halfway if asked
+static void send( data_source_tcp_server & server, const test_stream & s, double * slowest, viewer ** late )
+{
+size_t n = 0;
+for( size_t a = 0; a < s.access_units(); ++a )
+	{
+	if( a == 315 && late )
+		{
+		*late = new viewer( 0 );
+		while( server.clients() < 3 )
+			{
+			usleep( 1000 );
+			}
+		}
+	for( ; n < s.au_starts[a + 1]; ++n )
+		{
+		double start = now();
+		server.write( &s.nals[n][0], s.nals[n].size(), s.infos[n] );
+		double t = now() - start;
+		*slowest = t > *slowest ? t : *slowest;
+		}
+	usleep( 1000 );
+	}
+}
+
+//a viewer reading at about half the stream's rate
+static void send_to_slow_reader( const test_stream & s, bool bounded, uint64_t * peak, uint64_t * skipped, vector<int> & nals )
+{
+double slowest = 0;
+viewer * v;
+	{
+	data_source_tcp_server server( TEST_PORT );
+	if( bounded )
+		{
+		server.bound_latency();
+		}
+	v = new viewer( 65536, false, 2000 );
+	while( server.clients() < 1 )
+		{
+		usleep( 1000 );
+		}
+	send( server, s, &slowest, NULL );
+	server.report();
+	*peak = server.peak_queued.load();
+	*skipped = server.frames_skipped;
+	}
+v->finish();
+nals = nals_of( v->got, s );
+delete v;
+}
+
+static int check( const char * name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+//A viewer that reads nothing until the whole stream is written, with the
+//kernel holding little for it, so its queue fills where the stream says.
+//With a slice an access unit the first 510 or so fill the 512 packets,
+//give or take the few the kernel and the server's send batch took first,
+//and are dropped. It waits for the IDR at 600, fills the queue again at
+//1110, and waits for the IDR at 1200: two overflows, and the viewer sees
+//what went before the first, then the parameter sets and 1200 on.
+static int held_viewer()
+{
+stream_shape shape;
+shape.max_slices = 1;
+shape.min_slice = 2000;
+shape.max_slice = 12000;
+shape.gop = 100;
+shape.repeat_parameter_sets = false;
+test_stream s;
+make_stream( s, 1300, shape );
+double slowest = 0;
+uint64_t overflows;
+viewer * v;
+	{
+	data_source_tcp_server server( TEST_PORT );
+	server.limit_send_buffer( 16384 );
+	v = new viewer( 4096, true );
+	while( server.clients() < 1 )
+		{
+		usleep( 1000 );
+		}
+	send( server, s, &slowest, NULL );
+	server.report();
+	overflows = server.overflows;
+	v->reading.store( true );
+	}
+v->finish();
+
+int resumes;
+vector<int> nals = nals_of( v->got, s );
+size_t tail = s.nals.size() - s.au_starts[1200];
+bool ok = decodable( nals, s, &resumes ) && nals.size() > tail + 2 && nals[nals.size() - tail - 2] == 0 &&
+	nals[nals.size() - tail] == (int)s.au_starts[1200] && nals.back() == (int)s.nals.size() - 1;
+printf( "held viewer got %i of %i NALs, starting over %i times, after %llu overflows\n",
+	(int)nals.size(), (int)s.nals.size(), resumes, (unsigned long long)overflows );
+delete v;
+return check( "slow viewer skips to recovery points", ok && resumes >= 1 && overflows == 2 );
+}
+
+int main()
+{
+//an SPS and PPS, then access units of one to four slices with an IDR
+//every 30 but no parameter sets again, so joining takes the ones kept
+stream_shape shape;
+shape.max_slices = 4;
+shape.min_slice = 2000;
+shape.max_slice = 12000;
+shape.repeat_parameter_sets = false;
+test_stream s;
+make_stream( s, 600, shape );
+vector<uint8_t> all;
+for( size_t i = 0; i < s.nals.size(); ++i )
+	{
+	all.insert( all.end(), s.nals[i].begin(), s.nals[i].end() );
+	}
+
+int failures = 0;
+double slowest = 0;
+viewer * fast;
+viewer * slow;
+viewer * late = NULL;
+	{
+	data_source_tcp_server server( TEST_PORT );
+	fast = new viewer( 0 );
+	slow = new viewer( 4096, true );
+	while( server.clients() < 2 )
+		{
+		usleep( 1000 );
+		}
+
+	//a frame every millisecond, the slow viewer reading none of them
+	send( server, s, &slowest, &late );
+	server.report();
+	slow->reading.store( true );
+	}
+fast->finish();
+slow->finish();
+late->finish();
+
+printf( "slowest write %.3f ms\n", slowest * 1e3 );
+failures += check( "slow viewer doesn't hold up the producer", slowest < 0.05 );
+failures += check( "fast viewer gets everything", fast->got == all );
+
+int resumes;
+vector<int> nals = nals_of( late->got, s );
+bool late_ok = decodable( nals, s, &resumes ) && resumes == 1 && nals.back() == (int)s.nals.size() - 1 &&
+	nals[2] == (int)s.au_starts[330];
+failures += check( "late viewer starts at the next IDR with the parameter sets", late_ok );
+
+delete fast;
+delete slow;
+delete late;
+
+failures += held_viewer();
+
+//the same slow reader with and without latency bounded
+uint64_t free_peak, free_skipped, bounded_peak, bounded_skipped;
+vector<int> free_nals, bounded_nals;
+send_to_slow_reader( s, false, &free_peak, &free_skipped, free_nals );
+send_to_slow_reader( s, true, &bounded_peak, &bounded_skipped, bounded_nals );
+printf( "slow reader: at most %llu bytes queued in the kernel, %llu with latency bounded, skipping %llu frames\n",
+	(unsigned long long)free_peak, (unsigned long long)bounded_peak, (unsigned long long)bounded_skipped );
+failures += check( "bounded latency keeps the kernel's queue short", bounded_peak * 4 < free_peak && free_skipped == 0 );
+bool bounded_ok = decodable( bounded_nals, s, &resumes ) && resumes > 1 && bounded_skipped > 0;
+failures += check( "bounded latency skips whole frames to recovery points", bounded_ok );
+return failures ? 1 : 0;
+}
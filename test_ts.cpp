@@ -0,0 +1,303 @@
+#include <iostream>
+#include <vector>
+#include <cstdlib>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "data_source.h"
+#include "data_source_ts.h"
+#include "nal_info.h"
+#include "test_helpers.h"
+
+using namespace std;
+
+//keeps every datagram the muxer sends, and how many batches they came in
+class data_source_datagram_collector: public data_source
+	{
+	public:
+	data_source_datagram_collector() : batches( 0 ), padded( true ) {}
+	void write( const uint8_t * data, size_t bytes ){}
+	void write_batch( const struct iovec * iov, int count )
+		{
+		batches++;
+		for( int i = 0; i < count; ++i )
+			{
+			const uint8_t * data = (const uint8_t *)iov[i].iov_base;
+			datagrams.push_back( vector<uint8_t>( data, data + iov[i].iov_len ) );
+			for( int j = 0; j < PACKET_PADDING_SIZE; ++j )
+				{
+				padded = padded && data[iov[i].iov_len + j] == 0;
+				}
+			}
+		}
+	vector< vector<uint8_t> > datagrams;
+	size_t batches;
+	bool padded;
+	};
+
+static uint64_t capture_us( size_t a )
+{
+return 5000000000ULL + a * 33333;
+}
+
+//what each PES should carry: a delimiter, then every NAL but the filler
+static vector<uint8_t> expected_payload( const test_stream & s, size_t a )
+{
+static const uint8_t aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xF0 };
+vector<uint8_t> payload( aud, aud + sizeof( aud ) );
+for( size_t i = s.au_starts[a]; i + 1 < s.au_starts[a + 1]; ++i )
+	{
+	payload.insert( payload.end(), s.nals[i].begin(), s.nals[i].end() );
+	}
+return payload;
+}
+
+static void mux( const test_stream & s, data_source_datagram_collector & out, bool per_slice, bool batches )
+{
+data_source_ts ts( per_slice );
+ts.server.register_callback( &out );
+vector< struct iovec > iov;
+for( size_t a = 0; a < s.access_units(); ++a )
+	{
+	s.access_unit( a, iov );
+	vector< nal_info > infos( s.infos.begin() + s.au_starts[a], s.infos.begin() + s.au_starts[a + 1] );
+	for( size_t i = 0; i < infos.size(); ++i )
+		{
+		infos[i].timestamp_us = capture_us( a );
+		}
+	if( batches )
+		{
+		ts.write_batch( &iov[0], iov.size() );
+		}
+	else
+		{
+		ts.write_batch( &iov[0], iov.size(), &infos[0] );
+		}
+	}
+}
+
+//the CRC of a PSI section, its own CRC included, comes to zero
+static bool crc_ok( const uint8_t * section, size_t bytes )
+{
+uint32_t crc = 0xFFFFFFFF;
+for( size_t i = 0; i < bytes; ++i )
+	{
+	for( int bit = 7; bit >= 0; --bit )
+		{
+		bool top = ( ( crc >> 31 ) & 1 ) != ( ( section[i] >> bit ) & 1 );
+		crc = top ? ( crc << 1 ) ^ 0x04C11DB7 : crc << 1;
+		}
+	}
+return crc == 0;
+}
+
+static uint64_t read_pts( const uint8_t * p )
+{
+return ( (uint64_t)( p[0] & 0x0E ) << 29 ) | ( (uint64_t)p[1] << 22 ) | ( (uint64_t)( p[2] & 0xFE ) << 14 ) |
+	( (uint64_t)p[3] << 7 ) | ( p[4] >> 1 );
+}
+
+//a demuxer as strict as the standard: whole packets, no gaps in the
+//continuity counters, tables that check out, and the PESes they point to
+struct demuxed
+	{
+	bool packets_ok;
+	bool continuity_ok;
+	bool tables_ok;
+	bool pcr_ok;
+	vector< vector<uint8_t> > payloads;
+	vector< uint64_t > pts;
+	vector< uint64_t > pcr;
+	vector< size_t > lengths;       //as the PES header gives them
+	vector< bool > tables_before;   //PAT and PMT since the last PES
+	vector< bool > random_access;
+	};
+
+static void demux( const vector< vector<uint8_t> > & datagrams, demuxed & out )
+{
+out.packets_ok = true;
+out.continuity_ok = true;
+out.tables_ok = true;
+out.pcr_ok = true;
+int continuity[0x2000];
+for( int i = 0; i < 0x2000; ++i )
+	{
+	continuity[i] = -1;
+	}
+int pmt_pid = -1;
+int video_pid = -1;
+bool pat = false;
+bool pmt = false;
+vector<uint8_t> pes;
+for( size_t d = 0; d < datagrams.size(); ++d )
+	{
+	const vector<uint8_t> & datagram = datagrams[d];
+	if( datagram.empty() || datagram.size() % TS_PACKET_SIZE || datagram.size() > TS_PACKETS_PER_DATAGRAM * TS_PACKET_SIZE )
+		{
+		out.packets_ok = false;
+		continue;
+		}
+	for( size_t at = 0; at < datagram.size(); at += TS_PACKET_SIZE )
+		{
+		const uint8_t * p = &datagram[at];
+		int pid = ( ( p[1] & 0x1F ) << 8 ) | p[2];
+		bool unit_start = p[1] & 0x40;
+		int control = ( p[3] >> 4 ) & 3;
+		int counter = p[3] & 0x0F;
+		if( p[0] != TS_SYNC_BYTE || control == 0 )
+			{
+			out.packets_ok = false;
+			continue;
+			}
+		if( control & 1 )
+			{
+			if( continuity[pid] >= 0 && counter != ( ( continuity[pid] + 1 ) & 0x0F ) )
+				{
+				out.continuity_ok = false;
+				}
+			continuity[pid] = counter;
+			}
+		const uint8_t * payload = p + 4;
+		const uint8_t * end = p + TS_PACKET_SIZE;
+		bool pcr = false;
+		if( control & 2 )
+			{
+			payload += 1 + p[4];
+			pcr = p[4] > 0 && ( p[5] & 0x10 );
+			if( payload > end || ( control == 3 && payload == end ) )
+				{
+				out.packets_ok = false;
+				continue;
+				}
+			}
+
+		if( pid == 0 && unit_start )
+			{
+			const uint8_t * section = payload + 1 + payload[0];
+			size_t length = ( ( section[1] & 0x0F ) << 8 ) | section[2];
+			out.tables_ok = out.tables_ok && section[0] == 0x00 && crc_ok( section, 3 + length ) && length == 13;
+			pmt_pid = ( ( section[10] & 0x1F ) << 8 ) | section[11];
+			pat = true;
+			}
+		else if( pid == pmt_pid && unit_start )
+			{
+			const uint8_t * section = payload + 1 + payload[0];
+			size_t length = ( ( section[1] & 0x0F ) << 8 ) | section[2];
+			out.tables_ok = out.tables_ok && section[0] == 0x02 && crc_ok( section, 3 + length ) && section[12] == TS_STREAM_TYPE_H264;
+			int pcr_pid = ( ( section[8] & 0x1F ) << 8 ) | section[9];
+			video_pid = ( ( section[13] & 0x1F ) << 8 ) | section[14];
+			out.tables_ok = out.tables_ok && pcr_pid == video_pid;
+			pmt = pat;
+			}
+		else if( pid == video_pid )
+			{
+			if( unit_start )
+				{
+				if( pes.size() > 0 )
+					{
+					out.payloads.push_back( pes );
+					}
+				if( payload + 14 > end || payload[0] != 0 || payload[1] != 0 || payload[2] != 1 || payload[3] != TS_STREAM_ID_VIDEO || !( payload[7] & 0x80 ) )
+					{
+					out.packets_ok = false;
+					continue;
+					}
+				out.lengths.push_back( ( payload[4] << 8 ) | payload[5] );
+				out.pts.push_back( read_pts( payload + 9 ) );
+				out.tables_before.push_back( pat && pmt );
+				out.random_access.push_back( control & 2 && p[4] > 0 && ( p[5] & 0x40 ) );
+				out.pcr_ok = out.pcr_ok && pcr;
+				if( pcr )
+					{
+					const uint8_t * q = p + 6;
+					uint64_t base = ( (uint64_t)q[0] << 25 ) | ( q[1] << 17 ) | ( q[2] << 9 ) | ( q[3] << 1 ) | ( q[4] >> 7 );
+					out.pcr.push_back( base );
+					}
+				pat = false;
+				pmt = false;
+				pes.assign( payload + 9 + payload[8], end );
+				}
+			else
+				{
+				pes.insert( pes.end(), payload, end );
+				}
+			}
+		else if( pid != pmt_pid && pid != 0 )
+			{
+			out.packets_ok = false;
+			}
+		}
+	}
+if( pes.size() > 0 )
+	{
+	out.payloads.push_back( pes );
+	}
+}
+
+static int check( const char * name, bool ok )
+{
+cout<<( ok ? "ok   " : "FAIL " )<<name<<endl;
+return ok ? 0 : 1;
+}
+
+static int run( const test_stream & s, bool per_slice, bool batches )
+{
+cout<<( per_slice ? "per slice" : "per access unit" )<<( batches ? ", from undescribed batches" : "" )<<endl;
+data_source_datagram_collector sent;
+mux( s, sent, per_slice, batches );
+demuxed got;
+demux( sent.datagrams, got );
+
+bool payloads_ok = got.payloads.size() == s.access_units();
+bool lengths_ok = payloads_ok;
+bool timestamps_ok = payloads_ok && got.pcr.size() == s.access_units();
+bool tables_ok = payloads_ok && got.tables_before[0];
+for( size_t a = 0; payloads_ok && a < s.access_units(); ++a )
+	{
+	vector<uint8_t> expected = expected_payload( s, a );
+	payloads_ok = payloads_ok && got.payloads[a] == expected;
+	size_t length = 8 + expected.size();
+	lengths_ok = lengths_ok && got.lengths[a] == ( per_slice || length > 0xFFFF ? 0 : length );
+	if( !batches )
+		{
+		uint64_t clock = capture_us( a ) * 90 / 1000;
+		timestamps_ok = timestamps_ok && got.pcr[a] == ( clock & 0x1FFFFFFFFULL ) &&
+			got.pts[a] == ( ( clock + TS_PTS_DELAY_MS * 90 ) & 0x1FFFFFFFFULL );
+		}
+	bool idr = a % 30 == 0;
+	tables_ok = tables_ok && got.random_access[a] == idr && ( !idr || got.tables_before[a] );
+	}
+printf( "%i access units in %i datagrams, in %i batches\n", (int)s.access_units(), (int)sent.datagrams.size(), (int)sent.batches );
+
+int failures = 0;
+failures += check( "whole packets, 7 to a datagram at most, padded", got.packets_ok && sent.padded );
+failures += check( "continuity counters unbroken", got.continuity_ok );
+failures += check( "PAT and PMT valid, before the first access unit and every IDR", got.tables_ok && tables_ok );
+failures += check( "each access unit a PES, with a delimiter and without filler", payloads_ok );
+failures += check( per_slice ? "PES length unbounded" : "PES length given when it fits", lengths_ok );
+failures += check( "a PCR with each PES, PTS ahead of it", got.pcr_ok && timestamps_ok );
+failures += check( per_slice ? "a batch per slice" : "a batch per access unit", per_slice ? sent.batches > s.access_units() : sent.batches == s.access_units() );
+return failures;
+}
+
+int main()
+{
+//an SPS, a PPS and an IDR every 30, one to four slices, a few big enough
+//that the PES can't say how long it is, then the filler the encoders end
+//access units with
+stream_shape shape;
+shape.max_slices = 4;
+shape.min_slice = 16;
+shape.max_slice = 5016;
+shape.huge_one_in = 100;
+shape.filler = true;
+test_stream s;
+make_stream( s, 300, shape );
+
+int failures = 0;
+failures += run( s, false, false );
+failures += run( s, false, true );
+failures += run( s, true, false );
+return failures ? 1 : 0;
+}
@@ -6,6 +6,10 @@
 #include <vector>
 #include <fstream>
 #include <queue>
+#include <atomic>
+#include <cstring>
+
+#include <unistd.h>
 
 #include <SDL.h>
 #include <SDL_thread.h>
@@ -19,7 +23,10 @@ extern "C"
 }
 
 #include "config.h"
+#include "access_unit_assembler.h"
 #include "data_source.h"
+#include "packet_pool.h"
+#include "spsc_ring.h"
 #include "x264_destreamer.h"
 
 
@@ -123,45 +130,81 @@ bool GetBufferInfo
 }
 
 
+// decoded frames in pooled buffers, from the frame thread to the main one.
+// A display 8 frames behind drops the newest rather than showing ever
+// older ones, and counts them
 struct FrameQueue
 {
     FrameQueue()
+        : frames( 8 )
     {
         eventNumber = SDL_RegisterEvents(1);
-        mutex = SDL_CreateMutex();
-    }
-    ~FrameQueue()
-    {
-        SDL_DestroyMutex( mutex );
-    }
-
-    void Lock()
-    {
-        SDL_mutexP( mutex );
-    }
-
-    void Unlock()
-    {
-        SDL_mutexV( mutex );
+        dropped.store( 0 );
     }
 
     Uint32 eventNumber;
-    queue< vector< unsigned char > > frames;
-
-private:
-    SDL_mutex* mutex;
+    spsc_ring< packet_ref > frames;
+    std::atomic< uint64_t > dropped;
 };
 
 
-class data_source_packetizer: public data_source
+// decodes each access unit straight from the assembler's buffer
+class data_source_decoder: public data_source
 {
 public:
+    data_source_decoder( AVCodecContext* aCodecCtx, AVFrame* aFrame, FrameQueue& aFq )
+        : codecCtx( aCodecCtx ), frame( aFrame ), fq( aFq )
+    {
+    }
+
     void write( const uint8_t * data, size_t bytes )
     {
-        packets.push_back( std::vector< uint8_t >( data, data + bytes ) );
+        // Decode video frame
+        AVPacket avpkt;
+        av_init_packet( &avpkt );
+        avpkt.data = const_cast< uint8_t* >( data );
+        avpkt.size = bytes;
+        int gotFrame = 0;
+        avcodec_decode_video2( codecCtx, frame, &gotFrame, &avpkt );
+
+        if( gotFrame == 0 )
+            return;
+
+        // the display is behind, drop this one
+        packet_ref* slot = fq.frames.reserve();
+        if( slot == NULL )
+        {
+            fq.dropped++;
+            return;
+        }
+
+        const unsigned int widths[3] = { (unsigned int)frame->width, (unsigned int)frame->width / 2, (unsigned int)frame->width / 2 };
+        const unsigned int heights[3] = { (unsigned int)frame->height, (unsigned int)frame->height / 2, (unsigned int)frame->height / 2 };
+        packet_ref fbuf = packet_pool::shared().get( widths[0] * heights[0] + 2 * widths[1] * heights[1] );
+        unsigned char* out = fbuf.data();
+        for( unsigned int plane = 0; plane < 3; ++plane )
+        {
+            unsigned char* base = frame->data[ plane ];
+            for( unsigned int y = 0; y < heights[ plane ]; ++y )
+            {
+                memcpy( out, base, widths[ plane ] );
+                out += widths[ plane ];
+                base += frame->linesize[ plane ];
+            }
+        }
+
+        *slot = std::move( fbuf );
+        fq.frames.publish();
+
+        SDL_Event event;
+        event.type = fq.eventNumber;
+        SDL_PushEvent( &event );
     }
 
-    std::deque< std::vector< uint8_t > > packets;
+private:
+    AVCodecContext* codecCtx;
+    AVFrame* frame;
+    FrameQueue& fq;
 };
 
 
@@ -199,59 +242,22 @@ int FrameThread( void* ptr )
         cout << "bad frame" << endl;
 
     x264_destreamer ds;
-    data_source_packetizer dspkt;
-    ds.server.register_callback( &dspkt );
-    while( !feof(stdin) )
+    access_unit_assembler au;
+    data_source_decoder decoder( codecCtx, frame, fq );
+    ds.server.register_callback( &au );
+    au.server.register_callback( &decoder );
+
+    // read() returns whatever has arrived, so blocks don't add latency
+    vector< uint8_t > data( 65536 );
+    ssize_t bytes;
+    while( ( bytes = read( STDIN_FILENO, &data[0], data.size() ) ) > 0 )
     {
-        uint8_t data;
-        data = getchar();
-        ds.write( &data, sizeof( data ) );
-
-        while( !dspkt.packets.empty() )
-        {
-            vector< uint8_t > pkt = dspkt.packets.front();
-            dspkt.packets.pop_front();
-
-            // Decode video frame
-            AVPacket avpkt;
-            av_init_packet( &avpkt );
-            avpkt.data = &pkt[0];
-            avpkt.size = pkt.size();
-            int gotFrame = 0;
-            avcodec_decode_video2( codecCtx, frame, &gotFrame, &avpkt );
-
-            if( gotFrame == 0 )
-                continue;
-
-            vector< unsigned char > fbuf;
-
-            vector< unsigned int > widths(3);
-            widths[0] = frame->width;
-            widths[1] = frame->width / 2;
-            widths[2] = frame->width / 2;
-            vector< unsigned int > heights(3);
-            heights[0] = frame->height;
-            heights[1] = frame->height / 2;
-            heights[2] = frame->height / 2;
-            for( unsigned int plane = 0; plane < 3; ++plane )
-            {
-                unsigned char* base = frame->data[ plane ];
-                for( unsigned int y = 0; y < heights[ plane ]; ++y )
-                {
-                    fbuf.insert( fbuf.end(), base, base + widths[ plane ] );
-                    base += frame->linesize[ plane ];
-                }
-            }
-
-            fq.Lock();
-            fq.frames.push( fbuf );
-            fq.Unlock();
-
-            SDL_Event event;
-            event.type = fq.eventNumber;
-            SDL_PushEvent( &event );
-        }
+        ds.write( &data[0], bytes );
     }
+
+    cout << "copied " << ds.copy_ratio() << " bytes per byte read" << endl;
+    cout << fq.dropped.load() << " frames dropped with the display behind" << endl;
+    return 0;
 }
 
 
@@ -333,11 +339,14 @@ int main( int argc, char **argv )
 
             if( event.type == fq.eventNumber )
             {
-                fq.Lock();
-                vector< unsigned char > frame = fq.frames.front();
-                fq.frames.pop();
-                fq.Unlock();
-                SDL_UpdateTexture(tex, NULL, &frame[0], WIDTH * SDL_BYTESPERPIXEL(SDL_PIXELFORMAT_IYUV) );
+                size_t ticket;
+                packet_ref* frame = fq.frames.claim( &ticket );
+                if( frame != NULL )
+                {
+                    SDL_UpdateTexture(tex, NULL, frame->data(), WIDTH * SDL_BYTESPERPIXEL(SDL_PIXELFORMAT_IYUV) );
+                    frame->reset();
+                    fq.frames.release( ticket );
+                }
             }
         }
 
@@ -359,6 +368,8 @@ int main( int argc, char **argv )
         SDL_Delay( 10 );
     }
 
+    cout << fq.dropped.load() << " frames dropped with the display behind" << endl;
+
     SDL_DestroyRenderer( renderer );
     SDL_DestroyWindow( window );
 
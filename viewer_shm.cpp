@@ -0,0 +1,42 @@
+#include <iostream>
+#include <cstdio>
+
+#include "access_unit_assembler.h"
+#include "data_source_ocv_avcodec.h"
+#include "data_source_stdio_info.h"
+#include "shm_reader.h"
+
+using namespace std;
+
+//shows what "encoder <device> shm" hands over through shared memory
+int main(int numArgs, const char * args[] )
+{
+//the sinks outlive the servers, whose async threads may still be writing
+//to them until the servers are gone
+data_source_ocv_avcodec oavc("output");
+data_source_stdio_info info;
+
+	{
+	shm_reader reader;
+	access_unit_assembler au;
+
+	//NALs come described and whole, so there is nothing to destream, and
+	//decoding and display still get a thread of their own
+	reader.server.register_callback( &au );
+	reader.server.register_callback( &info );
+	au.server.register_async_callback( &oavc, 8, OVERFLOW_DROP_TO_RECOVERY );
+
+	if( !reader.open( numArgs >= 2 ? args[1] : SHM_RING_NAME ) )
+		{
+		return 1;
+		}
+	while( reader.read() )
+		{
+		}
+
+	au.server.report();
+	printf( "SHM: %llu NALs, %llu bytes, %llu skipped, %llu sleeps\n",
+		(unsigned long long)reader.nals, (unsigned long long)reader.bytes_read,
+		(unsigned long long)reader.skipped, (unsigned long long)reader.sleeps );
+	}
+}
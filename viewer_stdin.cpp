@@ -1,7 +1,13 @@
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
+#include "access_unit_assembler.h"
 #include "data_source_ocv_avcodec.h"
+#include "data_source_recorder.h"
+#include "data_source_segment_muxer.h"
 #include "data_source_stdio_info.h"
 #include "x264_destreamer.h"
 
@@ -9,17 +15,75 @@ using namespace std;
 
 int main(int numArgs, const char * args[] )
 {
-x264_destreamer ds;
+//the sinks outlive the servers, whose async threads may still be writing
+//to them until the servers are gone
 data_source_ocv_avcodec oavc("output");
 data_source_stdio_info info;
 
-ds.server.register_callback( &oavc );
-ds.server.register_callback( &info );
+//optionally record the stream: to a .ts or .mp4 name in segments, of so
+//many seconds and with a budget of so many MB if given, and otherwise as
+//it comes, indexed as it goes
+data_source_recorder * recording = NULL;
+data_source_segment_muxer * segments = NULL;
+if( numArgs >= 2 )
+	{
+	const char * extension = strrchr( args[1], '.' );
+	if( extension && ( strcmp( extension, ".ts" ) == 0 || strcmp( extension, ".mp4" ) == 0 ) )
+		{
+		double seconds = numArgs >= 3 ? atof( args[2] ) : SEGMENT_DEFAULT_SECONDS;
+		uint64_t budget = numArgs >= 4 ? (uint64_t)atoll( args[3] ) << 20 : 0;
+		segments = new data_source_segment_muxer( args[1], seconds, budget );
+		}
+	else
+		{
+		recording = new data_source_recorder( args[1] );
+		}
+	}
+
+	{
+	x264_destreamer ds;
+	access_unit_assembler au;
+
+	//decoding and display get a thread of their own, so cvWaitKey never
+	//holds up reading, and skip ahead to the next recovery point rather
+	//than fall behind. A raw recording only ever copies on this thread,
+	//and is written from its own
+	ds.server.register_callback( &au );
+	ds.server.register_callback( &info );
+	au.server.register_async_callback( &oavc, 8, OVERFLOW_DROP_TO_RECOVERY );
+	if( recording )
+		{
+		ds.server.register_callback( recording );
+		}
+
+	//muxing segments has a thread of its own too, and skips ahead rather
+	//than hold up the stream
+	if( segments )
+		{
+		au.server.register_async_callback( segments, 256, OVERFLOW_DROP_TO_RECOVERY );
+		}
 
-while( !feof( stdin) )
+	//read() returns whatever has arrived, so blocks don't add latency
+	static uint8_t data[65536];
+	ssize_t bytes;
+	while( ( bytes = read( STDIN_FILENO, data, sizeof( data ) ) ) > 0 )
+		{
+		ds.write( data, bytes );
+		}
+
+	au.server.report();
+	ds.server.report();
+	}
+
+if( recording )
 	{
-	uint8_t data;
-	data = getchar();
-	ds.write( &data, sizeof( data ) );
+	recording->report();
 	}
+if( segments )
+	{
+	segments->report();
+	}
+
+delete recording;
+delete segments;
 }
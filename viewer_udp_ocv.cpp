@@ -10,8 +10,12 @@
 #include <cstdio>
 
 #include "config.h"
+#include "access_unit_assembler.h"
 #include "data_source_ocv_avcodec.h"
 #include "data_source_stdio_info.h"
+#include "data_source_udp.h"
+#include "fec_decoder.h"
+#include "rtp_depacketizer.h"
 #include "x264_destreamer.h"
 
 using namespace std;
@@ -35,6 +39,8 @@ int main(int numArgs, const char * argv[] )
     unsigned short port = UDP_PORT_NUMBER;
     if( numArgs >= 2 )
         broadcastPort = atoi( argv[1] );
+    bool rtp_mode = numArgs >= 3 && strcmp( argv[2], "rtp" ) == 0;
+    const char * group = numArgs >= 4 ? argv[3] : NULL;   /* multicast group to join */
 
 
     /* Create a best-effort datagram socket using UDP */
@@ -51,16 +57,57 @@ int main(int numArgs, const char * argv[] )
     if (bind(sock, (struct sockaddr *) &broadcastAddr, sizeof(broadcastAddr)) < 0)
         DieWithError("bind() failed");
 
+    /* Join the group on the default interface */
+    if( group )
+    {
+        struct ip_mreq request;
+        request.imr_multiaddr.s_addr = inet_addr( group );
+        request.imr_interface.s_addr = htonl( INADDR_ANY );
+        if( setsockopt( sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof( request ) ) < 0 )
+            DieWithError("IP_ADD_MEMBERSHIP failed");
+    }
+
+    // datagrams may hold whole NALs or be cut from the byte stream at any
+    // point, so put the stream back together before decoding. RTP packets
+    // carry their own sequence numbers and NAL boundaries instead, and any
+    // FEC parity among them fills in for lost ones first.
     data_source_ocv_avcodec oavc("output");
+    x264_destreamer ds;
+    fec_decoder fec;
+    rtp_depacketizer rtp;
+    access_unit_assembler au;
+    fec.server.register_callback( &rtp );
+    data_source_udp * nacks = NULL;   // back to the sender, once it is known
+    ds.server.register_callback( &au );
+    rtp.server.register_callback( &au );
+    au.server.register_callback( &oavc );
+    uint64_t received = 0;
 
     while(1)
     {
         /* Receive a single datagram from the server */
-        if ((recvStringLen = recvfrom(sock, recvString, MAXRECVSTRING, 0, NULL, 0)) < 0)
+        struct sockaddr_in senderAddr;
+        socklen_t senderAddrLen = sizeof(senderAddr);
+        if ((recvStringLen = recvfrom(sock, recvString, MAXRECVSTRING, 0, (struct sockaddr *) &senderAddr, &senderAddrLen)) < 0)
             DieWithError("recvfrom() failed");
 
         printf("Received: %i bytes\n", recvStringLen);    /* Print the received string */
-        oavc.write( recvString, recvStringLen );
+        if( rtp_mode )
+        {
+            if( nacks == NULL )
+            {
+                nacks = new data_source_udp( inet_ntoa( senderAddr.sin_addr ), ntohs( senderAddr.sin_port ) );
+                rtp.feedback.register_callback( nacks );
+            }
+            fec.write( recvString, recvStringLen );
+            if( ++received % 1000 == 0 )
+            {
+                fec.report();
+                rtp.report();
+            }
+        }
+        else
+            ds.write( recvString, recvStringLen );
     }
 
     close(sock);
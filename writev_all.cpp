@@ -0,0 +1,71 @@
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "writev_all.h"
+
+#ifndef IOV_MAX
+	#define IOV_MAX 1024
+#endif
+
+size_t iovec_bytes( const struct iovec * iov, int count )
+{
+size_t total = 0;
+for( int i = 0; i < count; ++i )
+	{
+	total += iov[i].iov_len;
+	}
+return total;
+}
+
+size_t writev_all( int fd, const struct iovec * iov, int count )
+{
+size_t written = 0;
+while( count > 0 )
+	{
+	ssize_t n = writev( fd, iov, count < IOV_MAX ? count : IOV_MAX );
+	if( n < 0 )
+		{
+		if( errno == EINTR )
+			{
+			continue;
+			}
+		return written;
+		}
+	written += n;
+
+	//skip the entries that went out whole
+	size_t left = n;
+	while( count > 0 && left >= iov->iov_len )
+		{
+		left -= iov->iov_len;
+		iov++;
+		count--;
+		}
+
+	//finish a partly written one by itself, then carry on with the rest
+	if( left > 0 )
+		{
+		const char * p = (const char *)iov->iov_base + left;
+		size_t remaining = iov->iov_len - left;
+		while( remaining > 0 )
+			{
+			ssize_t m = write( fd, p, remaining );
+			if( m < 0 )
+				{
+				if( errno == EINTR )
+					{
+					continue;
+					}
+				return written;
+				}
+			p += m;
+			remaining -= m;
+			written += m;
+			}
+		iov++;
+		count--;
+		}
+	}
+return written;
+}
@@ -0,0 +1,23 @@
+#ifndef WRITEV_ALL_H
+#define WRITEV_ALL_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+//writev()s the whole array to fd, picking up after short writes and
+//interrupted calls, IOV_MAX entries at a time. Returns the bytes written,
+//which is less than the total only if fd failed.
+size_t writev_all( int fd, const struct iovec * iov, int count );
+
+inline struct iovec make_iovec( const void * data, size_t bytes )
+{
+struct iovec v;
+v.iov_base = const_cast<void *>( data );
+v.iov_len = bytes;
+return v;
+}
+
+//total length of an iovec array
+size_t iovec_bytes( const struct iovec * iov, int count );
+
+#endif
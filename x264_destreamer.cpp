@@ -1,50 +1,155 @@
 using namespace std;
 
+#include <time.h>
+
+#include "start_code.h"
 #include "x264_destreamer.h"
 
+static const uint8_t start_code_bytes[4] = { 0x00, 0x00, 0x00, 0x01 };
+
 void x264_destreamer::write( const uint8_t * data, size_t bytes )
 {
-while( bytes )
+const uint8_t * end = data + bytes;
+bytes_received += bytes;
+block = data;
+pending = data;
+
+//start codes straddling the previous write are caught by the state word
+size_t head = bytes < 3 ? bytes : 3;
+for( size_t i = 0; i < head; ++i )
+	{
+	previous_state = ( previous_state << 8 ) | data[i];
+	if( previous_state == 0x00000001 )
+		{
+		start_code( data + i - 3, end );
+		}
+	}
+
+//the rest are found by the block scanner
+const uint8_t * scan = data + 1;
+while( scan < end )
+	{
+	const uint8_t * code = find_start_code( scan, end );
+	if( code == end )
+		{
+		break;
+		}
+	if( code[-1] == 0 )
+		{
+		start_code( code - 1, end );
+		}
+	scan = code + 3;
+	}
+
+//whatever is left of the current NAL has to outlive the caller's block
+if( nal != NULL )
+	{
+	carry( nal, end );
+	nal = NULL;
+	}
+else if( sync )
+	{
+	carry( pending, end );
+	}
+
+if( bytes > 3 )
 	{
-	input( *data );
-	bytes--;
-	data++;
+	for( const uint8_t * p = end - 3; p < end; ++p )
+		{
+		previous_state = ( previous_state << 8 ) | *p;
+		}
 	}
 }
 
-void x264_destreamer::input( uint8_t byte )
+//code points at the 00 00 00 01 just found, which may begin in the previous write
+void x264_destreamer::start_code( const uint8_t * code, const uint8_t * end )
 {
-previous_state = ( ( previous_state & 0x00FFFFFF ) << 8 ) | byte;
-
-if( previous_state == 0x00000001 )
+if( sync && nal != NULL )
 	{
-	if( sync && buffer.size() > 4 )
+	//a NAL of only a start code is merged into the next one, as it always was
+	size_t nal_size = code - nal;
+	if( nal_size <= 4 )
 		{
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		buffer.push_back(0);
-		server.broadcast( &buffer[0], buffer.size()-8 );
-		buffer.clear();
+		return;
 		}
-	sync = true;
+	if( end - code >= X264_DESTREAMER_PADDING )
+		{
+		broadcast( nal, nal_size );
+		}
+	else
+		{
+		carry( nal, code );
+		broadcast_carry( nal_size );
+		}
+	}
+else if( sync )
+	{
+	carry( pending, code + 4 );
+	pending = code + 4;
+	size_t nal_size = buffer.size() - sizeof( start_code_bytes );
+	if( nal_size <= 4 )
+		{
+		return;
+		}
+	broadcast_carry( nal_size );
 	}
+sync = true;
 
-if( sync )
+//the next NAL starts at this start code
+if( code >= block )
+	{
+	nal = code;
+	}
+else
 	{
-	buffer.push_back( ( previous_state & 0xFF000000 ) >> 24 );
+	nal = NULL;
+	buffer.assign( start_code_bytes, start_code_bytes + sizeof( start_code_bytes ) );
+	pending = code + 4;
 	}
+}
 
+void x264_destreamer::carry( const uint8_t * from, const uint8_t * to )
+{
+if( to > from )
+	{
+	buffer.insert( buffer.end(), from, to );
+	bytes_copied += to - from;
+	}
+}
+
+void x264_destreamer::broadcast_carry( size_t nal_size )
+{
+buffer.resize( nal_size );
+buffer.resize( nal_size + X264_DESTREAMER_PADDING, 0 );
+broadcast( &buffer[0], nal_size );
+buffer.clear();
+}
+
+void x264_destreamer::broadcast( const uint8_t * data, size_t bytes )
+{
+timespec temp;
+clock_gettime( CLOCK_REALTIME, &temp );
+
+nal_info info;
+parser.parse( data, bytes, info );
+info.timestamp_us = (uint64_t)temp.tv_sec * 1000000 + temp.tv_nsec / 1000;
+server.broadcast( data, bytes, info );
+}
+
+double x264_destreamer::copy_ratio() const
+{
+return bytes_received ? (double)bytes_copied / bytes_received : 0.0;
 }
 
 x264_destreamer::x264_destreamer()
 {
 previous_state = 0xFFFFFFFF;
 sync = false;
+nal = NULL;
+block = NULL;
+pending = NULL;
+bytes_received = 0;
+bytes_copied = 0;
 }
 
 x264_destreamer::~x264_destreamer()
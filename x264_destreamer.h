@@ -4,8 +4,20 @@
 #include <vector>
 #include <stdint.h>
 
+#include "nal_info.h"
 #include "packet_server.h"
 
+//bytes guaranteed readable after every NAL handed to the sinks
+#define X264_DESTREAMER_PADDING 8
+
+//splits an Annex B byte stream on 00 00 00 01 start codes and broadcasts
+//each NAL, start code included, once the next start code arrives.
+//A NAL that lies within one write() is broadcast in place, followed by the
+//next start code and the rest of the caller's block. Only a NAL spanning
+//writes (or too close to the end of one) is copied into a zero padded
+//carry-over buffer first. Either way the data is only valid during the call.
+//Each NAL goes out with its nal_info, parsed here once for every sink and
+//stamped with its arrival time.
 class x264_destreamer
 	{
 	public:
@@ -14,9 +26,21 @@ class x264_destreamer
 	void write( const uint8_t * data, size_t bytes);
 	packet_server server;
 
+	//bytes copied into the carry-over buffer per byte written
+	double copy_ratio() const;
+	uint64_t bytes_received;
+	uint64_t bytes_copied;
+
 	private:
-	void input( uint8_t byte );
+	void start_code( const uint8_t * code, const uint8_t * end );
+	void carry( const uint8_t * from, const uint8_t * to );
+	void broadcast_carry( size_t nal_size );
+	void broadcast( const uint8_t * data, size_t bytes );
+	nal_parser parser;
 	std::vector<uint8_t>buffer;
+	const uint8_t * block;
+	const uint8_t * nal;
+	const uint8_t * pending;
 	uint32_t previous_state;
 	bool sync;
 	};